@@ -0,0 +1,215 @@
+/*
+ * ingest_bench.cpp
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: aleksey
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <iostream>
+
+#include <boost/bind.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+#include "bench/ingest_bench.h"
+
+#include "common/config.h"
+#include "common/latency_histogram.h"
+#include "common/log.h"
+#include "common/memory_buffer.h"
+
+#include "parser/statements.h"
+
+#include "rrdb/rrdb.h"
+#include "rrdb/rrdb_metric.h"
+
+#include "server/server_udp.h"
+
+static void ingest_bench_io_thread(boost::asio::io_service * io_service)
+{
+  io_service->run();
+}
+
+ingest_bench::ingest_bench(const t_bench_options & options) :
+  _options(options),
+  _stopped(false)
+{
+}
+
+ingest_bench::~ingest_bench()
+{
+}
+
+void ingest_bench::start(const boost::shared_ptr<config> & config)
+{
+  _rrdb.reset(new rrdb());
+  _rrdb->initialize(config);
+
+  // start clean
+  for(my::size_t ii = 0; ii < _options._metrics; ++ii) {
+      char buf[1024];
+      snprintf(buf, sizeof(buf), BENCH_METRIC_NAME_TEMPLATE, SIZE_T_CAST ii);
+      if(_rrdb->find_metric(buf)) {
+          _rrdb->drop_metric(buf);
+      }
+  }
+  _rrdb->start();
+
+  if(_options._transport == "udp") {
+      _server_udp.reset(new server_udp(_rrdb));
+      _server_udp->initialize(_io_service, config);
+      _server_udp->start();
+      _io_thread.reset(new boost::thread(boost::bind(&ingest_bench_io_thread, &_io_service)));
+  }
+}
+
+void ingest_bench::stop()
+{
+  if(_server_udp) {
+      _server_udp->stop();
+      _io_service.stop();
+      _io_thread->join();
+  }
+
+  // finishes the updates and flushes
+  _rrdb->stop();
+}
+
+/**
+ * ingest_bench::generate_load
+ *
+ * Sends "u|<name>|1|<ts>" updates for random metrics until stopped,
+ * sleeps if the thread is ahead of its share of the rate.
+ */
+void ingest_bench::generate_load(const my::size_t & id)
+{
+  unsigned int seed = time(NULL) + id;
+  my::size_t rate = _options._rate > 0 ? std::max(_options._rate / _options._threads, (my::size_t)1) : 0;
+
+  boost::asio::io_service io_service;
+  boost::asio::ip::udp::socket socket(io_service);
+  boost::asio::ip::udp::endpoint endpoint(boost::asio::ip::address::from_string("127.0.0.1"), _options._port);
+  if(_server_udp) {
+      socket.open(boost::asio::ip::udp::v4());
+  }
+
+  char buf[1024];
+  t_memory_buffer_data output_buffer;
+  boost::uint64_t start_ts = latency_histogram::now();
+  for(boost::uint64_t ii = 0; !_stopped.load(boost::memory_order_relaxed); ++ii) {
+      // keep the rate
+      if(rate > 0) {
+          boost::uint64_t due_ts = start_ts + ii * 1000000 / rate;
+          boost::uint64_t now = latency_histogram::now();
+          if(due_ts > now) {
+              boost::this_thread::sleep(boost::posix_time::microseconds(due_ts - now));
+          }
+      }
+
+      my::time_t ts = time(NULL) - (_options._skew > 0 ? rand_r(&seed) % (_options._skew + 1) : 0);
+      int len = snprintf(buf, sizeof(buf), "u|" BENCH_METRIC_NAME_TEMPLATE "|1|%ld",
+          SIZE_T_CAST (rand_r(&seed) % _options._metrics),
+          (long)ts
+      );
+
+      if(_server_udp) {
+          socket.send_to(boost::asio::buffer(buf, len), endpoint);
+      } else {
+          output_buffer.clear();
+          t_memory_buffer res(output_buffer);
+          _rrdb->execute_update_statement(std::string(buf, len), res);
+      }
+      _sent_updates.add();
+  }
+}
+
+// every update statement is timed so the count is the number of processed updates
+my::size_t ingest_bench::get_processed_updates()
+{
+  latency_histogram::t_percentiles percentiles;
+  _rrdb->get_statement_time(t_statement(statement_update()).which()).get_percentiles(percentiles);
+  return percentiles._count;
+}
+
+// the UDP updates still in the socket buffers and the thread pool queue
+void ingest_bench::wait_for_updates(const my::size_t & sent_updates)
+{
+  my::size_t processed_updates = this->get_processed_updates();
+  while(processed_updates < sent_updates) {
+      boost::this_thread::sleep(boost::posix_time::milliseconds(200));
+
+      // the rest is lost
+      my::size_t last_processed_updates = processed_updates;
+      processed_updates = this->get_processed_updates();
+      if(processed_updates == last_processed_updates) {
+          break;
+      }
+  }
+  _rrdb->wait_for_updates();
+}
+
+void ingest_bench::run(const t_bench_options & options, const t_bench_config_data & config_data)
+{
+  ingest_bench bench(options);
+
+  std::cout << "Ingest: " << options._metrics << " metrics, "
+      << options._threads << " threads, "
+      << (options._rate > 0 ? boost::lexical_cast<std::string>(options._rate) : std::string("unlimited")) << " updates/sec, "
+      << options._skew << " secs skew, "
+      << options._duration << " secs over " << options._transport
+      << std::endl;
+
+  bench.start(bench_setup_config(options._path, config_data));
+
+  // go!
+  boost::uint64_t start_ts = latency_histogram::now();
+  boost::thread_group threads;
+  for(my::size_t ii = 0; ii < options._threads; ++ii) {
+      threads.create_thread(boost::bind(&ingest_bench::generate_load, &bench, ii));
+  }
+
+  my::size_t last_processed_updates = 0;
+  for(my::size_t ii = 1; ii <= options._duration; ++ii) {
+      boost::this_thread::sleep(boost::posix_time::seconds(1));
+
+      my::size_t processed_updates = bench.get_processed_updates();
+      printf("%4lu sec: %10lu updates/sec, rss %lu MB\n",
+          SIZE_T_CAST ii,
+          SIZE_T_CAST (processed_updates - last_processed_updates),
+          SIZE_T_CAST (bench_get_rss() / (1024 * 1024))
+      );
+      fflush(stdout);
+      last_processed_updates = processed_updates;
+  }
+  bench._stopped.store(true);
+  threads.join_all();
+
+  // the rate includes catching up with the queued updates
+  my::size_t sent_updates = bench._sent_updates.get();
+  bench.wait_for_updates(sent_updates);
+  boost::uint64_t end_ts = latency_histogram::now();
+  my::size_t processed_updates = bench.get_processed_updates();
+
+  self_metrics udp_metrics;
+  if(bench._server_udp) {
+      bench._server_udp->update_status(udp_metrics);
+  }
+  bench.stop();
+
+  // report
+  printf("Sent updates:      %lu\n", SIZE_T_CAST sent_updates);
+  printf("Processed updates: %lu (%lu lost)\n", SIZE_T_CAST processed_updates, SIZE_T_CAST (sent_updates - processed_updates));
+  printf("Sustained rate:    %0.2f updates/sec\n", (double)processed_updates * 1000000 / (double)(end_ts - start_ts));
+  printf("Update latency:    %s\n", bench_format_latency(bench._rrdb->get_statement_time(t_statement(statement_update()).which())).c_str());
+  for(my::size_t ii = 0; ii < udp_metrics.get_values().size(); ++ii) {
+      printf("  %-30s %g\n", udp_metrics.get_values()[ii].first.c_str(), udp_metrics.get_values()[ii].second);
+  }
+  printf("Flush to disk:     %s\n", bench_format_latency(bench._rrdb->get_flush_time()).c_str());
+  printf("RSS:               %lu MB (max %lu MB)\n",
+      SIZE_T_CAST (bench_get_rss() / (1024 * 1024)),
+      SIZE_T_CAST (bench_get_max_rss() / (1024 * 1024))
+  );
+}
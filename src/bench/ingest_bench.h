@@ -0,0 +1,57 @@
+/*
+ * ingest_bench.h
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: aleksey
+ */
+
+#ifndef BENCH_INGEST_BENCH_H_
+#define BENCH_INGEST_BENCH_H_
+
+#include <boost/asio.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread.hpp>
+#include <boost/atomic.hpp>
+
+#include "common/types.h"
+#include "common/self_metrics.h"
+
+#include "bench/stats_rrdb_bench.h"
+
+class rrdb;
+class server_udp;
+
+//
+// Sends the updates to the in process rrdb or to the UDP server over
+// the loopback interface from several threads for the given time and
+// reports the sustained rate, latency, flush time and memory
+//
+class ingest_bench
+{
+public:
+  ingest_bench(const t_bench_options & options);
+  virtual ~ingest_bench();
+
+  static void run(const t_bench_options & options, const t_bench_config_data & config_data);
+
+private:
+  void start(const boost::shared_ptr<config> & config);
+  void stop();
+
+  void generate_load(const my::size_t & id);
+  my::size_t get_processed_updates();
+  void wait_for_updates(const my::size_t & sent_updates);
+
+private:
+  t_bench_options                     _options;
+
+  boost::shared_ptr<rrdb>             _rrdb;
+  boost::asio::io_service             _io_service;
+  boost::shared_ptr<server_udp>       _server_udp;
+  boost::shared_ptr<boost::thread>    _io_thread;
+
+  boost::atomic<bool>                 _stopped;
+  self_counter                        _sent_updates;
+}; // class ingest_bench
+
+#endif /* BENCH_INGEST_BENCH_H_ */
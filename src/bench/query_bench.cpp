@@ -0,0 +1,256 @@
+/*
+ * query_bench.cpp
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: aleksey
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <iostream>
+
+#include <boost/bind.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+#include "bench/query_bench.h"
+
+#include "common/config.h"
+#include "common/log.h"
+
+#include "parser/interval.h"
+#include "parser/retention_policy.h"
+
+#include "rrdb/rrdb.h"
+#include "rrdb/rrdb_metric.h"
+#include "rrdb/rrdb_files_cache.h"
+#include "rrdb/rrdb_metric_tuples_cache.h"
+#include "rrdb/rrdb_results_cache.h"
+
+static const char * query_bench_type_names[] = {
+    "raw",
+    "group by",
+    "spanning",
+    "spanning group by"
+};
+
+static void query_bench_print_hit_ratio(const char * name, const my::size_t & hits, const my::size_t & misses)
+{
+  printf("  %-30s %5.1f%% (%lu hits, %lu misses)\n",
+      name,
+      (hits + misses > 0) ? 100.0 * hits / (hits + misses) : 0.0,
+      SIZE_T_CAST hits,
+      SIZE_T_CAST misses
+  );
+}
+
+static boost::uint64_t query_bench_get_disk_size(const std::string & path)
+{
+  boost::uint64_t res = 0;
+  for(boost::filesystem::recursive_directory_iterator it(path), end; it != end; ++it) {
+      if(boost::filesystem::is_regular_file(it->status())) {
+          res += boost::filesystem::file_size(it->path());
+      }
+  }
+  return res;
+}
+
+query_bench::query_bench(const t_bench_options & options) :
+  _options(options),
+  _end_ts(time(NULL)),
+  _stopped(false),
+  _start_ts(0),
+  _start_read_chars(0),
+  _start_read_bytes(0)
+{
+}
+
+query_bench::~query_bench()
+{
+}
+
+/**
+ * query_bench::build_dataset
+ *
+ * Re-creates the metrics with the policy and writes a data point every
+ * step over the history, the data is flushed to disk before the queries.
+ */
+void query_bench::build_dataset(const boost::shared_ptr<config> & config)
+{
+  boost::uint64_t start_ts = latency_histogram::now();
+  t_retention_policy policy = retention_policy_parse(_options._policy);
+
+  this->start(config);
+  unsigned int seed = time(NULL);
+  for(my::size_t ii = 0; ii < _options._metrics; ++ii) {
+      char buf[1024];
+      snprintf(buf, sizeof(buf), BENCH_QUERY_METRIC_NAME_TEMPLATE, SIZE_T_CAST ii);
+      if(_rrdb->find_metric(buf)) {
+          _rrdb->drop_metric(buf);
+      }
+      _rrdb->create_metric(buf, policy);
+
+      for(my::time_t ts = _end_ts - _options._history; ts <= _end_ts; ts += _options._step) {
+          _rrdb->update_metric(buf, ts, rand_r(&seed) % 1000);
+      }
+  }
+  this->stop();
+
+  printf("Dataset: %lu metrics with %lu data points each, built in %0.2f secs, %lu MB on disk\n",
+      SIZE_T_CAST _options._metrics,
+      SIZE_T_CAST (_options._history / _options._step + 1),
+      (double)(latency_histogram::now() - start_ts) / 1000000,
+      SIZE_T_CAST (query_bench_get_disk_size(_options._path) / (1024 * 1024))
+  );
+}
+
+void query_bench::start(const boost::shared_ptr<config> & config)
+{
+  _rrdb.reset(new rrdb());
+  _rrdb->initialize(config);
+  _rrdb->start();
+}
+
+void query_bench::stop()
+{
+  _rrdb->stop();
+  _rrdb.reset();
+}
+
+void query_bench::execute_query(const my::size_t & metric, const enum query_type & type, t_memory_buffer_data & output_buffer)
+{
+  my::time_t ts1 = _end_ts;
+  const char * group_by = "";
+  switch(type) {
+  case Query_Raw:
+    ts1 = _end_ts - 10 * INTERVAL_MIN;
+    break;
+  case Query_GroupBy:
+    ts1 = _end_ts - 6 * INTERVAL_HOUR;
+    group_by = " GROUP BY 5 min";
+    break;
+  case Query_Spanning:
+    ts1 = _end_ts - _options._history;
+    break;
+  case Query_SpanningGroupBy:
+    ts1 = _end_ts - _options._history;
+    group_by = " GROUP BY 1 hour";
+    break;
+  case Query_Max:
+    break;
+  }
+
+  char buf[1024];
+  snprintf(buf, sizeof(buf), "SELECT * FROM METRIC \"" BENCH_QUERY_METRIC_NAME_TEMPLATE "\" BETWEEN %ld AND %ld%s;",
+      SIZE_T_CAST metric,
+      (long)ts1,
+      (long)_end_ts,
+      group_by
+  );
+
+  output_buffer.clear();
+  {
+    latency_histogram::scoped_timer timer(_latency[type]);
+    t_memory_buffer res(output_buffer);
+    _rrdb->execute_query_statement(buf, res);
+    res.flush();
+  }
+  _queries.add();
+  _returned_bytes.add(output_buffer.size());
+}
+
+void query_bench::generate_load(const my::size_t & id)
+{
+  unsigned int seed = time(NULL) + id;
+  t_memory_buffer_data output_buffer;
+  while(!_stopped.load(boost::memory_order_relaxed)) {
+      this->execute_query(
+          rand_r(&seed) % _options._metrics,
+          (enum query_type)(rand_r(&seed) % Query_Max),
+          output_buffer
+      );
+  }
+}
+
+void query_bench::reset_stats()
+{
+  _queries.get(true);
+  _returned_bytes.get(true);
+  for(my::size_t ii = 0; ii < Query_Max; ++ii) {
+      latency_histogram::t_percentiles percentiles;
+      _latency[ii].get_percentiles(percentiles, true);
+  }
+
+  _rrdb->get_files_cache()->get_cache_hits(true);
+  _rrdb->get_files_cache()->get_cache_misses(true);
+  _rrdb->get_tuples_cache()->get_cache_hits(true);
+  _rrdb->get_tuples_cache()->get_cache_misses(true);
+  _rrdb->get_results_cache()->get_cache_hits(true);
+  _rrdb->get_results_cache()->get_cache_misses(true);
+
+  bench_get_io(_start_read_chars, _start_read_bytes);
+  _start_ts = latency_histogram::now();
+}
+
+void query_bench::report(const std::string & phase)
+{
+  double secs = (double)(latency_histogram::now() - _start_ts) / 1000000;
+  boost::uint64_t read_chars, read_bytes;
+  bench_get_io(read_chars, read_bytes);
+
+  my::size_t queries = _queries.get();
+  printf("%s: %lu queries in %0.2f secs, %0.2f queries/sec\n", phase.c_str(), SIZE_T_CAST queries, secs, queries / secs);
+  printf("  %-30s %lu KB\n", "returned", SIZE_T_CAST (_returned_bytes.get() / 1024));
+  printf("  %-30s %lu KB (%lu KB from disk)\n", "read",
+      SIZE_T_CAST ((read_chars - _start_read_chars) / 1024),
+      SIZE_T_CAST ((read_bytes - _start_read_bytes) / 1024)
+  );
+  query_bench_print_hit_ratio("files cache", _rrdb->get_files_cache()->get_cache_hits(), _rrdb->get_files_cache()->get_cache_misses());
+  query_bench_print_hit_ratio("blocks cache", _rrdb->get_tuples_cache()->get_cache_hits(), _rrdb->get_tuples_cache()->get_cache_misses());
+  query_bench_print_hit_ratio("results cache", _rrdb->get_results_cache()->get_cache_hits(), _rrdb->get_results_cache()->get_cache_misses());
+  for(my::size_t ii = 0; ii < Query_Max; ++ii) {
+      printf("  %-30s %s\n", query_bench_type_names[ii], bench_format_latency(_latency[ii]).c_str());
+  }
+  fflush(stdout);
+}
+
+void query_bench::run(const t_bench_options & options, const t_bench_config_data & config_data)
+{
+  query_bench bench(options);
+
+  std::cout << "Query: " << options._metrics << " metrics with policy '" << options._policy << "', "
+      << interval_write(options._history) << " history every " << interval_write(options._step) << ", "
+      << options._threads << " threads, "
+      << options._duration << " secs"
+      << std::endl;
+
+  boost::shared_ptr<config> config(bench_setup_config(options._path, config_data));
+  bench.build_dataset(config);
+
+  // cold: the rrdb caches are empty after the restart (the OS page cache is not dropped),
+  // one query of each type for each metric
+  t_memory_buffer_data output_buffer;
+  bench.start(config);
+  bench.reset_stats();
+  for(my::size_t ii = 0; ii < Query_Max; ++ii) {
+      for(my::size_t jj = 0; jj < options._metrics; ++jj) {
+          bench.execute_query(jj, (enum query_type)ii, output_buffer);
+      }
+  }
+  bench.report("Cold caches");
+
+  // warm: random queries
+  bench.reset_stats();
+  boost::thread_group threads;
+  for(my::size_t ii = 0; ii < options._threads; ++ii) {
+      threads.create_thread(boost::bind(&query_bench::generate_load, &bench, ii));
+  }
+  boost::this_thread::sleep(boost::posix_time::seconds(options._duration));
+  bench._stopped.store(true);
+  threads.join_all();
+  bench.report("Warm caches");
+
+  bench.stop();
+  printf("RSS: %lu MB max\n", SIZE_T_CAST (bench_get_max_rss() / (1024 * 1024)));
+}
@@ -0,0 +1,76 @@
+/*
+ * query_bench.h
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: aleksey
+ */
+
+#ifndef BENCH_QUERY_BENCH_H_
+#define BENCH_QUERY_BENCH_H_
+
+#include <string>
+
+#include <boost/shared_ptr.hpp>
+#include <boost/atomic.hpp>
+
+#include "common/types.h"
+#include "common/memory_buffer.h"
+#include "common/latency_histogram.h"
+#include "common/self_metrics.h"
+
+#include "bench/stats_rrdb_bench.h"
+
+class rrdb;
+
+//
+// Builds the synthetic dataset and runs the mix of SELECTs: one pass
+// over all the metrics right after the restart (cold rrdb caches) and
+// then the random queries from several threads for the given time (warm
+// caches). Reports the queries/sec, bytes, cache hit ratios and latency.
+//
+class query_bench
+{
+public:
+  enum query_type {
+    Query_Raw = 0,          // the last 10 min, the first policy level
+    Query_GroupBy,          // the last 6 hours by 5 min
+    Query_Spanning,         // the whole history across the policy levels
+    Query_SpanningGroupBy,  // the whole history by 1 hour
+
+    Query_Max
+  };
+
+public:
+  query_bench(const t_bench_options & options);
+  virtual ~query_bench();
+
+  static void run(const t_bench_options & options, const t_bench_config_data & config_data);
+
+private:
+  void build_dataset(const boost::shared_ptr<config> & config);
+  void start(const boost::shared_ptr<config> & config);
+  void stop();
+
+  void execute_query(const my::size_t & metric, const enum query_type & type, t_memory_buffer_data & output_buffer);
+  void generate_load(const my::size_t & id);
+
+  void reset_stats();
+  void report(const std::string & phase);
+
+private:
+  t_bench_options               _options;
+  boost::shared_ptr<rrdb>       _rrdb;
+  my::time_t                    _end_ts;
+
+  boost::atomic<bool>           _stopped;
+  self_counter                  _queries;
+  self_counter                  _returned_bytes;
+  latency_histogram             _latency[Query_Max];
+
+  // the phase start
+  boost::uint64_t               _start_ts;
+  boost::uint64_t               _start_read_chars;
+  boost::uint64_t               _start_read_bytes;
+}; // class query_bench
+
+#endif /* BENCH_QUERY_BENCH_H_ */
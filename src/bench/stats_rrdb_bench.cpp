@@ -0,0 +1,208 @@
+/*
+ ============================================================================
+ Name        : stats-rrdb-bench.cpp
+ Author      : Aleksey Sanin
+ Version     :
+ Copyright   : Copyright 2013, Aleksey Sanin. All Rights Reserved.
+ ============================================================================
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/resource.h>
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include <boost/shared_ptr.hpp>
+#include <boost/foreach.hpp>
+#include <boost/program_options.hpp>
+#include <boost/lexical_cast.hpp>
+
+#include "common/log.h"
+#include "common/config.h"
+#include "common/exception.h"
+#include "common/latency_histogram.h"
+
+#include "parser/interval.h"
+
+#include "rrdb/rrdb_metric.h"
+
+#include "bench/stats_rrdb_bench.h"
+#include "bench/ingest_bench.h"
+#include "bench/query_bench.h"
+
+boost::shared_ptr<config> bench_setup_config(const std::string & path, const t_bench_config_data & data)
+{
+  // create config
+  std::string config_path = path + "./stats_rrdb_bench.conf";
+  std::fstream fs(config_path.c_str(), std::ios_base::out | std::ios_base::trunc);
+  fs.exceptions(std::ifstream::badbit | std::ifstream::failbit); // throw exceptions when error occurs
+  BOOST_FOREACH(const t_bench_config_data::value_type & v, data) {
+    fs << v.first << "=" << v.second << std::endl;
+  }
+  fs.flush();
+  fs.close();
+
+  // load config
+  const char * argv[] = { "stats-rrdb-bench", "-c", config_path.c_str() };
+  boost::shared_ptr<config> cfg(new config());
+  cfg->init(sizeof(argv) / sizeof(argv[0]), argv);
+
+  // done
+  return cfg;
+}
+
+boost::uint64_t bench_get_rss()
+{
+  long pages = 0, rss_pages = 0;
+  FILE * file = fopen("/proc/self/statm", "r");
+  if(file) {
+      if(fscanf(file, "%ld %ld", &pages, &rss_pages) != 2) {
+          rss_pages = 0;
+      }
+      fclose(file);
+  }
+  return (boost::uint64_t)rss_pages * sysconf(_SC_PAGESIZE);
+}
+
+boost::uint64_t bench_get_max_rss()
+{
+  struct rusage usage;
+  if(getrusage(RUSAGE_SELF, &usage) != 0) {
+      return 0;
+  }
+  return (boost::uint64_t)usage.ru_maxrss * 1024;
+}
+
+void bench_get_io(boost::uint64_t & read_chars, boost::uint64_t & read_bytes)
+{
+  // all the reads and the reads from the storage
+  read_chars = read_bytes = 0;
+  FILE * file = fopen("/proc/self/io", "r");
+  if(file) {
+      char name[64];
+      unsigned long value;
+      while(fscanf(file, "%63s %lu", name, &value) == 2) {
+          if(strcmp(name, "rchar:") == 0) {
+              read_chars = value;
+          } else if(strcmp(name, "read_bytes:") == 0) {
+              read_bytes = value;
+          }
+      }
+      fclose(file);
+  }
+}
+
+std::string bench_format_latency(latency_histogram & histogram, bool reset)
+{
+  latency_histogram::t_percentiles percentiles;
+  histogram.get_percentiles(percentiles, reset);
+
+  char buf[1024];
+  snprintf(buf, sizeof(buf), "%lu times, p50 %lu us, p99 %lu us, p999 %lu us, max %lu us",
+      SIZE_T_CAST percentiles._count,
+      SIZE_T_CAST percentiles._p50,
+      SIZE_T_CAST percentiles._p99,
+      SIZE_T_CAST percentiles._p999,
+      SIZE_T_CAST percentiles._max
+  );
+  return buf;
+}
+
+int main(int argc, char ** argv)
+{
+  using namespace boost::program_options;
+
+  try {
+    // init
+    srand(time(NULL));
+
+    t_bench_options options;
+    std::string history, step;
+    std::vector<std::string> config_options;
+    options_description desc("Benchmark Options");
+    desc.add_options()
+        ("help,h",          "produce this message")
+        ("mode",            value<std::string>()->default_value("ingest"),                  "benchmark: ingest or query")
+        ("path",            value<std::string>(&options._path)->default_value("/tmp/stats-rrdb-bench/"), "folder for the data and the generated config file")
+        ("set",             value< std::vector<std::string> >(&config_options),             "config file option for the benchmarked server as name=value, e.g. --set rrdb.update_shards=4 (repeatable)")
+        ("transport",       value<std::string>(&options._transport)->default_value("rrdb"), "ingest: send the updates to the in process rrdb or to the udp server over loopback")
+        ("port",            value<int>(&options._port)->default_value(9877),                "ingest: the loopback udp server port")
+        ("metrics",         value<my::size_t>(&options._metrics)->default_value(0),         "the number of metrics, 0 for the default: 1000 for ingest and 100 for query")
+        ("threads",         value<my::size_t>(&options._threads)->default_value(4),         "the number of threads sending the updates or the queries")
+        ("rate",            value<my::size_t>(&options._rate)->default_value(0),            "ingest: updates per sec from all the threads, 0 for unlimited")
+        ("duration",        value<my::size_t>(&options._duration)->default_value(10),       "the benchmark duration in secs (for query: the warm caches part)")
+        ("skew",            value<my::size_t>(&options._skew)->default_value(0),            "ingest: the update timestamps are randomly up to this many secs behind the current time")
+        ("policy",          value<std::string>(&options._policy)->default_value("1 sec FOR 30 min, 10 sec FOR 1 day, 1 min FOR 1 month, 10 min FOR 1 year, 1 hour FOR 10 years"), "query: the dataset metrics retention policy")
+        ("history",         value<std::string>(&history)->default_value("2 days"),          "query: the dataset covers this interval back from now")
+        ("step",            value<std::string>(&step)->default_value("10 secs"),            "query: the interval between the dataset data points")
+    ;
+    variables_map vm;
+    store(parse_command_line(argc, argv, desc), vm);
+    notify(vm);
+    if(vm.count("help")) {
+        std::cout << desc << std::endl;
+        return(0);
+    }
+    std::string mode = vm["mode"].as<std::string>();
+    if(options._metrics == 0) {
+        options._metrics = (mode == "query") ? 100 : 1000;
+    }
+    if(options._threads == 0) {
+        throw exception("The number of threads should be positive");
+    }
+    options._history = interval_parse(history);
+    options._step    = interval_parse(step);
+    if(options._step == 0) {
+        throw exception("The dataset step should be positive");
+    }
+    if(options._transport != "rrdb" && options._transport != "udp") {
+        throw exception("Unknown transport '%s'", options._transport.c_str());
+    }
+
+    // the benchmarked server config: quiet and local by default
+    rrdb_metric::create_directories(options._path);
+    t_bench_config_data config_data;
+    config_data["rrdb.path"]            = options._path;
+    config_data["log.level"]            = "error";
+    config_data["log.destination"]      = options._path + "./stats_rrdb_bench.log";
+    config_data["server_udp.address"]   = "127.0.0.1";
+    config_data["server_udp.port"]      = boost::lexical_cast<std::string>(options._port);
+    if(mode == "query") {
+        // no warm up after the restart for the cold caches queries
+        config_data["rrdb.blocks_cache_hot_set_size"] = "0";
+    }
+    BOOST_FOREACH(const std::string & option, config_options) {
+      std::string::size_type pos = option.find('=');
+      if(pos == std::string::npos) {
+          throw exception("The config option '%s' should be name=value", option.c_str());
+      }
+      config_data[option.substr(0, pos)] = option.substr(pos + 1);
+    }
+
+    if(mode == "ingest") {
+        ingest_bench::run(options, config_data);
+    } else if(mode == "query") {
+        query_bench::run(options, config_data);
+    } else {
+        throw exception("Unknown benchmark mode '%s'", mode.c_str());
+    }
+
+  } catch (const std::exception & e) {
+    LOG(log::LEVEL_CRITICAL,  "EXCEPTION: %s", e.what());
+
+    std::cerr << "EXCEPTION: " << e.what() << std::endl;
+    return(1);
+  } catch (...) {
+    LOG(log::LEVEL_CRITICAL,  "EXCEPTION: Unknown exception");
+
+    std::cerr << "EXCEPTION: Unknown Exception" << std::endl;
+    throw;
+  }
+
+  return(0);
+}
@@ -0,0 +1,56 @@
+/*
+ * stats_rrdb_bench.h
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: aleksey
+ */
+
+#ifndef STATS_RRDB_BENCH_H_
+#define STATS_RRDB_BENCH_H_
+
+#include <string>
+#include <map>
+
+#include <boost/shared_ptr.hpp>
+#include <boost/cstdint.hpp>
+
+#include "common/types.h"
+
+class config;
+class latency_histogram;
+
+#define BENCH_METRIC_NAME_TEMPLATE "bench.metric.%lu"
+#define BENCH_QUERY_METRIC_NAME_TEMPLATE "bench.query.%lu"
+
+//
+// The benchmark settings from the command line
+//
+typedef struct t_bench_options_ {
+  std::string _path;        // data folder, the config file is written there too
+  std::string _transport;   // rrdb (in process) or udp (loopback)
+  int         _port;        // udp port for the loopback server
+  my::size_t  _metrics;     // metrics cardinality
+  my::size_t  _threads;     // load generating threads
+  my::size_t  _rate;        // updates per sec from all the threads, 0 for unlimited
+  my::size_t  _duration;    // secs
+  my::size_t  _skew;        // max secs the update timestamps are behind the current time
+  std::string     _policy;  // retention policy for the query dataset
+  my::interval_t  _history; // the query dataset covers this many secs back from now
+  my::interval_t  _step;    // secs between the query dataset points
+} t_bench_options;
+
+//
+// Config helpers
+//
+typedef std::map<std::string, std::string> t_bench_config_data;
+boost::shared_ptr<config> bench_setup_config(const std::string & path, const t_bench_config_data & data);
+
+//
+// Report helpers
+//
+boost::uint64_t bench_get_rss();
+boost::uint64_t bench_get_max_rss();
+void bench_get_io(boost::uint64_t & read_chars, boost::uint64_t & read_bytes);
+std::string bench_format_latency(latency_histogram & histogram, bool reset = false);
+
+#endif /* STATS_RRDB_BENCH_H_ */
@@ -0,0 +1,77 @@
+/*
+ * adaptive_lock.cpp
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: aleksey
+ */
+#include <boost/static_assert.hpp>
+#include <boost/thread.hpp>
+
+#ifdef __linux__
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#endif /* __linux__ */
+
+#include "common/adaptive_lock.h"
+
+// the max number of pause instructions in one backoff round, we spin
+// 1 + 2 + 4 + ... + ADAPTIVE_LOCK_MAX_SPIN times before parking
+#define ADAPTIVE_LOCK_MAX_SPIN 1024
+
+// the futex syscall works on the int the atomic wraps
+BOOST_STATIC_ASSERT(sizeof(boost::atomic<int>) == sizeof(int));
+
+static inline void adaptive_lock_cpu_relax()
+{
+#if defined(__i386__) || defined(__x86_64__)
+  __asm__ __volatile__("pause" ::: "memory");
+#elif defined(__aarch64__)
+  __asm__ __volatile__("yield" ::: "memory");
+#else
+  __asm__ __volatile__("" ::: "memory");
+#endif
+}
+
+/**
+ * adaptive_lock::lock_slow
+ *
+ * Spins with exponential backoff and then parks the thread until the lock
+ * is released (the Drepper's "futexes are tricky" mutex)
+ */
+void adaptive_lock::lock_slow()
+{
+  _contended.fetch_add(1, boost::memory_order_relaxed);
+
+  // spin: read-only checks to keep the cache line shared
+  for(int spin = 1; spin <= ADAPTIVE_LOCK_MAX_SPIN; spin <<= 1) {
+      for(int ii = 0; ii < spin; ++ii) {
+          adaptive_lock_cpu_relax();
+      }
+      if(_state.load(boost::memory_order_relaxed) == State_Unlocked && this->try_lock()) {
+          return;
+      }
+  }
+
+  // park: mark the lock as having waiters so the unlock() wakes us up
+  _parked.fetch_add(1, boost::memory_order_relaxed);
+  while(_state.exchange(State_Waiters, boost::memory_order_acquire) != State_Unlocked) {
+#ifdef __linux__
+      syscall(SYS_futex, reinterpret_cast<int *>(&_state), FUTEX_WAIT_PRIVATE, State_Waiters, NULL, NULL, 0);
+#else  /* __linux__ */
+      boost::this_thread::yield();
+#endif /* __linux__ */
+  }
+}
+
+/**
+ * adaptive_lock::wake_one
+ *
+ * Wakes up one of the parked threads
+ */
+void adaptive_lock::wake_one()
+{
+#ifdef __linux__
+  syscall(SYS_futex, reinterpret_cast<int *>(&_state), FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+#endif /* __linux__ */
+}
@@ -0,0 +1,89 @@
+/*
+ * adaptive_lock.h
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: aleksey
+ */
+
+#ifndef COMMON_ADAPTIVE_LOCK_H_
+#define COMMON_ADAPTIVE_LOCK_H_
+
+#include <boost/atomic.hpp>
+#include <boost/cstdint.hpp>
+
+//
+// Spin-then-park lock: the uncontended lock()/unlock() is a single atomic
+// operation, under contention we spin with exponential backoff for a short
+// while (the critical sections are usually tiny) and then park the thread
+// in the kernel (futex on Linux) instead of burning CPU in the yield loop.
+//
+// The counters are only updated on the slow path so they are free for
+// the uncontended case.
+//
+class adaptive_lock
+{
+  typedef enum {
+    State_Unlocked = 0,
+    State_Locked   = 1,
+    State_Waiters  = 2     // locked and there might be parked threads
+  } lock_state;
+
+public:
+  inline adaptive_lock() :
+    _state(State_Unlocked),
+    _contended(0),
+    _parked(0)
+  {
+  }
+
+  inline void lock()
+  {
+    int state = State_Unlocked;
+    if(!_state.compare_exchange_strong(state, State_Locked, boost::memory_order_acquire, boost::memory_order_relaxed)) {
+        this->lock_slow();
+    }
+  }
+
+  inline bool try_lock()
+  {
+    int state = State_Unlocked;
+    return _state.compare_exchange_strong(state, State_Locked, boost::memory_order_acquire, boost::memory_order_relaxed);
+  }
+
+  inline void unlock()
+  {
+    if(_state.exchange(State_Unlocked, boost::memory_order_release) == State_Waiters) {
+        this->wake_one();
+    }
+  }
+
+  inline bool is_locked() const
+  {
+    return _state.load(boost::memory_order_relaxed) != State_Unlocked;
+  }
+
+  // contention counters
+  inline boost::uint64_t get_contended_count() const
+  {
+    return _contended.load(boost::memory_order_relaxed);
+  }
+  inline boost::uint64_t get_parked_count() const
+  {
+    return _parked.load(boost::memory_order_relaxed);
+  }
+
+private:
+  // disable copy constructor and assignment operator
+  adaptive_lock(const adaptive_lock &);
+  adaptive_lock & operator=(const adaptive_lock &);
+
+  void lock_slow();
+  void wake_one();
+
+private:
+  boost::atomic<int>              _state;
+  boost::atomic<boost::uint64_t>  _contended;
+  boost::atomic<boost::uint64_t>  _parked;
+}; // class adaptive_lock
+
+#endif /* COMMON_ADAPTIVE_LOCK_H_ */
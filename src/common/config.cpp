@@ -46,6 +46,10 @@ bool config::init(int argc, const char ** argv)
           value<std::string>(),
           "default metric policy (default: '1 sec for 1 min, 1 min for 1 year')"
       )
+      ("rrdb.rollups",
+          value<std::string>(),
+          "comma separated \"group by\" intervals materialized for the new metrics, should be multiples of the first policy block freq (default: none)"
+      )
       ("rrdb.flush_interval",
           value<std::string>(),
           "how often do we flush to disk (default: '10 sec')"
@@ -58,9 +62,29 @@ bool config::init(int argc, const char ** argv)
           value<double>(),
           "how much do we purge each time (default: 0.8 means that we purge to 0.8*blocks_cache_memory_used)"
       )
+      ("rrdb.blocks_cache_hot_set_size",
+          value<my::size_t>(),
+          "the max number of most recently used blocks saved on flush and loaded back into the cache on startup, 0 to disable (default: 10000)"
+      )
+      ("rrdb.results_cache_size",
+          value<my::size_t>(),
+          "the max number of \"group by\" results tuples cached for SELECT statements, 0 to disable (default: 100000)"
+      )
+      ("rrdb.select_thread_pool_size",
+          value<my::size_t>(),
+          "the number of threads used to run SELECT FROM METRICS LIKE queries in parallel, 0 to disable (default: 4)"
+      )
+      ("rrdb.update_shards",
+          value<my::size_t>(),
+          "the number of single threaded shards that execute the UDP updates, each metric is always updated by the same shard; 0 to update on the receiving thread (default: 0)"
+      )
+      ("rrdb.update_shard_queue_size",
+          value<my::size_t>(),
+          "the max number of updates waiting in one shard, the receiving thread waits when the queue is full (default: 10000)"
+      )
       ("rrdb.open_files_cache_size",
           value<my::size_t>(),
-          "the max size of open file handles (default: 1024)"
+          "the max size of open file handles, the open files limit is raised to match if possible (default: 100000)"
       )
       ("rrdb.open_files_cache_purge_threshold",
           value<double>(),
@@ -94,6 +118,22 @@ bool config::init(int argc, const char ** argv)
           value<my::size_t>(),
           "tcp server number of worker threads (default: 10)"
       )
+      ("server_tcp.output_chunk_size",
+          value<my::size_t>(),
+          "tcp query results are sent in chunks of this size in bytes (default: 65536)"
+      )
+      ("server_tcp.heavy_thread_pool_size",
+          value<my::size_t>(),
+          "tcp server number of worker threads for heavy queries (default: 4)"
+      )
+      ("server_tcp.heavy_query_cost",
+          value<my::size_t>(),
+          "queries that walk through at least this many tuples are executed on the heavy queries threads (default: 10000)"
+      )
+      ("server_tcp.heavy_max_queue_size",
+          value<my::size_t>(),
+          "heavy queries are rejected if this many heavy queries are already waiting (default: 100)"
+      )
 
       // server_udp
       ("server_udp.address",
@@ -104,6 +144,14 @@ bool config::init(int argc, const char ** argv)
           value<int>(),
           "udp listener port (default: 9876)"
       )
+      ("server_udp.listeners",
+          value<my::size_t>(),
+          "the number of udp sockets bound to the same port with SO_REUSEPORT, each with its own receiving thread; 0 to receive on the main server thread (default: 0)"
+      )
+      ("server_udp.pin_listeners",
+          value<bool>(),
+          "pin udp listener threads to CPUs (default: false)"
+      )
       ("server_udp.max_message_size",
           value<my::size_t>(),
           "udp max message size in bytes (default: 2048)"
@@ -112,6 +160,18 @@ bool config::init(int argc, const char ** argv)
           value<my::size_t>(),
           "udp server number of worker threads (default: 5)"
       )
+      ("server_udp.thread_pool_scheduler",
+          value<std::string>(),
+          "udp worker threads scheduler: shared (one queue) or work_stealing (a queue per thread, requires max_queue_size=0) (default: shared)"
+      )
+      ("server_udp.max_queue_size",
+          value<my::size_t>(),
+          "udp server max number of requests waiting for a worker thread, 0 for unlimited (default: 0)"
+      )
+      ("server_udp.queue_overflow_policy",
+          value<std::string>(),
+          "what to do with a request when the udp queue is full: drop_newest, drop_oldest or block the receive (default: drop_newest)"
+      )
       ("server_udp.send_success_response",
           value<bool>(),
           "udp server will send success 'OK' response (default: false)"
@@ -0,0 +1,79 @@
+/*
+ * latency_histogram.cpp
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: aleksey
+ */
+#include <algorithm>
+
+#include "common/latency_histogram.h"
+
+latency_histogram::latency_histogram() :
+  _max(0)
+{
+  for(my::size_t ii = 0; ii < LATENCY_HISTOGRAM_BUCKETS; ++ii) {
+      _buckets[ii].store(0, boost::memory_order_relaxed);
+  }
+}
+
+boost::uint64_t latency_histogram::get_bucket_max(const my::size_t & bucket)
+{
+  if(bucket < 2 * LATENCY_HISTOGRAM_SUB_BUCKETS) {
+      return bucket;
+  }
+
+  my::size_t shift = bucket / LATENCY_HISTOGRAM_SUB_BUCKETS - 1;
+  boost::uint64_t mantissa = bucket % LATENCY_HISTOGRAM_SUB_BUCKETS + LATENCY_HISTOGRAM_SUB_BUCKETS;
+  return ((mantissa + 1) << shift) - 1;
+}
+
+/**
+ * latency_histogram::get_percentiles
+ *
+ * Walks the buckets once to find p50/p99/p999, the max is exact. With
+ * reset the buckets are cleared one by one so the records made while we
+ * read might end up in either interval.
+ */
+void latency_histogram::get_percentiles(t_percentiles & res, bool reset)
+{
+  boost::uint64_t counts[LATENCY_HISTOGRAM_BUCKETS];
+  res._count = 0;
+  for(my::size_t ii = 0; ii < LATENCY_HISTOGRAM_BUCKETS; ++ii) {
+      counts[ii] = reset ?
+          _buckets[ii].exchange(0, boost::memory_order_relaxed) :
+          _buckets[ii].load(boost::memory_order_relaxed);
+      res._count += counts[ii];
+  }
+  res._max = reset ?
+      _max.exchange(0, boost::memory_order_relaxed) :
+      _max.load(boost::memory_order_relaxed);
+
+  res._p50 = res._p99 = res._p999 = 0;
+  if(res._count == 0) {
+      return;
+  }
+
+  // the number of values at or below the percentile (rounded up)
+  boost::uint64_t rank50  = (res._count * 500 + 999) / 1000;
+  boost::uint64_t rank99  = (res._count * 990 + 999) / 1000;
+  boost::uint64_t rank999 = (res._count * 999 + 999) / 1000;
+  boost::uint64_t seen = 0;
+  for(my::size_t ii = 0; ii < LATENCY_HISTOGRAM_BUCKETS && seen < rank999; ++ii) {
+      if(counts[ii] == 0) {
+          continue;
+      }
+
+      // the bucket's top might be above the max we've seen
+      boost::uint64_t value = std::min(latency_histogram::get_bucket_max(ii), res._max);
+      if(seen < rank50 && seen + counts[ii] >= rank50) {
+          res._p50 = value;
+      }
+      if(seen < rank99 && seen + counts[ii] >= rank99) {
+          res._p99 = value;
+      }
+      if(seen + counts[ii] >= rank999) {
+          res._p999 = value;
+      }
+      seen += counts[ii];
+  }
+}
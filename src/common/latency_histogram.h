@@ -0,0 +1,109 @@
+/*
+ * latency_histogram.h
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: aleksey
+ */
+
+#ifndef COMMON_LATENCY_HISTOGRAM_H_
+#define COMMON_LATENCY_HISTOGRAM_H_
+
+#include <time.h>
+
+#include <boost/atomic.hpp>
+#include <boost/cstdint.hpp>
+
+#include "common/types.h"
+
+// 16 linear sub-buckets per power of 2 (about 6% precision) from 1 usec
+// up to 2^36 usecs (about 19 hours), the larger values go to the last bucket
+#define LATENCY_HISTOGRAM_SUB_BUCKETS_BITS  4
+#define LATENCY_HISTOGRAM_SUB_BUCKETS       (1 << LATENCY_HISTOGRAM_SUB_BUCKETS_BITS)
+#define LATENCY_HISTOGRAM_MAX_BITS          36
+#define LATENCY_HISTOGRAM_BUCKETS           ((LATENCY_HISTOGRAM_MAX_BITS - LATENCY_HISTOGRAM_SUB_BUCKETS_BITS + 1) * LATENCY_HISTOGRAM_SUB_BUCKETS)
+
+//
+// HDR-style log-linear latency histogram in usecs: record() is lock free
+// (one relaxed atomic add and a max check), the percentiles are computed
+// when the histogram is read.
+//
+class latency_histogram
+{
+public:
+  typedef struct t_percentiles_ {
+    boost::uint64_t _count;
+    boost::uint64_t _p50;      // usecs
+    boost::uint64_t _p99;      // usecs
+    boost::uint64_t _p999;     // usecs
+    boost::uint64_t _max;      // usecs
+  } t_percentiles;
+
+public:
+  latency_histogram();
+
+  inline void record(const boost::uint64_t & usecs)
+  {
+    _buckets[latency_histogram::get_bucket(usecs)].fetch_add(1, boost::memory_order_relaxed);
+
+    boost::uint64_t max = _max.load(boost::memory_order_relaxed);
+    while(max < usecs && !_max.compare_exchange_weak(max, usecs, boost::memory_order_relaxed)) {
+    }
+  }
+
+  // the percentiles are the highest values in the percentile's bucket
+  void get_percentiles(t_percentiles & res, bool reset = false);
+
+  // monotonic clock in usecs
+  inline static boost::uint64_t now()
+  {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (boost::uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+  }
+
+  // records the time from the construction to the destruction
+  class scoped_timer
+  {
+  public:
+    explicit scoped_timer(latency_histogram & histogram) :
+      _histogram(histogram),
+      _start_ts(latency_histogram::now())
+    {
+    }
+    ~scoped_timer()
+    {
+      _histogram.record(latency_histogram::now() - _start_ts);
+    }
+
+  private:
+    latency_histogram & _histogram;
+    boost::uint64_t     _start_ts;
+  }; // class scoped_timer
+
+private:
+  // disable copy constructor and assignment operator
+  latency_histogram(const latency_histogram &);
+  latency_histogram & operator=(const latency_histogram &);
+
+  inline static my::size_t get_bucket(const boost::uint64_t & usecs)
+  {
+    if(usecs < LATENCY_HISTOGRAM_SUB_BUCKETS) {
+        return usecs;
+    }
+    if(usecs >> LATENCY_HISTOGRAM_MAX_BITS) {
+        return LATENCY_HISTOGRAM_BUCKETS - 1;
+    }
+
+    // the top LATENCY_HISTOGRAM_SUB_BUCKETS_BITS + 1 bits
+    my::size_t shift = (63 - __builtin_clzll(usecs)) - LATENCY_HISTOGRAM_SUB_BUCKETS_BITS;
+    return shift * LATENCY_HISTOGRAM_SUB_BUCKETS + (usecs >> shift);
+  }
+
+  static boost::uint64_t get_bucket_max(const my::size_t & bucket);
+
+private:
+  boost::atomic<boost::uint64_t> _buckets[LATENCY_HISTOGRAM_BUCKETS];
+  boost::atomic<boost::uint64_t> _max;
+}; // class latency_histogram
+
+#endif /* COMMON_LATENCY_HISTOGRAM_H_ */
@@ -11,10 +11,61 @@
 #include <vector>
 
 #include <boost/iostreams/stream.hpp>
-#include <boost/iostreams/device/back_inserter.hpp>
+#include <boost/iostreams/categories.hpp>
+
+#include "common/types.h"
 
 typedef std::vector<char>                                               t_memory_buffer_data;
-typedef boost::iostreams::back_insert_device<t_memory_buffer_data>      t_memory_buffer_device;
+
+//
+// Receives the buffered data in chunks (e.g. to stream it to the socket
+// while the query is still running)
+//
+class memory_buffer_drain
+{
+public:
+  virtual ~memory_buffer_drain()
+  {
+  }
+
+  virtual void drain(const char * data, const my::size_t & size) = 0;
+}; // memory_buffer_drain
+
+//
+// Appends to the vector; if the drain is set then the data is passed to
+// it and the vector is cleared every time it grows over the drain size
+//
+class memory_buffer_device
+{
+public:
+  typedef char                          char_type;
+  typedef boost::iostreams::sink_tag    category;
+
+public:
+  memory_buffer_device(t_memory_buffer_data & data, memory_buffer_drain * drain = NULL, const my::size_t & drain_size = 0) :
+    _data(&data),
+    _drain(drain),
+    _drain_size(drain_size)
+  {
+  }
+
+  std::streamsize write(const char_type * s, std::streamsize n)
+  {
+    _data->insert(_data->end(), s, s + n);
+    if(_drain && _data->size() >= _drain_size) {
+        _drain->drain(&((*_data)[0]), _data->size());
+        _data->clear();
+    }
+    return n;
+  }
+
+private:
+  t_memory_buffer_data * _data;
+  memory_buffer_drain *  _drain;
+  my::size_t             _drain_size;
+}; // memory_buffer_device
+
+typedef memory_buffer_device                                            t_memory_buffer_device;
 typedef boost::iostreams::stream<t_memory_buffer_device>                t_memory_buffer;
 
 #endif /* COMMON_MEMORY_BUFFER_H_ */
@@ -0,0 +1,92 @@
+/*
+ * named_lock.cpp
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: aleksey
+ */
+#include <map>
+
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/locks.hpp>
+
+#include "common/named_lock.h"
+
+#ifdef ENABLE_LOCK_STATS
+
+//
+// The counters for each lock name: created on the first use and never
+// deleted so the locks can keep the pointers
+//
+typedef std::map<std::string, named_lock::t_counters *> t_named_lock_counters;
+
+static boost::mutex & named_lock_registry_mutex()
+{
+  static boost::mutex mutex;
+  return mutex;
+}
+
+static t_named_lock_counters & named_lock_registry()
+{
+  static t_named_lock_counters counters;
+  return counters;
+}
+
+named_lock::named_lock(const char * name) :
+  _counters(NULL),
+  _locked_ts(0)
+{
+  boost::lock_guard<boost::mutex> guard(named_lock_registry_mutex());
+
+  t_named_lock_counters & counters(named_lock_registry());
+  t_named_lock_counters::const_iterator it = counters.find(name);
+  if(it != counters.end()) {
+      _counters = it->second;
+      return;
+  }
+
+  _counters = new t_counters();
+  _counters->_acquisitions  = 0;
+  _counters->_contended     = 0;
+  _counters->_wait_time     = 0;
+  _counters->_max_hold_time = 0;
+  counters[name] = _counters;
+}
+
+#endif /* ENABLE_LOCK_STATS */
+
+/**
+ * named_lock::get_stats
+ *
+ * Returns the counters for all the lock names, the times are in usecs
+ */
+void named_lock::get_stats(std::vector<t_stats> & res, bool reset)
+{
+  res.clear();
+
+#ifdef ENABLE_LOCK_STATS
+  boost::lock_guard<boost::mutex> guard(named_lock_registry_mutex());
+
+  const t_named_lock_counters & counters(named_lock_registry());
+  res.reserve(counters.size());
+  for(t_named_lock_counters::const_iterator it = counters.begin(); it != counters.end(); ++it) {
+      t_counters & counter(*(it->second));
+
+      t_stats stats;
+      stats._name = it->first;
+      if(reset) {
+          stats._acquisitions  = counter._acquisitions.exchange(0, boost::memory_order_relaxed);
+          stats._contended     = counter._contended.exchange(0, boost::memory_order_relaxed);
+          stats._wait_time     = counter._wait_time.exchange(0, boost::memory_order_relaxed) / 1000;
+          stats._max_hold_time = counter._max_hold_time.exchange(0, boost::memory_order_relaxed) / 1000;
+      } else {
+          stats._acquisitions  = counter._acquisitions.load(boost::memory_order_relaxed);
+          stats._contended     = counter._contended.load(boost::memory_order_relaxed);
+          stats._wait_time     = counter._wait_time.load(boost::memory_order_relaxed) / 1000;
+          stats._max_hold_time = counter._max_hold_time.load(boost::memory_order_relaxed) / 1000;
+      }
+      res.push_back(stats);
+  }
+#else  /* ENABLE_LOCK_STATS */
+  (void)reset;
+#endif /* ENABLE_LOCK_STATS */
+}
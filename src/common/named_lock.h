@@ -0,0 +1,119 @@
+/*
+ * named_lock.h
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: aleksey
+ */
+
+#ifndef COMMON_NAMED_LOCK_H_
+#define COMMON_NAMED_LOCK_H_
+
+#include <string>
+#include <vector>
+
+#include <boost/atomic.hpp>
+#include <boost/cstdint.hpp>
+
+#include "common/adaptive_lock.h"
+
+#ifdef ENABLE_LOCK_STATS
+#include <time.h>
+#endif /* ENABLE_LOCK_STATS */
+
+//
+// The adaptive_lock with a name for profiling: with ENABLE_LOCK_STATS
+// (configure --enable-lock-stats) all the locks with the same name share
+// the counters for acquisitions, contended acquisitions, total wait time
+// and max hold time. Otherwise the name is ignored and the lock is just
+// the adaptive_lock.
+//
+class named_lock
+{
+public:
+  typedef struct t_stats_ {
+    std::string     _name;
+    boost::uint64_t _acquisitions;
+    boost::uint64_t _contended;
+    boost::uint64_t _wait_time;      // usecs
+    boost::uint64_t _max_hold_time;  // usecs
+  } t_stats;
+
+public:
+#ifdef ENABLE_LOCK_STATS
+  explicit named_lock(const char * name);
+#else  /* ENABLE_LOCK_STATS */
+  inline explicit named_lock(const char * /* name */)
+  {
+  }
+#endif /* ENABLE_LOCK_STATS */
+
+  inline void lock()
+  {
+#ifdef ENABLE_LOCK_STATS
+    if(!_lock.try_lock()) {
+        boost::uint64_t ts = named_lock::now();
+        _lock.lock();
+        _locked_ts = named_lock::now();
+
+        _counters->_contended.fetch_add(1, boost::memory_order_relaxed);
+        _counters->_wait_time.fetch_add(_locked_ts - ts, boost::memory_order_relaxed);
+    } else {
+        _locked_ts = named_lock::now();
+    }
+    _counters->_acquisitions.fetch_add(1, boost::memory_order_relaxed);
+#else  /* ENABLE_LOCK_STATS */
+    _lock.lock();
+#endif /* ENABLE_LOCK_STATS */
+  }
+
+  inline void unlock()
+  {
+#ifdef ENABLE_LOCK_STATS
+    boost::uint64_t hold_time = named_lock::now() - _locked_ts;
+    boost::uint64_t max_hold_time = _counters->_max_hold_time.load(boost::memory_order_relaxed);
+    while(max_hold_time < hold_time && !_counters->_max_hold_time.compare_exchange_weak(max_hold_time, hold_time, boost::memory_order_relaxed)) {
+    }
+#endif /* ENABLE_LOCK_STATS */
+    _lock.unlock();
+  }
+
+  inline bool is_locked() const
+  {
+    return _lock.is_locked();
+  }
+
+  // returns the counters for all the lock names (empty if the stats are disabled)
+  static void get_stats(std::vector<t_stats> & res, bool reset = false);
+
+private:
+  // disable copy constructor and assignment operator
+  named_lock(const named_lock &);
+  named_lock & operator=(const named_lock &);
+
+#ifdef ENABLE_LOCK_STATS
+public:
+  typedef struct t_counters_ {
+    boost::atomic<boost::uint64_t> _acquisitions;
+    boost::atomic<boost::uint64_t> _contended;
+    boost::atomic<boost::uint64_t> _wait_time;      // nsecs
+    boost::atomic<boost::uint64_t> _max_hold_time;  // nsecs
+  } t_counters;
+
+private:
+  inline static boost::uint64_t now()
+  {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (boost::uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+  }
+#endif /* ENABLE_LOCK_STATS */
+
+private:
+  adaptive_lock     _lock;
+#ifdef ENABLE_LOCK_STATS
+  t_counters *      _counters;   // shared by the name, never deleted
+  boost::uint64_t   _locked_ts;  // protected by the lock itself
+#endif /* ENABLE_LOCK_STATS */
+}; // class named_lock
+
+#endif /* COMMON_NAMED_LOCK_H_ */
@@ -0,0 +1,64 @@
+/*
+ * self_metrics.cpp
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: aleksey
+ */
+#include <boost/static_assert.hpp>
+
+#include "common/latency_histogram.h"
+#include "common/self_metrics.h"
+
+BOOST_STATIC_ASSERT(sizeof(boost::atomic<boost::uint64_t>) < SELF_COUNTER_CACHE_LINE);
+
+self_counter::self_counter()
+{
+  for(my::size_t ii = 0; ii < SELF_COUNTER_STRIPES; ++ii) {
+      _stripes[ii]._value.store(0, boost::memory_order_relaxed);
+  }
+}
+
+boost::uint64_t self_counter::get(bool reset) const
+{
+  boost::uint64_t res = 0;
+  for(my::size_t ii = 0; ii < SELF_COUNTER_STRIPES; ++ii) {
+      res += reset ?
+          _stripes[ii]._value.exchange(0, boost::memory_order_acquire) :
+          _stripes[ii]._value.load(boost::memory_order_acquire);
+  }
+  return res;
+}
+
+my::size_t self_counter::get_stripe()
+{
+  static boost::atomic<my::size_t> next_stripe(0);
+  static __thread my::size_t stripe = SELF_COUNTER_STRIPES;
+
+  if(stripe == SELF_COUNTER_STRIPES) {
+      stripe = next_stripe.fetch_add(1, boost::memory_order_relaxed) % SELF_COUNTER_STRIPES;
+  }
+  return stripe;
+}
+
+self_metrics::self_metrics()
+{
+}
+
+void self_metrics::add(const std::string & name, const my::value_t & value)
+{
+  _values.push_back(std::make_pair(name, value));
+}
+
+void self_metrics::add(const std::string & prefix, latency_histogram & histogram)
+{
+  latency_histogram::t_percentiles percentiles;
+  histogram.get_percentiles(percentiles, true);
+  if(percentiles._count == 0) {
+      return;
+  }
+
+  this->add(prefix + ".p50",  percentiles._p50);
+  this->add(prefix + ".p99",  percentiles._p99);
+  this->add(prefix + ".p999", percentiles._p999);
+  this->add(prefix + ".max",  percentiles._max);
+}
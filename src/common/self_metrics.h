@@ -0,0 +1,86 @@
+/*
+ * self_metrics.h
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: aleksey
+ */
+
+#ifndef COMMON_SELF_METRICS_H_
+#define COMMON_SELF_METRICS_H_
+
+#include <string>
+#include <vector>
+#include <utility>
+
+#include <boost/atomic.hpp>
+#include <boost/cstdint.hpp>
+
+#include "common/types.h"
+
+class latency_histogram;
+
+// the number of stripes in the self_counter, the threads are assigned
+// to the stripes round robin
+#define SELF_COUNTER_STRIPES    16
+#define SELF_COUNTER_CACHE_LINE 64
+
+//
+// The counter for the hot paths: each thread adds to its own cache line
+// and the stripes are summed up when the counter is read
+//
+class self_counter
+{
+  typedef struct t_stripe_ {
+    boost::atomic<boost::uint64_t> _value;
+    char _padding[SELF_COUNTER_CACHE_LINE - sizeof(boost::atomic<boost::uint64_t>)];
+  } t_stripe;
+
+public:
+  self_counter();
+
+  inline void add(const boost::uint64_t & value = 1)
+  {
+    _stripes[self_counter::get_stripe()]._value.fetch_add(value, boost::memory_order_release);
+  }
+
+  boost::uint64_t get(bool reset = false) const;
+
+private:
+  // disable copy constructor and assignment operator
+  self_counter(const self_counter &);
+  self_counter & operator=(const self_counter &);
+
+  static my::size_t get_stripe();
+
+private:
+  mutable t_stripe _stripes[SELF_COUNTER_STRIPES];
+}; // class self_counter
+
+//
+// The self.* status values collected from all the components for one
+// status interval: rrdb::update_self_metrics() writes them in one step
+//
+class self_metrics
+{
+public:
+  typedef std::vector< std::pair<std::string, my::value_t> > t_values;
+
+public:
+  self_metrics();
+
+  void add(const std::string & name, const my::value_t & value);
+
+  // adds <prefix>.p50, .p99, .p999 and .max for the histogram and resets
+  // it, nothing is added if there were no records
+  void add(const std::string & prefix, latency_histogram & histogram);
+
+  inline const t_values & get_values() const
+  {
+    return _values;
+  }
+
+private:
+  t_values _values;
+}; // class self_metrics
+
+#endif /* COMMON_SELF_METRICS_H_ */
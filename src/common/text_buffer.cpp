@@ -0,0 +1,473 @@
+/*
+ * text_buffer.cpp
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: aleksey
+ */
+#include <stdio.h>
+#include <math.h>
+
+#include <vector>
+
+#include "common/text_buffer.h"
+
+// the largest integer we print without the floating point formatting
+#define TEXT_BUFFER_MAX_INTEGER   1e15
+
+//
+// Grisu2 (F. Loitsch, "Printing Floating-Point Numbers Quickly and Accurately
+// with Integers", 2010): the shortest digits that round trip for almost all
+// the values (and always round trip) using only 64-bit integer arithmetic
+//
+namespace grisu {
+
+// "do-it-yourself" floating point: f * 2^e
+class diy_fp
+{
+public:
+  enum {
+    Significand_Size    = 64,
+    Dp_Significand_Size = 52,
+    Dp_Exponent_Bias    = 0x3FF + Dp_Significand_Size,
+    Dp_Min_Exponent     = -Dp_Exponent_Bias
+  };
+
+public:
+  diy_fp(const boost::uint64_t & f = 0, const int & e = 0) :
+    _f(f),
+    _e(e)
+  {
+  }
+
+  explicit diy_fp(const double & d)
+  {
+    boost::uint64_t u;
+    memcpy(&u, &d, sizeof(u));
+
+    int biased_e = (int)((u >> Dp_Significand_Size) & 0x7FF);
+    boost::uint64_t significand = u & ((1ULL << Dp_Significand_Size) - 1);
+    if(biased_e != 0) {
+        _f = significand + (1ULL << Dp_Significand_Size);
+        _e = biased_e - Dp_Exponent_Bias;
+    } else {
+        _f = significand;
+        _e = Dp_Min_Exponent + 1;
+    }
+  }
+
+  diy_fp operator-(const diy_fp & other) const
+  {
+    return diy_fp(_f - other._f, _e);
+  }
+
+  // 64x64 -> upper 64 bits, rounded
+  diy_fp operator*(const diy_fp & other) const
+  {
+    const boost::uint64_t M32 = 0xFFFFFFFFULL;
+    boost::uint64_t a = _f >> 32;
+    boost::uint64_t b = _f & M32;
+    boost::uint64_t c = other._f >> 32;
+    boost::uint64_t d = other._f & M32;
+    boost::uint64_t ac = a * c;
+    boost::uint64_t bc = b * c;
+    boost::uint64_t ad = a * d;
+    boost::uint64_t bd = b * d;
+    boost::uint64_t tmp = (bd >> 32) + (ad & M32) + (bc & M32);
+    tmp += 1ULL << 31;
+    return diy_fp(ac + (ad >> 32) + (bc >> 32) + (tmp >> 32), _e + other._e + 64);
+  }
+
+  diy_fp normalize() const
+  {
+    diy_fp res(*this);
+    while(!(res._f & (1ULL << 63))) {
+        res._f <<= 1;
+        res._e--;
+    }
+    return res;
+  }
+
+  // m- and m+ boundaries normalized to the same exponent
+  void normalized_boundaries(diy_fp & minus, diy_fp & plus) const
+  {
+    diy_fp pl((_f << 1) + 1, _e - 1);
+    while(!(pl._f & (1ULL << (Dp_Significand_Size + 1)))) {
+        pl._f <<= 1;
+        pl._e--;
+    }
+    pl._f <<= (Significand_Size - Dp_Significand_Size - 2);
+    pl._e -= (Significand_Size - Dp_Significand_Size - 2);
+
+    diy_fp mi = (_f == (1ULL << Dp_Significand_Size)) ?
+        diy_fp((_f << 2) - 1, _e - 2) :
+        diy_fp((_f << 1) - 1, _e - 1);
+    mi._f <<= mi._e - pl._e;
+    mi._e = pl._e;
+
+    minus = mi;
+    plus  = pl;
+  }
+
+public:
+  boost::uint64_t _f;
+  int             _e;
+}; // diy_fp
+
+//
+// Cached powers 10^(-348 + 8*i): computed once on startup with exact
+// big integer arithmetic (rounded to 64 bits) instead of a table of
+// magic numbers
+//
+class cached_powers
+{
+  enum {
+    Min_Decimal_Exponent = -348,
+    Decimal_Exponent_Step = 8,
+    Powers_Num = 87
+  };
+
+  typedef std::vector<boost::uint32_t> t_bignum; // little-endian 32-bit words
+
+public:
+  cached_powers()
+  {
+    for(int ii = 0; ii < Powers_Num; ++ii) {
+        _powers[ii] = cached_powers::power10(Min_Decimal_Exponent + ii * Decimal_Exponent_Step);
+    }
+  }
+
+  // c = 10^-k such that the product with 2^e lands in the Grisu range
+  inline const diy_fp & get(const int & e, int & k) const
+  {
+    double dk = (-61 - e) * 0.30102999566398114 + 347;
+    int kk = (int)dk;
+    if(dk - kk > 0.0) {
+        ++kk;
+    }
+    unsigned int index = (unsigned int)((kk >> 3) + 1);
+    k = -(Min_Decimal_Exponent + (int)index * Decimal_Exponent_Step);
+    return _powers[index];
+  }
+
+private:
+  static void mul_small(t_bignum & num, const boost::uint32_t & m)
+  {
+    boost::uint64_t carry = 0;
+    for(my::size_t ii = 0; ii < num.size(); ++ii) {
+        boost::uint64_t v = (boost::uint64_t)num[ii] * m + carry;
+        num[ii] = (boost::uint32_t)v;
+        carry = v >> 32;
+    }
+    if(carry) {
+        num.push_back((boost::uint32_t)carry);
+    }
+  }
+
+  static void div_small(t_bignum & num, const boost::uint32_t & d)
+  {
+    boost::uint64_t rem = 0;
+    for(my::size_t ii = num.size(); ii > 0; --ii) {
+        boost::uint64_t v = (rem << 32) | num[ii - 1];
+        num[ii - 1] = (boost::uint32_t)(v / d);
+        rem = v % d;
+    }
+    while(!num.empty() && num.back() == 0) {
+        num.pop_back();
+    }
+  }
+
+  static inline bool get_bit(const t_bignum & num, const int & pos)
+  {
+    return pos >= 0 && (num[pos / 32] >> (pos % 32)) & 1;
+  }
+
+  // top 64 bits of num (rounded), num = f * 2^e
+  static diy_fp top_bits(const t_bignum & num, const int & shift)
+  {
+    int bits = (int)num.size() * 32;
+    while(!get_bit(num, bits - 1)) {
+        --bits;
+    }
+
+    boost::uint64_t f = 0;
+    for(int pos = bits - 1; pos >= bits - 64; --pos) {
+        f = (f << 1) | (get_bit(num, pos) ? 1 : 0);
+    }
+    int e = bits - 64 + shift;
+    if(get_bit(num, bits - 65)) {
+        if(++f == 0) {
+            f = 1ULL << 63;
+            ++e;
+        }
+    }
+    return diy_fp(f, e);
+  }
+
+  static diy_fp power10(const int & k)
+  {
+    t_bignum num;
+    if(k >= 0) {
+        // 10^k exactly
+        num.push_back(1);
+        for(int ii = 0; ii < k; ++ii) {
+            cached_powers::mul_small(num, 10);
+        }
+        return cached_powers::top_bits(num, 0);
+    }
+
+    // floor(2^n / 10^-k) with enough bits: floor(floor(x / a) / b) = floor(x / ab)
+    int n = -4 * k + 128;
+    num.resize(n / 32 + 1, 0);
+    num[n / 32] = 1U << (n % 32);
+    for(int ii = 0; ii < -k; ++ii) {
+        cached_powers::div_small(num, 10);
+    }
+    return cached_powers::top_bits(num, -n);
+  }
+
+private:
+  diy_fp _powers[Powers_Num];
+}; // cached_powers
+
+static const cached_powers g_cached_powers;
+
+static const boost::uint64_t g_pow10[] = {
+  1ULL, 10ULL, 100ULL, 1000ULL, 10000ULL, 100000ULL, 1000000ULL, 10000000ULL,
+  100000000ULL, 1000000000ULL, 10000000000ULL, 100000000000ULL, 1000000000000ULL,
+  10000000000000ULL, 100000000000000ULL, 1000000000000000ULL, 10000000000000000ULL,
+  100000000000000000ULL, 1000000000000000000ULL, 10000000000000000000ULL
+};
+
+static inline int count_decimal_digits(const boost::uint32_t & n)
+{
+  int digits = 1;
+  while(digits < 10 && n >= g_pow10[digits]) {
+      ++digits;
+  }
+  return digits;
+}
+
+static inline void round_weed(char * buffer, const int & len, const boost::uint64_t & delta, boost::uint64_t rest, const boost::uint64_t & ten_kappa, const boost::uint64_t & wp_w)
+{
+  while(rest < wp_w && delta - rest >= ten_kappa &&
+        (rest + ten_kappa < wp_w || wp_w - rest > rest + ten_kappa - wp_w)) {
+      buffer[len - 1]--;
+      rest += ten_kappa;
+  }
+}
+
+static void digit_gen(const diy_fp & W, const diy_fp & Mp, boost::uint64_t delta, char * buffer, int & len, int & K)
+{
+  const diy_fp one(1ULL << -Mp._e, Mp._e);
+  const diy_fp wp_w = Mp - W;
+  boost::uint32_t p1 = (boost::uint32_t)(Mp._f >> -one._e);
+  boost::uint64_t p2 = Mp._f & (one._f - 1);
+  int kappa = count_decimal_digits(p1);
+  len = 0;
+
+  // integral part
+  while(kappa > 0) {
+      boost::uint32_t div = (boost::uint32_t)g_pow10[kappa - 1];
+      boost::uint32_t d = p1 / div;
+      p1 %= div;
+      if(d || len) {
+          buffer[len++] = (char)('0' + d);
+      }
+      --kappa;
+
+      boost::uint64_t tmp = ((boost::uint64_t)p1 << -one._e) + p2;
+      if(tmp <= delta) {
+          K += kappa;
+          round_weed(buffer, len, delta, tmp, g_pow10[kappa] << -one._e, wp_w._f);
+          return;
+      }
+  }
+
+  // fractional part
+  for(;;) {
+      p2 *= 10;
+      delta *= 10;
+      char d = (char)(p2 >> -one._e);
+      if(d || len) {
+          buffer[len++] = (char)('0' + d);
+      }
+      p2 &= one._f - 1;
+      --kappa;
+      if(p2 < delta) {
+          K += kappa;
+          int index = -kappa;
+          round_weed(buffer, len, delta, p2, one._f, index < 20 ? wp_w._f * g_pow10[index] : 0);
+          return;
+      }
+  }
+}
+
+// positive finite value -> digits (len) and decimal exponent K: value = digits * 10^K
+static void grisu2(const double & value, char * buffer, int & len, int & K)
+{
+  const diy_fp v(value);
+  diy_fp w_m, w_p;
+  v.normalized_boundaries(w_m, w_p);
+
+  const diy_fp & c_mk = g_cached_powers.get(w_p._e, K);
+  const diy_fp W  = v.normalize() * c_mk;
+  diy_fp Wp = w_p * c_mk;
+  diy_fp Wm = w_m * c_mk;
+  Wm._f++;
+  Wp._f--;
+  digit_gen(W, Wp, Wp._f - Wm._f, buffer, len, K);
+}
+
+} // namespace grisu
+
+text_buffer::text_buffer(const my::size_t & capacity) :
+  _data(NULL),
+  _size(0),
+  _capacity(0)
+{
+  this->grow(capacity > 0 ? capacity : 64);
+}
+
+text_buffer::~text_buffer()
+{
+  free(_data);
+}
+
+void text_buffer::grow(const my::size_t & capacity)
+{
+  my::size_t new_capacity = _capacity > 0 ? _capacity : 64;
+  while(new_capacity < capacity) {
+      new_capacity *= 2;
+  }
+
+  char * new_data = (char*)realloc(_data, new_capacity);
+  if(!new_data) {
+      throw exception("Unable to allocate %lu bytes for text buffer", new_capacity);
+  }
+  _data     = new_data;
+  _capacity = new_capacity;
+}
+
+text_buffer & text_buffer::append(const boost::uint64_t & value)
+{
+  // digits in reverse order
+  char buf[24];
+  char * end = buf + sizeof(buf);
+  char * ptr = end;
+  boost::uint64_t v = value;
+  do {
+      *(--ptr) = '0' + (v % 10);
+      v /= 10;
+  } while(v > 0);
+
+  return this->append(ptr, end - ptr);
+}
+
+text_buffer & text_buffer::append(const double & value)
+{
+  char buf[32];
+  my::size_t len = text_buffer::format(value, buf, sizeof(buf));
+  return this->append(buf, len);
+}
+
+void text_buffer::write_to(t_memory_buffer & res)
+{
+  if(_size > 0) {
+      res.write(_data, _size);
+      _size = 0;
+  }
+}
+
+my::size_t text_buffer::format(const double & value, char * buf, const my::size_t & buf_size)
+{
+  CHECK_AND_THROW(buf_size >= 32);
+
+  // special values
+  if(isnan(value)) {
+      memcpy(buf, "nan", 3);
+      return 3;
+  }
+  if(isinf(value)) {
+      if(value < 0) {
+          memcpy(buf, "-inf", 4);
+          return 4;
+      }
+      memcpy(buf, "inf", 3);
+      return 3;
+  }
+
+  // integers (counts, sums of integer values, etc) are the most
+  // common case: no need for the floating point machinery
+  if(value == floor(value) && fabs(value) < TEXT_BUFFER_MAX_INTEGER) {
+      boost::uint64_t v = (boost::uint64_t)fabs(value);
+      char * end = buf + buf_size;
+      char * ptr = end;
+      do {
+          *(--ptr) = '0' + (v % 10);
+          v /= 10;
+      } while(v > 0);
+      if(value < 0) {
+          *(--ptr) = '-';
+      }
+
+      my::size_t len = end - ptr;
+      memmove(buf, ptr, len);
+      return len;
+  }
+
+  // digits
+  char * ptr = buf;
+  if(value < 0) {
+      *(ptr++) = '-';
+  }
+  char digits[24];
+  int len = 0, K = 0;
+  grisu::grisu2(fabs(value), digits, len, K);
+
+  // same layout as printf("%g"): fixed notation unless the
+  // exponent is too small or too large
+  int exp10 = len + K - 1;
+  if(exp10 < -4 || exp10 >= 17) {
+      *(ptr++) = digits[0];
+      if(len > 1) {
+          *(ptr++) = '.';
+          memcpy(ptr, digits + 1, len - 1);
+          ptr += len - 1;
+      }
+      *(ptr++) = 'e';
+      *(ptr++) = exp10 < 0 ? '-' : '+';
+      int e = exp10 < 0 ? -exp10 : exp10;
+      if(e >= 100) {
+          *(ptr++) = '0' + e / 100;
+          e %= 100;
+      }
+      *(ptr++) = '0' + e / 10;
+      *(ptr++) = '0' + e % 10;
+  } else if(exp10 < 0) {
+      // 0.000ddd
+      *(ptr++) = '0';
+      *(ptr++) = '.';
+      for(int ii = exp10 + 1; ii < 0; ++ii) {
+          *(ptr++) = '0';
+      }
+      memcpy(ptr, digits, len);
+      ptr += len;
+  } else if(exp10 + 1 >= len) {
+      // ddd000
+      memcpy(ptr, digits, len);
+      ptr += len;
+      for(int ii = len; ii <= exp10; ++ii) {
+          *(ptr++) = '0';
+      }
+  } else {
+      // ddd.ddd
+      memcpy(ptr, digits, exp10 + 1);
+      ptr += exp10 + 1;
+      *(ptr++) = '.';
+      memcpy(ptr, digits + exp10 + 1, len - exp10 - 1);
+      ptr += len - exp10 - 1;
+  }
+
+  CHECK_AND_THROW((my::size_t)(ptr - buf) < buf_size);
+  return ptr - buf;
+}
@@ -0,0 +1,98 @@
+/*
+ * text_buffer.h
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: aleksey
+ */
+
+#ifndef COMMON_TEXT_BUFFER_H_
+#define COMMON_TEXT_BUFFER_H_
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <string>
+
+#include "common/types.h"
+#include "common/exception.h"
+#include "common/memory_buffer.h"
+
+//
+// Append-only text buffer for formatting query results: no locale,
+// no stream state and no flushes, the data is moved to the output stream
+// in large chunks with write_to()
+//
+class text_buffer
+{
+public:
+  text_buffer(const my::size_t & capacity = 4096);
+  virtual ~text_buffer();
+
+  inline const char * data() const
+  {
+    return _data;
+  }
+  inline my::size_t size() const
+  {
+    return _size;
+  }
+  inline bool empty() const
+  {
+    return _size == 0;
+  }
+  inline void clear()
+  {
+    _size = 0;
+  }
+
+  inline text_buffer & append(const char & ch)
+  {
+    this->reserve(1);
+    _data[_size++] = ch;
+    return *this;
+  }
+  inline text_buffer & append(const char * str, const my::size_t & len)
+  {
+    this->reserve(len);
+    memcpy(_data + _size, str, len);
+    _size += len;
+    return *this;
+  }
+  inline text_buffer & append(const char * str)
+  {
+    return this->append(str, strlen(str));
+  }
+  inline text_buffer & append(const std::string & str)
+  {
+    return this->append(str.data(), str.length());
+  }
+
+  text_buffer & append(const boost::uint64_t & value);
+  text_buffer & append(const double & value);
+
+  // moves the data to the stream and clears the buffer
+  void write_to(t_memory_buffer & res);
+
+  // the shortest (Grisu2) text that parses back to the same double
+  static my::size_t format(const double & value, char * buf, const my::size_t & buf_size);
+
+private:
+  // disable copy constructor and assignment operator
+  text_buffer(const text_buffer &);
+  text_buffer & operator=(const text_buffer &);
+
+  inline void reserve(const my::size_t & len)
+  {
+    if(_size + len > _capacity) {
+        this->grow(_size + len);
+    }
+  }
+  void grow(const my::size_t & capacity);
+
+private:
+  char *      _data;
+  my::size_t  _size;
+  my::size_t  _capacity;
+}; // text_buffer
+
+#endif /* COMMON_TEXT_BUFFER_H_ */
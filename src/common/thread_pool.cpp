@@ -5,35 +5,223 @@
  *      Author: aleksey
  */
 
+#include <vector>
+#include <algorithm>
+
+#include <boost/algorithm/string.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/locks.hpp>
+
+#include "common/adaptive_lock.h"
 #include "common/exception.h"
 #include "common/log.h"
 #include "common/thread_pool.h"
 
-thread_pool::thread_pool(my::size_t pool_size) :
+//
+// The work stealing scheduler: each thread has its own queue protected by
+// its own lock. The new tasks are spread across the queues round robin,
+// the owner takes the tasks from the front of its queue (in the order they
+// came) and the idle threads steal from the back of the other queues. The
+// threads park only when there are no pending tasks anywhere.
+//
+class thread_pool_work_stealing
+{
+  typedef struct t_worker_queue_ {
+    adaptive_lock                                         _lock;
+    std::deque< boost::intrusive_ptr<thread_pool_task> >  _tasks;
+  } t_worker_queue;
+
+public:
+  thread_pool_work_stealing(thread_pool & pool, my::size_t pool_size) :
+    _pool(pool),
+    _next(0),
+    _pending(0),
+    _searching(0),
+    _sleeping(0),
+    _stopped(false)
+  {
+    for(my::size_t ii = 0; ii < pool_size; ++ii) {
+        _queues.push_back(boost::shared_ptr<t_worker_queue>(new t_worker_queue()));
+    }
+    for(my::size_t ii = 0; ii < pool_size; ++ii) {
+        _threads.create_thread(boost::bind(&thread_pool_work_stealing::worker, this, ii));
+    }
+  }
+
+  ~thread_pool_work_stealing()
+  {
+    {
+      boost::lock_guard<boost::mutex> guard(_idle_lock);
+      _stopped = true;
+    }
+    _idle_cond.notify_all();
+
+    // Suppress all exceptions.
+    try {
+        _threads.join_all();
+    } catch (std::exception& e) {
+      LOG(log::LEVEL_ERROR, "%s", e.what());
+    }
+  }
+
+  void push(const boost::intrusive_ptr<thread_pool_task> & task)
+  {
+    // count the task first so the threads don't park while we push it
+    _pending.fetch_add(1, boost::memory_order_seq_cst);
+
+    t_worker_queue & queue(*_queues[_next.fetch_add(1, boost::memory_order_relaxed) % _queues.size()]);
+    {
+      boost::lock_guard<adaptive_lock> guard(queue._lock);
+      queue._tasks.push_back(task);
+    }
+
+    // the searching threads will find the task themselves
+    if(_searching.load(boost::memory_order_seq_cst) == 0 && _sleeping.load(boost::memory_order_seq_cst) > 0) {
+        boost::lock_guard<boost::mutex> guard(_idle_lock);
+        _idle_cond.notify_one();
+    }
+  }
+
+private:
+  void worker(const my::size_t & pos)
+  {
+    boost::intrusive_ptr<thread_pool_task> task;
+    while(!_stopped.load(boost::memory_order_relaxed)) {
+        if(this->pop(pos, task)) {
+            this->wake_up_sleeping();
+            _pool.wrap_task_run(task);
+            task.reset();
+            continue;
+        }
+
+        _searching.fetch_add(1, boost::memory_order_seq_cst);
+        bool found = this->steal(pos, task);
+        _searching.fetch_sub(1, boost::memory_order_seq_cst);
+        if(found) {
+            this->wake_up_sleeping();
+            _pool.wrap_task_run(task);
+            task.reset();
+            continue;
+        }
+
+        // nothing to do anywhere: park until a new task is pushed
+        boost::unique_lock<boost::mutex> guard(_idle_lock);
+        _sleeping.fetch_add(1, boost::memory_order_seq_cst);
+        while(_pending.load(boost::memory_order_seq_cst) == 0 && !_stopped.load(boost::memory_order_relaxed)) {
+            _idle_cond.wait(guard);
+        }
+        _sleeping.fetch_sub(1, boost::memory_order_relaxed);
+    }
+  }
+
+  // push() doesn't wake up the threads while someone is searching: the
+  // thread that got a task passes the remaining work on to a sleeping
+  // thread unless another thread is still searching
+  void wake_up_sleeping()
+  {
+    if(_searching.load(boost::memory_order_seq_cst) == 0 && _pending.load(boost::memory_order_seq_cst) > 0 && _sleeping.load(boost::memory_order_seq_cst) > 0) {
+        boost::lock_guard<boost::mutex> guard(_idle_lock);
+        _idle_cond.notify_one();
+    }
+  }
+
+  bool pop(const my::size_t & pos, boost::intrusive_ptr<thread_pool_task> & task)
+  {
+    t_worker_queue & queue(*_queues[pos]);
+    boost::lock_guard<adaptive_lock> guard(queue._lock);
+    if(queue._tasks.empty()) {
+        return false;
+    }
+    task = queue._tasks.front();
+    queue._tasks.pop_front();
+    _pending.fetch_sub(1, boost::memory_order_relaxed);
+    return true;
+  }
+
+  bool steal(const my::size_t & pos, boost::intrusive_ptr<thread_pool_task> & task)
+  {
+    for(my::size_t ii = 1; ii < _queues.size(); ++ii) {
+        t_worker_queue & queue(*_queues[(pos + ii) % _queues.size()]);
+        boost::lock_guard<adaptive_lock> guard(queue._lock);
+        if(queue._tasks.empty()) {
+            continue;
+        }
+        task = queue._tasks.back();
+        queue._tasks.pop_back();
+        _pending.fetch_sub(1, boost::memory_order_relaxed);
+        return true;
+    }
+    return false;
+  }
+
+private:
+  thread_pool &                                   _pool;
+  std::vector< boost::shared_ptr<t_worker_queue> > _queues;
+  boost::thread_group                             _threads;
+
+  boost::atomic<my::size_t>   _next;
+  boost::atomic<my::size_t>   _pending;
+  boost::atomic<my::size_t>   _searching;
+  boost::atomic<my::size_t>   _sleeping;
+  boost::atomic<bool>         _stopped;
+  boost::mutex                _idle_lock;
+  boost::condition_variable   _idle_cond;
+}; // class thread_pool_work_stealing
+
+thread_pool::thread_pool(
+    my::size_t pool_size,
+    my::size_t max_queue_size,
+    enum overflow_policy policy,
+    enum scheduler scheduler
+) :
   _pool_size(pool_size),
+  _max_queue_size(max_queue_size),
+  _overflow_policy(policy),
   _work(_io_service),
   _used_threads(0),
-  _started_jobs(0),
-  _finished_jobs(0)
+  _stopped(false)
 {
   LOG(log::LEVEL_DEBUG, "Creating thread pool");
 
   // init
-  for(my::size_t ii = 0; ii < _pool_size; ++ii) {
-      _threads.create_thread(boost::bind(
-          static_cast<size_t (boost::asio::io_service::*)()>(&boost::asio::io_service::run),
-          &_io_service
-      ));
+  if(scheduler == Scheduler_WorkStealing) {
+      if(_max_queue_size > 0) {
+          throw exception("The work stealing thread pool does not support the bounded queue");
+      }
+      _work_stealing.reset(new thread_pool_work_stealing(*this, _pool_size));
+  } else {
+      for(my::size_t ii = 0; ii < _pool_size; ++ii) {
+          _threads.create_thread(boost::bind(
+              static_cast<size_t (boost::asio::io_service::*)()>(&boost::asio::io_service::run),
+              &_io_service
+          ));
+      }
   }
 
   // done
-  LOG(log::LEVEL_INFO, "Created thread pool with %lu threads", SIZE_T_CAST _pool_size);
+  if(_work_stealing) {
+      LOG(log::LEVEL_INFO, "Created work stealing thread pool with %lu threads", SIZE_T_CAST _pool_size);
+  } else if(_max_queue_size > 0) {
+      LOG(log::LEVEL_INFO, "Created thread pool with %lu threads and queue size %lu", SIZE_T_CAST _pool_size, SIZE_T_CAST _max_queue_size);
+  } else {
+      LOG(log::LEVEL_INFO, "Created thread pool with %lu threads", SIZE_T_CAST _pool_size);
+  }
 }
 
 thread_pool::~thread_pool()
 {
   LOG(log::LEVEL_DEBUG, "Stopping thread pool");
 
+  // stop the work stealing threads, the queued tasks are dropped
+  _work_stealing.reset();
+
+  // release the threads blocked on the full queue
+  {
+    boost::lock_guard<boost::mutex> guard(_queue_lock);
+    _stopped = true;
+  }
+  _queue_not_full.notify_all();
+
   // Force all threads to return from io_service::run().
   _io_service.stop();
 
@@ -47,8 +235,39 @@ thread_pool::~thread_pool()
   LOG(log::LEVEL_INFO, "Stopped thread pool");
 }
 
+enum thread_pool::overflow_policy thread_pool::str2overflow_policy(const std::string & str)
+{
+  std::string str_lower = boost::to_lower_copy(str);
+  if(str_lower == "drop_newest") {
+      return thread_pool::Overflow_DropNewest;
+  } else if(str_lower == "drop_oldest") {
+      return thread_pool::Overflow_DropOldest;
+  } else if(str_lower == "block") {
+      return thread_pool::Overflow_Block;
+  } else {
+      throw exception("Unknown queue overflow policy '%s'", str.c_str());
+  }
+}
+
+enum thread_pool::scheduler thread_pool::str2scheduler(const std::string & str)
+{
+  std::string str_lower = boost::to_lower_copy(str);
+  if(str_lower == "shared") {
+      return thread_pool::Scheduler_Shared;
+  } else if(str_lower == "work_stealing") {
+      return thread_pool::Scheduler_WorkStealing;
+  } else {
+      throw exception("Unknown thread pool scheduler '%s'", str.c_str());
+  }
+}
+
 my::size_t thread_pool::run(const boost::intrusive_ptr<thread_pool_task> & task)
 {
+  task->_queued_ts = latency_histogram::now();
+  if(_max_queue_size > 0) {
+      return this->run_bounded(task);
+  }
+
   // ready to execute?
   my::size_t used_threads = _used_threads.fetch_add(1, boost::memory_order_acquire);
   if(_used_threads >= _pool_size) {
@@ -56,15 +275,89 @@ my::size_t thread_pool::run(const boost::intrusive_ptr<thread_pool_task> & task)
   }
 
   // go!
-  _started_jobs.fetch_add(1, boost::memory_order_acquire);
-  _io_service.post(boost::bind( &thread_pool::wrap_task_run, this, task)) ;
+  _started_jobs.add();
+  if(_work_stealing) {
+      _work_stealing->push(task);
+  } else {
+      _io_service.post(boost::bind( &thread_pool::wrap_task_run, this, task)) ;
+  }
+
+  // done
+  return used_threads;
+}
+
+/**
+ * thread_pool::run_bounded
+ *
+ * Puts the task in the bounded queue and posts one queue pop for each
+ * queued task. If the queue is full then the task is dropped, replaces
+ * the oldest queued task or waits for the space depending on the policy.
+ */
+my::size_t thread_pool::run_bounded(const boost::intrusive_ptr<thread_pool_task> & task)
+{
+  _started_jobs.add();
+  {
+    boost::unique_lock<boost::mutex> guard(_queue_lock);
+    if(_queue.size() >= _max_queue_size) {
+        switch(_overflow_policy) {
+        case Overflow_DropNewest:
+          _dropped_jobs.add();
+          LOG(log::LEVEL_DEBUG, "The thread pool queue is full, dropping the new task");
+          return _used_threads.load(boost::memory_order_relaxed);
+
+        case Overflow_DropOldest:
+          // the pop for the oldest task is already posted and picks up the new one
+          _queue.pop_front();
+          _queue.push_back(task);
+          _dropped_jobs.add();
+          LOG(log::LEVEL_DEBUG, "The thread pool queue is full, dropping the oldest task");
+          return _used_threads.load(boost::memory_order_relaxed);
+
+        case Overflow_Block:
+          while(_queue.size() >= _max_queue_size && !_stopped) {
+              _queue_not_full.wait(guard);
+          }
+          if(_stopped) {
+              _dropped_jobs.add();
+              return _used_threads.load(boost::memory_order_relaxed);
+          }
+          break;
+        }
+    }
+    _queue.push_back(task);
+  }
+
+  // go!
+  my::size_t used_threads = _used_threads.fetch_add(1, boost::memory_order_acquire);
+  _io_service.post(boost::bind(&thread_pool::wrap_queue_run, this));
 
   // done
   return used_threads;
 }
 
+void thread_pool::wrap_queue_run()
+{
+  boost::intrusive_ptr<thread_pool_task> task;
+  {
+    boost::lock_guard<boost::mutex> guard(_queue_lock);
+    // one pop is posted for each queued task so this shouldn't happen
+    if(_queue.empty()) {
+        LOG(log::LEVEL_ERROR, "The thread pool queue is empty");
+        return;
+    }
+    task = _queue.front();
+    _queue.pop_front();
+  }
+  _queue_not_full.notify_one();
+
+  this->wrap_task_run(task);
+}
+
 void thread_pool::wrap_task_run(const boost::intrusive_ptr<thread_pool_task> & task)
 {
+  boost::uint64_t start_ts = latency_histogram::now();
+  _wait_time.record(start_ts - std::min(task->_queued_ts, start_ts));
+
   // run the task, ignore all exception
   try {
       task->run();
@@ -75,6 +368,7 @@ void thread_pool::wrap_task_run(const boost::intrusive_ptr<thread_pool_task> & t
   }
 
   // done!
+  _run_time.record(latency_histogram::now() - start_ts);
   _used_threads.fetch_sub(1, boost::memory_order_relaxed);
-  _finished_jobs.fetch_add(1, boost::memory_order_release);
+  _finished_jobs.add();
 }
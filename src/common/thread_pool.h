@@ -9,31 +9,68 @@
 #define THREAD_POOL_H_
 
 #include <string>
+#include <deque>
 
 #include <boost/asio.hpp>
 #include <boost/thread.hpp>
 #include <boost/atomic.hpp>
+#include <boost/scoped_ptr.hpp>
 
 #include "common/types.h"
 #include "common/enable_intrusive_ptr.h"
+#include "common/latency_histogram.h"
+#include "common/self_metrics.h"
 
 class thread_pool_task:
     public enable_intrusive_ptr<thread_pool_task>
 {
+  friend class thread_pool;
+
 public:
-  thread_pool_task() { }
+  thread_pool_task() : _queued_ts(0) { }
   virtual ~thread_pool_task() { }
 
 public:
   virtual void run() = 0;
+
+private:
+  boost::uint64_t _queued_ts; // usecs, set by thread_pool::run()
 }; // thread_pool_task
 
+class thread_pool_work_stealing;
+
 class thread_pool
 {
+  friend class thread_pool_work_stealing;
+
+public:
+  // what to do when the bounded queue is full
+  enum overflow_policy {
+    Overflow_DropNewest = 0,
+    Overflow_DropOldest,
+    Overflow_Block
+  };
+
+  // how the tasks get to the threads
+  enum scheduler {
+    Scheduler_Shared = 0,     // one io_service queue shared by all threads
+    Scheduler_WorkStealing    // a queue per thread, idle threads steal from the others
+  };
+
 public:
-  thread_pool(my::size_t pool_size);
+  // the queue is unbounded if max_queue_size is 0 (the only option for
+  // the work stealing scheduler)
+  thread_pool(
+      my::size_t pool_size,
+      my::size_t max_queue_size = 0,
+      enum overflow_policy policy = Overflow_DropNewest,
+      enum scheduler scheduler = Scheduler_Shared
+  );
   virtual ~thread_pool();
 
+  static enum overflow_policy str2overflow_policy(const std::string & str);
+  static enum scheduler str2scheduler(const std::string & str);
+
   my::size_t run(const boost::intrusive_ptr<thread_pool_task> & task);
 
   inline double get_load_factor() const
@@ -41,27 +78,70 @@ public:
       return _used_threads.load(boost::memory_order_relaxed) / (double)_pool_size;
   }
 
+  // the number of tasks waiting for a thread
+  inline my::size_t get_queue_size() const
+  {
+      my::size_t used_threads = _used_threads.load(boost::memory_order_relaxed);
+      return used_threads > _pool_size ? used_threads - _pool_size : 0;
+  }
+
   inline my::size_t get_started_jobs() const
   {
-      return _started_jobs.load(boost::memory_order_relaxed);
+      return _started_jobs.get();
   }
 
   inline my::size_t get_finished_jobs() const
   {
-      return _finished_jobs.load(boost::memory_order_relaxed);
+      return _finished_jobs.get();
+  }
+
+  // the tasks that were submitted but never executed because the queue was full
+  inline my::size_t get_dropped_jobs() const
+  {
+      return _dropped_jobs.get();
+  }
+
+  // the time from run() until a thread picks up the task
+  inline latency_histogram & get_wait_time() const
+  {
+      return _wait_time;
+  }
+
+  // the time the task runs
+  inline latency_histogram & get_run_time() const
+  {
+      return _run_time;
   }
 
 private:
+  my::size_t run_bounded(const boost::intrusive_ptr<thread_pool_task> & task);
+  void wrap_queue_run();
   void wrap_task_run(const boost::intrusive_ptr<thread_pool_task> & task);
 
 private:
+  typedef std::deque< boost::intrusive_ptr<thread_pool_task> > t_tasks_queue;
+
   my::size_t                    _pool_size;
+  my::size_t                    _max_queue_size;
+  enum overflow_policy          _overflow_policy;
   boost::asio::io_service        _io_service;
   boost::asio::io_service::work  _work;
   boost::thread_group            _threads;
   boost::atomic<my::size_t>     _used_threads;
-  boost::atomic<my::size_t>     _started_jobs;
-  boost::atomic<my::size_t>     _finished_jobs;
+  self_counter                  _started_jobs;
+  self_counter                  _finished_jobs;
+  self_counter                  _dropped_jobs;
+  mutable latency_histogram     _wait_time;
+  mutable latency_histogram     _run_time;
+
+  // bounded queue mode only
+  boost::mutex                  _queue_lock;
+  boost::condition_variable     _queue_not_full;
+  t_tasks_queue                 _queue;
+  bool                          _stopped;
+
+  // work stealing scheduler only
+  boost::scoped_ptr<thread_pool_work_stealing> _work_stealing;
 };
 
 #endif /* THREAD_POOL_H_ */
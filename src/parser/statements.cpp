@@ -51,6 +51,25 @@ t_statement statement_query_parse(const std::string & str)
   return ret;
 }
 
+my::size_t statement_find_end(const std::string & str)
+{
+  char quote = 0;
+  for(my::size_t ii = 0; ii < str.length(); ++ii) {
+      char ch = str[ii];
+      if(quote) {
+          if(ch == quote) {
+              quote = 0;
+          }
+      } else if(ch == '\'' || ch == '"') {
+          quote = ch;
+      } else if(ch == ';') {
+          return ii;
+      }
+  }
+
+  return std::string::npos;
+}
+
 t_statement statement_update_parse(const std::string & str)
 {
   std::vector< std::string > data;
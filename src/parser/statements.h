@@ -63,7 +63,7 @@ public:
 /**
  * SELECT statement string representation:
  *
- * SELECT *| (min,max, ..) FROM [METRIC] "<name>" BETWEEN <timestamp1> AND <timestamp2> [ GROUP BY <interval> ];
+ * SELECT *| (min,max, ..) FROM [METRIC] "<name>" BETWEEN <timestamp1> AND <timestamp2> [ GROUP BY <interval> ] [ FORMAT CSV|BINARY ];
  *
  */
 class statement_select
@@ -74,6 +74,45 @@ public:
   my::time_t                      _ts_begin;
   my::time_t                      _ts_end;
   boost::optional<my::interval_t> _group_by;
+  boost::optional<t_result_format> _format;
+};
+
+/**
+ * SELECT from multiple metrics statement string representation:
+ *
+ * SELECT *| (min,max, ..) FROM METRICS LIKE "<pattern>" BETWEEN <timestamp1> AND <timestamp2> [ GROUP BY <interval> ] [ FORMAT CSV|BINARY ];
+ *
+ * The pattern might include '*' wildcards (e.g. "web.*.latency"), otherwise
+ * it matches all the metrics with names containing the pattern.
+ */
+class statement_select_metrics
+{
+public:
+  t_tuple_expr_list               _result;
+  std::string                     _like;
+  my::time_t                      _ts_begin;
+  my::time_t                      _ts_end;
+  boost::optional<my::interval_t> _group_by;
+  boost::optional<t_result_format> _format;
+};
+
+/**
+ * SELECT aggregated across multiple metrics statement string representation:
+ *
+ * SELECT <func>(<field>), ... FROM METRICS LIKE "<pattern>" BETWEEN <timestamp1> AND <timestamp2> [ GROUP BY <interval> ] [ FORMAT CSV|BINARY ];
+ *
+ * where <func> is one of sum, avg, min, max, count and <field> is one of
+ * min, max, sum, count, avg, stddev (e.g. "SUM(avg)").
+ */
+class statement_select_aggregate
+{
+public:
+  t_tuple_aggregate_list          _result;
+  std::string                     _like;
+  my::time_t                      _ts_begin;
+  my::time_t                      _ts_end;
+  boost::optional<my::interval_t> _group_by;
+  boost::optional<t_result_format> _format;
 };
 
 /**
@@ -121,6 +160,8 @@ typedef boost::variant<
     statement_drop,
     statement_update,
     statement_select,
+    statement_select_metrics,
+    statement_select_aggregate,
     statement_show_policy,
     statement_show_metrics,
     statement_show_status
@@ -129,6 +170,10 @@ typedef boost::variant<
 // The above grammar
 t_statement statement_query_parse(const std::string & str);
 
+// position of the ';' that ends the first statement in the string
+// (skipping quoted names), std::string::npos if there is no complete statement
+my::size_t statement_find_end(const std::string & str);
+
 // <command>|<param1>|<param2>|....
 t_statement statement_update_parse(const std::string & str);
 
@@ -41,6 +41,30 @@ BOOST_FUSION_ADAPT_STRUCT(
     (my::time_t,      _ts_begin)
     (my::time_t,      _ts_end)
     (boost::optional<my::interval_t>,     _group_by)
+    (boost::optional<t_result_format>,    _format)
+)
+BOOST_FUSION_ADAPT_STRUCT(
+    statement_select_metrics,
+    (t_tuple_expr_list, _result)
+    (std::string,     _like)
+    (my::time_t,      _ts_begin)
+    (my::time_t,      _ts_end)
+    (boost::optional<my::interval_t>,     _group_by)
+    (boost::optional<t_result_format>,    _format)
+)
+BOOST_FUSION_ADAPT_STRUCT(
+    statement_select_aggregate,
+    (t_tuple_aggregate_list, _result)
+    (std::string,     _like)
+    (my::time_t,      _ts_begin)
+    (my::time_t,      _ts_end)
+    (boost::optional<my::interval_t>,     _group_by)
+    (boost::optional<t_result_format>,    _format)
+)
+BOOST_FUSION_ADAPT_STRUCT(
+    t_tuple_aggregate_expr,
+    (t_tuple_aggregate_func, _func)
+    (t_tuple_field_getter,   _field)
 )
 BOOST_FUSION_ADAPT_STRUCT(
     statement_show_policy,
@@ -68,12 +92,16 @@ private:
   qi::rule < Iterator, std::string(), ascii::space_type >      _start;
 
 public:
-  metric_name_grammar(bool enable_upper_case):
+  metric_name_grammar(bool enable_upper_case, bool enable_wildcards = false):
     base_type(_start, "metric name")
   {
     // rule definitions
-    if(enable_upper_case) {
+    if(enable_upper_case && enable_wildcards) {
+        _start %= +qi::char_("a-zA-Z0-9._*-");
+    } else if(enable_upper_case) {
         _start %= +qi::char_("a-zA-Z0-9._-");
+    } else if(enable_wildcards) {
+        _start %= +qi::char_("a-z0-9._*-");
     } else {
         _start %= +qi::char_("a-z0-9._-");
     }
@@ -103,9 +131,9 @@ private:
   qi::rule < Iterator, std::string(), ascii::space_type >      _start;
 
 public:
-  metric_quoted_name_grammar(bool enable_upper_case):
+  metric_quoted_name_grammar(bool enable_upper_case, bool enable_wildcards = false):
     base_type(_start, "quoted metric name"),
-    _name(enable_upper_case)
+    _name(enable_upper_case, enable_wildcards)
   {
     // rule definitions
     _start %=
@@ -165,6 +193,59 @@ public:
 }; // select_result_grammar
 
 
+//
+// SELECT aggregate field (e.g. "sum(avg)", "max(max)", etc.)
+//
+template<typename Iterator>
+class select_aggregate_result_grammar:
+    public qi::grammar < Iterator, t_tuple_aggregate_list(), ascii::space_type >
+{
+  typedef qi::grammar < Iterator, t_tuple_aggregate_list(), ascii::space_type > base_type;
+
+private:
+  qi::rule < Iterator, t_tuple_aggregate_func(), ascii::space_type >  _func;
+  qi::rule < Iterator, t_tuple_field_getter(), ascii::space_type >    _field;
+  qi::rule < Iterator, t_tuple_aggregate_expr(), ascii::space_type >  _expr;
+  qi::rule < Iterator, t_tuple_aggregate_list(), ascii::space_type >  _start;
+
+public:
+  select_aggregate_result_grammar():
+    base_type(_start, "select aggregate result")
+  {
+    // rule definitions
+    _func =
+        (nocaselit("sum")    [ qi::_val = Aggregate_Sum ]) |
+        (nocaselit("avg")    [ qi::_val = Aggregate_Avg ]) |
+        (nocaselit("min")    [ qi::_val = Aggregate_Min ]) |
+        (nocaselit("max")    [ qi::_val = Aggregate_Max ]) |
+        (nocaselit("count")  [ qi::_val = Aggregate_Count ])
+    ;
+    _field =
+        (nocaselit("min")    [ qi::_val = &rrdb_metric_tuple_get_min ]) |
+        (nocaselit("max")    [ qi::_val = &rrdb_metric_tuple_get_max ]) |
+        (nocaselit("sum")    [ qi::_val = &rrdb_metric_tuple_get_sum ]) |
+        (nocaselit("avg")    [ qi::_val = &rrdb_metric_tuple_get_avg ]) |
+        (nocaselit("count")  [ qi::_val = &rrdb_metric_tuple_get_count ]) |
+        (nocaselit("stddev") [ qi::_val = &rrdb_metric_tuple_get_stddev ])
+    ;
+    // no expectations before "(" so we can fall back to the regular select fields
+    _expr %= _func >> nocaselit("(") > _field > nocaselit(")");
+    _start %= _expr % nocaselit(",");
+
+    // rule names
+    _func.name("aggregate function");
+    _field.name("aggregate field");
+    _expr.name("aggregate expression");
+    _start.name("select aggregate result");
+
+    // errors
+    qi::on_error<qi::fail> (
+        _start,
+        grammar_error_handler(qi::_1, qi::_2, qi::_3, qi::_4)
+    );
+  }
+}; // select_aggregate_result_grammar
+
 //
 // Main - statements
 //
@@ -180,28 +261,38 @@ private:
   t_retention_policy_grammar<Iterator>                         _policy;
   interval_grammar< Iterator >                                 _interval;
   select_result_grammar< Iterator >                            _select_result;
+  select_aggregate_result_grammar< Iterator >                  _select_aggregate_result;
 
   qi::rule < Iterator, statement_create(),       ascii::space_type > _statement_create;
   qi::rule < Iterator, statement_drop(),         ascii::space_type > _statement_drop;
   qi::rule < Iterator, statement_update(),       ascii::space_type > _statement_update;
   qi::rule < Iterator, statement_select(),       ascii::space_type > _statement_select;
+  qi::rule < Iterator, statement_select_metrics(), ascii::space_type > _statement_select_metrics;
+  qi::rule < Iterator, statement_select_aggregate(), ascii::space_type > _statement_select_aggregate;
   qi::rule < Iterator, statement_show_policy(),  ascii::space_type > _statement_show_policy;
   qi::rule < Iterator, statement_show_metrics(), ascii::space_type > _statement_show_metrics;
   qi::rule < Iterator, statement_show_status(),  ascii::space_type > _statement_show_status;
   qi::rule < Iterator, t_statement(),            ascii::space_type > _statement;
 
+  qi::rule < Iterator, t_result_format(), ascii::space_type >  _result_format;
+
   qi::rule < Iterator, t_statement(), ascii::space_type >      _start;
 
 public:
   statement_grammar():
     base_type(_start),
     _quoted_name(true), // enable upper case in metric names
-    _quoted_like(true)  // enable upper case in metric names
+    _quoted_like(true, true)  // enable upper case and wildcards in metric names
   {
     // there is a bug in boost with handling single member structures:
     // http://stackoverflow.com/questions/7770791/spirit-unable-to-assign-attribute-to-single-element-struct-or-fusion-sequence
 
     // rule definitions
+    _result_format =
+        (nocaselit("csv")    [ qi::_val = Format_Csv ]) |
+        (nocaselit("binary") [ qi::_val = Format_Binary ])
+    ;
+
     _statement_update %=
         nocaselit("update") > -nocaselit("metric")
         > _quoted_name
@@ -215,6 +306,28 @@ public:
         > nocaselit("from") > -nocaselit("metric") > _quoted_name
         > nocaselit("between") > qi::ulong_ > nocaselit("and") > qi::ulong_
         > -(nocaselit("group") > nocaselit("by") > _interval)
+        > -(nocaselit("format") > _result_format)
+     ;
+
+    _statement_select_aggregate %=
+        nocaselit("select")
+        >> _select_aggregate_result
+        >> nocaselit("from") > nocaselit("metrics")
+        > nocaselit("like") > _quoted_like
+        > nocaselit("between") > qi::ulong_ > nocaselit("and") > qi::ulong_
+        > -(nocaselit("group") > nocaselit("by") > _interval)
+        > -(nocaselit("format") > _result_format)
+     ;
+
+    // no expectations before "metrics" so we can fall back to the single metric select
+    _statement_select_metrics %=
+        nocaselit("select")
+        >> _select_result
+        >> nocaselit("from") >> nocaselit("metrics")
+        > nocaselit("like") > _quoted_like
+        > nocaselit("between") > qi::ulong_ > nocaselit("and") > qi::ulong_
+        > -(nocaselit("group") > nocaselit("by") > _interval)
+        > -(nocaselit("format") > _result_format)
      ;
 
      _statement_create %=
@@ -245,7 +358,7 @@ public:
     _statement_show_metrics %=
         (
             nocaselit("show") >> nocaselit("metrics")
-            > -(nocaselit("like") > _quoted_name)
+            > -(nocaselit("like") > _quoted_like)
         )
         >> boost::spirit::eps
     ;
@@ -253,7 +366,7 @@ public:
     _statement_show_status %=
         (
             nocaselit("show") >> nocaselit("status")
-            > -(nocaselit("like") > _quoted_name)
+            > -(nocaselit("like") > _quoted_like)
         )
         >> boost::spirit::eps
     ;
@@ -266,6 +379,8 @@ public:
             _statement_create |
             _statement_drop   |
             _statement_update |
+            _statement_select_aggregate |
+            _statement_select_metrics |
             _statement_select |
             _statement_show_policy   |
             _statement_show_metrics  |
@@ -282,11 +397,15 @@ public:
    _policy.name("retention policy");
    _interval.name("interval");
    _select_result.name("select result");
+   _select_aggregate_result.name("select aggregate result");
+   _result_format.name("result format");
 
    _statement_create.name("'create metric' statement");
    _statement_drop.name("'drop metric' statement");
    _statement_update.name("'update metric' statement");
    _statement_select.name("'select' statement");
+   _statement_select_metrics.name("'select from metrics' statement");
+   _statement_select_aggregate.name("'select aggregate from metrics' statement");
    _statement_show_policy.name("'show policy' statement");
    _statement_show_metrics.name("'show metrics' statement");
    _statement_show_status.name("'show status' statement");
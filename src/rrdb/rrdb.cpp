@@ -6,9 +6,16 @@
  */
 
 #include <sstream>
+#include <map>
+#include <queue>
+#include <algorithm>
 
 #include <boost/thread/locks.hpp>
 #include <boost/foreach.hpp>
+#include <boost/atomic.hpp>
+#include <boost/algorithm/string.hpp>
+#include <boost/functional/hash.hpp>
+#include <boost/static_assert.hpp>
 
 
 #include "rrdb/rrdb.h"
@@ -16,6 +23,8 @@
 #include "rrdb/rrdb_files_cache.h"
 #include "rrdb/rrdb_journal_file.h"
 #include "rrdb/rrdb_metric_tuples_cache.h"
+#include "rrdb/rrdb_metric_tuples_aggregate.h"
+#include "rrdb/rrdb_results_cache.h"
 
 #include "parser/interval.h"
 #include "parser/statements.h"
@@ -23,6 +32,9 @@
 #include "server/server.h"
 
 #include "common/config.h"
+#include "common/thread_pool.h"
+#include "common/self_metrics.h"
+#include "common/text_buffer.h"
 #include "common/log.h"
 #include "common/exception.h"
 
@@ -97,6 +109,175 @@ class statement_execute_visitor : public boost::static_visitor<void>
      my::time_t                 _value_ts;
    }; // class metrics_walker_show_status
 
+  //
+  // Writes out tuples selected by the walkers
+  //
+  class tuple_writer
+  {
+  public:
+    virtual void write(const t_rrdb_metric_tuple & tuple) = 0;
+    virtual void flush() = 0;
+  }; // class tuple_writer
+
+  //
+  // CSV output optionally prefixed with the metric name: rows are formatted
+  // in the text buffer and moved to the stream in large chunks
+  //
+  class tuple_writer_csv :
+      public tuple_writer
+  {
+    enum {
+      Flush_Size = 64 * 1024
+    };
+
+  public:
+    tuple_writer_csv(const t_tuple_column_list & columns, t_memory_buffer & res, const std::string * name = NULL) :
+      _columns(columns),
+      _res(res),
+      _name(name),
+      _buf(Flush_Size + 1024)
+    {
+    }
+
+    virtual ~tuple_writer_csv()
+    {
+    }
+
+  public:
+    // tuple_writer
+    void write(const t_rrdb_metric_tuple & tuple)
+    {
+      if(_name) {
+          _buf.append(*_name).append(',');
+      }
+      rrdb_metric_tuple_write_csv_tuple(_columns, tuple, _buf);
+      if(_buf.size() >= Flush_Size) {
+          _buf.write_to(_res);
+      }
+    }
+
+    void flush()
+    {
+      _buf.write_to(_res);
+    }
+
+  private:
+    const t_tuple_column_list & _columns;
+    mutable t_memory_buffer &   _res;
+    const std::string *         _name;
+    text_buffer                 _buf;
+  }; // class tuple_writer_csv
+
+  //
+  // Binary output optionally prefixed with the metric index
+  //
+  class tuple_writer_binary :
+      public tuple_writer
+  {
+  public:
+    tuple_writer_binary(const t_tuple_column_list & columns, t_memory_buffer & res, const my::size_t * metric_idx = NULL) :
+      _columns(columns),
+      _res(res),
+      _metric_idx(metric_idx)
+    {
+    }
+
+    virtual ~tuple_writer_binary()
+    {
+    }
+
+  public:
+    // tuple_writer
+    void write(const t_rrdb_metric_tuple & tuple)
+    {
+      rrdb_metric_tuple_write_binary_tuple(_columns, tuple, _metric_idx, _res);
+    }
+
+    void flush()
+    {
+      // do nothing - we write immediately
+    }
+
+  private:
+    const t_tuple_column_list & _columns;
+    mutable t_memory_buffer &   _res;
+    const my::size_t *          _metric_idx;
+  }; // class tuple_writer_binary
+
+  //
+  // Collects tuples in memory (newest first)
+  //
+  class tuple_writer_collect :
+      public tuple_writer
+  {
+  public:
+    tuple_writer_collect(std::vector<t_rrdb_metric_tuple> & tuples) :
+      _tuples(tuples)
+    {
+    }
+
+    virtual ~tuple_writer_collect()
+    {
+    }
+
+  public:
+    // tuple_writer
+    void write(const t_rrdb_metric_tuple & tuple)
+    {
+      _tuples.push_back(tuple);
+    }
+
+    void flush()
+    {
+      // do nothing
+    }
+
+  private:
+    std::vector<t_rrdb_metric_tuple> & _tuples;
+  }; // class tuple_writer_collect
+
+  //
+  // Writes tuples through and keeps the "group by" buckets that end
+  // before the sealed ts for the results cache
+  //
+  class tuple_writer_sealed :
+      public tuple_writer
+  {
+  public:
+    tuple_writer_sealed(tuple_writer & writer, std::vector<t_rrdb_metric_tuple> & tuples, const statement_select & select, const my::time_t & sealed_ts) :
+      _writer(writer),
+      _tuples(tuples),
+      _select(select),
+      _sealed_ts(sealed_ts)
+    {
+    }
+
+    virtual ~tuple_writer_sealed()
+    {
+    }
+
+  public:
+    // tuple_writer
+    void write(const t_rrdb_metric_tuple & tuple)
+    {
+      _writer.write(tuple);
+      if(std::min<my::time_t>(tuple._ts + *_select._group_by, _select._ts_end) <= _sealed_ts) {
+          _tuples.push_back(tuple);
+      }
+    }
+
+    void flush()
+    {
+      _writer.flush();
+    }
+
+  private:
+    tuple_writer &                      _writer;
+    std::vector<t_rrdb_metric_tuple> &  _tuples;
+    const statement_select &            _select;
+    my::time_t                          _sealed_ts;
+  }; // class tuple_writer_sealed
+
   //
   // Walker class for SELECT statement w/o group by
   //
@@ -104,9 +285,9 @@ class statement_execute_visitor : public boost::static_visitor<void>
       public rrdb::data_walker
   {
   public:
-    data_walker_select_no_group_by(const statement_select & select, t_memory_buffer & res) :
+    data_walker_select_no_group_by(const statement_select & select, tuple_writer & writer) :
       _select(select),
-      _res(res),
+      _writer(writer),
       _last_ts(select._ts_end + 1)
     {
     }
@@ -125,7 +306,7 @@ class statement_execute_visitor : public boost::static_visitor<void>
       // but do we want this tuple? we might have lower resolution data in subsequent
       // blocks so we just use our last_ts to figure it out
       if(_select._ts_begin <= tuple._ts && tuple._ts < _last_ts && tuple._count > 0) {
-        rrdb_metric_tuple_write_tuple(_select._result, tuple, _res);
+        _writer.write(tuple);
         _last_ts = tuple._ts;
       }
     }
@@ -137,7 +318,7 @@ class statement_execute_visitor : public boost::static_visitor<void>
 
   private:
     const statement_select  & _select;
-    mutable t_memory_buffer & _res;
+    tuple_writer            & _writer;
     my::time_t                _last_ts;
   }; // class data_walker_select_no_group_by
 
@@ -148,9 +329,9 @@ class statement_execute_visitor : public boost::static_visitor<void>
         public rrdb::data_walker
     {
     public:
-      data_walker_select(const statement_select & select, t_memory_buffer & res) :
+      data_walker_select(const statement_select & select, tuple_writer & writer) :
         _select(select),
-        _res(res),
+        _writer(writer),
         _group_by(*select._group_by),
         _ts(0),
         _ts_beg(0),
@@ -225,11 +406,39 @@ class statement_execute_visitor : public boost::static_visitor<void>
         }
       }
 
+      void append(const t_rrdb_metric_tuples & tuples, const my::size_t & first_pos, const my::size_t & last_pos, const my::interval_t & interval)
+      {
+        CHECK_AND_THROW(last_pos <= first_pos);
+        CHECK_AND_THROW(first_pos < tuples.get_size());
+
+        const my::time_t * ts(tuples.get_ts_column());
+        t_rrdb_metric_tuple tuple;
+        my::size_t pos = first_pos + 1;
+        while(pos > last_pos) {
+            // find the run of tuples fully inside the current "group by"
+            // interval and aggregate them all at once
+            my::size_t run_end = pos;
+            my::time_t upper_bound = _ts;
+            while(run_end > last_pos && _ts_beg <= ts[run_end - 1] && ts[run_end - 1] + interval <= upper_bound) {
+                upper_bound = ts[--run_end];
+            }
+            if(run_end < pos) {
+                rrdb_metric_tuples_aggregate(_cur_tuple, tuples, pos - 1, run_end);
+                _ts = upper_bound;
+                pos = run_end;
+                continue;
+            }
+
+            // partial overlap or the next "group by" interval
+            tuples.get(--pos, tuple);
+            this->append(tuple, interval);
+        }
+      }
+
       virtual void flush()
       {
         if(_cur_tuple._count > 0) {
-            rrdb_metric_tuple_write_tuple(_select._result, _cur_tuple, _res);
-            _res << std::endl;
+            _writer.write(_cur_tuple);
         }
       }
 
@@ -248,7 +457,7 @@ class statement_execute_visitor : public boost::static_visitor<void>
 
     private:
       const statement_select  & _select;
-      mutable t_memory_buffer & _res;
+      tuple_writer            & _writer;
       const my::interval_t      _group_by;
 
       t_rrdb_metric_tuple       _cur_tuple;
@@ -258,6 +467,274 @@ class statement_execute_visitor : public boost::static_visitor<void>
     }; // class data_walker
 
 
+  //
+  // SELECT from one metric: the "group by" buckets that can't change
+  // anymore come from the results cache and only the newer buckets
+  // are computed
+  //
+  static void select_from_metric(rrdb & rrdb, const statement_select & st, const boost::intrusive_ptr<rrdb_metric> & metric, tuple_writer & writer)
+  {
+    const boost::shared_ptr<rrdb_results_cache> & results_cache(rrdb.get_results_cache());
+    if(!st._group_by || !(*st._group_by)) {
+        data_walker_select_no_group_by walker(st, writer);
+        rrdb.select_from_metric(metric, st._ts_begin, st._ts_end, walker);
+        return;
+    }
+    if(!results_cache->is_enabled()) {
+        data_walker_select walker(st, writer);
+        rrdb.select_from_metric(metric, st._ts_begin, st._ts_end, walker, *st._group_by);
+        return;
+    }
+
+    // the buckets are [ts_begin + N * group_by, ts_begin + (N + 1) * group_by),
+    // find the ones that end before the metric's current slot
+    my::interval_t group_by(*st._group_by);
+    my::size_t version;
+    my::time_t sealed_ts = metric->get_sealed_ts(version);
+    if(sealed_ts >= st._ts_end) {
+        sealed_ts = st._ts_end;
+    } else if(sealed_ts > st._ts_begin) {
+        sealed_ts -= (sealed_ts - st._ts_begin) % group_by;
+    } else {
+        sealed_ts = st._ts_begin;
+    }
+
+    // compute the buckets newer than the cached ones
+    std::string name(metric->get_name());
+    rrdb_results_cache::t_entry_ptr cached(results_cache->find(name, st._ts_begin, st._ts_end, group_by, version));
+    boost::shared_ptr<rrdb_results_cache::t_entry> entry(new rrdb_results_cache::t_entry());
+    entry->_version   = version;
+    entry->_sealed_ts = sealed_ts;
+
+    statement_select select(st);
+    if(cached) {
+        select._ts_begin = cached->_sealed_ts;
+    }
+    if(select._ts_begin < select._ts_end) {
+        tuple_writer_sealed writer_sealed(writer, entry->_tuples, select, sealed_ts);
+        data_walker_select walker(select, writer_sealed);
+        rrdb.select_from_metric(metric, select._ts_begin, select._ts_end, walker, group_by);
+    }
+
+    // the rest is cached
+    if(cached) {
+        BOOST_FOREACH(const t_rrdb_metric_tuple & tuple, cached->_tuples) {
+          writer.write(tuple);
+        }
+        if(cached->_sealed_ts >= sealed_ts) {
+            return;
+        }
+        entry->_tuples.insert(entry->_tuples.end(), cached->_tuples.begin(), cached->_tuples.end());
+    }
+    results_cache->insert(name, st._ts_begin, st._ts_end, group_by, entry);
+  }
+
+  //
+  // Walker class to collect metrics for SELECT FROM METRICS statement (sorted by name)
+  //
+  class metrics_walker_collect :
+       public rrdb::metrics_walker
+  {
+  public:
+    typedef std::map<std::string, boost::intrusive_ptr<rrdb_metric> > t_metrics;
+
+  public:
+    metrics_walker_collect()
+    {
+    }
+
+    virtual ~metrics_walker_collect()
+    {
+    }
+
+  public:
+    //rrdb::metrics_walker
+    void on_metric(const std::string & name, const boost::intrusive_ptr<rrdb_metric> & metric)
+    {
+      _metrics[name] = metric;
+    }
+
+  public:
+    t_metrics _metrics;
+  }; // class metrics_walker_collect
+
+  //
+  // Task for SELECT FROM METRICS statements: the calling thread and the
+  // select threads pick up metrics one by one until all are done so the
+  // query doesn't stall if the select threads are busy. The results are
+  // either CSV per metric or the tuples for cross-metric aggregation
+  //
+  class select_metrics_task :
+      public thread_pool_task
+  {
+  public:
+    select_metrics_task(rrdb & rrdb, const statement_select & select, const metrics_walker_collect::t_metrics & metrics, bool collect_tuples) :
+      _rrdb(rrdb),
+      _select(select),
+      _collect_tuples(collect_tuples),
+      _next(0),
+      _finished(0)
+    {
+      _names.reserve(metrics.size());
+      _metrics.reserve(metrics.size());
+      BOOST_FOREACH(const metrics_walker_collect::t_metrics::value_type & v, metrics) {
+        _names.push_back(v.first);
+        _metrics.push_back(v.second);
+      }
+      if(_collect_tuples) {
+          _tuples.resize(metrics.size());
+      } else {
+          _outputs.resize(metrics.size());
+      }
+      rrdb_metric_tuple_get_columns(_select._result, _columns);
+    }
+
+    virtual ~select_metrics_task()
+    {
+    }
+
+  public:
+    // thread_pool_task
+    void run()
+    {
+      for(my::size_t ii = _next.fetch_add(1); ii < _metrics.size(); ii = _next.fetch_add(1)) {
+          try {
+              this->select(ii);
+          } catch(const std::exception & e) {
+              boost::lock_guard<boost::mutex> guard(_mutex);
+              if(_error.empty()) {
+                  _error = e.what();
+              }
+          }
+
+          boost::lock_guard<boost::mutex> guard(_mutex);
+          if(++_finished == _metrics.size()) {
+              _cond.notify_all();
+          }
+      }
+    }
+
+  public:
+    const std::vector<std::string> & get_names() const
+    {
+      return _names;
+    }
+
+    const t_tuple_column_list & get_columns() const
+    {
+      return _columns;
+    }
+
+    void wait()
+    {
+      boost::unique_lock<boost::mutex> lock(_mutex);
+      while(_finished < _metrics.size()) {
+          _cond.wait(lock);
+      }
+      if(!_error.empty()) {
+          throw exception("%s", _error.c_str());
+      }
+    }
+
+    void write(t_memory_buffer & res)
+    {
+      CHECK_AND_THROW(!_collect_tuples);
+
+      BOOST_FOREACH(const t_memory_buffer_data & output, _outputs) {
+        if(!output.empty()) {
+            res.write(&(output[0]), output.size());
+        }
+      }
+      res.flush();
+    }
+
+    void write_aggregate(const t_tuple_aggregate_list & expr_list, t_memory_buffer & res)
+    {
+      CHECK_AND_THROW(_collect_tuples);
+
+      // k-way merge of the per metric tuples (newest first): all the
+      // tuples with the same ts are aggregated in one row
+      typedef std::pair<my::time_t, my::size_t> t_merge_head; // (ts, metric index)
+      std::priority_queue<t_merge_head> heads;
+      std::vector<my::size_t> pos(_tuples.size(), 0);
+      for(my::size_t ii = 0; ii < _tuples.size(); ++ii) {
+          if(!_tuples[ii].empty()) {
+              heads.push(t_merge_head(_tuples[ii][0]._ts, ii));
+          }
+      }
+
+      std::vector<my::value_t> values(expr_list.size(), 0);
+      text_buffer buf;
+      while(!heads.empty()) {
+          my::time_t ts = heads.top().first;
+          my::size_t num = 0;
+          while(!heads.empty() && heads.top().first == ts) {
+              my::size_t ii = heads.top().second;
+              heads.pop();
+
+              rrdb_metric_tuple_aggregate_update(expr_list, _tuples[ii][pos[ii]], num++, values);
+              if(++pos[ii] < _tuples[ii].size()) {
+                  heads.push(t_merge_head(_tuples[ii][pos[ii]]._ts, ii));
+              }
+          }
+          if(_select._format == Format_Binary) {
+              rrdb_metric_tuple_write_binary_aggregate(expr_list, ts, values, num, res);
+          } else {
+              rrdb_metric_tuple_write_aggregate(expr_list, ts, values, num, buf);
+              if(buf.size() >= 64 * 1024) {
+                  buf.write_to(res);
+              }
+          }
+      }
+      buf.write_to(res);
+      res.flush();
+    }
+
+  private:
+    void select(const my::size_t & ii)
+    {
+      statement_select st(_select);
+      st._name = _names[ii];
+
+      if(_collect_tuples) {
+          tuple_writer_collect writer(_tuples[ii]);
+          this->select(st, _metrics[ii], writer);
+      } else {
+          t_memory_buffer res(_outputs[ii]);
+          if(st._format == Format_Binary) {
+              tuple_writer_binary writer(_columns, res, &ii);
+              this->select(st, _metrics[ii], writer);
+          } else {
+              tuple_writer_csv writer(_columns, res, &(_names[ii]));
+              this->select(st, _metrics[ii], writer);
+          }
+          res.flush();
+      }
+    }
+
+    void select(const statement_select & st, const boost::intrusive_ptr<rrdb_metric> & metric, tuple_writer & writer)
+    {
+      statement_execute_visitor::select_from_metric(_rrdb, st, metric, writer);
+      writer.flush();
+    }
+
+  private:
+    rrdb &                            _rrdb;
+    statement_select                  _select;
+    bool                              _collect_tuples;
+    std::vector<std::string>          _names;
+    rrdb::t_metrics_vector            _metrics;
+    t_tuple_column_list               _columns;
+    std::vector<t_memory_buffer_data> _outputs;
+    std::vector< std::vector<t_rrdb_metric_tuple> > _tuples;
+
+    boost::atomic<my::size_t>         _next;
+    my::size_t                        _finished;
+    std::string                       _error;
+    boost::mutex                      _mutex;
+    boost::condition_variable         _cond;
+  }; // class select_metrics_task
+
 public:
   statement_execute_visitor(rrdb & rrdb, t_memory_buffer & res) :
       _rrdb(rrdb),
@@ -288,19 +765,91 @@ public:
   void operator()(const statement_select & st) const
   {
     // write header
-    rrdb_metric_tuple_write_header(st._result, _res);
+    t_tuple_column_list columns;
+    rrdb_metric_tuple_get_columns(st._result, columns);
+    if(st._format == Format_Binary) {
+        rrdb_metric_tuple_write_binary_header(std::vector<std::string>(), columns, _res);
+    } else {
+        text_buffer buf;
+        rrdb_metric_tuple_write_csv_header(columns, buf);
+        buf.write_to(_res);
+    }
+    // send the header right away if we are streaming
+    _res.flush();
 
     if(st._ts_begin < st._ts_end) {
-      if(st._group_by && (*st._group_by)) {
-          // hard case
-          data_walker_select walker(st, _res);
-          _rrdb.select_from_metric(st._name, st._ts_begin, st._ts_end, walker);
-      } else {
-          // simple case
-          data_walker_select_no_group_by walker(st, _res);
-          _rrdb.select_from_metric(st._name, st._ts_begin, st._ts_end, walker);
+      tuple_writer_csv    writer_csv(columns, _res);
+      tuple_writer_binary writer_binary(columns, _res);
+      tuple_writer & writer(st._format == Format_Binary ?
+          static_cast<tuple_writer&>(writer_binary) :
+          static_cast<tuple_writer&>(writer_csv)
+      );
+      boost::intrusive_ptr<rrdb_metric> metric = _rrdb.find_metric(st._name);
+      if(!metric) {
+          throw exception("The metric '%s' does not exist", st._name.c_str());
       }
+      statement_execute_visitor::select_from_metric(_rrdb, st, metric, writer);
+      writer.flush();
     }
+    _res.flush();
+  }
+
+  void operator()(const statement_select_metrics & st) const
+  {
+    boost::intrusive_ptr<select_metrics_task> task;
+    if(st._ts_begin < st._ts_end) {
+        statement_select select;
+        select._result   = st._result;
+        select._ts_begin = st._ts_begin;
+        select._ts_end   = st._ts_end;
+        select._group_by = st._group_by;
+        select._format   = st._format;
+
+        task = this->select_metrics(st._like, select, false);
+    }
+
+    // write header: binary format needs the metric names upfront
+    t_tuple_column_list columns;
+    rrdb_metric_tuple_get_columns(st._result, columns);
+    if(st._format == Format_Binary) {
+        rrdb_metric_tuple_write_binary_header(task ? task->get_names() : std::vector<std::string>(), columns, _res);
+    } else {
+        text_buffer buf;
+        buf.append("metric,", 7);
+        rrdb_metric_tuple_write_csv_header(columns, buf);
+        buf.write_to(_res);
+    }
+
+    if(task) {
+        task->write(_res);
+    }
+    _res.flush();
+  }
+
+  void operator()(const statement_select_aggregate & st) const
+  {
+    // write header
+    if(st._format == Format_Binary) {
+        rrdb_metric_tuple_write_binary_header(st._result, _res);
+    } else {
+        text_buffer buf;
+        rrdb_metric_tuple_write_aggregate_header(st._result, buf);
+        buf.write_to(_res);
+    }
+
+    if(st._ts_begin < st._ts_end) {
+        statement_select select;
+        select._ts_begin = st._ts_begin;
+        select._ts_end   = st._ts_end;
+        select._group_by = st._group_by;
+        select._format   = st._format;
+
+        boost::intrusive_ptr<select_metrics_task> task(this->select_metrics(st._like, select, true));
+        if(task) {
+            task->write_aggregate(st._result, _res);
+        }
+    }
+    _res.flush();
   }
 
   void operator()(const statement_show_policy & st) const
@@ -323,22 +872,169 @@ public:
 
   }
 
+private:
+  boost::intrusive_ptr<select_metrics_task> select_metrics(const std::string & like, const statement_select & select, bool collect_tuples) const
+  {
+    metrics_walker_collect collect;
+    _rrdb.get_metrics(like, collect);
+    if(collect._metrics.empty()) {
+        return boost::intrusive_ptr<select_metrics_task>();
+    }
+
+    boost::intrusive_ptr<select_metrics_task> task(new select_metrics_task(_rrdb, select, collect._metrics, collect_tuples));
+    _rrdb.execute_in_parallel(task, collect._metrics.size());
+    task->wait();
+    return task;
+  }
+
 private:
   mutable rrdb & _rrdb;
   mutable t_memory_buffer & _res;
 };
 // statement_execute_visitor
 
+//
+// Estimates the statement cost: the metadata statements and updates are
+// cheap, selects cost as many tuples as they walk through
+//
+class statement_cost_visitor : public boost::static_visitor<my::size_t>
+{
+  //
+  // Sums up the costs for SELECT FROM METRICS statement
+  //
+  class metrics_walker_cost :
+       public rrdb::metrics_walker
+  {
+  public:
+    metrics_walker_cost(const my::time_t & ts1, const my::time_t & ts2) :
+      _ts1(ts1),
+      _ts2(ts2),
+      _cost(0)
+    {
+    }
+
+    virtual ~metrics_walker_cost()
+    {
+    }
+
+  public:
+    //rrdb::metrics_walker
+    void on_metric(const std::string & name, const boost::intrusive_ptr<rrdb_metric> & metric)
+    {
+      _cost += metric->get_select_cost(_ts1, _ts2);
+    }
+
+  public:
+    my::time_t _ts1;
+    my::time_t _ts2;
+    my::size_t _cost;
+  }; // class metrics_walker_cost
+
+public:
+  statement_cost_visitor(rrdb & rrdb) :
+      _rrdb(rrdb)
+  {
+  }
+
+public:
+  template<typename T>
+  my::size_t operator()(const T & st) const
+  {
+    return 0;
+  }
+
+  my::size_t operator()(const statement_select & st) const
+  {
+    boost::intrusive_ptr<rrdb_metric> metric = _rrdb.find_metric(st._name);
+    return metric ? metric->get_select_cost(st._ts_begin, st._ts_end) : 0;
+  }
+
+  my::size_t operator()(const statement_select_metrics & st) const
+  {
+    return this->get_metrics_cost(st._like, st._ts_begin, st._ts_end);
+  }
+
+  my::size_t operator()(const statement_select_aggregate & st) const
+  {
+    return this->get_metrics_cost(st._like, st._ts_begin, st._ts_end);
+  }
+
+private:
+  my::size_t get_metrics_cost(const std::string & like, const my::time_t & ts1, const my::time_t & ts2) const
+  {
+    metrics_walker_cost walker(ts1, ts2);
+    _rrdb.get_metrics(like, walker);
+    return walker._cost;
+  }
+
+private:
+  mutable rrdb & _rrdb;
+};
+// statement_cost_visitor
+
+// the statement names for the self.statements.* metrics in the t_statement order
+static const char * rrdb_statement_names[] = {
+    "create",
+    "drop",
+    "update",
+    "select",
+    "select_metrics",
+    "select_aggregate",
+    "show_policy",
+    "show_metrics",
+    "show_status"
+};
+BOOST_STATIC_ASSERT(sizeof(rrdb_statement_names) / sizeof(rrdb_statement_names[0]) == boost::mpl::size<t_statement::types>::value);
+
+//
+// Update for one metric executed on the metric's shard thread
+//
+class update_shard_task :
+    public thread_pool_task
+{
+public:
+  update_shard_task(rrdb & rrdb, const std::string & name, const my::time_t & ts, const my::value_t & value) :
+    _rrdb(rrdb),
+    _name(name),
+    _ts(ts),
+    _value(value)
+  {
+  }
+
+  virtual ~update_shard_task()
+  {
+  }
+
+public:
+  // thread_pool_task
+  void run()
+  {
+    _rrdb.update_metric(_name, _ts, _value);
+  }
+
+private:
+  rrdb &          _rrdb;
+  std::string     _name;
+  my::time_t      _ts;
+  my::value_t     _value;
+}; // class update_shard_task
+
 //
 //
 //
 rrdb::rrdb() :
   _flush_interval(interval_parse("1 min")),
-  _default_policy(retention_policy_parse("1 min FOR 1 day"))
+  _default_policy(retention_policy_parse("1 min FOR 1 day")),
+  _hot_set_size(10000),
+  _select_thread_pool_size(4),
+  _update_shards_num(0),
+  _update_shard_queue_size(10000),
+  _metrics_lock("metrics")
 {
   _files_cache.reset(new rrdb_files_cache());
   _tuples_cache.reset(new rrdb_metric_tuples_cache(_files_cache));
   _journal_file.reset(new rrdb_journal_file(_files_cache));
+  _results_cache.reset(new rrdb_results_cache());
 }
 
 rrdb::~rrdb()
@@ -354,10 +1050,35 @@ void rrdb::initialize(boost::shared_ptr<config> config)
   _default_policy = retention_policy_parse(
       config->get<std::string>("rrdb.default_policy", retention_policy_write(_default_policy))
   );
+  _rollups.clear();
+  std::string rollups = config->get<std::string>("rrdb.rollups", std::string());
+  if(!boost::algorithm::trim_copy(rollups).empty()) {
+      std::vector<std::string> intervals;
+      boost::algorithm::split(intervals, rollups, boost::algorithm::is_any_of(","));
+      BOOST_FOREACH(const std::string & interval, intervals) {
+        _rollups.push_back(interval_parse(interval));
+      }
+  }
+  _hot_set_size = config->get<my::size_t>("rrdb.blocks_cache_hot_set_size", _hot_set_size);
+  _select_thread_pool_size = config->get<my::size_t>("rrdb.select_thread_pool_size", _select_thread_pool_size);
+  if(_select_thread_pool_size > 0) {
+      _select_thread_pool.reset(new thread_pool(_select_thread_pool_size));
+  }
+
+  // each metric is always updated by the same single threaded shard
+  _update_shards_num = config->get<my::size_t>("rrdb.update_shards", _update_shards_num);
+  _update_shard_queue_size = config->get<my::size_t>("rrdb.update_shard_queue_size", _update_shard_queue_size);
+  _update_shards.clear();
+  for(my::size_t ii = 0; ii < _update_shards_num; ++ii) {
+      _update_shards.push_back(boost::shared_ptr<thread_pool>(
+          new thread_pool(1, _update_shard_queue_size, thread_pool::Overflow_Block)
+      ));
+  }
 
   LOG(log::LEVEL_DEBUG, "Loading RRDB data files");
   _files_cache->initialize(config);
   _tuples_cache->initialize(config);
+  _results_cache->initialize(config);
   _journal_file->initialize();
 
   LOG(log::LEVEL_INFO, "Loaded RRDB data files");
@@ -374,7 +1095,7 @@ void rrdb::start()
       return;
   }
 
-  LOG(log::LEVEL_INFO, "Starting RRDB server");
+  LOG(log::LEVEL_INFO, "Starting RRDB server (%s aggregation kernels)", rrdb_metric_tuples_aggregate_get_name());
 
   // check if there was a crash
   if(_journal_file->is_journal_file_present()) {
@@ -392,7 +1113,7 @@ void rrdb::start()
   // load metrics from disk - we do it under lock though it doesn't matter
   {
     LOG(log::LEVEL_INFO, "Loading metrics");
-    boost::lock_guard<spinlock> guard(_metrics_lock);
+    boost::lock_guard<named_lock> guard(_metrics_lock);
 
     rrdb_metric::create_directories(_files_cache->get_path());
     rrdb_metric::load_metrics(_files_cache, _files_cache->get_path(), _metrics);
@@ -401,6 +1122,11 @@ void rrdb::start()
   // start flush thread
   _flush_to_disk_thread.reset(new boost::thread(boost::bind(&rrdb::flush_to_disk_thread, this)));
 
+  // warm up blocks cache in the background while we start serving requests
+  if(_hot_set_size > 0) {
+      _warm_up_thread.reset(new boost::thread(boost::bind(&rrdb::warm_up_thread, this)));
+  }
+
   // done
   LOG(log::LEVEL_INFO, "Started RRDB server");
 }
@@ -413,13 +1139,24 @@ void rrdb::stop()
 
   LOG(log::LEVEL_DEBUG, "Stopping RRDB server");
 
+  // stop warm up thread if it is still running
+  if(_warm_up_thread) {
+      _warm_up_thread->interrupt();
+      _warm_up_thread->join();
+      _warm_up_thread.reset();
+  }
+
   // stop flush thread
   _flush_to_disk_thread->interrupt();
   _flush_to_disk_thread->join();
   _flush_to_disk_thread.reset();
 
-  // flush one more time
+  // finish the queued updates
+  this->wait_for_updates();
+
+  // flush one more time and remember what was hot
   this->flush_to_disk();
+  this->save_hot_set();
 
   //
   _files_cache->clear();
@@ -429,20 +1166,52 @@ void rrdb::stop()
 }
 
 
-void rrdb::update_status(const time_t & now)
+void rrdb::update_status(self_metrics & metrics)
 {
-  this->update_metric("self.file_cache.max_size", now,   _files_cache->get_max_size());
-  this->update_metric("self.file_cache.size", now,       _files_cache->get_cache_size());
-  this->update_metric("self.file_cache.hits", now,       _files_cache->get_cache_hits(true));
-  this->update_metric("self.file_cache.misses", now,     _files_cache->get_cache_misses(true));
+  metrics.add("self.file_cache.max_size", _files_cache->get_max_size());
+  metrics.add("self.file_cache.size",     _files_cache->get_cache_size());
+  metrics.add("self.file_cache.hits",     _files_cache->get_cache_hits(true));
+  metrics.add("self.file_cache.misses",   _files_cache->get_cache_misses(true));
+
+  metrics.add("self.blocks_cache.max_used_memory", _tuples_cache->get_max_used_memory());
+  metrics.add("self.blocks_cache.used_memory",     _tuples_cache->get_cache_used_memory());
+  metrics.add("self.blocks_cache.size",            _tuples_cache->get_cache_size());
+  metrics.add("self.blocks_cache.hits",            _tuples_cache->get_cache_hits(true));
+  metrics.add("self.blocks_cache.misses",          _tuples_cache->get_cache_misses(true));
+  metrics.add("self.blocks_cache.coalesced_loads", _tuples_cache->get_coalesced_loads(true));
+  metrics.add("self.results_cache.size",           _results_cache->get_cache_size());
+  metrics.add("self.results_cache.hits",           _results_cache->get_cache_hits(true));
+  metrics.add("self.results_cache.misses",         _results_cache->get_cache_misses(true));
+  if(_select_thread_pool) {
+      metrics.add("self.select.load_factor", _select_thread_pool->get_load_factor());
+  }
+  if(!_update_shards.empty()) {
+      my::size_t queue_size = 0, finished_jobs = 0;
+      BOOST_FOREACH(const boost::shared_ptr<thread_pool> & shard, _update_shards) {
+        queue_size    += shard->get_queue_size();
+        finished_jobs += shard->get_finished_jobs();
+      }
+      metrics.add("self.update_shards.queue_size",        queue_size);
+      metrics.add("self.update_shards.finished_requests", finished_jobs);
+  }
+
+  metrics.add("self.metrics.count", this->get_metrics_num());
+  metrics.add("self.flush_to_disk.time", _flush_time);
 
-  this->update_metric("self.blocks_cache.max_used_memory", now,   _tuples_cache->get_max_used_memory());
-  this->update_metric("self.blocks_cache.used_memory", now,       _tuples_cache->get_cache_used_memory());
-  this->update_metric("self.blocks_cache.size", now,              _tuples_cache->get_cache_size());
-  this->update_metric("self.blocks_cache.hits", now,              _tuples_cache->get_cache_hits(true));
-  this->update_metric("self.blocks_cache.misses", now,            _tuples_cache->get_cache_misses(true));
+  for(my::size_t ii = 0; ii < boost::mpl::size<t_statement::types>::value; ++ii) {
+      metrics.add(std::string("self.statements.") + rrdb_statement_names[ii] + ".time", _statements_time[ii]);
+  }
 
-  this->update_metric("self.metrics.count", now, this->get_metrics_num());
+  // empty unless built with the lock stats
+  std::vector<named_lock::t_stats> locks_stats;
+  named_lock::get_stats(locks_stats, true);
+  BOOST_FOREACH(const named_lock::t_stats & stats, locks_stats) {
+    std::string prefix("self.locks." + stats._name);
+    metrics.add(prefix + ".acquisitions",  stats._acquisitions);
+    metrics.add(prefix + ".contended",     stats._contended);
+    metrics.add(prefix + ".wait_time",     stats._wait_time);
+    metrics.add(prefix + ".max_hold_time", stats._max_hold_time);
+  }
 }
 
 void rrdb::flush_to_disk_thread()
@@ -463,6 +1232,9 @@ void rrdb::flush_to_disk_thread()
           time_t end = time(NULL);
           this->update_metric("self.flush_to_disk.duration", end, (end - start));
 
+          // save the hot set in case we crash
+          this->save_hot_set();
+
 
           boost::this_thread::sleep(boost::posix_time::seconds(this->_flush_interval));
       }
@@ -483,6 +1255,7 @@ void rrdb::flush_to_disk_thread()
 void rrdb::flush_to_disk()
 {
   LOG(log::LEVEL_DEBUG2, "Flushing to disk");
+  latency_histogram::scoped_timer timer(_flush_time);
 
   t_metrics_vector dirty_metrics = this->get_dirty_metrics();
   BOOST_FOREACH(boost::intrusive_ptr<rrdb_metric> metric, dirty_metrics) {
@@ -516,9 +1289,87 @@ void rrdb::flush_to_disk()
   LOG(log::LEVEL_DEBUG2, "Flushed to disk");
 }
 
+void rrdb::save_hot_set()
+{
+  if(_hot_set_size == 0) {
+      return;
+  }
+
+  try {
+      _tuples_cache->save_hot_set(_hot_set_size);
+  } catch(std::exception & e) {
+      LOG(log::LEVEL_ERROR, "Exception saving blocks cache hot set: %s", e.what());
+  } catch(...) {
+      LOG(log::LEVEL_ERROR, "Unknown exception saving blocks cache hot set");
+  }
+}
+
+void rrdb::warm_up_thread()
+{
+  LOG(log::LEVEL_INFO, "RRDB warm up thread started");
+
+  try {
+      this->warm_up_blocks_cache();
+  } catch (boost::thread_interrupted & e) {
+      LOG(log::LEVEL_DEBUG, "RRDB warm up thread was interrupted");
+  } catch (std::exception & e) {
+      LOG(log::LEVEL_ERROR, "RRDB warm up thread exception: %s", e.what());
+  } catch (...) {
+      LOG(log::LEVEL_ERROR, "RRDB warm up thread un-handled exception");
+  }
+
+  LOG(log::LEVEL_INFO, "RRDB warm up thread stopped");
+}
+
+/**
+ * rrdb::warm_up_blocks_cache
+ *
+ * Re-reads the blocks from the saved hot set in the file order until
+ * we are done or the cache is full
+ */
+void rrdb::warm_up_blocks_cache()
+{
+  rrdb_metric_tuples_cache::t_hot_blocks hot_blocks;
+  _tuples_cache->load_hot_set(hot_blocks);
+  if(hot_blocks.empty()) {
+      return;
+  }
+
+  // we need to find metric by filename
+  t_metrics_map metrics_by_filename;
+  {
+    boost::lock_guard<named_lock> guard(_metrics_lock);
+    BOOST_FOREACH(const t_metrics_map::value_type & v, _metrics) {
+      metrics_by_filename[*(v.second->get_filename())] = v.second;
+    }
+  }
+
+  LOG(log::LEVEL_INFO, "Warming up blocks cache: %lu blocks", hot_blocks.size());
+  my::size_t count = 0;
+  BOOST_FOREACH(const rrdb_metric_tuples_cache::t_hot_block & hot_block, hot_blocks) {
+    boost::this_thread::interruption_point();
+    if(_tuples_cache->is_full()) {
+        break;
+    }
+
+    t_metrics_map::const_iterator it = metrics_by_filename.find(*hot_block._filename);
+    if(it == metrics_by_filename.end()) {
+        continue;
+    }
+
+    try {
+        (*it).second->warm_up_block(_tuples_cache, hot_block._offset);
+        ++count;
+    } catch(std::exception & e) {
+        LOG(log::LEVEL_ERROR, "Exception warming up block from '%s': %s", hot_block._filename->c_str(), e.what());
+    }
+  }
+  LOG(log::LEVEL_INFO, "Warmed up blocks cache: %lu blocks", count);
+}
+
 my::size_t rrdb::get_metrics_num() const
 {
-  boost::lock_guard<spinlock> guard(_metrics_lock);
+  boost::lock_guard<named_lock> guard(_metrics_lock);
   return _metrics.size();
 }
 
@@ -529,7 +1380,7 @@ boost::intrusive_ptr<rrdb_metric> rrdb::find_metric(const std::string & name)
 
   // search in the map: lock access to _metrics
   {
-    boost::lock_guard<spinlock> guard(_metrics_lock);
+    boost::lock_guard<named_lock> guard(_metrics_lock);
     t_metrics_map::const_iterator it = _metrics.find(name_normalized);
     if(it != _metrics.end()) {
         return (*it).second;
@@ -560,10 +1411,10 @@ boost::intrusive_ptr<rrdb_metric> rrdb::create_metric(const std::string & name,
 
   // create new and try to insert into map, lock access to _metrics
   boost::intrusive_ptr<rrdb_metric> res(new rrdb_metric());
-  res->create(name_normalized, policy);
+  res->create(name_normalized, policy, _rollups);
   {
     // make sure there is always only one metric for the name
-    boost::lock_guard<spinlock> guard(_metrics_lock);
+    boost::lock_guard<named_lock> guard(_metrics_lock);
     t_metrics_map::const_iterator it = _metrics.find(name_normalized);
     if(it != _metrics.end()) {
         // someone inserted it in the meantime
@@ -596,7 +1447,7 @@ void rrdb::drop_metric(const std::string & name)
   // lock access to _metrics and  try to find the metric
   boost::intrusive_ptr<rrdb_metric> res;
   {
-    boost::lock_guard<spinlock> guard(_metrics_lock);
+    boost::lock_guard<named_lock> guard(_metrics_lock);
     t_metrics_map::const_iterator it = _metrics.find(name_normalized);
     if(it == _metrics.end()) {
         throw exception("The metric '%s' does not exist", name.c_str());
@@ -623,9 +1474,9 @@ void rrdb::get_metrics(const boost::optional<std::string> & like, metrics_walker
 
   // lock access to _metrics
   {
-    boost::lock_guard<spinlock> guard(_metrics_lock);
+    boost::lock_guard<named_lock> guard(_metrics_lock);
     BOOST_FOREACH(const t_metrics_map::value_type & v, _metrics) {
-      if(like_normalized && v.first.find(*like_normalized) == std::string::npos) {
+      if(like_normalized && !rrdb_metric::match_name(*like_normalized, v.first)) {
           continue;
       }
       walker.on_metric(v.first, v.second);
@@ -643,13 +1494,13 @@ void rrdb::get_status_metrics(const boost::optional<std::string> & like, metrics
 
   // lock access to _metrics
   {
-    boost::lock_guard<spinlock> guard(_metrics_lock);
+    boost::lock_guard<named_lock> guard(_metrics_lock);
     BOOST_FOREACH(const t_metrics_map::value_type & v, _metrics) {
       // should start with "self."
       if(v.first.find("self.") != 0) {
           continue;
       }
-      if(like_normalized && v.first.find(*like_normalized) == std::string::npos) {
+      if(like_normalized && !rrdb_metric::match_name(*like_normalized, v.first)) {
           continue;
       }
       walker.on_metric(v.first, v.second);
@@ -662,7 +1513,7 @@ rrdb::t_metrics_vector rrdb::get_dirty_metrics()
   // lock access to _metrics
   rrdb::t_metrics_vector res;
   {
-    boost::lock_guard<spinlock> guard(_metrics_lock);
+    boost::lock_guard<named_lock> guard(_metrics_lock);
     BOOST_FOREACH(t_metrics_map::value_type & v, _metrics){
       if(v.second->is_dirty()) {
         res.push_back(v.second);
@@ -685,14 +1536,48 @@ void rrdb::update_metric(const std::string & name, const my::time_t & ts, const
   metric->update(_tuples_cache, ts, value);
 }
 
-void rrdb::select_from_metric(const std::string & name, const my::time_t & ts1, const my::time_t & ts2, data_walker & walker)
+void rrdb::select_from_metric(const boost::intrusive_ptr<rrdb_metric> & metric, const my::time_t & ts1, const my::time_t & ts2, data_walker & walker, const my::interval_t & group_by)
+{
+  CHECK_AND_THROW(metric);
+  metric->select(_tuples_cache, ts1, ts2, walker, group_by);
+}
+
+void rrdb::execute_in_parallel(const boost::intrusive_ptr<thread_pool_task> & task, const my::size_t & concurrency)
+{
+  // the calling thread always participates
+  if(_select_thread_pool) {
+      for(my::size_t ii = 1; ii < std::min(concurrency, _select_thread_pool_size + 1); ++ii) {
+          _select_thread_pool->run(task);
+      }
+  }
+  task->run();
+}
+
+/**
+ * rrdb::data_walker::append
+ *
+ * Default implementation simply walks the tuples one by one
+ */
+void rrdb::data_walker::append(const t_rrdb_metric_tuples & tuples, const my::size_t & first_pos, const my::size_t & last_pos, const my::interval_t & interval)
+{
+  CHECK_AND_THROW(last_pos <= first_pos);
+  CHECK_AND_THROW(first_pos < tuples.get_size());
+
+  t_rrdb_metric_tuple tuple;
+  for(my::size_t pos = first_pos + 1; pos-- > last_pos; ) {
+      tuples.get(pos, tuple);
+      this->append(tuple, interval);
+  }
+}
+
+void rrdb::select_from_metric(const std::string & name, const my::time_t & ts1, const my::time_t & ts2, data_walker & walker, const my::interval_t & group_by)
 {
   boost::intrusive_ptr<rrdb_metric> metric = this->find_metric(name);
   if(!metric) {
       throw exception("The metric '%s' does not exist", name.c_str());
   }
 
-  metric->select(_tuples_cache, ts1, ts2, walker);
+  metric->select(_tuples_cache, ts1, ts2, walker, group_by);
 }
 
 void rrdb::execute_query_statement(const std::string & buffer, t_memory_buffer & res)
@@ -700,14 +1585,82 @@ void rrdb::execute_query_statement(const std::string & buffer, t_memory_buffer &
   LOG(log::LEVEL_DEBUG3, "TCP command: '%s'", buffer.c_str());
 
   t_statement st = statement_query_parse(buffer);
+  this->execute_query_statement(st, res);
+}
+
+void rrdb::execute_query_statement(const t_statement & st, t_memory_buffer & res)
+{
+  latency_histogram::scoped_timer timer(_statements_time[st.which()]);
   boost::apply_visitor<>(statement_execute_visitor(*this, res), st);
 }
 
+my::size_t rrdb::get_query_cost(const t_statement & st)
+{
+  return boost::apply_visitor<>(statement_cost_visitor(*this), st);
+}
+
 void rrdb::execute_update_statement(const std::string & buffer, t_memory_buffer & res)
 {
   LOG(log::LEVEL_DEBUG3, "UDP command: %s", buffer.c_str());
 
   t_statement st = statement_update_parse(buffer);
+  latency_histogram::scoped_timer timer(_statements_time[st.which()]);
+  if(!_update_shards.empty()) {
+      const statement_update * update = boost::get<statement_update>(&st);
+      if(update) {
+          this->update_metric_sharded(update->_name, update->_ts ? *update->_ts : time(NULL), update->_value);
+          return;
+      }
+  }
   boost::apply_visitor<>(statement_execute_visitor(*this, res), st);
 }
 
+/**
+ * rrdb::update_self_metrics
+ *
+ * Writes all the status values in one step. The self.* metrics are
+ * remembered between the calls so the metrics map is only searched
+ * for the new or dropped metrics.
+ */
+void rrdb::update_self_metrics(const self_metrics & metrics, const my::time_t & ts)
+{
+  boost::lock_guard<boost::mutex> guard(_self_metrics_lock);
+  BOOST_FOREACH(const self_metrics::t_values::value_type & value, metrics.get_values()) {
+    boost::intrusive_ptr<rrdb_metric> & metric(_self_metrics[value.first]);
+    if(!metric || metric->is_deleted()) {
+        metric = this->find_metric(value.first);
+        if(!metric) {
+            metric = this->create_metric(value.first, _default_policy, false);
+        }
+    }
+
+    metric->update(_tuples_cache, ts, value.second);
+  }
+}
+
+/**
+ * rrdb::update_metric_sharded
+ *
+ * Routes the update to the shard picked by the metric name hash so the
+ * metric is never updated from two threads at once. The calling thread
+ * waits if the shard's queue is full.
+ */
+void rrdb::update_metric_sharded(const std::string & name, const my::time_t & ts, const my::value_t & value)
+{
+  CHECK_AND_THROW(!_update_shards.empty());
+
+  my::size_t shard = boost::hash<std::string>()(name) % _update_shards.size();
+  _update_shards[shard]->run(boost::intrusive_ptr<thread_pool_task>(
+      new update_shard_task(*this, name, ts, value)
+  ));
+}
+
+void rrdb::wait_for_updates()
+{
+  BOOST_FOREACH(const boost::shared_ptr<thread_pool> & shard, _update_shards) {
+    while(shard->get_load_factor() > 0) {
+        boost::this_thread::sleep(boost::posix_time::milliseconds(1));
+    }
+  }
+}
+
@@ -15,13 +15,16 @@
 #include <boost/shared_ptr.hpp>
 #include <boost/unordered_map.hpp>
 #include <boost/thread.hpp>
+#include <boost/mpl/size.hpp>
 
 #include "common/types.h"
-#include "common/spinlock.h"
+#include "common/latency_histogram.h"
+#include "common/named_lock.h"
 #include "common/memory_buffer.h"
 
 #include "parser/interval.h"
 #include "parser/retention_policy.h"
+#include "parser/statements.h"
 
 #include "rrdb/rrdb_metric_tuple.h"
 
@@ -30,16 +33,22 @@ class rrdb_metric;
 class rrdb_files_cache;
 class rrdb_journal_file;
 class rrdb_metric_tuples_cache;
+class rrdb_results_cache;
+
+class thread_pool;
+class thread_pool_task;
 
 class config;
-class statement_select;
 class server;
+class self_metrics;
 
 class rrdb
 {
 public:
   typedef boost::unordered_map< std::string, boost::intrusive_ptr<rrdb_metric> > t_metrics_map;
   typedef std::vector< boost::intrusive_ptr<rrdb_metric> > t_metrics_vector;
+  typedef std::vector< my::interval_t > t_rollup_intervals;
+  typedef std::vector< boost::shared_ptr<thread_pool> > t_thread_pools;
 
   //
   // Walks through metrics
@@ -55,6 +64,8 @@ public:
   class data_walker {
   public:
     virtual void append(const t_rrdb_metric_tuple & tuple, const my::interval_t & interval) = 0;
+    // tuples from first_pos down to last_pos (first_pos >= last_pos), newest first
+    virtual void append(const t_rrdb_metric_tuples & tuples, const my::size_t & first_pos, const my::size_t & last_pos, const my::interval_t & interval);
     virtual void flush() = 0;
   }; // class data_walker
 
@@ -68,7 +79,10 @@ public:
   void start();
   void stop();
 
-  void update_status(const time_t & now);
+  // collects the status values for the self.* metrics
+  void update_status(self_metrics & metrics);
+  // writes the collected status values
+  void update_self_metrics(const self_metrics & metrics, const my::time_t & ts);
 
   // metrics map operations
   boost::intrusive_ptr<rrdb_metric> get_metric(const std::string & name);
@@ -83,12 +97,23 @@ public:
 
   // values
   void update_metric(const std::string & name, const my::time_t & ts, const my::value_t & value);
-  void select_from_metric(const std::string & name, const my::time_t & ts1, const my::time_t & ts2, data_walker & walker);
+  void select_from_metric(const std::string & name, const my::time_t & ts1, const my::time_t & ts2, data_walker & walker, const my::interval_t & group_by = 0);
+  void select_from_metric(const boost::intrusive_ptr<rrdb_metric> & metric, const my::time_t & ts1, const my::time_t & ts2, data_walker & walker, const my::interval_t & group_by = 0);
+
+  // runs the task on the calling thread and up to (concurrency - 1) select threads
+  void execute_in_parallel(const boost::intrusive_ptr<thread_pool_task> & task, const my::size_t & concurrency);
 
   // commands
   void execute_query_statement(const std::string & buffer, t_memory_buffer & res);
+  void execute_query_statement(const t_statement & st, t_memory_buffer & res);
   void execute_update_statement(const std::string & buffer, t_memory_buffer & res);
 
+  // waits until the update shards finish all the queued updates
+  void wait_for_updates();
+
+  // the estimated number of tuples the statement walks through
+  my::size_t get_query_cost(const t_statement & st);
+
   // helpers
   const boost::shared_ptr<rrdb_files_cache> & get_files_cache() const
   {
@@ -98,6 +123,10 @@ public:
   {
     return _tuples_cache;
   }
+  const boost::shared_ptr<rrdb_results_cache> & get_results_cache() const
+  {
+    return _results_cache;
+  }
   const boost::shared_ptr<rrdb_journal_file> & get_journal_file() const
   {
     return _journal_file;
@@ -106,25 +135,61 @@ public:
   {
     return _default_policy;
   }
+  const t_rollup_intervals & get_rollups() const
+  {
+    return _rollups;
+  }
+  // the execution time for the statement type (t_statement::which())
+  latency_histogram & get_statement_time(const int & which)
+  {
+    return _statements_time[which];
+  }
+  latency_histogram & get_flush_time()
+  {
+    return _flush_time;
+  }
 
 private:
   void flush_to_disk_thread();
   void flush_to_disk();
+  void save_hot_set();
+
+  void warm_up_thread();
+  void warm_up_blocks_cache();
 
   t_metrics_vector get_dirty_metrics();
 
+  void update_metric_sharded(const std::string & name, const my::time_t & ts, const my::value_t & value);
+
 private:
   // config
   my::interval_t          _flush_interval;
   t_retention_policy      _default_policy;
+  t_rollup_intervals      _rollups;
+  my::size_t              _hot_set_size;
+  my::size_t              _select_thread_pool_size;
+  my::size_t              _update_shards_num;
+  my::size_t              _update_shard_queue_size;
 
   t_metrics_map           _metrics;
-  mutable spinlock        _metrics_lock;
+  mutable named_lock      _metrics_lock;
+
+  // the self.* metrics resolved by update_self_metrics()
+  t_metrics_map           _self_metrics;
+  boost::mutex            _self_metrics_lock;
 
   boost::shared_ptr<rrdb_files_cache>         _files_cache;
   boost::shared_ptr<rrdb_metric_tuples_cache> _tuples_cache;
   boost::shared_ptr<rrdb_journal_file>        _journal_file;
+  boost::shared_ptr<rrdb_results_cache>       _results_cache;
   boost::shared_ptr< boost::thread >          _flush_to_disk_thread;
+  boost::shared_ptr< boost::thread >          _warm_up_thread;
+  boost::shared_ptr<thread_pool>              _select_thread_pool;
+  t_thread_pools                              _update_shards;
+
+  // execution time for each statement type (in the t_statement order)
+  latency_histogram _statements_time[boost::mpl::size<t_statement::types>::value];
+  latency_histogram _flush_time;
 }; // class rrdb
 
 #endif /* RRDB_H_ */
@@ -0,0 +1,85 @@
+/*
+ * rrdb_file.cpp
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: aleksey
+ */
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+
+#include "rrdb/rrdb_file.h"
+
+#include "common/log.h"
+#include "common/exception.h"
+
+rrdb_file::rrdb_file(const std::string & full_path) :
+  _full_path(full_path),
+  _fd(-1)
+{
+  LOG(log::LEVEL_DEBUG3, "Opening file '%s'", _full_path.c_str());
+
+  do {
+      _fd = ::open(_full_path.c_str(), O_RDWR);
+  } while(_fd < 0 && errno == EINTR);
+
+  if(_fd < 0) {
+      throw exception("Unable to open file '%s': %s", _full_path.c_str(), strerror(errno));
+  }
+}
+
+rrdb_file::~rrdb_file()
+{
+  if(_fd >= 0) {
+      ::close(_fd);
+      _fd = -1;
+  }
+}
+
+/**
+ * rrdb_file::read
+ *
+ * Reads exactly size bytes at the given offset, fails on short reads
+ */
+void rrdb_file::read(const my::size_t & offset, char * buf, const my::size_t & size) const
+{
+  CHECK_AND_THROW(buf);
+
+  my::size_t done = 0;
+  while(done < size) {
+      ssize_t res = ::pread(_fd, buf + done, size - done, offset + done);
+      if(res < 0) {
+          if(errno == EINTR) {
+              continue;
+          }
+          throw exception("Unable to read %lu bytes at offset %lu from file '%s': %s", size, offset, _full_path.c_str(), strerror(errno));
+      } else if(res == 0) {
+          throw exception("Unexpected end of file '%s': read %lu bytes at offset %lu (expected %lu)", _full_path.c_str(), done, offset, size);
+      }
+      done += res;
+  }
+}
+
+/**
+ * rrdb_file::write
+ *
+ * Writes exactly size bytes at the given offset
+ */
+void rrdb_file::write(const my::size_t & offset, const char * buf, const my::size_t & size)
+{
+  CHECK_AND_THROW(buf);
+
+  my::size_t done = 0;
+  while(done < size) {
+      ssize_t res = ::pwrite(_fd, buf + done, size - done, offset + done);
+      if(res < 0) {
+          if(errno == EINTR) {
+              continue;
+          }
+          throw exception("Unable to write %lu bytes at offset %lu to file '%s': %s", size, offset, _full_path.c_str(), strerror(errno));
+      }
+      done += res;
+  }
+}
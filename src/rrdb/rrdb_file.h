@@ -0,0 +1,44 @@
+/*
+ * rrdb_file.h
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: aleksey
+ */
+
+#ifndef RRDB_FILE_H_
+#define RRDB_FILE_H_
+
+#include <string>
+
+#include <boost/intrusive_ptr.hpp>
+
+#include "common/types.h"
+#include "common/enable_intrusive_ptr.h"
+
+//
+// Raw file descriptor with positional (pread/pwrite) IO: no shared
+// seek position and no stream buffers so the same open file can be
+// used by multiple threads at once and we can keep many of them open.
+//
+class rrdb_file :
+    public enable_intrusive_ptr<rrdb_file>
+{
+public:
+  rrdb_file(const std::string & full_path);
+  virtual ~rrdb_file();
+
+  inline const std::string & get_full_path() const {
+    return _full_path;
+  }
+
+  void read(const my::size_t & offset, char * buf, const my::size_t & size) const;
+  void write(const my::size_t & offset, const char * buf, const my::size_t & size);
+
+private:
+  std::string _full_path;
+  int         _fd;
+}; // rrdb_file
+
+typedef boost::intrusive_ptr<rrdb_file> rrdb_file_ptr;
+
+#endif /* RRDB_FILE_H_ */
@@ -5,6 +5,8 @@
  *      Author: aleksey
  */
 
+#include <sys/resource.h>
+
 #include <boost/filesystem.hpp>
 #include <boost/foreach.hpp>
 
@@ -16,18 +18,22 @@
 #include "common/config.h"
 #include "common/log.h"
 #include "common/exception.h"
-#include "common/spinlock.h"
+#include "common/named_lock.h"
+
 
+// how many file descriptors we leave for sockets, journal, etc
+#define RRDB_FILES_CACHE_RESERVED_FDS   256
 
 // black magic to make forward declarations work
 class rrdb_files_cache_impl :
-    public lru_cache<std::string, rrdb_files_cache::fstream_ptr, my::time_t>
+    public lru_cache<std::string, rrdb_file_ptr, my::time_t>
 {
 }; // rrdb_files_cache_impl
 
 rrdb_files_cache::rrdb_files_cache():
+  _lock("file_cache"),
   _path("/var/lib/rrdb/"),
-  _max_size(1024),
+  _max_size(100000),
   _purge_threshold(0.8),
   _files_cache_impl(new rrdb_files_cache_impl())
 {
@@ -50,13 +56,16 @@ void rrdb_files_cache::initialize(boost::shared_ptr<config> config)
 
   // simple - under lock
   {
-    boost::lock_guard<spinlock> guard(_lock);
+    boost::lock_guard<named_lock> guard(_lock);
     _purge_threshold = config->get<double>("rrdb.open_files_cache_purge_threshold", _purge_threshold);
     if(_purge_threshold > 1.0) {
         throw exception("The rrdb.open_files_cache_purge_threshold should not exceed 1.0");
     }
   }
 
+  // make sure we can actually open that many files
+  this->check_files_limit();
+
   LOG(log::LEVEL_INFO, "Initialized open files cache: %lu open files with %f purge threshold",
       this->get_max_size(),
       _purge_threshold
@@ -65,7 +74,7 @@ void rrdb_files_cache::initialize(boost::shared_ptr<config> config)
 
 my::size_t rrdb_files_cache::get_max_size() const
 {
-  boost::lock_guard<spinlock> guard(_lock);
+  boost::lock_guard<named_lock> guard(_lock);
   return _max_size;
 }
 
@@ -73,10 +82,10 @@ void rrdb_files_cache::set_max_size(const my::size_t & max_size)
 {
   CHECK_AND_THROW(max_size > 0);
 
-  boost::lock_guard<spinlock> guard(_lock);
-  if(_max_size < max_size) {
+  boost::lock_guard<named_lock> guard(_lock);
+  if(_max_size > max_size) {
       _max_size = max_size;
-      this->purge();
+      this->purge(_max_size * _purge_threshold);
   } else {
       _max_size = max_size;
   }
@@ -86,7 +95,7 @@ void rrdb_files_cache::set_max_size(const my::size_t & max_size)
 
 std::string rrdb_files_cache::get_path() const
 {
-  boost::lock_guard<spinlock> guard(_lock);
+  boost::lock_guard<named_lock> guard(_lock);
   return _path;
 }
 
@@ -94,7 +103,7 @@ void rrdb_files_cache::set_path(const std::string & path)
 {
   CHECK_AND_THROW(!path.empty());
 
-  boost::lock_guard<spinlock> guard(_lock);
+  boost::lock_guard<named_lock> guard(_lock);
   _path = path;
   if((*_path.rbegin()) != '/') {
       _path += "/";
@@ -107,19 +116,19 @@ void rrdb_files_cache::clear()
 {
   LOG(log::LEVEL_INFO, "Clearing open files cache");
 
-  boost::lock_guard<spinlock> guard(_lock);
+  boost::lock_guard<named_lock> guard(_lock);
   _files_cache_impl->clear();
 }
 
 my::size_t rrdb_files_cache::get_cache_size() const
 {
-  boost::lock_guard<spinlock> guard(_lock);
+  boost::lock_guard<named_lock> guard(_lock);
   return _files_cache_impl->get_size();
 }
 
 my::size_t rrdb_files_cache::get_cache_hits(bool reset)
 {
-  boost::lock_guard<spinlock> guard(_lock);
+  boost::lock_guard<named_lock> guard(_lock);
   my::size_t res(_files_cache_impl->get_cache_hits());
   if(reset) {
       _files_cache_impl->reset_cache_hits();
@@ -129,7 +138,7 @@ my::size_t rrdb_files_cache::get_cache_hits(bool reset)
 
 my::size_t rrdb_files_cache::get_cache_misses(bool reset)
 {
-  boost::lock_guard<spinlock> guard(_lock);
+  boost::lock_guard<named_lock> guard(_lock);
   my::size_t res(_files_cache_impl->get_cache_misses());
   if(reset) {
       _files_cache_impl->reset_cache_misses();
@@ -140,7 +149,7 @@ my::size_t rrdb_files_cache::get_cache_misses(bool reset)
 std::string rrdb_files_cache::get_full_path(const std::string & filename) const
 {
   CHECK_AND_THROW(!filename.empty());
-  boost::lock_guard<spinlock> guard(_lock);
+  boost::lock_guard<named_lock> guard(_lock);
   return _path + filename;
 }
 
@@ -150,7 +159,48 @@ std::string rrdb_files_cache::get_full_path(const my::filename_t & filename) con
   return this->get_full_path(*filename);
 }
 
-void rrdb_files_cache::purge()
+/**
+ * rrdb_files_cache::check_files_limit
+ *
+ * Each cached file holds a file descriptor: try to raise the soft
+ * RLIMIT_NOFILE up to the hard limit and shrink the cache if even
+ * that is not enough
+ */
+void rrdb_files_cache::check_files_limit()
+{
+  struct rlimit rl;
+  if(getrlimit(RLIMIT_NOFILE, &rl) != 0 || rl.rlim_cur == RLIM_INFINITY) {
+      return;
+  }
+
+  my::size_t max_size = this->get_max_size();
+  rlim_t needed = max_size + RRDB_FILES_CACHE_RESERVED_FDS;
+  if(rl.rlim_cur >= needed) {
+      return;
+  }
+
+  // try to raise the soft limit as much as we can
+  rlim_t old_limit = rl.rlim_cur;
+  rl.rlim_cur = (rl.rlim_max == RLIM_INFINITY || rl.rlim_max >= needed) ? needed : rl.rlim_max;
+  if(setrlimit(RLIMIT_NOFILE, &rl) != 0) {
+      rl.rlim_cur = old_limit;
+  } else {
+      LOG(log::LEVEL_INFO, "Raised open files limit from %lu to %lu", SIZE_T_CAST old_limit, SIZE_T_CAST rl.rlim_cur);
+  }
+
+  if(rl.rlim_cur < needed) {
+      CHECK_AND_THROW(rl.rlim_cur > 2 * RRDB_FILES_CACHE_RESERVED_FDS);
+      my::size_t new_max_size = rl.rlim_cur - RRDB_FILES_CACHE_RESERVED_FDS;
+      LOG(log::LEVEL_ERROR, "Open files limit is %lu, reducing open files cache size from %lu to %lu",
+          SIZE_T_CAST rl.rlim_cur,
+          max_size,
+          new_max_size
+      );
+      this->set_max_size(new_max_size);
+  }
+}
+
+void rrdb_files_cache::purge(const my::size_t & purge_limit)
 {
   LOG(log::LEVEL_DEBUG3, "Purging open files cache: %lu files before", _files_cache_impl->get_size());
 
@@ -159,7 +209,6 @@ void rrdb_files_cache::purge()
 
   rrdb_files_cache_impl::t_lru_iterator it(_files_cache_impl->lru_begin());
   rrdb_files_cache_impl::t_lru_iterator it_end(_files_cache_impl->lru_end());
-  my::size_t purge_limit = _max_size * _purge_threshold;
   while(it != it_end && _files_cache_impl->get_size() >= purge_limit) {
       it = _files_cache_impl->lru_erase(it);
   }
@@ -184,7 +233,7 @@ rrdb_files_cache::fstream_ptr rrdb_files_cache::open_file(
   }
 }
 
-rrdb_files_cache::fstream_ptr rrdb_files_cache::open_file(
+rrdb_file_ptr rrdb_files_cache::open_file(
     const my::filename_t & filename,
     const my::time_t & ts
 )
@@ -195,17 +244,17 @@ rrdb_files_cache::fstream_ptr rrdb_files_cache::open_file(
   // open file (no lock) and insert (under lock) to make sure we
   // don't perform IO operations under the lock
   LOG(log::LEVEL_DEBUG3, "Looking for file '%s'", filename->c_str());
-  boost::shared_ptr<std::fstream> fs;
+  rrdb_file_ptr file;
   std::string base_folder;
 
   //
   // Try to find
   //
   {
-    boost::lock_guard<spinlock> guard(_lock);
-    fs = _files_cache_impl->find(*filename, ts);
-    if(fs) {
-        return fs;
+    boost::lock_guard<named_lock> guard(_lock);
+    file = _files_cache_impl->find(*filename, ts);
+    if(file) {
+        return file;
     }
 
     // while we are under lock copy base folder...
@@ -213,32 +262,46 @@ rrdb_files_cache::fstream_ptr rrdb_files_cache::open_file(
   }
 
   //
-  // open a new fstream - OUTSIDE of the lock!
+  // open a new file - OUTSIDE of the lock!
   //
   std::string full_path = base_folder + (*filename);
 
   LOG(log::LEVEL_DEBUG3, "Opening file cache file '%s', full path '%s'", filename->c_str(), full_path.c_str());
-  fs = rrdb_files_cache::open_file(full_path);
+  try {
+      file.reset(new rrdb_file(full_path));
+  } catch(const std::exception & e) {
+      // most likely we ran out of file descriptors: drop half of the
+      // cached ones and try again
+      {
+        boost::lock_guard<named_lock> guard(_lock);
+        if(_files_cache_impl->get_size() == 0) {
+            throw;
+        }
+        LOG(log::LEVEL_ERROR, "%s, purging open files cache and trying again", e.what());
+        this->purge(_files_cache_impl->get_size() / 2);
+      }
+      file.reset(new rrdb_file(full_path));
+  }
 
   //
   // Insert back into cache - under lock
   //
   {
-    boost::lock_guard<spinlock> guard(_lock);
+    boost::lock_guard<named_lock> guard(_lock);
 
     // purge cache if needed
     if(_files_cache_impl->get_size() >= _max_size) {
-        this->purge();
+        this->purge(_max_size * _purge_threshold);
     }
 
     // put it in the cache
-    _files_cache_impl->insert(*filename, fs, ts);
+    _files_cache_impl->insert(*filename, file, ts);
   }
 
   //
   // done
   //
-  return fs;
+  return file;
 }
 
 void rrdb_files_cache::delete_file(const my::filename_t & filename)
@@ -248,18 +311,12 @@ void rrdb_files_cache::delete_file(const my::filename_t & filename)
   std::string full_path = this->get_full_path(filename);
   LOG(log::LEVEL_DEBUG3, "Deleting file '%s', full path '%s'", filename->c_str(), full_path.c_str());
 
-  // don't forget to cleanup any open file handles
-  fstream_ptr fs;
+  // drop the cached file handle: we can't close the descriptor here since
+  // other threads might still be using it (and the number might be reused
+  // right away), it is closed when the last reference goes away
   {
-    boost::lock_guard<spinlock> guard(_lock);
-    fs = _files_cache_impl->erase(*filename);
-  }
-
-  // close it manually here, if any other thread has a handle then it will
-  // get IO failure
-  if(fs) {
-      fs->close();
-      fs.reset();
+    boost::lock_guard<named_lock> guard(_lock);
+    _files_cache_impl->erase(*filename);
   }
 
   // delete
@@ -15,7 +15,9 @@
 
 
 #include "common/types.h"
-#include "common/spinlock.h"
+#include "common/named_lock.h"
+
+#include "rrdb/rrdb_file.h"
 
 class rrdb;
 class config;
@@ -43,7 +45,7 @@ public:
   my::size_t get_cache_hits(bool reset = false);
   my::size_t get_cache_misses(bool reset = false);
 
-  fstream_ptr open_file(
+  rrdb_file_ptr open_file(
       const my::filename_t & filename,
       const my::time_t & ts
   );
@@ -59,10 +61,11 @@ public:
   );
 
 private:
-  void purge();
+  void purge(const my::size_t & purge_limit);
+  void check_files_limit();
 
 private:
-  mutable spinlock _lock;
+  mutable named_lock _lock;
 
   // params
   std::string      _path;
@@ -96,11 +96,12 @@ void rrdb_journal_file::add_block(const my::size_t & offset, const my::size_t &
 }
 
 
-void rrdb_journal_file::apply_journal(std::fstream & os)
+void rrdb_journal_file::apply_journal(const rrdb_file_ptr & file)
 {
+  CHECK_AND_THROW(file);
+
   BOOST_FOREACH(const t_journal_block_header & block, _cur_data_blocks) {
-    os.seekg(block._real_offset, os.beg);
-    os.write((const char*)&(_cur_data[block._journal_offset]), block._size);
+    file->write(block._real_offset, (const char*)&(_cur_data[block._journal_offset]), block._size);
   }
 }
 
@@ -109,16 +110,9 @@ void rrdb_journal_file::apply_journal(const my::filename_t & filename)
   CHECK_AND_THROW(filename);
   LOG(log::LEVEL_DEBUG2, "Applying journal file for filename '%s' to file '%s'", _cur_filename.get(), filename->c_str());
 
-  // open real file and seek to the start of the file
-  rrdb_files_cache::fstream_ptr fs(_files_cache->open_file(filename, time(NULL)));
-  fs->sync();
-
-  // apply the journal file to the real file
-  this->apply_journal(*fs);
-
-  // flush, don't close (this is the file from cache!)
-  fs->flush();
-  fs->sync();
+  // apply the journal file to the real file (this is the file from cache,
+  // pwrite() goes straight to the OS so there is nothing to flush)
+  this->apply_journal(_files_cache->open_file(filename, time(NULL)));
 
   LOG(log::LEVEL_DEBUG2, "Applyed journal file for filename '%s' to file '%s'", _cur_filename.get(), filename->c_str());
 }
@@ -14,6 +14,7 @@
 #include <fstream>
 #include <boost/shared_ptr.hpp>
 
+#include "rrdb/rrdb_file.h"
 #include "rrdb/rrdb_metric_tuple.h"
 
 #include "common/utils.h"
@@ -84,7 +85,7 @@ public:
   }
 
 private:
-  void apply_journal(std::fstream & os);
+  void apply_journal(const rrdb_file_ptr & file);
 
 private:
   boost::shared_ptr<rrdb_files_cache>  _files_cache;
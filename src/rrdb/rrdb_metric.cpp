@@ -7,10 +7,12 @@
 #include "rrdb/rrdb_metric.h"
 
 #include <stdio.h>
+#include <algorithm>
 
 #include <boost/thread/locks.hpp>
 #include <boost/functional/hash.hpp>
 #include <boost/foreach.hpp>
+#include <boost/atomic.hpp>
 #include <boost/filesystem.hpp>
 #include <boost/algorithm/string.hpp>
 
@@ -44,9 +46,101 @@
 //    <block1>            rrdb_metric_block
 //    <block2>            rrdb_metric_block
 //    ...
+//    <rollup1>           rrdb_metric_block (with Status_Rollup flag)
+//    ...
+
+// the versions are unique across all metrics so the results computed
+// for a dropped metric never match the new one with the same name
+static boost::atomic<my::size_t> g_rrdb_metric_results_version(0);
+
+static inline my::size_t rrdb_metric_next_results_version()
+{
+  return g_rrdb_metric_results_version.fetch_add(1, boost::memory_order_relaxed) + 1;
+}
+
+//
+// Passes the block data before the given ts to the walker: the newest
+// slot has only the data before that ts (the rest is in the finer block)
+// so the walker shouldn't scale it down
+//
+class rrdb_metric_clipping_walker :
+    public rrdb::data_walker
+{
+public:
+  rrdb_metric_clipping_walker(rrdb::data_walker & walker, const my::time_t & cur_ts) :
+    _walker(walker),
+    _cur_ts(cur_ts)
+  {
+  }
+
+  virtual ~rrdb_metric_clipping_walker()
+  {
+  }
+
+public:
+  // rrdb::data_walker
+  void append(const t_rrdb_metric_tuple & tuple, const my::interval_t & interval)
+  {
+    if(tuple._ts + interval <= _cur_ts) {
+        _walker.append(tuple, interval);
+    } else if(tuple._ts < _cur_ts) {
+        _walker.append(tuple, _cur_ts - tuple._ts);
+    }
+  }
+
+  void append(const t_rrdb_metric_tuples & tuples, const my::size_t & first_pos, const my::size_t & last_pos, const my::interval_t & interval)
+  {
+    CHECK_AND_THROW(last_pos <= first_pos);
+
+    // only the first (newest) tuple in the run might be partial
+    my::size_t pos = first_pos;
+    if(tuples.get_ts_column()[pos] + interval > _cur_ts) {
+        t_rrdb_metric_tuple tuple;
+        tuples.get(pos, tuple);
+        this->append(tuple, interval);
+        if(pos == last_pos) {
+            return;
+        }
+        --pos;
+    }
+    _walker.append(tuples, pos, last_pos, interval);
+  }
+
+  void flush()
+  {
+    // do nothing - the metric flushes the original walker
+  }
+
+private:
+  rrdb::data_walker & _walker;
+  my::time_t          _cur_ts;
+}; // class rrdb_metric_clipping_walker
+
+//
+// Updates the rollup blocks with the data sealed in the first block
+//
+static void rrdb_metric_update_rollups(
+    const my::filename_t & filename,
+    const boost::shared_ptr<rrdb_metric_tuples_cache> & tuples_cache,
+    const std::vector< boost::intrusive_ptr<rrdb_metric_block> > & rollups,
+    const rrdb_metric_block::t_update_ctx & in
+) {
+  rrdb_metric_block::t_update_ctx ctx(in), out;
+  BOOST_FOREACH(const boost::intrusive_ptr<rrdb_metric_block> & rollup, rollups) {
+    // the rollup slots are aligned by the rollup interval
+    if(ctx._state == rrdb_metric_block::UpdateState_Tuple) {
+        ctx._tuple._ts = rollup->get_normalized_ts(in._tuple._ts);
+    } else {
+        ctx._ts = rollup->get_normalized_ts(in._ts);
+    }
+    rollup->update(filename, tuples_cache, ctx, out);
+  }
+}
 
 rrdb_metric::rrdb_metric(const my::filename_t & filename) :
-  _filename(filename)
+  _lock("metric"),
+  _filename(filename),
+  _results_version(rrdb_metric_next_results_version())
 {
   // setup empty header
   memset(&_header, 0, sizeof(_header));
@@ -65,7 +159,7 @@ rrdb_metric::~rrdb_metric()
  */
 std::string rrdb_metric::get_name() const
 {
-  boost::lock_guard<spinlock> guard(_lock);
+  boost::lock_guard<named_lock> guard(_lock);
   return std::string(_name.get(), _name.get_size());
 }
 
@@ -76,7 +170,7 @@ std::string rrdb_metric::get_name() const
  */
 my::filename_t rrdb_metric::get_filename() const
 {
-  boost::lock_guard<spinlock> guard(_lock);
+  boost::lock_guard<named_lock> guard(_lock);
   return _filename;
 }
 
@@ -87,11 +181,11 @@ my::filename_t rrdb_metric::get_filename() const
  */
 t_retention_policy rrdb_metric::get_policy() const
 {
-  boost::lock_guard<spinlock> guard(_lock);
-  CHECK_AND_THROW(_blocks.size() == _header._blocks_size);
+  boost::lock_guard<named_lock> guard(_lock);
+  CHECK_AND_THROW(_blocks.size() + _rollups.size() == _header._blocks_size);
 
   t_retention_policy res;
-  res.reserve(_header._blocks_size);
+  res.reserve(_blocks.size());
   BOOST_FOREACH(const boost::intrusive_ptr<rrdb_metric_block> & block, _blocks) {
     t_retention_policy_elem elem;
     elem._freq     = block->get_freq();
@@ -102,6 +196,23 @@ t_retention_policy rrdb_metric::get_policy() const
   return res;
 }
 
+/**
+ * rrdb_metric::get_rollups
+ *
+ * Returns the metric's materialized "group by" intervals
+ */
+rrdb::t_rollup_intervals rrdb_metric::get_rollups() const
+{
+  boost::lock_guard<named_lock> guard(_lock);
+
+  rrdb::t_rollup_intervals res;
+  res.reserve(_rollups.size());
+  BOOST_FOREACH(const boost::intrusive_ptr<rrdb_metric_block> & rollup, _rollups) {
+    res.push_back(rollup->get_freq());
+  }
+  return res;
+}
+
 /**
  * rrdb_metric::get_last_value
  *
@@ -109,7 +220,7 @@ t_retention_policy rrdb_metric::get_policy() const
  */
 void rrdb_metric::get_last_value(my::value_t & value, my::time_t & value_ts) const
 {
-  boost::lock_guard<spinlock> guard(_lock);
+  boost::lock_guard<named_lock> guard(_lock);
   value    = _header._last_value;
   value_ts = _header._last_value_ts;
 }
@@ -117,9 +228,10 @@ void rrdb_metric::get_last_value(my::value_t & value, my::time_t & value_ts) con
 /**
  * rrdb_metric::create
  *
- * Creates a new metric with the given name and policy. The current object must be "empty".
+ * Creates a new metric with the given name, policy and "group by" intervals
+ * to materialize. The current object must be "empty".
  */
-void rrdb_metric::create(const std::string & name, const t_retention_policy & policy)
+void rrdb_metric::create(const std::string & name, const t_retention_policy & policy, const rrdb::t_rollup_intervals & rollups)
 {
   // check the name
   if(!statement_check_metric_name(name, false)) {
@@ -128,7 +240,7 @@ void rrdb_metric::create(const std::string & name, const t_retention_policy & po
   CHECK_AND_THROW(!policy.empty());
 
   // good, let's do it!
-  boost::lock_guard<spinlock> guard(_lock);
+  boost::lock_guard<named_lock> guard(_lock);
 
   // check we are good
   CHECK_AND_THROW(_name.empty());
@@ -140,21 +252,56 @@ void rrdb_metric::create(const std::string & name, const t_retention_policy & po
   _filename = rrdb_metric::construct_filename(name);
 
   // copy policy
-  _header._blocks_size  = policy.size();
   _blocks.clear();
-  _blocks.reserve(_header._blocks_size);
+  _blocks.reserve(policy.size());
   my::size_t offset = sizeof(_header) + _name.get_file_size();
+  my::interval_t duration = 0;
   BOOST_FOREACH(const t_retention_policy_elem & elem, policy) {
     boost::intrusive_ptr<rrdb_metric_block> block(
         new rrdb_metric_block(elem._freq, elem._duration / elem._freq, offset)
     );
     _blocks.push_back(block);
     offset += block->get_max_disk_size(); // the last block might be LESS but we don't care!
+
+    duration = std::max(duration, elem._duration);
   }
 
+  // rollups: the rollup slots are filled from the first block slots so the
+  // interval should be a multiple of the first block freq, skip the intervals
+  // we have in the policy already
+  _rollups.clear();
+  BOOST_FOREACH(const my::interval_t & interval, rollups) {
+    if(interval <= policy.front()._freq || interval % policy.front()._freq != 0) {
+        LOG(log::LEVEL_DEBUG, "Skipping rollup %lu for metric '%s': not aligned with the first block", SIZE_T_CAST interval, name.c_str());
+        continue;
+    }
+    bool found = false;
+    BOOST_FOREACH(const t_retention_policy_elem & elem, policy) {
+      found = found || (elem._freq == interval);
+    }
+    BOOST_FOREACH(const boost::intrusive_ptr<rrdb_metric_block> & rollup, _rollups) {
+      found = found || (rollup->get_freq() == interval);
+    }
+    if(found) {
+        continue;
+    }
+
+    boost::intrusive_ptr<rrdb_metric_block> rollup(
+        new rrdb_metric_block(interval, (duration + interval - 1) / interval, offset)
+    );
+    rollup->set_rollup();
+    _rollups.push_back(rollup);
+    offset += rollup->get_max_disk_size();
+  }
+  _header._blocks_size = _blocks.size() + _rollups.size();
+
   // mark last block
   CHECK_AND_THROW(!_blocks.empty());
-  _blocks.back()->set_last_block();
+  if(_rollups.empty()) {
+      _blocks.back()->set_last_block();
+  } else {
+      _rollups.back()->set_last_block();
+  }
 
   // done
   LOG(log::LEVEL_DEBUG3, "Created metric '%s'", name.c_str());
@@ -172,12 +319,12 @@ void rrdb_metric::update(
 ) {
   CHECK_AND_THROW(tuples_cache);
 
-  boost::lock_guard<spinlock> guard(_lock);
+  boost::lock_guard<named_lock> guard(_lock);
 
   // check we are good
   CHECK_AND_THROW(!_name.empty());
   CHECK_AND_THROW(!_blocks.empty());
-  CHECK_AND_THROW(_blocks.size() == _header._blocks_size);
+  CHECK_AND_THROW(_blocks.size() + _rollups.size() == _header._blocks_size);
   LOG(log::LEVEL_DEBUG3, "Updating from metric '%s' with %f at timestamp %ld", _name.c_str(), value, ts);
 
   // mark dirty
@@ -203,6 +350,10 @@ void rrdb_metric::update(
   one._state = rrdb_metric_block::UpdateState_Value;
   one._ts    = _blocks.front()->get_normalized_ts(ts); // we want to make sure that blocks are "aligned" by the first block
   one._value = value;
+  if(one._ts < _blocks.front()->get_cur_ts()) {
+      // late update: the results computed before are not valid anymore
+      _results_version = rrdb_metric_next_results_version();
+  }
   my::size_t ii(1); // start from block 1
   BOOST_FOREACH(boost::intrusive_ptr<rrdb_metric_block> & block, _blocks) {
       // swap one and two to avoid copying data
@@ -213,6 +364,11 @@ void rrdb_metric::update(
           if(two._state == rrdb_metric_block::UpdateState_Stop) {
               break;
           }
+
+          // the rollups get everything before the first block's current slot
+          if(!_rollups.empty() && block == _blocks.front()) {
+              rrdb_metric_update_rollups(_filename, tuples_cache, _rollups, two);
+          }
           ii = 2; // next block 2
       } else {
           LOG(log::LEVEL_DEBUG3, "Updating block with 'two' at ts %lld with ctx state %d", two.get_ts(), two._state);
@@ -233,36 +389,82 @@ void rrdb_metric::update(
  * rrdb_metric::select
  *
  * Selects data from the metric with fir the given [ts1, ts2) period
- * and passes the data to the walker
+ * and passes the data to the walker. If there is a rollup for the "group by"
+ * interval and the period is aligned with it then the rollup is used
+ * instead of the policy blocks
  */
 void rrdb_metric::select(
     const boost::shared_ptr<rrdb_metric_tuples_cache> & tuples_cache,
     const my::time_t & ts1,
     const my::time_t & ts2,
-    rrdb::data_walker & walker
+    rrdb::data_walker & walker,
+    const my::interval_t & group_by
 ) {
   CHECK_AND_THROW(tuples_cache);
 
-  boost::lock_guard<spinlock> guard(_lock);
+  boost::lock_guard<named_lock> guard(_lock);
 
   // check we are good
   CHECK_AND_THROW(!_name.empty());
   CHECK_AND_THROW(!_blocks.empty());
-  CHECK_AND_THROW(_blocks.size() == _header._blocks_size);
+  CHECK_AND_THROW(_blocks.size() + _rollups.size() == _header._blocks_size);
   LOG(log::LEVEL_DEBUG3, "Selecting from metric '%s'", _name.c_str());
 
+  // the rollup has all the data before the first block's current slot
+  my::time_t cur_ts = _blocks.front()->get_cur_ts();
+  if(group_by > 0 && ts1 % group_by == 0 && ts1 < cur_ts && (cur_ts <= ts2 || ts2 % group_by == 0)) {
+      BOOST_FOREACH(const boost::intrusive_ptr<rrdb_metric_block> & rollup, _rollups) {
+        if(rollup->get_freq() != group_by) {
+            continue;
+        }
+
+        if(cur_ts < ts2) {
+            _blocks.front()->select(_filename, tuples_cache, cur_ts, ts2, walker);
+        }
+        rrdb_metric_clipping_walker clipping_walker(walker, cur_ts);
+        rollup->select(_filename, tuples_cache, ts1, std::min(ts2, cur_ts), clipping_walker);
+
+        // done - finish up
+        walker.flush();
+
+        LOG(log::LEVEL_DEBUG3, "Selected from metric '%s' rollup %lu", _name.c_str(), SIZE_T_CAST group_by);
+        return;
+      }
+  }
+
+  // the planner: the coarsest block with the slots aligned with the "group by"
+  // buckets gives the same results as the finer blocks. This block has all
+  // the data before the previous block's current slot and we need the finer
+  // blocks only for the data after it
+  my::size_t plan = this->plan_select(ts1, ts2, group_by);
+  my::time_t plan_ts = (plan > 0) ? _blocks[plan - 1]->get_cur_ts() : ts1;
+
   // note that logic for checking timestamps in rrdb_metric_block::select()
   // is very similar
-  BOOST_FOREACH(const boost::intrusive_ptr<rrdb_metric_block> & block, _blocks) {
-    int res = my::interval_overlap(block->get_earliest_ts(), block->get_latest_ts(), ts1, ts2);
+  for(my::size_t ii = 0; ii < _blocks.size(); ++ii) {
+    const boost::intrusive_ptr<rrdb_metric_block> & block(_blocks[ii]);
+    my::time_t from = (ii < plan) ? std::max(ts1, plan_ts) : ts1;
+    if(ts2 <= from) {
+        continue;
+    }
+
+    int res = my::interval_overlap(block->get_earliest_ts(), block->get_latest_ts(), from, ts2);
     if(res < 0) {
         // [block) < [ts1, ts2): blocks are ordered from newest to oldest, so we
         // are done - all the next blocks will be earlier than this one
+        if(ii < plan) {
+            continue;
+        }
         break;
     }
     if(res ==  0) {
         // res == 0 => block and interval intersect!
-        block->select(_filename, tuples_cache, ts1, ts2, walker);
+        if(ii == plan && plan > 0) {
+            rrdb_metric_clipping_walker clipping_walker(walker, plan_ts);
+            block->select(_filename, tuples_cache, from, ts2, clipping_walker);
+        } else {
+            block->select(_filename, tuples_cache, from, ts2, walker);
+        }
     }
   }
 
@@ -272,6 +474,143 @@ void rrdb_metric::select(
   LOG(log::LEVEL_DEBUG3, "Selected from metric '%s'", _name.c_str());
 }
 
+/**
+ * rrdb_metric::plan_select
+ *
+ * Returns the index of the coarsest block overlapping [ts1, ts2) with the
+ * freq that divides "group by" interval and the slots aligned with ts1
+ * (i.e. aligned with the buckets). MUST be under the lock.
+ */
+my::size_t rrdb_metric::plan_select(
+    const my::time_t & ts1,
+    const my::time_t & ts2,
+    const my::interval_t & group_by
+) const {
+  // should be locked
+  CHECK_AND_THROW(_lock.is_locked());
+
+  my::size_t plan = 0;
+  if(group_by == 0) {
+      return plan;
+  }
+  for(my::size_t ii = 1; ii < _blocks.size(); ++ii) {
+    const boost::intrusive_ptr<rrdb_metric_block> & block(_blocks[ii]);
+    if(block->get_freq() > group_by) {
+        break;
+    }
+    if(group_by % block->get_freq() != 0 || (ts1 - block->get_cur_ts()) % block->get_freq() != 0) {
+        continue;
+    }
+    if(my::interval_overlap(block->get_earliest_ts(), block->get_latest_ts(), ts1, ts2) != 0) {
+        continue;
+    }
+    plan = ii;
+  }
+  return plan;
+}
+
+/**
+ * rrdb_metric::get_sealed_ts
+ *
+ * Returns the first block's current slot ts and the results version
+ */
+my::time_t rrdb_metric::get_sealed_ts(my::size_t & version) const
+{
+  boost::lock_guard<named_lock> guard(_lock);
+  CHECK_AND_THROW(!_blocks.empty());
+
+  version = _results_version;
+  return _blocks.front()->get_cur_ts();
+}
+
+/**
+ * rrdb_metric::get_select_cost
+ *
+ * Estimates how much work select() would do: the number of tuples
+ * from each block overlapping [ts1, ts2)
+ */
+my::size_t rrdb_metric::get_select_cost(
+    const my::time_t & ts1,
+    const my::time_t & ts2
+) const {
+  if(ts1 >= ts2) {
+      return 0;
+  }
+
+  boost::lock_guard<named_lock> guard(_lock);
+
+  my::size_t cost = 0;
+  BOOST_FOREACH(const boost::intrusive_ptr<rrdb_metric_block> & block, _blocks) {
+    int res = my::interval_overlap(block->get_earliest_ts(), block->get_latest_ts(), ts1, ts2);
+    if(res < 0) {
+        break;
+    }
+    if(res == 0) {
+        my::time_t from = std::max(block->get_earliest_ts(), ts1);
+        my::time_t to   = std::min(block->get_latest_ts(), ts2);
+        cost += std::min<my::size_t>((to - from + block->get_freq() - 1) / block->get_freq(), block->get_count());
+    }
+  }
+  return cost;
+}
+
+/**
+ * rrdb_metric::warm_up_block
+ *
+ * Loads the data for the block at the given offset into the tuples cache
+ */
+void rrdb_metric::warm_up_block(
+    const boost::shared_ptr<rrdb_metric_tuples_cache> & tuples_cache,
+    const my::size_t & offset
+) {
+  CHECK_AND_THROW(tuples_cache);
+
+  // find the block and copy it under lock
+  boost::intrusive_ptr<rrdb_metric_block> block, block_copy;
+  my::filename_t filename;
+  {
+    boost::lock_guard<named_lock> guard(_lock);
+    if(my::bitmask_check<boost::uint16_t>(_header._status, Status_Deleted)) {
+        return;
+    }
+
+    BOOST_FOREACH(const boost::intrusive_ptr<rrdb_metric_block> & b, _blocks) {
+      if(b->get_offset() == offset) {
+          block = b;
+          break;
+      }
+    }
+    BOOST_FOREACH(const boost::intrusive_ptr<rrdb_metric_block> & b, _rollups) {
+      if(!block && b->get_offset() == offset) {
+          block = b;
+          break;
+      }
+    }
+    if(!block) {
+        LOG(log::LEVEL_DEBUG, "Block at offset %lu not found in metric '%s'", offset, _name.c_str());
+        return;
+    }
+
+    // nothing to do if we have the data in memory already
+    if(block->is_dirty()) {
+        return;
+    }
+    block_copy.reset(new rrdb_metric_block(*block));
+    filename = _filename;
+  }
+
+  // read the data outside of the lock: if an update or select needs this
+  // block meanwhile then it waits for this load instead of reading it again
+  block_copy->warm_up(block.get(), filename, tuples_cache);
+
+  // the metric might have been deleted while we were reading
+  {
+    boost::lock_guard<named_lock> guard(_lock);
+    if(my::bitmask_check<boost::uint16_t>(_header._status, Status_Deleted)) {
+        tuples_cache->erase(block.get());
+    }
+  }
+}
 
 /**
  * rrdb_metric::load_file
@@ -290,17 +629,15 @@ void rrdb_metric::load_file(const boost::shared_ptr<rrdb_files_cache> & files_ca
   try {
     // get data
     my::filename_t filename(this->get_filename());
-    my::time_t ts(time(NULL));
     CHECK_AND_THROW(filename);
 
-    // open file and seek to the start of the file outside of the lock
-    boost::shared_ptr<std::fstream> fs(files_cache->open_file(filename, ts));
-    fs->seekg(0, fs->beg);
-    fs->sync();
+    // open file outside of the lock: we read it sequentially once so
+    // don't bother with the files cache
+    boost::shared_ptr<std::fstream> fs(rrdb_files_cache::open_file(files_cache->get_full_path(filename)));
 
     // operate on metric data under lock
     {
-      boost::lock_guard<spinlock> guard(_lock);
+      boost::lock_guard<named_lock> guard(_lock);
 
       // check we are good
       CHECK_AND_THROW(_name.empty());
@@ -316,14 +653,20 @@ void rrdb_metric::load_file(const boost::shared_ptr<rrdb_files_cache> & files_ca
       // read header
       this->read_header(*fs);
 
-      // read blocks
+      // read blocks: the rollups follow the policy blocks
       this->_blocks.reserve(this->_header._blocks_size);
       for(my::size_t ii = 0; ii < this->_header._blocks_size; ++ii) {
           boost::intrusive_ptr<rrdb_metric_block> block(new rrdb_metric_block());
           block->read_block(*fs);
 
-          this->_blocks.push_back(block);
+          if(block->is_rollup()) {
+              this->_rollups.push_back(block);
+          } else {
+              CHECK_AND_THROW(this->_rollups.empty());
+              this->_blocks.push_back(block);
+          }
       }
+      CHECK_AND_THROW(!this->_blocks.empty());
 
       // done
       LOG(log::LEVEL_DEBUG, "Loaded metric '%s' from file '%s'", _name.c_str(), _filename->c_str());
@@ -363,12 +706,12 @@ void rrdb_metric::save_file(const boost::shared_ptr<rrdb_files_cache> & files_ca
 
     // operate on metric data under lock
     {
-      boost::lock_guard<spinlock> guard(_lock);
+      boost::lock_guard<named_lock> guard(_lock);
 
       // check we are good
       CHECK_AND_THROW(!_name.empty());
       CHECK_AND_THROW(!_blocks.empty());
-      CHECK_AND_THROW(_blocks.size() == _header._blocks_size);
+      CHECK_AND_THROW(_blocks.size() + _rollups.size() == _header._blocks_size);
       LOG(log::LEVEL_DEBUG, "Saving metric '%s' to file '%s'", _name.c_str(), _filename->c_str());
 
       // not dirty (clear before writing header)
@@ -381,6 +724,9 @@ void rrdb_metric::save_file(const boost::shared_ptr<rrdb_files_cache> & files_ca
       BOOST_FOREACH(boost::intrusive_ptr<rrdb_metric_block> & block, _blocks) {
         block->write_block(*fs);
       }
+      BOOST_FOREACH(boost::intrusive_ptr<rrdb_metric_block> & rollup, _rollups) {
+        rollup->write_block(*fs);
+      }
 
       // flush, don't close
       fs->flush();
@@ -422,16 +768,20 @@ void rrdb_metric::delete_file(
 
   // operate on metric data under lock
   try  {
-    boost::lock_guard<spinlock> guard(_lock);
+    boost::lock_guard<named_lock> guard(_lock);
     LOG(log::LEVEL_DEBUG, "Deleting metric '%s' in file '%s'", _name.c_str(), _filename->c_str());
 
     // mark as deleted in case the flush thread picks it up in the meantime
     my::bitmask_set<boost::uint16_t>(_header._status, Status_Deleted);
+    _results_version = rrdb_metric_next_results_version();
 
     // drop blocks from cache
     BOOST_FOREACH(const boost::intrusive_ptr<rrdb_metric_block> & block, _blocks) {
       tuples_cache->erase(block.get());
     }
+    BOOST_FOREACH(const boost::intrusive_ptr<rrdb_metric_block> & rollup, _rollups) {
+      tuples_cache->erase(rollup.get());
+    }
 
     // delete
     files_cache->delete_file(_filename);
@@ -476,12 +826,12 @@ my::size_t rrdb_metric::save_dirty_blocks(
 
     // operate on the file under lock: one at a time!
     {
-      boost::lock_guard<spinlock> guard(_lock);
+      boost::lock_guard<named_lock> guard(_lock);
 
       // check we are good
       CHECK_AND_THROW(!_name.empty());
       CHECK_AND_THROW(!_blocks.empty());
-      CHECK_AND_THROW(_blocks.size() == _header._blocks_size);
+      CHECK_AND_THROW(_blocks.size() + _rollups.size() == _header._blocks_size);
       LOG(log::LEVEL_DEBUG, "Saving dirty blocks in metric '%s' to file journal file", _name.c_str());
 
       // not dirty (clear before writing header)
@@ -500,6 +850,14 @@ my::size_t rrdb_metric::save_dirty_blocks(
             ++dirty_blocks_count;
         }
       }
+      BOOST_FOREACH(boost::intrusive_ptr<rrdb_metric_block> & rollup, _rollups) {
+        if(rollup->is_dirty()) {
+            written_bytes = rollup->write_block(os);
+            journal_file->add_block(rollup->get_offset(), written_bytes);
+
+            ++dirty_blocks_count;
+        }
+      }
 
       // done
       LOG(log::LEVEL_DEBUG, "Saved dirty blocks in metric '%s' to file journal file", _name.c_str());
@@ -670,3 +1028,39 @@ std::string rrdb_metric::normalize_name(const std::string & str)
   return res;
 }
 
+/**
+ * rrdb_metric::match_name
+ *
+ * Checks if the (normalized) name matches the (normalized) LIKE pattern: '*'
+ * matches any sequence of characters and the whole name should match. The
+ * pattern without wildcards matches all the names that contain it.
+ */
+bool rrdb_metric::match_name(const std::string & like, const std::string & name)
+{
+  if(like.find('*') == std::string::npos) {
+      return name.find(like) != std::string::npos;
+  }
+
+  // glob matching with backtracking to the last '*'
+  std::string::size_type ll = 0, nn = 0;
+  std::string::size_type star = std::string::npos, star_nn = 0;
+  while(nn < name.length()) {
+      if(ll < like.length() && like[ll] == '*') {
+          star    = ll++;
+          star_nn = nn;
+      } else if(ll < like.length() && like[ll] == name[nn]) {
+          ++ll;
+          ++nn;
+      } else if(star != std::string::npos) {
+          ll = star + 1;
+          nn = ++star_nn;
+      } else {
+          return false;
+      }
+  }
+  while(ll < like.length() && like[ll] == '*') {
+      ++ll;
+  }
+  return ll == like.length();
+}
+
@@ -20,7 +20,7 @@
 
 #include "common/types.h"
 #include "common/utils.h"
-#include "common/spinlock.h"
+#include "common/named_lock.h"
 #include "parser/retention_policy.h"
 #include "common/enable_intrusive_ptr.h"
 
@@ -38,7 +38,7 @@ typedef struct t_rrdb_metric_header_ {
   boost::uint16_t   _magic;             // magic bytes (0x99DB)
   boost::uint16_t   _version;           // version (0x01)
   boost::uint16_t   _status;            // status flags
-  boost::uint16_t   _blocks_size;       // number of blocks in the metric (size of _blocks array)
+  boost::uint16_t   _blocks_size;       // number of blocks in the metric (size of _blocks and _rollups arrays)
 
   my::value_t       _last_value;        // the latest value
   my::time_t        _last_value_ts;     // the ts of the latest value
@@ -64,24 +64,25 @@ public:
 
   std::string get_name() const ;
   t_retention_policy get_policy() const;
-  void create(const std::string & name, const t_retention_policy & policy);
+  rrdb::t_rollup_intervals get_rollups() const;
+  void create(const std::string & name, const t_retention_policy & policy, const rrdb::t_rollup_intervals & rollups = rrdb::t_rollup_intervals());
 
   //
   // status
   //
   inline bool is_dirty() const
   {
-    boost::lock_guard<spinlock> guard(_lock);
+    boost::lock_guard<named_lock> guard(_lock);
     return my::bitmask_check<boost::uint16_t>(_header._status, Status_Dirty);
   }
   inline void set_dirty()
   {
-    boost::lock_guard<spinlock> guard(_lock);
+    boost::lock_guard<named_lock> guard(_lock);
     my::bitmask_set<boost::uint16_t>(_header._status, Status_Dirty);
   }
   inline bool is_deleted() const
   {
-    boost::lock_guard<spinlock> guard(_lock);
+    boost::lock_guard<named_lock> guard(_lock);
     return my::bitmask_check<boost::uint16_t>(_header._status, Status_Deleted);
   }
   //
@@ -120,6 +121,10 @@ public:
   static std::string normalize_name(
       const std::string & str
   );
+  static bool match_name(
+      const std::string & like,
+      const std::string & name
+  );
 
   //
   // Operations: update/select
@@ -133,22 +138,42 @@ public:
       const boost::shared_ptr<rrdb_metric_tuples_cache> & tuples_cache,
       const my::time_t & ts1,
       const my::time_t & ts2,
-      rrdb::data_walker & walker
+      rrdb::data_walker & walker,
+      const my::interval_t & group_by = 0
   );
 
+  // the number of tuples in the blocks overlapping [ts1, ts2)
+  my::size_t get_select_cost(
+      const my::time_t & ts1,
+      const my::time_t & ts2
+  ) const;
+
   void get_last_value(my::value_t & value, my::time_t & value_ts) const;
 
+  // the first block's current slot: the data before it changes only with
+  // the late updates which also change the version
+  my::time_t get_sealed_ts(my::size_t & version) const;
+
+  void warm_up_block(
+      const boost::shared_ptr<rrdb_metric_tuples_cache> & tuples_cache,
+      const my::size_t & offset
+  );
+
 private:
+  my::size_t plan_select(const my::time_t & ts1, const my::time_t & ts2, const my::interval_t & group_by) const;
+
   my::size_t write_header(std::ostream & os) const;
   void read_header(std::istream & is);
 
 private:
-  mutable spinlock               _lock;
+  mutable named_lock             _lock;
   t_rrdb_metric_header           _header;
   padded_string                  _name;
   my::filename_t                 _filename;
+  my::size_t                     _results_version;
 
   std::vector< boost::intrusive_ptr<rrdb_metric_block> > _blocks;
+  std::vector< boost::intrusive_ptr<rrdb_metric_block> > _rollups;
 }; // class rrdb_metric
 
 #endif /* RRDB_METRIC_H_ */
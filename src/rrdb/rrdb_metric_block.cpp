@@ -5,6 +5,8 @@
  *      Author: aleksey
  */
 
+#include <algorithm>
+
 #include "rrdb/rrdb_metric_block.h"
 
 #include "rrdb/rrdb_metric.h"
@@ -17,6 +19,41 @@
 
 #define RRDB_METRIC_BLOCK_MAGIC    0xBB99
 
+// how many tuples we convert at once when reading/writing block data
+#define RRDB_METRIC_BLOCK_IO_CHUNK 4096
+
+//
+// Reads the block data from the disk on cache miss
+//
+class rrdb_metric_block_loader :
+    public rrdb_metric_tuples_cache::loader
+{
+public:
+  rrdb_metric_block_loader(
+      const rrdb_metric_block & block,
+      const my::filename_t & filename,
+      const boost::shared_ptr<rrdb_files_cache> & files_cache,
+      const my::time_t & ts
+  ) :
+    _block(block),
+    _filename(filename),
+    _files_cache(files_cache),
+    _ts(ts)
+  {
+  }
+
+  t_rrdb_metric_tuples_ptr load()
+  {
+    return _block.read_block_data(_files_cache->open_file(_filename, _ts));
+  }
+
+private:
+  const rrdb_metric_block &                   _block;
+  const my::filename_t &                      _filename;
+  const boost::shared_ptr<rrdb_files_cache> & _files_cache;
+  const my::time_t &                          _ts;
+}; // rrdb_metric_block_loader
+
 rrdb_metric_block::rrdb_metric_block(
     const rrdb_metric_block_pos_t & freq,
     const rrdb_metric_block_pos_t & count,
@@ -34,9 +71,7 @@ rrdb_metric_block::rrdb_metric_block(
   if(_header._count && _header._data_size) {
       _modified_tuples.reset(new t_rrdb_metric_tuples(_header._count));
       CHECK_AND_THROW(_modified_tuples);
-      CHECK_AND_THROW(_modified_tuples->get());
       CHECK_AND_THROW(_modified_tuples->get_size() == _header._count);
-      CHECK_AND_THROW(_modified_tuples->get_memory_size() == _header._data_size);
   }
 }
 
@@ -56,86 +91,84 @@ t_rrdb_metric_tuples_ptr rrdb_metric_block::get_tuples(
   // very easy case: if we have _modified_tuples then we MUST use
   // them since cache could have purged the data already
   if(_modified_tuples) {
-      CHECK_AND_THROW(_modified_tuples->get());
-
       // notify cache about usage
       tuples_cache->notify_used(this, ts);
       return _modified_tuples;
   }
 
-  // easy case
-  t_rrdb_metric_tuples_ptr the_tuples = tuples_cache->find(this, ts);
-  if(the_tuples) {
-      CHECK_AND_THROW(the_tuples->get());
-      return the_tuples;
-  }
-
-  // hard case: load data from disk
-  const boost::shared_ptr<rrdb_files_cache> & files_cache(tuples_cache->get_files_cache());
-  boost::shared_ptr<std::fstream> ifs(files_cache->open_file(filename, ts));
-  ifs->seekg(this->get_offset_to_data(), ifs->beg);
-  the_tuples = this->read_block_data(*ifs);
+  // find in cache or load data from disk (maybe by another thread)
+  rrdb_metric_block_loader loader(*this, filename, tuples_cache->get_files_cache(), ts);
+  t_rrdb_metric_tuples_ptr the_tuples = tuples_cache->find_or_load(this, filename, ts, loader);
   CHECK_AND_THROW(the_tuples);
-  CHECK_AND_THROW(the_tuples->get());
-
-  // insert into cache and we are done
-  tuples_cache->insert(this, the_tuples, ts);
   return the_tuples;
 }
 
-t_rrdb_metric_tuple * rrdb_metric_block::find_tuple(
+void rrdb_metric_block::warm_up(
+    const rrdb_metric_block * const block,
+    const my::filename_t & filename,
+    const boost::shared_ptr<rrdb_metric_tuples_cache> & tuples_cache
+) const
+{
+  CHECK_AND_THROW(tuples_cache);
+  CHECK_AND_THROW(!_modified_tuples);
+
+  my::time_t ts(time(NULL));
+  rrdb_metric_block_loader loader(*this, filename, tuples_cache->get_files_cache(), ts);
+  tuples_cache->find_or_load(block, filename, ts, loader);
+}
+
+bool rrdb_metric_block::find_tuple(
     t_rrdb_metric_tuples_ptr & the_tuples,
     const t_update_ctx & in,
-    t_update_ctx & out
+    t_update_ctx & out,
+    rrdb_metric_block_pos_t & res
 ) {
   CHECK_AND_THROW(the_tuples);
-  CHECK_AND_THROW(the_tuples->get());
   CHECK_AND_THROW(the_tuples->get_size() == _header._count);
-  CHECK_AND_THROW(the_tuples->get_memory_size() == _header._data_size);
   CHECK_AND_THROW(_header._pos < _header._count);
   CHECK_AND_THROW(_header._freq > 0);
 
   const my::time_t & ts(in.get_ts());
+  my::time_t * ts_column(the_tuples->get_ts_column());
   // LOG(log::LEVEL_DEBUG3, "Looking for tuple in block for ts: %lu", ts);
 
   if(this->get_latest_possible_ts() <= ts) {
       // complete shift forward, notify about rollup
       // copy data here because we are going to destroy these tuples next
       out._state = UpdateState_Tuple;
-      out._tuple = *(the_tuples->get_at(_header._pos));
+      the_tuples->get(_header._pos, out._tuple);
 
       // destroy tuples and start from 0, we assume this ts is
       // the latest
       the_tuples->zero();
-      t_rrdb_metric_tuple * tuple = the_tuples->get_at(0);
       _header._pos      = 0;
-      _header._pos_ts   = tuple->_ts = ts;
+      _header._pos_ts   = ts_column[0] = ts;
 
       // done
-      return tuple;
+      res = 0;
+      return true;
   } else if(this->get_cur_ts() <= ts) {
       // we are somewhere ahead but not too much
-      t_rrdb_metric_tuple * tuple = the_tuples->get_at(_header._pos);
-      my::time_t next_tuple_ts = tuple->_ts + _header._freq;
+      my::time_t next_tuple_ts = ts_column[_header._pos] + _header._freq;
       if(ts < next_tuple_ts) {
           // our current tuple will do
           out._state = UpdateState_Stop;
-          return tuple;
+          res = _header._pos;
+          return true;
       }
 
       // we are shifting forward, notify about rollup
       out._state = UpdateState_Tuple;
-      out._tuple = (*tuple);
+      the_tuples->get(_header._pos, out._tuple);
 
       // find the tuple
       do {
           // move the pointer
           _header._pos = this->get_next_pos(_header._pos);
-          tuple = the_tuples->get_at(_header._pos);
 
           // reset values
-          memset(tuple, 0, sizeof(*tuple));
-          tuple->_ts = _header._pos_ts = next_tuple_ts;
+          the_tuples->zero(_header._pos);
+          ts_column[_header._pos] = _header._pos_ts = next_tuple_ts;
 
           // LOG(log::LEVEL_DEBUG, "Find tuple %p: new pos: %lu, new tuple ts: %lld", this, _header._pos, next_tuple_ts);
 
@@ -144,7 +177,8 @@ t_rrdb_metric_tuple * rrdb_metric_block::find_tuple(
       } while(next_tuple_ts <= ts);
 
       // done
-      return tuple;
+      res = _header._pos;
+      return true;
   } else if(this->get_earliest_ts() <= ts) {
       // we are somewhere behind but not too much, just update the same way
       out = in;
@@ -155,23 +189,23 @@ t_rrdb_metric_tuple * rrdb_metric_block::find_tuple(
           tuple_ts -= _header._freq;
 
           // overwrite tuple ts just in case (it might not be initialized!)
-          t_rrdb_metric_tuple * tuple = the_tuples->get_at(pos);
-          tuple->_ts = tuple_ts;
-          if(ts >= tuple->_ts) {
-              CHECK_AND_THROW(ts < tuple->_ts + _header._freq);
-              return tuple;
+          ts_column[pos] = tuple_ts;
+          if(ts >= tuple_ts) {
+              CHECK_AND_THROW(ts < tuple_ts + _header._freq);
+              res = pos;
+              return true;
           }
       }
 
       // shouldn't happen really but just in case
-      return NULL;
+      return false;
   } else {
       // we are WAY behind, ignore but let the next block try
       out = in;
 
       // done
       CHECK_AND_THROW(ts < this->get_earliest_ts());
-      return NULL;
+      return false;
   }
 }
 
@@ -184,36 +218,38 @@ void rrdb_metric_block::update(
 {
   t_rrdb_metric_tuples_ptr the_tuples(this->get_tuples(filename, tuples_cache));
   CHECK_AND_THROW(the_tuples);
-  CHECK_AND_THROW(the_tuples->get());
   CHECK_AND_THROW(the_tuples->get_size() == _header._count);
-  CHECK_AND_THROW(the_tuples->get_memory_size() == _header._data_size);
-  CHECK_AND_THROW(this->get_cur_ts() == (*the_tuples)[_header._pos]._ts);
+  CHECK_AND_THROW(this->get_cur_ts() == the_tuples->get_ts_column()[_header._pos]);
 
-  t_rrdb_metric_tuple * tuple = this->find_tuple(the_tuples, in, out);
-  if(!tuple) {
+  rrdb_metric_block_pos_t pos;
+  if(!this->find_tuple(the_tuples, in, out, pos)) {
       LOG(log::LEVEL_DEBUG, "Can not find tuple ts: %ld (current block time: %ld, duration: %ld)", in.get_ts(), this->get_cur_ts(), this->get_duration());
       return;
   }
-  CHECK_AND_THROW(tuple->_ts <= in.get_ts());
-  CHECK_AND_THROW(in.get_ts() < tuple->_ts + _header._freq);
+
+  t_rrdb_metric_tuple tuple;
+  the_tuples->get(pos, tuple);
+  CHECK_AND_THROW(tuple._ts <= in.get_ts());
+  CHECK_AND_THROW(in.get_ts() < tuple._ts + _header._freq);
 
   // update our tuple
   switch(in._state) {
   case UpdateState_Value:
-    // LOG(log::LEVEL_DEBUG3, "Update block with single value: tuple ts: %lu, value ts: %lu, value: %f", tuple->_ts, in._ts, in._value);
+    // LOG(log::LEVEL_DEBUG3, "Update block with single value: tuple ts: %lu, value ts: %lu, value: %f", tuple._ts, in._ts, in._value);
 
     // we have single value
-    rrdb_metric_tuple_update(*tuple, in._value);
+    rrdb_metric_tuple_update(tuple, in._value);
     break;
   case UpdateState_Tuple:
-    // LOG(log::LEVEL_DEBUG3, "Update block with another value tuple: tuple ts: %lu, value tuple ts: %lu, value tuple count: %f", tuple->_ts, in._tuple._ts, in._tuple._count);
+    // LOG(log::LEVEL_DEBUG3, "Update block with another value tuple: tuple ts: %lu, value tuple ts: %lu, value tuple count: %f", tuple._ts, in._tuple._ts, in._tuple._count);
 
     // we have another tuple
-    rrdb_metric_tuple_update(*tuple, in._tuple);
+    rrdb_metric_tuple_update(tuple, in._tuple);
     break;
   default:
     throw exception("Unexpected update ctx state %d", in._state);
   }
+  the_tuples->set(pos, tuple);
 
   // remember modified tuples
   _modified_tuples.swap(the_tuples);
@@ -231,18 +267,18 @@ void rrdb_metric_block::select(
 
   t_rrdb_metric_tuples_ptr the_tuples(this->get_tuples(filename, tuples_cache));
   CHECK_AND_THROW(the_tuples);
-  CHECK_AND_THROW(the_tuples->get());
   CHECK_AND_THROW(the_tuples->get_size() == _header._count);
-  CHECK_AND_THROW(the_tuples->get_memory_size() == _header._data_size);
-
 
   // walk through all the tuples until we hit the end or the time stops
+  // looking only at the ts column and hand over runs of matching tuples
+  // (contiguous in memory) to the walker
   // note that logic for checking timestamps in rrdb_metric::select()
   // is very similar
-  rrdb_metric_block_pos_t pos(_header._pos);
+  const my::time_t * ts_column(the_tuples->get_ts_column());
+  rrdb_metric_block_pos_t pos(_header._pos), run_first(0), run_last(0);
+  bool in_run = false;
   do {
-      const t_rrdb_metric_tuple & tuple((*the_tuples)[pos]);
-      int res = my::interval_overlap(tuple._ts, tuple._ts + _header._freq, ts1, ts2);
+      int res = my::interval_overlap(ts_column[pos], ts_column[pos] + _header._freq, ts1, ts2);
       if(res < 0) {
           // [tuple) < [ts1, ts2): tuples are ordered from newest to oldest, so we
           // are done - all the next tuples will be earlier than this one
@@ -250,20 +286,35 @@ void rrdb_metric_block::select(
       }
       if(res ==  0) {
           // res == 0 => tuple and interval intersect!
-          walker.append(tuple, _header._freq);
+          if(!in_run) {
+              run_first = pos;
+              in_run = true;
+          }
+          run_last = pos;
+      } else if(in_run) {
+          walker.append(*the_tuples, run_first, run_last, _header._freq);
+          in_run = false;
+      }
+
+      // the run can't continue past the start of the circular buffer
+      if(pos == 0 && in_run) {
+          walker.append(*the_tuples, run_first, run_last, _header._freq);
+          in_run = false;
       }
 
       // move to prev one
       pos = this->get_prev_pos(pos);
   } while(pos != _header._pos);
+
+  if(in_run) {
+      walker.append(*the_tuples, run_first, run_last, _header._freq);
+  }
 }
 
 my::size_t rrdb_metric_block::write_block(std::ostream & os)
 {
   CHECK_AND_THROW(_modified_tuples);
-  CHECK_AND_THROW(_modified_tuples->get());
   CHECK_AND_THROW(_modified_tuples->get_size() == _header._count);
-  CHECK_AND_THROW(_modified_tuples->get_memory_size() == _header._data_size);
 
   LOG(log::LEVEL_DEBUG3, "RRDB writing block at offset %ld, size %ld", _header._offset, _header._data_size);
   my::size_t written_bytes(0);
@@ -272,14 +323,19 @@ my::size_t rrdb_metric_block::write_block(std::ostream & os)
   if(_header._max_pos < _header._pos) {
       _header._max_pos =_header._pos;
   }
-  CHECK_AND_THROW(_modified_tuples->get_memory_size() >= this->get_disk_data_size());
+  CHECK_AND_THROW(_modified_tuples->get_size() >= this->get_disk_data_count());
 
   // write header
   os.write((const char*)&_header, sizeof(_header));
   written_bytes += sizeof(_header);
 
-  // write data
-  os.write((const char*)_modified_tuples->get(), this->get_disk_data_size());
+  // write data: convert to the array of tuples by chunks
+  std::vector<t_rrdb_metric_tuple> buf(std::min<my::size_t>(RRDB_METRIC_BLOCK_IO_CHUNK, this->get_disk_data_count()));
+  for(my::size_t pos = 0, count = this->get_disk_data_count(); pos < count; pos += buf.size()) {
+      my::size_t n = std::min<my::size_t>(buf.size(), count - pos);
+      _modified_tuples->store(pos, &(buf[0]), n);
+      os.write((const char*)&(buf[0]), n * sizeof(t_rrdb_metric_tuple));
+  }
   written_bytes += this->get_disk_data_size();
 
   // modified tuples no longer needed
@@ -333,36 +389,72 @@ void rrdb_metric_block::read_block(std::istream & is, bool skip_data)
   } else {
       _modified_tuples = this->read_block_data(is);
       CHECK_AND_THROW(_modified_tuples);
-      CHECK_AND_THROW(_modified_tuples->get());
       CHECK_AND_THROW(_modified_tuples->get_size() == _header._count);
-      CHECK_AND_THROW(_modified_tuples->get_memory_size() == _header._data_size);
   }
 }
 
-t_rrdb_metric_tuples_ptr rrdb_metric_block::read_block_data(std::istream & is) const
+t_rrdb_metric_tuples_ptr rrdb_metric_block::create_block_data() const
 {
   LOG(log::LEVEL_DEBUG3, "RRDB metric block read data at offset %ld, size %ld", _header._offset, _header._data_size);
 
   // create data
   t_rrdb_metric_tuples_ptr the_tuples(new t_rrdb_metric_tuples(_header._count));
   CHECK_AND_THROW(the_tuples);
-  CHECK_AND_THROW(the_tuples->get());
   CHECK_AND_THROW(the_tuples->get_size() == _header._count);
-  CHECK_AND_THROW(the_tuples->get_memory_size() == _header._data_size);
-  CHECK_AND_THROW(the_tuples->get_memory_size() >= this->get_disk_data_size());
+  CHECK_AND_THROW(the_tuples->get_size() >= this->get_disk_data_count());
   CHECK_AND_THROW(this->get_disk_data_size());
 
   LOG(log::LEVEL_DEBUG3, "Reading %lu bytes (memory size %lu)", this->get_disk_data_size(), the_tuples->get_memory_size());
 
-  // read data
-  is.read((char*)the_tuples->get(), this->get_disk_data_size());
+  // done
+  return the_tuples;
+}
 
-  // check data
-  if((*the_tuples)[_header._pos]._ts != _header._pos_ts) {
-      throw exception("Unexpected rrdb metric block pos %u pos_ts: %ld (expected from tuple: %ld)",  _header._pos, _header._pos_ts, (*the_tuples)[_header._pos]._ts);
+void rrdb_metric_block::check_block_data(const t_rrdb_metric_tuples_ptr & the_tuples) const
+{
+  const my::time_t & pos_ts(the_tuples->get_ts_column()[_header._pos]);
+  if(pos_ts != _header._pos_ts) {
+      throw exception("Unexpected rrdb metric block pos %u pos_ts: %ld (expected from tuple: %ld)",  _header._pos, _header._pos_ts, pos_ts);
+  }
+}
+
+t_rrdb_metric_tuples_ptr rrdb_metric_block::read_block_data(std::istream & is) const
+{
+  t_rrdb_metric_tuples_ptr the_tuples(this->create_block_data());
+
+  // read data and convert from the array of tuples by chunks
+  std::vector<t_rrdb_metric_tuple> buf(std::min<my::size_t>(RRDB_METRIC_BLOCK_IO_CHUNK, this->get_disk_data_count()));
+  for(my::size_t pos = 0, count = this->get_disk_data_count(); pos < count; pos += buf.size()) {
+      my::size_t n = std::min<my::size_t>(buf.size(), count - pos);
+      is.read((char*)&(buf[0]), n * sizeof(t_rrdb_metric_tuple));
+      the_tuples->load(pos, &(buf[0]), n);
   }
 
+  // check data
+  this->check_block_data(the_tuples);
+
   // done
   return the_tuples;
 }
 
+t_rrdb_metric_tuples_ptr rrdb_metric_block::read_block_data(const rrdb_file_ptr & file) const
+{
+  CHECK_AND_THROW(file);
+
+  t_rrdb_metric_tuples_ptr the_tuples(this->create_block_data());
+
+  // read data: pread() by chunks at the data offset, no seeks
+  std::vector<t_rrdb_metric_tuple> buf(std::min<my::size_t>(RRDB_METRIC_BLOCK_IO_CHUNK, this->get_disk_data_count()));
+  my::size_t offset = this->get_offset_to_data();
+  for(my::size_t pos = 0, count = this->get_disk_data_count(); pos < count; pos += buf.size()) {
+      my::size_t n = std::min<my::size_t>(buf.size(), count - pos);
+      file->read(offset + pos * sizeof(t_rrdb_metric_tuple), (char*)&(buf[0]), n * sizeof(t_rrdb_metric_tuple));
+      the_tuples->load(pos, &(buf[0]), n);
+  }
+
+  // check data
+  this->check_block_data(the_tuples);
+
+  // done
+  return the_tuples;
+}
@@ -17,6 +17,7 @@
 #include <boost/cstdint.hpp>
 
 #include "rrdb/rrdb.h"
+#include "rrdb/rrdb_file.h"
 #include "rrdb/rrdb_metric_tuple.h"
 
 #include "common/types.h"
@@ -60,6 +61,8 @@ typedef struct t_rrdb_metric_block_header_ {
 class rrdb_metric_block:
     public enable_intrusive_ptr<rrdb_metric_block>
 {
+  friend class rrdb_metric_block_loader;
+
 public:
   enum update_state {
     UpdateState_Stop  = 0,
@@ -89,7 +92,8 @@ public:
 
 public:
   enum {
-    Status_LastBlock = 0x0001
+    Status_LastBlock = 0x0001,
+    Status_Rollup    = 0x0002
   };
 
 public:
@@ -113,6 +117,14 @@ public:
   {
     my::bitmask_set<boost::uint16_t>(_header._status, Status_LastBlock);
   }
+  inline bool is_rollup() const
+  {
+    return my::bitmask_check<boost::uint16_t>(_header._status, Status_Rollup);
+  }
+  inline void set_rollup()
+  {
+    my::bitmask_set<boost::uint16_t>(_header._status, Status_Rollup);
+  }
 
   // BLOCK POLICY STUFF
   inline my::interval_t get_freq() const {
@@ -167,6 +179,14 @@ public:
       t_update_ctx & out
   );
 
+  // loads block data into the tuples cache: called on the copy of the block
+  // made under the metric lock so we don't hold the lock while reading
+  void warm_up(
+      const rrdb_metric_block * const block,
+      const my::filename_t & filename,
+      const boost::shared_ptr<rrdb_metric_tuples_cache> & tuples_cache
+  ) const;
+
   // READ/WRITE FILES
   my::size_t write_block(std::ostream & os);
   void read_block(std::istream & is, bool skip_data = true);
@@ -177,15 +197,21 @@ private:
       const boost::shared_ptr<rrdb_metric_tuples_cache> & tuples_cache
   );
 
-  t_rrdb_metric_tuple * find_tuple(
+  bool find_tuple(
       t_rrdb_metric_tuples_ptr & the_tuples,
       const t_update_ctx & in,
-      t_update_ctx & out
+      t_update_ctx & out,
+      rrdb_metric_block_pos_t & res
   );
 
+  t_rrdb_metric_tuples_ptr create_block_data() const;
+  void check_block_data(const t_rrdb_metric_tuples_ptr & the_tuples) const;
   t_rrdb_metric_tuples_ptr read_block_data(
       std::istream & is
   ) const;
+  t_rrdb_metric_tuples_ptr read_block_data(
+      const rrdb_file_ptr & file
+  ) const;
 
   inline rrdb_metric_block_pos_t get_next_pos(const rrdb_metric_block_pos_t & pos) const {
     rrdb_metric_block_pos_t new_pos = pos + 1;
@@ -202,8 +228,11 @@ private:
   inline my::size_t get_data_size() const {
     return _header._data_size;
   }
+  inline my::size_t get_disk_data_count() const {
+    return this->is_last_block() ? (_header._max_pos + 1) : _header._count;
+  }
   inline my::size_t get_disk_data_size() const {
-    return this->is_last_block() ? (sizeof(t_rrdb_metric_tuple) * ( _header._max_pos + 1)) : _header._data_size;
+    return sizeof(t_rrdb_metric_tuple) * this->get_disk_data_count();
   }
 
 private:
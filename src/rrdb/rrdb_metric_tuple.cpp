@@ -7,10 +7,12 @@
 #include <ostream>
 #include <cmath>
 #include <boost/foreach.hpp>
+#include <boost/static_assert.hpp>
 
 #include "rrdb/rrdb_metric_tuple.h"
 
 #include "common/log.h"
+#include "common/text_buffer.h"
 
 void rrdb_metric_tuple_update(t_rrdb_metric_tuple & tuple, const my::value_t & value)
 {
@@ -60,10 +62,11 @@ void rrdb_metric_tuple_write_header(
     t_memory_buffer & res
 ) {
   // ts is always first
-  res << "ts,";
+  res << "ts";
 
   // field names
   BOOST_FOREACH(const t_tuple_field_extractor & func, expr_list) {
+    res << ',';
     func(NULL, res);
   }
 
@@ -77,10 +80,11 @@ void rrdb_metric_tuple_write_tuple(
     t_memory_buffer & res
 ) {
   // ts is always first
-  res << tuple._ts << ",";
+  res << tuple._ts;
 
   // fields
   BOOST_FOREACH(const t_tuple_field_extractor & func, expr_list) {
+    res << ',';
     func(&tuple, res);
   }
 
@@ -208,3 +212,357 @@ void rrdb_metric_tuple_write_stddev(t_rrdb_metric_tuple const * tuple, t_memory_
   // write
   res  << stddev;
 }
+
+my::value_t rrdb_metric_tuple_get_min(t_rrdb_metric_tuple const & tuple)
+{
+  return tuple._min;
+}
+
+my::value_t rrdb_metric_tuple_get_max(t_rrdb_metric_tuple const & tuple)
+{
+  return tuple._max;
+}
+
+my::value_t rrdb_metric_tuple_get_avg(t_rrdb_metric_tuple const & tuple)
+{
+  return (tuple._count > 0) ? tuple._sum / tuple._count : 0;
+}
+
+my::value_t rrdb_metric_tuple_get_sum(t_rrdb_metric_tuple const & tuple)
+{
+  return tuple._sum;
+}
+
+my::value_t rrdb_metric_tuple_get_count(t_rrdb_metric_tuple const & tuple)
+{
+  return tuple._count;
+}
+
+my::value_t rrdb_metric_tuple_get_stddev(t_rrdb_metric_tuple const & tuple)
+{
+  if(tuple._count <= 0) {
+      return 0;
+  }
+
+  my::value_t avg = tuple._sum / tuple._count;
+  return sqrt(tuple._sum_sqr / tuple._count - avg * avg);
+}
+
+void rrdb_metric_tuple_aggregate_update(
+    const t_tuple_aggregate_list & expr_list,
+    const t_rrdb_metric_tuple & tuple,
+    const my::size_t & num,
+    std::vector<my::value_t> & values
+) {
+  values.resize(expr_list.size());
+  for(my::size_t ii = 0; ii < expr_list.size(); ++ii) {
+      my::value_t value = expr_list[ii]._field(tuple);
+      if(num == 0) {
+          values[ii] = value;
+          continue;
+      }
+
+      switch(expr_list[ii]._func) {
+      case Aggregate_Sum:
+      case Aggregate_Avg:
+        values[ii] += value;
+        break;
+      case Aggregate_Min:
+        if(values[ii] > value) {
+            values[ii] = value;
+        }
+        break;
+      case Aggregate_Max:
+        if(values[ii] < value) {
+            values[ii] = value;
+        }
+        break;
+      case Aggregate_Count:
+        // we count tuples, not values
+        break;
+      default:
+        throw exception("Unexpected aggregate function %d", expr_list[ii]._func);
+      }
+  }
+}
+
+static const char * rrdb_metric_tuple_get_aggregate_func_name(const t_tuple_aggregate_func & func)
+{
+  switch(func) {
+  case Aggregate_Sum:   return "sum";
+  case Aggregate_Avg:   return "avg";
+  case Aggregate_Min:   return "min";
+  case Aggregate_Max:   return "max";
+  case Aggregate_Count: return "count";
+  default:
+    throw exception("Unexpected aggregate function %d", func);
+  }
+}
+
+static const char * rrdb_metric_tuple_get_field_name(const t_tuple_field_getter & field)
+{
+  if(field == &rrdb_metric_tuple_get_min)    return "min";
+  if(field == &rrdb_metric_tuple_get_max)    return "max";
+  if(field == &rrdb_metric_tuple_get_avg)    return "avg";
+  if(field == &rrdb_metric_tuple_get_sum)    return "sum";
+  if(field == &rrdb_metric_tuple_get_count)  return "count";
+  if(field == &rrdb_metric_tuple_get_stddev) return "stddev";
+  throw exception("Unexpected field");
+}
+
+void rrdb_metric_tuple_write_aggregate_header(
+    const t_tuple_aggregate_list & expr_list,
+    text_buffer & res
+) {
+  // ts is always first
+  res.append("ts", 2);
+
+  // function(field) names
+  BOOST_FOREACH(const t_tuple_aggregate_expr & expr, expr_list) {
+    res.append(',')
+       .append(rrdb_metric_tuple_get_aggregate_func_name(expr._func))
+       .append('(')
+       .append(rrdb_metric_tuple_get_field_name(expr._field))
+       .append(')');
+  }
+
+  // end of record/line
+  res.append('\n');
+}
+
+static inline my::value_t rrdb_metric_tuple_get_aggregate_value(
+    const t_tuple_aggregate_expr & expr,
+    const my::value_t & value,
+    const my::size_t & num
+) {
+  switch(expr._func) {
+  case Aggregate_Avg:
+    return value / num;
+  case Aggregate_Count:
+    return num;
+  default:
+    return value;
+  }
+}
+
+void rrdb_metric_tuple_write_aggregate(
+    const t_tuple_aggregate_list & expr_list,
+    const my::time_t & ts,
+    const std::vector<my::value_t> & values,
+    const my::size_t & num,
+    text_buffer & res
+) {
+  CHECK_AND_THROW(num > 0);
+  CHECK_AND_THROW(values.size() == expr_list.size());
+
+  // ts is always first
+  res.append((boost::uint64_t)ts);
+
+  // values
+  for(my::size_t ii = 0; ii < expr_list.size(); ++ii) {
+      res.append(',').append(rrdb_metric_tuple_get_aggregate_value(expr_list[ii], values[ii], num));
+  }
+
+  // end of record/line
+  res.append('\n');
+}
+
+//
+// CSV format through the text buffer
+//
+void rrdb_metric_tuple_write_csv_header(
+    const t_tuple_column_list & columns,
+    text_buffer & res
+) {
+  // ts is always first
+  res.append("ts", 2);
+
+  // column names
+  BOOST_FOREACH(const t_tuple_column & column, columns) {
+    res.append(',').append(column._name);
+  }
+
+  // end of record/line
+  res.append('\n');
+}
+
+void rrdb_metric_tuple_write_csv_tuple(
+    const t_tuple_column_list & columns,
+    const t_rrdb_metric_tuple & tuple,
+    text_buffer & res
+) {
+  // ts is always first
+  res.append((boost::uint64_t)tuple._ts);
+
+  // values
+  BOOST_FOREACH(const t_tuple_column & column, columns) {
+    res.append(',').append(column._getter(tuple));
+  }
+
+  // end of record/line
+  res.append('\n');
+}
+
+//
+// Binary format: everything is little-endian, strings are (uint32 length, bytes)
+//
+static inline char * rrdb_metric_tuple_binary_put_uint32(char * buf, boost::uint32_t v)
+{
+  for(int ii = 0; ii < 4; ++ii, v >>= 8) {
+      *(buf++) = (char)(v & 0xFF);
+  }
+  return buf;
+}
+
+static inline char * rrdb_metric_tuple_binary_put_uint64(char * buf, boost::uint64_t v)
+{
+  for(int ii = 0; ii < 8; ++ii, v >>= 8) {
+      *(buf++) = (char)(v & 0xFF);
+  }
+  return buf;
+}
+
+static inline char * rrdb_metric_tuple_binary_put_double(char * buf, const my::value_t & v)
+{
+  BOOST_STATIC_ASSERT(sizeof(my::value_t) == sizeof(boost::uint64_t));
+
+  boost::uint64_t u;
+  memcpy(&u, &v, sizeof(u));
+  return rrdb_metric_tuple_binary_put_uint64(buf, u);
+}
+
+static void rrdb_metric_tuple_binary_write_string(const std::string & str, t_memory_buffer & res)
+{
+  char buf[4];
+  rrdb_metric_tuple_binary_put_uint32(buf, str.length());
+  res.write(buf, sizeof(buf));
+  res.write(str.data(), str.length());
+}
+
+static void rrdb_metric_tuple_binary_write_strings(const std::vector<std::string> & strs, t_memory_buffer & res)
+{
+  char buf[4];
+  rrdb_metric_tuple_binary_put_uint32(buf, strs.size());
+  res.write(buf, sizeof(buf));
+  BOOST_FOREACH(const std::string & str, strs) {
+    rrdb_metric_tuple_binary_write_string(str, res);
+  }
+}
+
+void rrdb_metric_tuple_get_columns(
+    const t_tuple_expr_list & expr_list,
+    t_tuple_column_list & columns
+) {
+  static const t_tuple_column all_columns[] = {
+      { "count",  &rrdb_metric_tuple_get_count  },
+      { "sum",    &rrdb_metric_tuple_get_sum    },
+      { "avg",    &rrdb_metric_tuple_get_avg    },
+      { "stddev", &rrdb_metric_tuple_get_stddev },
+      { "min",    &rrdb_metric_tuple_get_min    },
+      { "max",    &rrdb_metric_tuple_get_max    }
+  };
+  static const my::size_t all_columns_num = sizeof(all_columns) / sizeof(all_columns[0]);
+
+  columns.clear();
+  BOOST_FOREACH(const t_tuple_field_extractor & func, expr_list) {
+    if(func == &rrdb_metric_tuple_write_all) {
+        columns.insert(columns.end(), all_columns, all_columns + all_columns_num);
+    } else if(func == &rrdb_metric_tuple_write_count) {
+        columns.push_back(all_columns[0]);
+    } else if(func == &rrdb_metric_tuple_write_sum) {
+        columns.push_back(all_columns[1]);
+    } else if(func == &rrdb_metric_tuple_write_avg) {
+        columns.push_back(all_columns[2]);
+    } else if(func == &rrdb_metric_tuple_write_stddev) {
+        columns.push_back(all_columns[3]);
+    } else if(func == &rrdb_metric_tuple_write_min) {
+        columns.push_back(all_columns[4]);
+    } else if(func == &rrdb_metric_tuple_write_max) {
+        columns.push_back(all_columns[5]);
+    } else {
+        throw exception("Unexpected select field");
+    }
+  }
+}
+
+void rrdb_metric_tuple_write_binary_header(
+    const std::vector<std::string> & names,
+    const std::vector<std::string> & columns,
+    t_memory_buffer & res
+) {
+  char buf[8];
+  memcpy(buf, RRDB_BINARY_FORMAT_MAGIC, 4);
+  rrdb_metric_tuple_binary_put_uint32(buf + 4, RRDB_BINARY_FORMAT_VERSION);
+  res.write(buf, sizeof(buf));
+
+  rrdb_metric_tuple_binary_write_strings(names, res);
+  rrdb_metric_tuple_binary_write_strings(columns, res);
+}
+
+void rrdb_metric_tuple_write_binary_header(
+    const std::vector<std::string> & names,
+    const t_tuple_column_list & columns,
+    t_memory_buffer & res
+) {
+  std::vector<std::string> column_names;
+  column_names.reserve(columns.size());
+  BOOST_FOREACH(const t_tuple_column & column, columns) {
+    column_names.push_back(column._name);
+  }
+  rrdb_metric_tuple_write_binary_header(names, column_names, res);
+}
+
+void rrdb_metric_tuple_write_binary_header(
+    const t_tuple_aggregate_list & expr_list,
+    t_memory_buffer & res
+) {
+  std::vector<std::string> column_names;
+  column_names.reserve(expr_list.size());
+  BOOST_FOREACH(const t_tuple_aggregate_expr & expr, expr_list) {
+    column_names.push_back(
+        std::string(rrdb_metric_tuple_get_aggregate_func_name(expr._func)) +
+        "(" + rrdb_metric_tuple_get_field_name(expr._field) + ")"
+    );
+  }
+  rrdb_metric_tuple_write_binary_header(std::vector<std::string>(), column_names, res);
+}
+
+void rrdb_metric_tuple_write_binary_tuple(
+    const t_tuple_column_list & columns,
+    const t_rrdb_metric_tuple & tuple,
+    const my::size_t * metric_idx,
+    t_memory_buffer & res
+) {
+  // the whole row in one write
+  char buf[4 + 8 + 8 * 32];
+  CHECK_AND_THROW(columns.size() <= 32);
+
+  char * ptr = buf;
+  if(metric_idx) {
+      ptr = rrdb_metric_tuple_binary_put_uint32(ptr, *metric_idx);
+  }
+  ptr = rrdb_metric_tuple_binary_put_uint64(ptr, tuple._ts);
+  BOOST_FOREACH(const t_tuple_column & column, columns) {
+    ptr = rrdb_metric_tuple_binary_put_double(ptr, column._getter(tuple));
+  }
+  res.write(buf, ptr - buf);
+}
+
+void rrdb_metric_tuple_write_binary_aggregate(
+    const t_tuple_aggregate_list & expr_list,
+    const my::time_t & ts,
+    const std::vector<my::value_t> & values,
+    const my::size_t & num,
+    t_memory_buffer & res
+) {
+  CHECK_AND_THROW(num > 0);
+  CHECK_AND_THROW(values.size() == expr_list.size());
+
+  char buf[8];
+  rrdb_metric_tuple_binary_put_uint64(buf, ts);
+  res.write(buf, sizeof(buf));
+  for(my::size_t ii = 0; ii < expr_list.size(); ++ii) {
+      rrdb_metric_tuple_binary_put_double(buf, rrdb_metric_tuple_get_aggregate_value(expr_list[ii], values[ii], num));
+      res.write(buf, sizeof(buf));
+  }
+}
@@ -8,6 +8,12 @@
 #ifndef RRDB_METRIC_TUPLE_H_
 #define RRDB_METRIC_TUPLE_H_
 
+#include <stdlib.h>
+#include <string.h>
+
+#include <string>
+#include <vector>
+
 #include <boost/cstdint.hpp>
 #include <boost/function.hpp>
 
@@ -17,6 +23,8 @@
 #include "common/memory_buffer.h"
 #include "common/enable_intrusive_ptr.h"
 
+class text_buffer;
+
 //
 // Value
 //
@@ -29,62 +37,116 @@ typedef struct t_rrdb_metric_tuple_ {
   my::value_t   _max;               // max(data point value)
 } t_rrdb_metric_tuple;
 
+//
+// Tuples for a block stored as separate cache line aligned columns
+// (structure of arrays) so scans only touch the fields they need. On
+// disk tuples are an array of t_rrdb_metric_tuple, we convert on load/store.
+//
 typedef struct t_rrdb_metric_tuples_ :
     public enable_intrusive_ptr<t_rrdb_metric_tuples_>
 {
   typedef my::size_t size_type;
 
+  enum {
+    Column_Alignment = 64,   // cache line
+    Columns_Num      = 6     // ts, count, sum, sum_sqr, min, max
+  };
+
 public:
   // constuctor/destructor
   inline t_rrdb_metric_tuples_(const size_type & size = 0) :
-    _tuples(NULL),
-    _size(0)
+    _data(NULL),
+    _size(0),
+    _column_size(0)
   {
     if(size > 0) {
-        this->reset(new t_rrdb_metric_tuple[size](), size);
+        // round up each column to the cache line
+        _column_size = ((size * sizeof(my::value_t) + Column_Alignment - 1) / Column_Alignment) * Column_Alignment;
+        if(posix_memalign(&_data, Column_Alignment, Columns_Num * _column_size) != 0) {
+            throw exception("Unable to allocate %lu tuples", size);
+        }
+        _size = size;
         this->zero();
     }
   }
   inline ~t_rrdb_metric_tuples_()
   {
-    this->reset();
+    if(_data) {
+        free(_data);
+    }
   }
 
   inline void zero()
   {
-    // shouldn't be doing it in C++ but it's the fastest way
-    if(_tuples) {
-        memset(this->get(), 0, this->get_memory_size());
+    if(_data) {
+        memset(_data, 0, this->get_memory_size());
     }
   }
 
-  // access
-  inline t_rrdb_metric_tuple & operator[] (const size_type & pos)
+  inline void zero(const size_type & pos)
   {
     CHECK_AND_THROW(pos < _size);
-    return _tuples[pos];
-  }
-  inline const t_rrdb_metric_tuple& operator[] (const size_type & pos) const
-  {
-    CHECK_AND_THROW(pos < _size);
-    return _tuples[pos];
+    this->get_ts_column()[pos]      = 0;
+    this->get_count_column()[pos]   = 0;
+    this->get_sum_column()[pos]     = 0;
+    this->get_sum_sqr_column()[pos] = 0;
+    this->get_min_column()[pos]     = 0;
+    this->get_max_column()[pos]     = 0;
   }
 
   inline size_type get_size() const { return _size; }
-  inline size_type get_memory_size() const { return get_size() * sizeof(t_rrdb_metric_tuple); }
+  inline size_type get_memory_size() const { return Columns_Num * _column_size; }
 
-  inline t_rrdb_metric_tuple * get() { return _tuples; }
-  inline t_rrdb_metric_tuple const * get() const { return _tuples; }
+  // columns
+  inline my::time_t * get_ts_column()                { return (my::time_t*)this->get_column(0); }
+  inline const my::time_t * get_ts_column() const    { return (const my::time_t*)this->get_column(0); }
+  inline my::value_t * get_count_column()              { return (my::value_t*)this->get_column(1); }
+  inline const my::value_t * get_count_column() const  { return (const my::value_t*)this->get_column(1); }
+  inline my::value_t * get_sum_column()                { return (my::value_t*)this->get_column(2); }
+  inline const my::value_t * get_sum_column() const    { return (const my::value_t*)this->get_column(2); }
+  inline my::value_t * get_sum_sqr_column()            { return (my::value_t*)this->get_column(3); }
+  inline const my::value_t * get_sum_sqr_column() const { return (const my::value_t*)this->get_column(3); }
+  inline my::value_t * get_min_column()                { return (my::value_t*)this->get_column(4); }
+  inline const my::value_t * get_min_column() const    { return (const my::value_t*)this->get_column(4); }
+  inline my::value_t * get_max_column()                { return (my::value_t*)this->get_column(5); }
+  inline const my::value_t * get_max_column() const    { return (const my::value_t*)this->get_column(5); }
 
-  inline t_rrdb_metric_tuple * get_at(const size_type & pos)
+  // single tuple access
+  inline void get(const size_type & pos, t_rrdb_metric_tuple & tuple) const
   {
     CHECK_AND_THROW(pos < _size);
-    return &(_tuples[pos]);
+    tuple._ts      = this->get_ts_column()[pos];
+    tuple._count   = this->get_count_column()[pos];
+    tuple._sum     = this->get_sum_column()[pos];
+    tuple._sum_sqr = this->get_sum_sqr_column()[pos];
+    tuple._min     = this->get_min_column()[pos];
+    tuple._max     = this->get_max_column()[pos];
   }
-  inline t_rrdb_metric_tuple const * get_at(const size_type & pos) const
+  inline void set(const size_type & pos, const t_rrdb_metric_tuple & tuple)
   {
     CHECK_AND_THROW(pos < _size);
-    return &(_tuples[pos]);
+    this->get_ts_column()[pos]      = tuple._ts;
+    this->get_count_column()[pos]   = tuple._count;
+    this->get_sum_column()[pos]     = tuple._sum;
+    this->get_sum_sqr_column()[pos] = tuple._sum_sqr;
+    this->get_min_column()[pos]     = tuple._min;
+    this->get_max_column()[pos]     = tuple._max;
+  }
+
+  // conversion from/to the array of tuples (disk format)
+  inline void load(const size_type & pos, const t_rrdb_metric_tuple * tuples, const size_type & count)
+  {
+    CHECK_AND_THROW(pos + count <= _size);
+    for(size_type ii = 0; ii < count; ++ii) {
+        this->set(pos + ii, tuples[ii]);
+    }
+  }
+  inline void store(const size_type & pos, t_rrdb_metric_tuple * tuples, const size_type & count) const
+  {
+    CHECK_AND_THROW(pos + count <= _size);
+    for(size_type ii = 0; ii < count; ++ii) {
+        this->get(pos + ii, tuples[ii]);
+    }
   }
 
 private:
@@ -92,19 +154,15 @@ private:
   t_rrdb_metric_tuples_(t_rrdb_metric_tuples_ const &);
   t_rrdb_metric_tuples_ &operator =(t_rrdb_metric_tuples_ const &);
 
-  // assign tuples
-  inline void reset(t_rrdb_metric_tuple * tuples = NULL, const size_type & size = 0)
+  inline char * get_column(const size_type & n) const
   {
-    if(_tuples) {
-        delete[] _tuples;
-    }
-    _tuples = tuples;
-    _size = size;
+    return ((char*)_data) + n * _column_size;
   }
 
 private:
-  t_rrdb_metric_tuple * _tuples;
-  size_type             _size;
+  void *     _data;
+  size_type  _size;
+  size_type  _column_size;
 } t_rrdb_metric_tuples;
 
 // and the actual thing we are going to use
@@ -117,12 +175,53 @@ typedef boost::intrusive_ptr< t_rrdb_metric_tuples > t_rrdb_metric_tuples_ptr;
 typedef void (*t_tuple_field_extractor)(t_rrdb_metric_tuple const * tuple, t_memory_buffer & res);
 typedef std::vector<t_tuple_field_extractor> t_tuple_expr_list;
 
+//
+// Cross-metric aggregation (e.g. "SUM(avg)"): the field value is taken
+// from each metric's tuple and then aggregated across the metrics
+//
+typedef my::value_t (*t_tuple_field_getter)(t_rrdb_metric_tuple const & tuple);
+
+typedef enum {
+  Aggregate_Sum = 0,
+  Aggregate_Avg,
+  Aggregate_Min,
+  Aggregate_Max,
+  Aggregate_Count
+} t_tuple_aggregate_func;
+
+typedef struct t_tuple_aggregate_expr_ {
+  t_tuple_aggregate_func _func;
+  t_tuple_field_getter   _field;
+} t_tuple_aggregate_expr;
+typedef std::vector<t_tuple_aggregate_expr> t_tuple_aggregate_list;
+
+//
+// Query results format: CSV (default) or binary frame (see LANGUAGE.md)
+//
+typedef enum {
+  Format_Csv = 0,
+  Format_Binary
+} t_result_format;
+
+//
+// CSV and binary formats: all the selected fields as separate columns
+//
+typedef struct t_tuple_column_ {
+  const char *           _name;
+  t_tuple_field_getter   _getter;
+} t_tuple_column;
+typedef std::vector<t_tuple_column> t_tuple_column_list;
+
+#define RRDB_BINARY_FORMAT_MAGIC    "RRDB"
+#define RRDB_BINARY_FORMAT_VERSION  1
+
 // helper functions for updating tuple values
 void rrdb_metric_tuple_update(t_rrdb_metric_tuple & tuple, const my::value_t & value);
 void rrdb_metric_tuple_update(t_rrdb_metric_tuple & tuple, const t_rrdb_metric_tuple & other);
 void rrdb_metric_tuple_update(t_rrdb_metric_tuple & tuple, const t_rrdb_metric_tuple & other, const my::value_t & factor);
 
-// helper function for writing tuple out
+// helper functions for writing tuple out through the iostream
+// (slow, see rrdb_metric_tuple_write_csv_tuple() below)
 void rrdb_metric_tuple_write_header(
     const t_tuple_expr_list & expr_list,
     t_memory_buffer & res
@@ -134,6 +233,81 @@ void rrdb_metric_tuple_write_tuple(
 );
 
 
+// helper functions for cross-metric aggregation: values[] is updated with
+// the tuple (num is the number of tuples already aggregated for this ts)
+void rrdb_metric_tuple_aggregate_update(
+    const t_tuple_aggregate_list & expr_list,
+    const t_rrdb_metric_tuple & tuple,
+    const my::size_t & num,
+    std::vector<my::value_t> & values
+);
+void rrdb_metric_tuple_write_aggregate_header(
+    const t_tuple_aggregate_list & expr_list,
+    text_buffer & res
+);
+void rrdb_metric_tuple_write_aggregate(
+    const t_tuple_aggregate_list & expr_list,
+    const my::time_t & ts,
+    const std::vector<my::value_t> & values,
+    const my::size_t & num,
+    text_buffer & res
+);
+
+// helper functions for writing CSV results through the text buffer
+void rrdb_metric_tuple_get_columns(
+    const t_tuple_expr_list & expr_list,
+    t_tuple_column_list & columns
+);
+void rrdb_metric_tuple_write_csv_header(
+    const t_tuple_column_list & columns,
+    text_buffer & res
+);
+void rrdb_metric_tuple_write_csv_tuple(
+    const t_tuple_column_list & columns,
+    const t_rrdb_metric_tuple & tuple,
+    text_buffer & res
+);
+
+// helper functions for writing binary results: the header lists metric
+// names (if any) and column names, each row is [metric index] ts values...
+void rrdb_metric_tuple_write_binary_header(
+    const std::vector<std::string> & names,
+    const std::vector<std::string> & columns,
+    t_memory_buffer & res
+);
+void rrdb_metric_tuple_write_binary_header(
+    const std::vector<std::string> & names,
+    const t_tuple_column_list & columns,
+    t_memory_buffer & res
+);
+void rrdb_metric_tuple_write_binary_header(
+    const t_tuple_aggregate_list & expr_list,
+    t_memory_buffer & res
+);
+void rrdb_metric_tuple_write_binary_tuple(
+    const t_tuple_column_list & columns,
+    const t_rrdb_metric_tuple & tuple,
+    const my::size_t * metric_idx,
+    t_memory_buffer & res
+);
+void rrdb_metric_tuple_write_binary_aggregate(
+    const t_tuple_aggregate_list & expr_list,
+    const my::time_t & ts,
+    const std::vector<my::value_t> & values,
+    const my::size_t & num,
+    t_memory_buffer & res
+);
+
+//
+// these functions must match t_tuple_field_getter declaration
+//
+my::value_t rrdb_metric_tuple_get_min(t_rrdb_metric_tuple const & tuple);
+my::value_t rrdb_metric_tuple_get_max(t_rrdb_metric_tuple const & tuple);
+my::value_t rrdb_metric_tuple_get_avg(t_rrdb_metric_tuple const & tuple);
+my::value_t rrdb_metric_tuple_get_sum(t_rrdb_metric_tuple const & tuple);
+my::value_t rrdb_metric_tuple_get_count(t_rrdb_metric_tuple const & tuple);
+my::value_t rrdb_metric_tuple_get_stddev(t_rrdb_metric_tuple const & tuple);
+
 //
 // these functions must match t_tuple_field_extractor declaration
 //
@@ -0,0 +1,241 @@
+/*
+ * rrdb_metric_tuples_aggregate.cpp
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: aleksey
+ */
+#include <string>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define RRDB_AGGREGATE_X86 1
+#include <immintrin.h>
+#endif
+
+#include "rrdb/rrdb_metric_tuples_aggregate.h"
+
+#include "common/exception.h"
+
+//
+// Reference implementation: one tuple at a time
+//
+static void rrdb_metric_tuples_aggregate_scalar(
+    t_rrdb_metric_tuple & tuple,
+    const t_rrdb_metric_tuples & tuples,
+    const my::size_t & first_pos,
+    const my::size_t & last_pos
+) {
+  CHECK_AND_THROW(last_pos <= first_pos && first_pos < tuples.get_size());
+
+  t_rrdb_metric_tuple other;
+  for(my::size_t pos = first_pos + 1; pos-- > last_pos; ) {
+      tuples.get(pos, other);
+      rrdb_metric_tuple_update(tuple, other);
+  }
+}
+
+//
+// rrdb_metric_tuple_update() resets min/max while the tuple is empty: find
+// the first (in the walk order) position that contributes to the min/max
+// and initialize the tuple from it if needed
+//
+static inline my::size_t rrdb_metric_tuples_aggregate_min_max_first(
+    t_rrdb_metric_tuple & tuple,
+    const t_rrdb_metric_tuples & tuples,
+    const my::size_t & first_pos,
+    const my::size_t & last_pos
+) {
+  if(tuple._count != 0) {
+      return first_pos;
+  }
+
+  const my::value_t * count(tuples.get_count_column());
+  my::size_t pos = first_pos;
+  while(pos > last_pos && count[pos] == 0) {
+      --pos;
+  }
+  tuple._min = tuples.get_min_column()[pos];
+  tuple._max = tuples.get_max_column()[pos];
+  return pos;
+}
+
+#ifdef RRDB_AGGREGATE_X86
+
+//
+// SSE2: 2 doubles at a time
+//
+__attribute__((target("sse2")))
+static void rrdb_metric_tuples_aggregate_sse2(
+    t_rrdb_metric_tuple & tuple,
+    const t_rrdb_metric_tuples & tuples,
+    const my::size_t & first_pos,
+    const my::size_t & last_pos
+) {
+  CHECK_AND_THROW(last_pos <= first_pos && first_pos < tuples.get_size());
+
+  // count, sum, sum_sqr for all tuples
+  const my::value_t * count(tuples.get_count_column());
+  const my::value_t * sum(tuples.get_sum_column());
+  const my::value_t * sum_sqr(tuples.get_sum_sqr_column());
+  __m128d v_count   = _mm_setzero_pd();
+  __m128d v_sum     = _mm_setzero_pd();
+  __m128d v_sum_sqr = _mm_setzero_pd();
+  my::size_t pos = last_pos;
+  for(; pos + 2 <= first_pos + 1; pos += 2) {
+      v_count   = _mm_add_pd(v_count,   _mm_loadu_pd(count + pos));
+      v_sum     = _mm_add_pd(v_sum,     _mm_loadu_pd(sum + pos));
+      v_sum_sqr = _mm_add_pd(v_sum_sqr, _mm_loadu_pd(sum_sqr + pos));
+  }
+  double buf[2];
+  my::value_t s_count, s_sum, s_sum_sqr;
+  _mm_storeu_pd(buf, v_count);   s_count   = buf[0] + buf[1];
+  _mm_storeu_pd(buf, v_sum);     s_sum     = buf[0] + buf[1];
+  _mm_storeu_pd(buf, v_sum_sqr); s_sum_sqr = buf[0] + buf[1];
+  for(; pos <= first_pos; ++pos) {
+      s_count   += count[pos];
+      s_sum     += sum[pos];
+      s_sum_sqr += sum_sqr[pos];
+  }
+
+  // min, max only for the tuples after the first non-empty one
+  my::size_t min_max_first = rrdb_metric_tuples_aggregate_min_max_first(tuple, tuples, first_pos, last_pos);
+  const my::value_t * min(tuples.get_min_column());
+  const my::value_t * max(tuples.get_max_column());
+  __m128d v_min = _mm_set1_pd(tuple._min);
+  __m128d v_max = _mm_set1_pd(tuple._max);
+  for(pos = last_pos; pos + 2 <= min_max_first + 1; pos += 2) {
+      v_min = _mm_min_pd(v_min, _mm_loadu_pd(min + pos));
+      v_max = _mm_max_pd(v_max, _mm_loadu_pd(max + pos));
+  }
+  my::value_t s_min, s_max;
+  _mm_storeu_pd(buf, v_min); s_min = buf[0] < buf[1] ? buf[0] : buf[1];
+  _mm_storeu_pd(buf, v_max); s_max = buf[0] > buf[1] ? buf[0] : buf[1];
+  for(; pos <= min_max_first; ++pos) {
+      if(s_min > min[pos]) s_min = min[pos];
+      if(s_max < max[pos]) s_max = max[pos];
+  }
+
+  // done
+  tuple._count   += s_count;
+  tuple._sum     += s_sum;
+  tuple._sum_sqr += s_sum_sqr;
+  tuple._min      = s_min;
+  tuple._max      = s_max;
+}
+
+//
+// AVX2: 4 doubles at a time
+//
+__attribute__((target("avx2")))
+static void rrdb_metric_tuples_aggregate_avx2(
+    t_rrdb_metric_tuple & tuple,
+    const t_rrdb_metric_tuples & tuples,
+    const my::size_t & first_pos,
+    const my::size_t & last_pos
+) {
+  CHECK_AND_THROW(last_pos <= first_pos && first_pos < tuples.get_size());
+
+  // count, sum, sum_sqr for all tuples
+  const my::value_t * count(tuples.get_count_column());
+  const my::value_t * sum(tuples.get_sum_column());
+  const my::value_t * sum_sqr(tuples.get_sum_sqr_column());
+  __m256d v_count   = _mm256_setzero_pd();
+  __m256d v_sum     = _mm256_setzero_pd();
+  __m256d v_sum_sqr = _mm256_setzero_pd();
+  my::size_t pos = last_pos;
+  for(; pos + 4 <= first_pos + 1; pos += 4) {
+      v_count   = _mm256_add_pd(v_count,   _mm256_loadu_pd(count + pos));
+      v_sum     = _mm256_add_pd(v_sum,     _mm256_loadu_pd(sum + pos));
+      v_sum_sqr = _mm256_add_pd(v_sum_sqr, _mm256_loadu_pd(sum_sqr + pos));
+  }
+  double buf[4];
+  my::value_t s_count, s_sum, s_sum_sqr;
+  _mm256_storeu_pd(buf, v_count);   s_count   = (buf[0] + buf[1]) + (buf[2] + buf[3]);
+  _mm256_storeu_pd(buf, v_sum);     s_sum     = (buf[0] + buf[1]) + (buf[2] + buf[3]);
+  _mm256_storeu_pd(buf, v_sum_sqr); s_sum_sqr = (buf[0] + buf[1]) + (buf[2] + buf[3]);
+  for(; pos <= first_pos; ++pos) {
+      s_count   += count[pos];
+      s_sum     += sum[pos];
+      s_sum_sqr += sum_sqr[pos];
+  }
+
+  // min, max only for the tuples after the first non-empty one
+  my::size_t min_max_first = rrdb_metric_tuples_aggregate_min_max_first(tuple, tuples, first_pos, last_pos);
+  const my::value_t * min(tuples.get_min_column());
+  const my::value_t * max(tuples.get_max_column());
+  __m256d v_min = _mm256_set1_pd(tuple._min);
+  __m256d v_max = _mm256_set1_pd(tuple._max);
+  for(pos = last_pos; pos + 4 <= min_max_first + 1; pos += 4) {
+      v_min = _mm256_min_pd(v_min, _mm256_loadu_pd(min + pos));
+      v_max = _mm256_max_pd(v_max, _mm256_loadu_pd(max + pos));
+  }
+  my::value_t s_min, s_max;
+  _mm256_storeu_pd(buf, v_min);
+  s_min = buf[0];
+  for(int ii = 1; ii < 4; ++ii) if(s_min > buf[ii]) s_min = buf[ii];
+  _mm256_storeu_pd(buf, v_max);
+  s_max = buf[0];
+  for(int ii = 1; ii < 4; ++ii) if(s_max < buf[ii]) s_max = buf[ii];
+  for(; pos <= min_max_first; ++pos) {
+      if(s_min > min[pos]) s_min = min[pos];
+      if(s_max < max[pos]) s_max = max[pos];
+  }
+
+  // done
+  tuple._count   += s_count;
+  tuple._sum     += s_sum;
+  tuple._sum_sqr += s_sum_sqr;
+  tuple._min      = s_min;
+  tuple._max      = s_max;
+}
+
+#endif /* RRDB_AGGREGATE_X86 */
+
+//
+// Runtime dispatch
+//
+t_rrdb_metric_tuples_aggregate_func rrdb_metric_tuples_aggregate_get(const std::string & name)
+{
+  if(name == "scalar") {
+      return rrdb_metric_tuples_aggregate_scalar;
+  }
+#ifdef RRDB_AGGREGATE_X86
+  // we might be called before main() from the static initializer
+  __builtin_cpu_init();
+  if(name == "sse2" && __builtin_cpu_supports("sse2")) {
+      return rrdb_metric_tuples_aggregate_sse2;
+  }
+  if(name == "avx2" && __builtin_cpu_supports("avx2")) {
+      return rrdb_metric_tuples_aggregate_avx2;
+  }
+#endif /* RRDB_AGGREGATE_X86 */
+
+  return NULL;
+}
+
+static const char * rrdb_metric_tuples_aggregate_select_name()
+{
+  static const char * names[] = { "avx2", "sse2" };
+  for(my::size_t ii = 0; ii < sizeof(names) / sizeof(names[0]); ++ii) {
+      if(rrdb_metric_tuples_aggregate_get(names[ii])) {
+          return names[ii];
+      }
+  }
+  return "scalar";
+}
+
+static const char * g_rrdb_metric_tuples_aggregate_name = rrdb_metric_tuples_aggregate_select_name();
+static t_rrdb_metric_tuples_aggregate_func g_rrdb_metric_tuples_aggregate_func = rrdb_metric_tuples_aggregate_get(g_rrdb_metric_tuples_aggregate_name);
+
+void rrdb_metric_tuples_aggregate(
+    t_rrdb_metric_tuple & tuple,
+    const t_rrdb_metric_tuples & tuples,
+    const my::size_t & first_pos,
+    const my::size_t & last_pos
+) {
+  g_rrdb_metric_tuples_aggregate_func(tuple, tuples, first_pos, last_pos);
+}
+
+const char * rrdb_metric_tuples_aggregate_get_name()
+{
+  return g_rrdb_metric_tuples_aggregate_name;
+}
@@ -0,0 +1,43 @@
+/*
+ * rrdb_metric_tuples_aggregate.h
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: aleksey
+ */
+
+#ifndef RRDB_METRIC_TUPLES_AGGREGATE_H_
+#define RRDB_METRIC_TUPLES_AGGREGATE_H_
+
+#include <string>
+
+#include "common/types.h"
+
+#include "rrdb/rrdb_metric_tuple.h"
+
+//
+// Aggregates tuples from first_pos down to last_pos (first_pos >= last_pos,
+// i.e. newest first) into the tuple. The result is the same as calling
+// rrdb_metric_tuple_update(tuple, tuples[pos]) for each tuple in this order
+// (up to the floating point rounding for sums).
+//
+typedef void (*t_rrdb_metric_tuples_aggregate_func)(
+    t_rrdb_metric_tuple & tuple,
+    const t_rrdb_metric_tuples & tuples,
+    const my::size_t & first_pos,
+    const my::size_t & last_pos
+);
+
+// the best implementation available on this CPU (selected at startup)
+void rrdb_metric_tuples_aggregate(
+    t_rrdb_metric_tuple & tuple,
+    const t_rrdb_metric_tuples & tuples,
+    const my::size_t & first_pos,
+    const my::size_t & last_pos
+);
+const char * rrdb_metric_tuples_aggregate_get_name();
+
+// all the implementations: returns NULL if the name is unknown or
+// the implementation is not supported by this CPU ("scalar", "sse2", "avx2")
+t_rrdb_metric_tuples_aggregate_func rrdb_metric_tuples_aggregate_get(const std::string & name);
+
+#endif /* RRDB_METRIC_TUPLES_AGGREGATE_H_ */
@@ -4,7 +4,12 @@
  *  Created on: Jun 21, 2013
  *      Author: aleksey
  */
+#include <algorithm>
+
 #include <boost/foreach.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
 
 #include "parser/memory_size.h"
 
@@ -12,30 +17,101 @@
 #include "rrdb/rrdb_metric.h"
 #include "rrdb/rrdb_metric_block.h"
 #include "rrdb/rrdb_metric_tuples_cache.h"
+#include "rrdb/rrdb_files_cache.h"
 
+#include "common/utils.h"
 #include "common/lru_cache.h"
 #include "common/config.h"
 #include "common/log.h"
 #include "common/exception.h"
 
 
+#define RRDB_HOT_SET_FILE_HEADER_MAGIC               0xDB77
+#define RRDB_HOT_SET_FILE_VERSION                    1
+#define RRDB_HOT_SET_FILENAME                        "rrdb-statsd.hot"
+
+// hot set file format:
+// <header>              t_hot_set_file_header
+// <block1 offset>       my::size_t
+// <block1 file name>    padded_string
+// <block2 offset>       my::size_t
+// <block2 file name>    padded_string
+// ...
+typedef struct t_hot_set_file_header_ {
+  boost::uint16_t   _magic;             // magic bytes (RRDB_HOT_SET_FILE_HEADER_MAGIC)
+  boost::uint16_t   _version;           // version (0x01)
+  boost::uint32_t   _blocks_size;       // number of blocks
+} t_hot_set_file_header;
+
+// we keep where the block came from next to the data to be able to save the hot set
+typedef struct t_rrdb_metric_tuples_cache_entry_ {
+  t_rrdb_metric_tuples_ptr _tuples;
+  my::filename_t           _filename;
+  my::size_t               _offset;
+} t_rrdb_metric_tuples_cache_entry;
+
 // black magic to make forward declarations work
 class rrdb_metric_tuples_cache_impl :
     public lru_cache<
       const rrdb_metric_block * const,
-      t_rrdb_metric_tuples_ptr,
+      t_rrdb_metric_tuples_cache_entry,
       my::size_t
     >
 {
 }; // rrdb_metric_tuples_cache_impl
 
+// the block load in progress: other threads that miss on the same block
+// wait here instead of reading it from the disk again
+class rrdb_metric_tuples_pending_load
+{
+public:
+  rrdb_metric_tuples_pending_load() : _done(false) { }
+
+  void wait()
+  {
+    boost::unique_lock<boost::mutex> guard(_mutex);
+    while(!_done) {
+        _cond.wait(guard);
+    }
+  }
+
+  void notify(const t_rrdb_metric_tuples_ptr & tuples, const std::string & error = std::string())
+  {
+    {
+      boost::lock_guard<boost::mutex> guard(_mutex);
+      _tuples = tuples;
+      _error  = error;
+      _done   = true;
+    }
+    _cond.notify_all();
+  }
+
+public:
+  boost::mutex              _mutex;
+  boost::condition_variable _cond;
+  bool                      _done;
+  t_rrdb_metric_tuples_ptr  _tuples;
+  std::string               _error;
+}; // rrdb_metric_tuples_pending_load
+
+// sort hot blocks in the file order
+static bool hot_block_less(
+    const rrdb_metric_tuples_cache::t_hot_block & a,
+    const rrdb_metric_tuples_cache::t_hot_block & b
+) {
+  int res = a._filename->compare(*b._filename);
+  return (res != 0) ? (res < 0) : (a._offset < b._offset);
+}
+
 
 rrdb_metric_tuples_cache::rrdb_metric_tuples_cache(
     const boost::shared_ptr<rrdb_files_cache> & files_cache
 ):
+  _lock("blocks_cache"),
   _max_used_memory(1 * MEMORY_SIZE_GIGABYTE), // 1GB
   _purge_threshold(0.8),
   _used_memory(0),
+  _coalesced_loads(0),
   _files_cache(files_cache),
   _tuples_cache_impl(new rrdb_metric_tuples_cache_impl())
 {
@@ -57,7 +133,7 @@ void rrdb_metric_tuples_cache::initialize(boost::shared_ptr<config> config)
 
   // simple - under lock
   {
-    boost::lock_guard<spinlock> guard(_lock);
+    boost::lock_guard<named_lock> guard(_lock);
     _purge_threshold = config->get<double>("rrdb.blocks_cache_purge_threshold", _purge_threshold);
     if(_purge_threshold > 1.0) {
         throw exception("The rrdb.open_files_cache_purge_threshold should not exceed 1.0");
@@ -76,7 +152,7 @@ void rrdb_metric_tuples_cache::notify_used(
 ) {
   LOG(log::LEVEL_DEBUG3, "Using for block '%p'", block);
 
-  boost::lock_guard<spinlock> guard(_lock);
+  boost::lock_guard<named_lock> guard(_lock);
   _tuples_cache_impl->use(block, ts);
 }
 
@@ -86,20 +162,112 @@ t_rrdb_metric_tuples_ptr rrdb_metric_tuples_cache::find(
 ) {
   LOG(log::LEVEL_DEBUG3, "Looking for block '%p'", block);
 
-  boost::lock_guard<spinlock> guard(_lock);
-  return _tuples_cache_impl->find(block, ts);
+  boost::lock_guard<named_lock> guard(_lock);
+  return _tuples_cache_impl->find(block, ts)._tuples;
+}
+
+/**
+ * rrdb_metric_tuples_cache::find_or_load
+ *
+ * Returns the block data from the cache or loads it using the loader. Only
+ * one thread loads a given block, others wait for the result
+ */
+t_rrdb_metric_tuples_ptr rrdb_metric_tuples_cache::find_or_load(
+    const rrdb_metric_block * const block,
+    const my::filename_t & filename,
+    const my::time_t & ts,
+    loader & block_loader
+) {
+  LOG(log::LEVEL_DEBUG3, "Looking for block '%p'", block);
+
+  boost::shared_ptr<rrdb_metric_tuples_pending_load> pending_load;
+  {
+    boost::lock_guard<named_lock> guard(_lock);
+    t_rrdb_metric_tuples_ptr the_tuples(_tuples_cache_impl->find(block, ts)._tuples);
+    if(the_tuples) {
+        return the_tuples;
+    }
+
+    // somebody is already loading it?
+    t_pending_loads::const_iterator it = _pending_loads.find(block);
+    if(it != _pending_loads.end()) {
+        pending_load = (*it).second;
+        ++_coalesced_loads;
+    } else {
+        _pending_loads[block].reset(new rrdb_metric_tuples_pending_load());
+    }
+  }
+
+  // wait for the other thread
+  if(pending_load) {
+      LOG(log::LEVEL_DEBUG3, "Waiting for block '%p' load", block);
+      pending_load->wait();
+      if(!pending_load->_tuples) {
+          throw exception("Loading block failed: %s", pending_load->_error.c_str());
+      }
+      return pending_load->_tuples;
+  }
+
+  // we are loading it: outside of the lock!
+  t_rrdb_metric_tuples_ptr the_tuples;
+  std::string error;
+  try {
+      the_tuples = block_loader.load();
+      CHECK_AND_THROW(the_tuples);
+  } catch(const std::exception & e) {
+      error = e.what();
+  } catch(...) {
+      error = "unknown exception";
+  }
+
+  // insert into cache and wake up everybody who is waiting
+  {
+    boost::lock_guard<named_lock> guard(_lock);
+    t_pending_loads::iterator it = _pending_loads.find(block);
+    CHECK_AND_THROW(it != _pending_loads.end());
+    pending_load = (*it).second;
+    _pending_loads.erase(it);
+
+    if(the_tuples) {
+        this->insert_no_lock(block, filename, the_tuples, ts);
+    }
+  }
+  pending_load->notify(the_tuples, error);
+
+  if(!the_tuples) {
+      throw exception("%s", error.c_str());
+  }
+  return the_tuples;
 }
 
 void rrdb_metric_tuples_cache::insert(
     const rrdb_metric_block * const block,
+    const my::filename_t & filename,
+    const t_rrdb_metric_tuples_ptr & tuples,
+    const my::time_t & ts
+) {
+  boost::lock_guard<named_lock> guard(_lock);
+  this->insert_no_lock(block, filename, tuples, ts);
+}
+
+void rrdb_metric_tuples_cache::insert_no_lock(
+    const rrdb_metric_block * const block,
+    const my::filename_t & filename,
     const t_rrdb_metric_tuples_ptr & tuples,
     const my::time_t & ts
 ) {
+  CHECK_AND_THROW(block);
+  CHECK_AND_THROW(filename);
   CHECK_AND_THROW(tuples);
-  CHECK_AND_THROW(tuples->get());
   LOG(log::LEVEL_DEBUG3, "Inserting block '%p'", block);
 
-  boost::lock_guard<spinlock> guard(_lock);
+  // should be locked
+  CHECK_AND_THROW(_lock.is_locked());
+
+  t_rrdb_metric_tuples_cache_entry entry;
+  entry._tuples   = tuples;
+  entry._filename = filename;
+  entry._offset   = block->get_offset();
 
   // purge cache if needed
   my::memory_size_t tuples_size = tuples->get_memory_size();
@@ -108,7 +276,7 @@ void rrdb_metric_tuples_cache::insert(
   }
 
   // and put it in the cache
-  if(_tuples_cache_impl->insert(block, tuples, ts)) {
+  if(_tuples_cache_impl->insert(block, entry, ts)) {
       _used_memory += tuples_size;
   }
 }
@@ -119,8 +287,8 @@ void rrdb_metric_tuples_cache::erase(
 ) {
   LOG(log::LEVEL_DEBUG3, "Erasing block '%p'", block);
 
-  boost::lock_guard<spinlock> guard(_lock);
-  t_rrdb_metric_tuples_ptr the_tuples(_tuples_cache_impl->erase(block));
+  boost::lock_guard<named_lock> guard(_lock);
+  t_rrdb_metric_tuples_ptr the_tuples(_tuples_cache_impl->erase(block)._tuples);
   if(the_tuples) {
       _used_memory -= the_tuples->get_memory_size();
   }
@@ -128,7 +296,7 @@ void rrdb_metric_tuples_cache::erase(
 
 void rrdb_metric_tuples_cache::clear()
 {
-  boost::lock_guard<spinlock> guard(_lock);
+  boost::lock_guard<named_lock> guard(_lock);
   _tuples_cache_impl->clear();
   _used_memory = 0;
 }
@@ -144,10 +312,10 @@ void rrdb_metric_tuples_cache::purge()
   my::memory_size_t tuples_size;
   while(it != it_end && _used_memory >= purge_limit) {
       LOG(log::LEVEL_DEBUG3, "Purging block '%p'", (*it)._k);
-      CHECK_AND_THROW((*it)._v);
+      CHECK_AND_THROW((*it)._v._tuples);
 
       // decrease used memory
-      tuples_size = ((*it)._v)->get_memory_size();
+      tuples_size = ((*it)._v._tuples)->get_memory_size();
       CHECK_AND_THROW(_used_memory >= tuples_size);
       _used_memory -= tuples_size;
 
@@ -156,15 +324,115 @@ void rrdb_metric_tuples_cache::purge()
   }
 }
 
+bool rrdb_metric_tuples_cache::is_full() const
+{
+  boost::lock_guard<named_lock> guard(_lock);
+  return _used_memory >= _max_used_memory * _purge_threshold;
+}
+
+std::string rrdb_metric_tuples_cache::get_hot_set_full_path() const
+{
+  return _files_cache->get_full_path(RRDB_HOT_SET_FILENAME);
+}
+
+/**
+ * rrdb_metric_tuples_cache::save_hot_set
+ *
+ * Saves the identities of up to max_size most recently used blocks
+ * so we can warm up the cache after restart
+ */
+void rrdb_metric_tuples_cache::save_hot_set(const my::size_t & max_size)
+{
+  // copy the most recently used entries under lock
+  t_hot_blocks hot_blocks;
+  {
+    boost::lock_guard<named_lock> guard(_lock);
+    hot_blocks.reserve(std::min<my::size_t>(max_size, _tuples_cache_impl->get_size()));
+
+    rrdb_metric_tuples_cache_impl::t_lru_iterator it(_tuples_cache_impl->lru_end());
+    rrdb_metric_tuples_cache_impl::t_lru_iterator it_begin(_tuples_cache_impl->lru_begin());
+    while(it != it_begin && hot_blocks.size() < max_size) {
+        --it;
+
+        t_hot_block hot_block;
+        hot_block._filename = (*it)._v._filename;
+        hot_block._offset   = (*it)._v._offset;
+        hot_blocks.push_back(hot_block);
+    }
+  }
+
+  // write everything to a tmp file and move it in place
+  std::string full_path     = this->get_hot_set_full_path();
+  std::string tmp_full_path = full_path + ".tmp";
+  LOG(log::LEVEL_DEBUG2, "Saving %lu blocks to the hot set file '%s'", hot_blocks.size(), full_path.c_str());
+  {
+    rrdb_files_cache::fstream_ptr fs = rrdb_files_cache::open_file(tmp_full_path, std::ios_base::trunc);
+
+    t_hot_set_file_header header;
+    header._magic       = RRDB_HOT_SET_FILE_HEADER_MAGIC;
+    header._version     = RRDB_HOT_SET_FILE_VERSION;
+    header._blocks_size = hot_blocks.size();
+    fs->write((const char*)&header, sizeof(header));
+
+    padded_string filename;
+    BOOST_FOREACH(const t_hot_block & hot_block, hot_blocks) {
+      filename = (*hot_block._filename);
+      fs->write((const char*)&hot_block._offset, sizeof(hot_block._offset));
+      filename.write(*fs);
+    }
+    fs->flush();
+  }
+  boost::filesystem::rename(tmp_full_path, full_path);
+}
+
+/**
+ * rrdb_metric_tuples_cache::load_hot_set
+ *
+ * Loads the hot set saved by save_hot_set() sorted in the file
+ * order so the warm up reads are as sequential as possible
+ */
+void rrdb_metric_tuples_cache::load_hot_set(t_hot_blocks & res) const
+{
+  std::string full_path = this->get_hot_set_full_path();
+  if(!boost::filesystem::is_regular_file(full_path)) {
+      LOG(log::LEVEL_DEBUG, "Hot set file '%s' does not exist", full_path.c_str());
+      return;
+  }
+
+  LOG(log::LEVEL_DEBUG2, "Loading hot set file '%s'", full_path.c_str());
+  rrdb_files_cache::fstream_ptr fs = rrdb_files_cache::open_file(full_path);
+
+  t_hot_set_file_header header;
+  fs->read((char*)&header, sizeof(header));
+  if(header._magic != RRDB_HOT_SET_FILE_HEADER_MAGIC) {
+      throw exception("Unexpected hot set file magic: %04x", header._magic);
+  }
+  if(header._version != RRDB_HOT_SET_FILE_VERSION) {
+      throw exception("Unexpected hot set file version: %u", header._version);
+  }
+
+  padded_string filename;
+  res.reserve(res.size() + header._blocks_size);
+  for(my::size_t ii = 0; ii < header._blocks_size; ++ii) {
+      t_hot_block hot_block;
+      fs->read((char*)&hot_block._offset, sizeof(hot_block._offset));
+      filename.read(*fs);
+      hot_block._filename.reset(new std::string(filename.get()));
+      res.push_back(hot_block);
+  }
+
+  std::sort(res.begin(), res.end(), hot_block_less);
+}
+
 my::memory_size_t rrdb_metric_tuples_cache::get_max_used_memory() const
 {
-  boost::lock_guard<spinlock> guard(_lock);
+  boost::lock_guard<named_lock> guard(_lock);
   return _max_used_memory;
 }
 
 void rrdb_metric_tuples_cache::set_max_used_memory(const my::memory_size_t & max_used_memory)
 {
-  boost::lock_guard<spinlock> guard(_lock);
+  boost::lock_guard<named_lock> guard(_lock);
   if(_max_used_memory < max_used_memory) {
       _max_used_memory = max_used_memory;
       this->purge();
@@ -175,19 +443,19 @@ void rrdb_metric_tuples_cache::set_max_used_memory(const my::memory_size_t & max
 
 my::memory_size_t rrdb_metric_tuples_cache::get_cache_used_memory() const
 {
-  boost::lock_guard<spinlock> guard(_lock);
+  boost::lock_guard<named_lock> guard(_lock);
   return _used_memory;
 }
 
 my::size_t rrdb_metric_tuples_cache::get_cache_size() const
 {
-  boost::lock_guard<spinlock> guard(_lock);
+  boost::lock_guard<named_lock> guard(_lock);
   return _tuples_cache_impl->get_size();
 }
 
 my::size_t rrdb_metric_tuples_cache::get_cache_hits(bool reset)
 {
-  boost::lock_guard<spinlock> guard(_lock);
+  boost::lock_guard<named_lock> guard(_lock);
   my::size_t res(_tuples_cache_impl->get_cache_hits());
   if(reset) {
       _tuples_cache_impl->reset_cache_hits();
@@ -195,9 +463,19 @@ my::size_t rrdb_metric_tuples_cache::get_cache_hits(bool reset)
   return res;
 }
 
+my::size_t rrdb_metric_tuples_cache::get_coalesced_loads(bool reset)
+{
+  boost::lock_guard<named_lock> guard(_lock);
+  my::size_t res(_coalesced_loads);
+  if(reset) {
+      _coalesced_loads = 0;
+  }
+  return res;
+}
+
 my::size_t rrdb_metric_tuples_cache::get_cache_misses(bool reset)
 {
-  boost::lock_guard<spinlock> guard(_lock);
+  boost::lock_guard<named_lock> guard(_lock);
   my::size_t res(_tuples_cache_impl->get_cache_misses());
   if(reset) {
       _tuples_cache_impl->reset_cache_misses();
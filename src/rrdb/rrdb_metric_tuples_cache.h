@@ -8,21 +8,41 @@
 #ifndef RRDB_METRIC_TUPLES_CACHE_H_
 #define RRDB_METRIC_TUPLES_CACHE_H_
 
+#include <vector>
+
 #include <boost/shared_ptr.hpp>
+#include <boost/unordered_map.hpp>
 
 #include "rrdb/rrdb_metric_tuple.h"
 
 #include "common/types.h"
-#include "common/spinlock.h"
+#include "common/named_lock.h"
 
 class config;
 class rrdb_files_cache;
 class rrdb_metric_block;
 class rrdb_metric_tuples_cache_impl;
+class rrdb_metric_tuples_pending_load;
 
 
 class rrdb_metric_tuples_cache
 {
+public:
+  // the block identity for the persisted hot set: the metric's file and the block offset in it
+  typedef struct t_hot_block_ {
+    my::filename_t _filename;
+    my::size_t     _offset;
+  } t_hot_block;
+  typedef std::vector<t_hot_block> t_hot_blocks;
+
+  //
+  // Loads the block data on cache miss
+  //
+  class loader {
+  public:
+    virtual t_rrdb_metric_tuples_ptr load() = 0;
+  }; // class loader
+
 public:
   rrdb_metric_tuples_cache(const boost::shared_ptr<rrdb_files_cache> & files_cache);
   virtual ~rrdb_metric_tuples_cache();
@@ -38,8 +58,15 @@ public:
       const rrdb_metric_block * const block,
       const my::time_t & ts
   );
+  t_rrdb_metric_tuples_ptr find_or_load(
+      const rrdb_metric_block * const block,
+      const my::filename_t & filename,
+      const my::time_t & ts,
+      loader & block_loader
+  );
   void insert(
       const rrdb_metric_block * const block,
+      const my::filename_t & filename,
       const t_rrdb_metric_tuples_ptr & tuples,
       const my::time_t & ts
   );
@@ -48,6 +75,11 @@ public:
   );
   void clear();
 
+  // hot set
+  void save_hot_set(const my::size_t & max_size);
+  void load_hot_set(t_hot_blocks & res) const;
+  bool is_full() const;
+
   // params
   my::memory_size_t get_max_used_memory() const;
   void set_max_used_memory(const my::memory_size_t & max_used_memory);
@@ -58,6 +90,7 @@ public:
   my::size_t get_cache_size() const;
   my::size_t get_cache_hits(bool reset = false);
   my::size_t get_cache_misses(bool reset = false);
+  my::size_t get_coalesced_loads(bool reset = false);
 
   // misc
   inline const boost::shared_ptr<rrdb_files_cache> & get_files_cache() const
@@ -66,10 +99,23 @@ public:
   }
 
 private:
+  typedef boost::unordered_map<
+      const rrdb_metric_block *,
+      boost::shared_ptr<rrdb_metric_tuples_pending_load>
+  > t_pending_loads;
+
+private:
+  void insert_no_lock(
+      const rrdb_metric_block * const block,
+      const my::filename_t & filename,
+      const t_rrdb_metric_tuples_ptr & tuples,
+      const my::time_t & ts
+  );
   void purge();
+  std::string get_hot_set_full_path() const;
 
 private:
-  mutable spinlock _lock;
+  mutable named_lock _lock;
 
   // params
   my::memory_size_t _max_used_memory;
@@ -77,6 +123,8 @@ private:
 
   // data
   my::memory_size_t _used_memory;
+  my::size_t        _coalesced_loads;
+  t_pending_loads   _pending_loads;
   boost::shared_ptr<rrdb_files_cache> _files_cache;
   boost::shared_ptr<rrdb_metric_tuples_cache_impl> _tuples_cache_impl;
 }; // rrdb_metric_tuples_cache
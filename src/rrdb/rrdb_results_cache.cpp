@@ -0,0 +1,167 @@
+/*
+ * rrdb_results_cache.cpp
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: aleksey
+ */
+#include <stdio.h>
+
+#include <boost/thread/locks.hpp>
+
+#include "rrdb/rrdb_results_cache.h"
+
+#include "common/lru_cache.h"
+#include "common/config.h"
+#include "common/log.h"
+#include "common/exception.h"
+
+// black magic to make forward declarations work
+class rrdb_results_cache_impl :
+    public lru_cache<
+      std::string,
+      rrdb_results_cache::t_entry_ptr,
+      my::size_t
+    >
+{
+}; // rrdb_results_cache_impl
+
+rrdb_results_cache::rrdb_results_cache() :
+  _lock("results_cache"),
+  _max_size(100000),
+  _size(0),
+  _use_counter(0),
+  _cache_hits(0),
+  _cache_misses(0),
+  _results_cache_impl(new rrdb_results_cache_impl())
+{
+}
+
+rrdb_results_cache::~rrdb_results_cache()
+{
+}
+
+void rrdb_results_cache::initialize(boost::shared_ptr<config> config)
+{
+  _max_size = config->get<my::size_t>("rrdb.results_cache_size", _max_size);
+
+  LOG(log::LEVEL_DEBUG, "Results cache size is %lu tuples", SIZE_T_CAST _max_size);
+}
+
+std::string rrdb_results_cache::get_key(
+    const std::string & name,
+    const my::time_t & ts_begin,
+    const my::time_t & ts_end,
+    const my::interval_t & group_by
+) {
+  // '|' is not allowed in the metric names
+  char buf[128];
+  snprintf(buf, sizeof(buf), "|%lu|%lu|%lu",
+      (unsigned long)ts_begin,
+      (unsigned long)ts_end,
+      (unsigned long)group_by
+  );
+  return name + buf;
+}
+
+rrdb_results_cache::t_entry_ptr rrdb_results_cache::find(
+    const std::string & name,
+    const my::time_t & ts_begin,
+    const my::time_t & ts_end,
+    const my::interval_t & group_by,
+    const my::size_t & version
+) {
+  if(!this->is_enabled()) {
+      return t_entry_ptr();
+  }
+  std::string key(rrdb_results_cache::get_key(name, ts_begin, ts_end, group_by));
+
+  boost::lock_guard<named_lock> guard(_lock);
+  t_entry_ptr res = _results_cache_impl->find(key, ++_use_counter);
+  if(res && res->_version != version) {
+      // the metric got late updates since
+      _results_cache_impl->erase(key);
+      _size -= res->_tuples.size();
+      res.reset();
+  }
+
+  if(res) {
+      ++_cache_hits;
+  } else {
+      ++_cache_misses;
+  }
+  return res;
+}
+
+void rrdb_results_cache::insert(
+    const std::string & name,
+    const my::time_t & ts_begin,
+    const my::time_t & ts_end,
+    const my::interval_t & group_by,
+    const t_entry_ptr & entry
+) {
+  CHECK_AND_THROW(entry);
+  if(!this->is_enabled() || entry->_tuples.size() > _max_size) {
+      return;
+  }
+  std::string key(rrdb_results_cache::get_key(name, ts_begin, ts_end, group_by));
+
+  boost::lock_guard<named_lock> guard(_lock);
+
+  // replace the old entry if any
+  t_entry_ptr old = _results_cache_impl->erase(key);
+  if(old) {
+      _size -= old->_tuples.size();
+  }
+  _results_cache_impl->insert(key, entry, ++_use_counter);
+  _size += entry->_tuples.size();
+
+  this->purge();
+}
+
+void rrdb_results_cache::clear()
+{
+  boost::lock_guard<named_lock> guard(_lock);
+  _results_cache_impl->clear();
+  _size = 0;
+}
+
+// purge least recently used entries, the caller holds the lock
+void rrdb_results_cache::purge()
+{
+  rrdb_results_cache_impl::t_lru_iterator it = _results_cache_impl->lru_begin();
+  while(_size > _max_size && it != _results_cache_impl->lru_end()) {
+      _size -= (*it)._v->_tuples.size();
+      it = _results_cache_impl->lru_erase(it);
+  }
+}
+
+my::size_t rrdb_results_cache::get_max_size() const
+{
+  return _max_size;
+}
+
+my::size_t rrdb_results_cache::get_cache_size() const
+{
+  boost::lock_guard<named_lock> guard(_lock);
+  return _size;
+}
+
+my::size_t rrdb_results_cache::get_cache_hits(bool reset)
+{
+  boost::lock_guard<named_lock> guard(_lock);
+  my::size_t res(_cache_hits);
+  if(reset) {
+      _cache_hits = 0;
+  }
+  return res;
+}
+
+my::size_t rrdb_results_cache::get_cache_misses(bool reset)
+{
+  boost::lock_guard<named_lock> guard(_lock);
+  my::size_t res(_cache_misses);
+  if(reset) {
+      _cache_misses = 0;
+  }
+  return res;
+}
@@ -0,0 +1,98 @@
+/*
+ * rrdb_results_cache.h
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: aleksey
+ */
+
+#ifndef RRDB_RESULTS_CACHE_H_
+#define RRDB_RESULTS_CACHE_H_
+
+#include <string>
+#include <vector>
+
+#include <boost/shared_ptr.hpp>
+
+#include "rrdb/rrdb_metric_tuple.h"
+
+#include "common/types.h"
+#include "common/named_lock.h"
+
+class config;
+class rrdb_results_cache_impl;
+
+//
+// The "group by" buckets computed by the SELECT statements: the buckets
+// older than the metric's current slot can't change anymore (unless the
+// metric gets late updates and changes its version) so we don't need to
+// compute them again
+//
+class rrdb_results_cache
+{
+public:
+  // the buckets in [ts_begin, sealed_ts), newest first
+  typedef struct t_entry_ {
+    my::size_t                        _version;
+    my::time_t                        _sealed_ts;
+    std::vector<t_rrdb_metric_tuple>  _tuples;
+  } t_entry;
+  typedef boost::shared_ptr<const t_entry> t_entry_ptr;
+
+public:
+  rrdb_results_cache();
+  virtual ~rrdb_results_cache();
+
+  void initialize(boost::shared_ptr<config> config);
+
+  inline bool is_enabled() const
+  {
+    return _max_size > 0;
+  }
+
+  // basic operations
+  t_entry_ptr find(
+      const std::string & name,
+      const my::time_t & ts_begin,
+      const my::time_t & ts_end,
+      const my::interval_t & group_by,
+      const my::size_t & version
+  );
+  void insert(
+      const std::string & name,
+      const my::time_t & ts_begin,
+      const my::time_t & ts_end,
+      const my::interval_t & group_by,
+      const t_entry_ptr & entry
+  );
+  void clear();
+
+  // stats
+  my::size_t get_max_size() const;
+  my::size_t get_cache_size() const;
+  my::size_t get_cache_hits(bool reset = false);
+  my::size_t get_cache_misses(bool reset = false);
+
+private:
+  static std::string get_key(
+      const std::string & name,
+      const my::time_t & ts_begin,
+      const my::time_t & ts_end,
+      const my::interval_t & group_by
+  );
+  void purge();
+
+private:
+  mutable named_lock _lock;
+
+  // params: the max number of cached tuples
+  my::size_t _max_size;
+
+  // data
+  my::size_t _size;
+  my::size_t _use_counter;
+  my::size_t _cache_hits;
+  my::size_t _cache_misses;
+  boost::shared_ptr<rrdb_results_cache_impl> _results_cache_impl;
+}; // rrdb_results_cache
+
+#endif /* RRDB_RESULTS_CACHE_H_ */
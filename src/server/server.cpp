@@ -15,6 +15,7 @@
 #include "common/log.h"
 #include "common/config.h"
 #include "common/thread_pool.h"
+#include "common/self_metrics.h"
 
 #include "parser/interval.h"
 
@@ -237,12 +238,16 @@ void server::update_status()
   // TODO: add more stats (e.g. uptime)
   time_t now = time(NULL);
 
-  _server_udp->update_status(now);
-  _server_tcp->update_status(now);
-  _rrdb->update_status(now);
+  // collect everything first and write all the self.* metrics at once
+  self_metrics metrics;
+  _server_udp->update_status(metrics);
+  _server_tcp->update_status(metrics);
+  _rrdb->update_status(metrics);
 
-  _rrdb->update_metric("self.uptime.secs", now, now - _start_time);
-  _rrdb->update_metric("self.uptime.days", now, (now - _start_time) / INTERVAL_DAY);
+  metrics.add("self.uptime.secs", now - _start_time);
+  metrics.add("self.uptime.days", (now - _start_time) / INTERVAL_DAY);
+
+  _rrdb->update_self_metrics(metrics, now);
 }
 
 void server::status_update_thread()
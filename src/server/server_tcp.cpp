@@ -10,29 +10,49 @@
 #include <iostream>
 #include <boost/array.hpp>
 #include <boost/bind.hpp>
+#include <boost/algorithm/string.hpp>
 
 #include "common/exception.h"
 #include "common/log.h"
 #include "common/config.h"
 
 #include "common/thread_pool.h"
+#include "common/self_metrics.h"
+
+#include "parser/statements.h"
 
 #include "rrdb/rrdb.h"
 
 using namespace boost::asio::ip;
 
 /**
- * One connection
+ * One connection: either a single statement terminated by the client
+ * closing its side of the socket or, if the first statement is "PIPELINE;",
+ * a persistent connection with many ';'-delimited statements processed
+ * in order with the framed results (see LANGUAGE.md)
  */
 class connection_tcp:
-    public thread_pool_task
+    public thread_pool_task,
+    public memory_buffer_drain
 {
+  enum t_mode {
+    Mode_Unknown,
+    Mode_Single,
+    Mode_Pipeline
+  };
+
 public:
-  connection_tcp(boost::asio::io_service& io_service, const boost::shared_ptr<rrdb> & rrdb, const my::size_t & buffer_size) :
+  connection_tcp(server_tcp & server, boost::asio::io_service& io_service, const boost::shared_ptr<rrdb> & rrdb, const my::size_t & max_message_size, const my::size_t & output_chunk_size) :
+    _server(server),
     _socket(io_service),
-    _rrdb(rrdb)
+    _rrdb(rrdb),
+    _mode(Mode_Unknown),
+    _eof(false),
+    _pipeline_statement(false),
+    _max_message_size(max_message_size),
+    _output_chunk_size(output_chunk_size),
+    _sent_bytes(0)
   {
-    _input_buffer.resize(buffer_size);
   }
 
   virtual ~connection_tcp()
@@ -44,9 +64,9 @@ public:
     return _socket;
   }
 
-  std::string & get_input_buffer()
+  void start()
   {
-    return _input_buffer;
+    this->read_more();
   }
 
 public:
@@ -54,36 +74,129 @@ public:
   void run() {
     // TODO: check TCP connection is still alive (in case we don't need to process the query)
 
-    // execute command
-    t_memory_buffer res(_output_buffer);
+    this->execute();
+    switch(_mode) {
+    case Mode_Pipeline:
+      this->run_pipeline();
+      break;
+    default:
+      this->run_single();
+      break;
+    }
+  }
+
+  // memory_buffer_drain: we are on the worker thread and nobody else
+  // uses the socket until run() is done so just block
+  void drain(const char * data, const my::size_t & size)
+  {
+    if(_mode == Mode_Pipeline) {
+        this->write_frame(data, size);
+    } else {
+        boost::asio::write(_socket, boost::asio::buffer(data, size));
+    }
+    _sent_bytes += size;
+
+    LOG(log::LEVEL_DEBUG3, "TCP Server sent %lu bytes chunk", SIZE_T_CAST size);
+  }
+
+private:
+  void read_more()
+  {
+    _socket.async_read_some(
+        boost::asio::buffer(_read_buffer),
+        boost::bind(
+            &connection_tcp::handle_read,
+            boost::intrusive_ptr<connection_tcp>(this),
+            boost::asio::placeholders::error,
+            boost::asio::placeholders::bytes_transferred
+        )
+    );
+  }
+
+  void handle_read(const boost::system::error_code& error, my::size_t bytes_transferred)
+  {
     try {
-        _rrdb->execute_query_statement(_input_buffer, res);
-    } catch(std::exception & e) {
-        LOG(log::LEVEL_ERROR, "Exception executing long rrdb command: %s", e.what());
-
-        res.clear();
-        _output_buffer.clear();
-        res << "ERROR: " << e.what();
-    } catch(...) {
-        LOG(log::LEVEL_ERROR, "Unknown exception long short rrdb command");
-
-        res.clear();
-        _output_buffer.clear();
-        res << "ERROR: " << "unhandled exception";
+        // any errors?
+        if (error && error != boost::asio::error::eof) {
+            LOG(log::LEVEL_ERROR, "TCP Server read failed - %d: %s", error.value(), error.message().c_str());
+            return;
+        }
+        _eof = (error == boost::asio::error::eof);
+        _input.append(_read_buffer.data(), bytes_transferred);
+
+        // log
+        LOG(log::LEVEL_DEBUG3, "TCP Server read %lu bytes", SIZE_T_CAST bytes_transferred);
+
+        // the first complete statement decides what kind of connection it is
+        my::size_t pos = statement_find_end(_input);
+        if(_mode == Mode_Unknown && pos != std::string::npos) {
+            _mode = connection_tcp::is_pipeline_statement(_input.substr(0, pos)) ? Mode_Pipeline : Mode_Single;
+        }
+
+        // off-load task for processing to the buffer pool once we have
+        // the complete statement
+        if(_mode == Mode_Pipeline ? pos != std::string::npos : _eof) {
+            this->schedule();
+            return;
+        } else if(_eof) {
+            // pipeline is done
+            return;
+        }
+
+        // in the pipeline mode the limit is for one statement
+        if(_input.length() > _max_message_size) {
+            LOG(log::LEVEL_ERROR, "TCP Server received request larger than %lu bytes, consider increasing server_tcp.max_message_size config parameter", SIZE_T_CAST _max_message_size);
+            return;
+        }
+
+        this->read_more();
+    } catch(const std::exception & e) {
+        LOG(log::LEVEL_CRITICAL,  "Exception in tcp read handler: %s", e.what());
     }
-    res.flush();
+  }
 
-    // add default OK
-    if(_output_buffer.empty()) {
-        res << "OK";
-        res.flush();
+  void schedule()
+  {
+    // take the next statement
+    if(_mode == Mode_Pipeline) {
+        my::size_t pos = statement_find_end(_input);
+        CHECK_AND_THROW(pos != std::string::npos);
+        _statement.assign(_input, 0, pos + 1);
+        _input.erase(0, pos + 1);
+    } else {
+        _statement.swap(_input);
+        _input.clear();
+    }
+
+    // parse and estimate the cost to pick the lane: the errors are sent
+    // back when the statement is executed to keep the results in order
+    _pipeline_statement = connection_tcp::is_pipeline_statement(_statement);
+    _error.clear();
+    bool heavy = false;
+    if(!_pipeline_statement) {
+        try {
+            _parsed = statement_query_parse(_statement);
+            heavy   = _server.is_heavy_query(_rrdb->get_query_cost(_parsed));
+        } catch(std::exception & e) {
+            LOG(log::LEVEL_ERROR, "Exception parsing long rrdb command: %s", e.what());
+            _error = e.what();
+        }
+    }
+
+    // off-load task for processing to the thread pool
+    boost::shared_ptr<thread_pool> pool(heavy ? _server._heavy_thread_pool : _server._thread_pool);
+    if(pool) {
+        pool->run(this);
     }
+  }
 
+  void run_single()
+  {
     // clear input data
-    _input_buffer.clear();
+    _statement.clear();
     _rrdb.reset();
 
-    // send
+    // send the rest
     boost::asio::async_write(
         _socket,
         boost::asio::buffer(_output_buffer),
@@ -96,6 +209,88 @@ public:
     );
   }
 
+  void run_pipeline()
+  {
+    // send the rest of the results with the end of results frame:
+    // we block the worker thread but the statements on the connection
+    // are processed one at a time anyway
+    try {
+        if(!_output_buffer.empty()) {
+            this->write_frame(&_output_buffer[0], _output_buffer.size());
+        }
+        this->write_frame(NULL, 0);
+    } catch(const std::exception & e) {
+        LOG(log::LEVEL_ERROR, "TCP Server write failed: %s", e.what());
+        return;
+    }
+
+    // next statement: either we have it already or need to read more
+    if(statement_find_end(_input) != std::string::npos) {
+        this->schedule();
+    } else if(!_eof) {
+        this->read_more();
+    }
+  }
+
+  void execute()
+  {
+    _output_buffer.clear();
+    _sent_bytes = 0;
+
+    // execute command: the results are sent to the socket in chunks
+    // as the query runs (see drain() below)
+    std::string error(_error);
+    if(error.empty() && !_pipeline_statement) {
+        try {
+            t_memory_buffer res(t_memory_buffer_device(_output_buffer, this, _output_chunk_size));
+            _rrdb->execute_query_statement(_parsed, res);
+            res.flush();
+        } catch(std::exception & e) {
+            LOG(log::LEVEL_ERROR, "Exception executing long rrdb command: %s", e.what());
+            error = e.what();
+        } catch(...) {
+            LOG(log::LEVEL_ERROR, "Unknown exception long short rrdb command");
+            error = "unhandled exception";
+        }
+    }
+
+    // errors: replace the results if we haven't sent anything yet,
+    // otherwise the error goes at the end of the partial results
+    if(!error.empty()) {
+        std::string msg;
+        if(_sent_bytes > 0) {
+            msg = "\n";
+        } else {
+            _output_buffer.clear();
+        }
+        msg += "ERROR: " + error;
+        _output_buffer.insert(_output_buffer.end(), msg.begin(), msg.end());
+    }
+
+    // add default OK
+    if(_output_buffer.empty() && _sent_bytes == 0) {
+        static const std::string ok("OK");
+        _output_buffer.insert(_output_buffer.end(), ok.begin(), ok.end());
+    }
+  }
+
+  // [4 bytes little-endian length][data], empty frame marks the end of results
+  void write_frame(const char * data, const my::size_t & size)
+  {
+    boost::uint32_t len = size;
+    unsigned char header[4] = {
+        (unsigned char)(len & 0xFF),
+        (unsigned char)((len >> 8) & 0xFF),
+        (unsigned char)((len >> 16) & 0xFF),
+        (unsigned char)((len >> 24) & 0xFF)
+    };
+    boost::array<boost::asio::const_buffer, 2> buffers = {{
+        boost::asio::buffer(header, sizeof(header)),
+        boost::asio::buffer(data, size)
+    }};
+    boost::asio::write(_socket, buffers);
+  }
+
   void handle_write(const boost::system::error_code& error, my::size_t bytes_transferred)
   {
     // any errors?
@@ -109,11 +304,31 @@ public:
     // do nothing
   }
 
+  static bool is_pipeline_statement(const std::string & statement)
+  {
+    std::string str(boost::algorithm::trim_copy(statement));
+    if(!str.empty() && str[str.length() - 1] == ';') {
+        str.erase(str.length() - 1);
+    }
+    return boost::algorithm::iequals(boost::algorithm::trim_copy(str), "pipeline");
+  }
+
 private:
+  server_tcp &                  _server;
   tcp::socket                   _socket;
   boost::shared_ptr<rrdb>       _rrdb;
-  std::string                   _input_buffer;
+  t_mode                        _mode;
+  bool                          _eof;
+  std::string                   _statement;
+  t_statement                   _parsed;
+  bool                          _pipeline_statement;
+  std::string                   _error;
+  boost::array<char, 4096>      _read_buffer;
+  std::string                   _input;
   t_memory_buffer_data          _output_buffer;
+  my::size_t                    _max_message_size;
+  my::size_t                    _output_chunk_size;
+  my::size_t                    _sent_bytes;
 }; // class connection_tcp
 
 server_tcp::server_tcp(boost::shared_ptr<rrdb> rrdb) :
@@ -121,7 +336,11 @@ server_tcp::server_tcp(boost::shared_ptr<rrdb> rrdb) :
   _address("0.0.0.0"),
   _port(9876),
   _thread_pool_size(5),
-  _buffer_size(4096)
+  _buffer_size(4096),
+  _output_chunk_size(64 * 1024),
+  _heavy_thread_pool_size(4),
+  _heavy_query_cost(10000),
+  _heavy_max_queue_size(100)
 {
 }
 
@@ -139,6 +358,10 @@ void server_tcp::initialize(boost::asio::io_service& io_service, boost::shared_p
   _port             = config->get<int>("server_tcp.port", _port);
   _thread_pool_size = config->get<my::size_t>("server_tcp.thread_pool_size", _thread_pool_size);
   _buffer_size      = config->get<my::size_t>("server_tcp.max_message_size", _buffer_size);
+  _output_chunk_size = config->get<my::size_t>("server_tcp.output_chunk_size", _output_chunk_size);
+  _heavy_thread_pool_size = config->get<my::size_t>("server_tcp.heavy_thread_pool_size", _heavy_thread_pool_size);
+  _heavy_query_cost       = config->get<my::size_t>("server_tcp.heavy_query_cost", _heavy_query_cost);
+  _heavy_max_queue_size   = config->get<my::size_t>("server_tcp.heavy_max_queue_size", _heavy_max_queue_size);
 
   // create socket
   _acceptor.reset(new tcp::acceptor(io_service, tcp::endpoint(address_v4::from_string(_address), _port)));
@@ -154,6 +377,7 @@ void server_tcp::start()
 {
   // create threads
   _thread_pool.reset(new thread_pool(_thread_pool_size));
+  _heavy_thread_pool.reset(new thread_pool(_heavy_thread_pool_size));
 
   this->accept();
 }
@@ -168,25 +392,54 @@ void server_tcp::stop()
       _acceptor.reset();
   }
   _thread_pool.reset();
+  _heavy_thread_pool.reset();
 
   LOG(log::LEVEL_INFO, "Stopped TCP server");
 }
 
-void server_tcp::update_status(const time_t & now)
+void server_tcp::update_status(self_metrics & metrics)
 {
   // eat our own dog food
-  _rrdb->update_metric("self.tcp.load_factor", now, _thread_pool->get_load_factor());
-  _rrdb->update_metric("self.tcp.started_requests", now, _thread_pool->get_started_jobs());
-  _rrdb->update_metric("self.tcp.finished_requests", now, _thread_pool->get_finished_jobs());
+  metrics.add("self.tcp.load_factor",             _thread_pool->get_load_factor());
+  metrics.add("self.tcp.started_requests",        _thread_pool->get_started_jobs());
+  metrics.add("self.tcp.finished_requests",       _thread_pool->get_finished_jobs());
+  metrics.add("self.tcp.queue_size",              _thread_pool->get_queue_size());
+  metrics.add("self.tcp.wait_time",               _thread_pool->get_wait_time());
+  metrics.add("self.tcp.run_time",                _thread_pool->get_run_time());
+
+  metrics.add("self.tcp.heavy.load_factor",       _heavy_thread_pool->get_load_factor());
+  metrics.add("self.tcp.heavy.started_requests",  _heavy_thread_pool->get_started_jobs());
+  metrics.add("self.tcp.heavy.finished_requests", _heavy_thread_pool->get_finished_jobs());
+  metrics.add("self.tcp.heavy.queue_size",        _heavy_thread_pool->get_queue_size());
+  metrics.add("self.tcp.heavy.wait_time",         _heavy_thread_pool->get_wait_time());
+  metrics.add("self.tcp.heavy.run_time",          _heavy_thread_pool->get_run_time());
+  metrics.add("self.tcp.rejected_requests",       _rejected_requests.get());
+}
+
+bool server_tcp::is_heavy_query(const my::size_t & cost)
+{
+  if(cost < _heavy_query_cost) {
+      return false;
+  }
+
+  // shed the load: the heavy queries would wait too long anyway
+  boost::shared_ptr<thread_pool> pool(_heavy_thread_pool);
+  if(pool && pool->get_queue_size() >= _heavy_max_queue_size) {
+      _rejected_requests.add();
+      throw exception("The server is too busy, try again later");
+  }
+  return true;
 }
 
 void server_tcp::accept()
 {
   boost::intrusive_ptr<connection_tcp> new_connection(
       new connection_tcp(
+          *this,
           _acceptor->get_io_service(),
           _rrdb,
-          _buffer_size
+          _buffer_size,
+          _output_chunk_size
        )
   );
   _acceptor->async_accept(
@@ -215,20 +468,7 @@ void server_tcp::handle_accept(
       LOG(log::LEVEL_DEBUG3, "TCP Server accepted new connection");
 
       // start async read
-      async_read(
-          new_connection->get_socket(),
-          boost::asio::buffer(
-              &(new_connection->get_input_buffer())[0],
-              new_connection->get_input_buffer().size()
-          ),
-          boost::bind(
-              &server_tcp::handle_read,
-              this,
-              new_connection,
-              boost::asio::placeholders::error,
-              boost::asio::placeholders::bytes_transferred
-          )
-      );
+      new_connection->start();
   } catch(const std::exception & e) {
       LOG(log::LEVEL_CRITICAL,  "Exception in tcp accept handler: %s", e.what());
   }
@@ -236,30 +476,3 @@ void server_tcp::handle_accept(
   // next one, please
   this->accept();
 }
-
-void server_tcp::handle_read(
-    const boost::intrusive_ptr<connection_tcp> & new_connection,
-    const boost::system::error_code& error,
-    my::size_t bytes_transferred
-) {
-  try {
-      // any errors?
-      if (error && error != boost::asio::error::eof) {
-          LOG(log::LEVEL_ERROR, "TCP Server read failed - %d: %s", error.value(), error.message().c_str());
-          return;
-      } else if(error != boost::asio::error::eof) {
-          LOG(log::LEVEL_ERROR, "TCP Server received request larger than the buffer size %lu bytes, consider increasing server.tcp_max_message_size config parameter", SIZE_T_CAST _buffer_size);
-          return;
-      }
-
-      // log
-      LOG(log::LEVEL_DEBUG3, "TCP Server read %lu bytes", SIZE_T_CAST bytes_transferred);
-
-      // off-load task for processing to the buffer pool
-      new_connection->get_input_buffer().resize(bytes_transferred);
-      _thread_pool->run(new_connection);
-  } catch(const std::exception & e) {
-      LOG(log::LEVEL_CRITICAL,  "Exception in tcp read handler: %s", e.what());
-  }
-}
-
@@ -15,6 +15,7 @@
 #include <boost/intrusive_ptr.hpp>
 
 #include "common/types.h"
+#include "common/self_metrics.h"
 
 class config;
 class thread_pool;
@@ -34,7 +35,11 @@ public:
   void start();
   void stop();
 
-  void update_status(const time_t & now);
+  void update_status(self_metrics & metrics);
+
+  // picks the lane for the query: true for the heavy queries lane,
+  // throws if the query needs to be rejected
+  bool is_heavy_query(const my::size_t & cost);
 
 protected:
   void accept();
@@ -43,11 +48,6 @@ protected:
       const boost::intrusive_ptr<connection_tcp> & new_connection,
       const boost::system::error_code& error
   );
-  void handle_read(
-      const boost::intrusive_ptr<connection_tcp> & new_connection,
-      const boost::system::error_code& error,
-      my::size_t bytes_transferred
-  );
 
   inline boost::shared_ptr<rrdb> get_rrdb() const {
     return _rrdb;
@@ -55,6 +55,7 @@ protected:
 
 private:
   boost::shared_ptr<thread_pool>                    _thread_pool;
+  boost::shared_ptr<thread_pool>                    _heavy_thread_pool;
   boost::shared_ptr<rrdb>                           _rrdb;
   boost::shared_ptr<boost::asio::ip::tcp::acceptor> _acceptor;
 
@@ -62,6 +63,12 @@ private:
   int          _port;
   my::size_t  _thread_pool_size;
   my::size_t  _buffer_size;
+  my::size_t  _output_chunk_size;
+  my::size_t  _heavy_thread_pool_size;
+  my::size_t  _heavy_query_cost;
+  my::size_t  _heavy_max_queue_size;
+
+  self_counter _rejected_requests;
 }; // server_tcp
 
 #endif /* SERVER_TCP_H_ */
@@ -7,12 +7,19 @@
 
 #include "server/server_udp.h"
 
+#include <errno.h>
 #include <iostream>
 #include <boost/array.hpp>
 #include <boost/bind.hpp>
+#include <boost/foreach.hpp>
 
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif /* __linux__ */
 
 #include "common/thread_pool.h"
+#include "common/self_metrics.h"
 
 #include "rrdb/rrdb.h"
 
@@ -134,7 +141,12 @@ server_udp::server_udp(boost::shared_ptr<rrdb> rrdb) :
   _rrdb(rrdb),
   _address("0.0.0.0"),
   _port(9876),
+  _listeners(0),
+  _pin_listeners(false),
   _thread_pool_size(5),
+  _thread_pool_scheduler("shared"),
+  _max_queue_size(0),
+  _queue_overflow_policy("drop_newest"),
   _buffer_size(2048),
   _send_success_response(false)
 {
@@ -151,27 +163,108 @@ void server_udp::initialize(boost::asio::io_service& io_service, boost::shared_p
 
   _address          = config->get<std::string>("server_udp.address", _address);
   _port             = config->get<int>("server_udp.port", _port);
+  _listeners        = config->get<my::size_t>("server_udp.listeners", _listeners);
+  _pin_listeners    = config->get<bool>("server_udp.pin_listeners", _pin_listeners);
   _thread_pool_size = config->get<my::size_t>("server_udp.thread_pool_size", _thread_pool_size);
+  _thread_pool_scheduler = config->get<std::string>("server_udp.thread_pool_scheduler", _thread_pool_scheduler);
+  _max_queue_size   = config->get<my::size_t>("server_udp.max_queue_size", _max_queue_size);
+  _queue_overflow_policy = config->get<std::string>("server_udp.queue_overflow_policy", _queue_overflow_policy);
   _buffer_size      = config->get<my::size_t>("server_udp.max_message_size", _buffer_size);
+
+  // validate the thread pool settings early
+  thread_pool::str2overflow_policy(_queue_overflow_policy);
+  if(thread_pool::str2scheduler(_thread_pool_scheduler) == thread_pool::Scheduler_WorkStealing && _max_queue_size > 0) {
+      throw exception("The udp work stealing thread pool does not support server_udp.max_queue_size");
+  }
   _send_success_response = config->get<bool>("server_udp.send_success_response", _send_success_response);
 
-  // create socket
-  _socket.reset(new udp::socket(io_service, udp::endpoint(address_v4::from_string(_address), _port)));
-  if(!_socket->is_open()) {
-      throw exception("Unable to listen to UDP %s:%d", _address.c_str(), _port);
+  // create sockets: either one socket on the server's io_service or
+  // SO_REUSEPORT sockets each with its own io_service and thread
+  udp::endpoint endpoint(address_v4::from_string(_address), _port);
+  if(_listeners == 0) {
+      _sockets.push_back(server_udp::open_socket(io_service, endpoint, false));
+  } else {
+      for(my::size_t ii = 0; ii < _listeners; ++ii) {
+          boost::shared_ptr<boost::asio::io_service> listener_io_service(new boost::asio::io_service());
+          _sockets.push_back(server_udp::open_socket(*listener_io_service, endpoint, true));
+          _listeners_io_services.push_back(listener_io_service);
+      }
   }
 
   // done
-  LOG(log::LEVEL_INFO, "Started UDP server on %s:%d", _address.c_str(), _port);
+  LOG(log::LEVEL_INFO, "Started UDP server on %s:%d with %lu listeners", _address.c_str(), _port, SIZE_T_CAST _sockets.size());
+}
+
+server_udp::t_socket_ptr server_udp::open_socket(
+    boost::asio::io_service& io_service,
+    const boost::asio::ip::udp::endpoint & endpoint,
+    bool reuse_port
+) {
+  t_socket_ptr socket(new udp::socket(io_service));
+  socket->open(endpoint.protocol());
+  if(reuse_port) {
+#ifdef SO_REUSEPORT
+      int val = 1;
+      if(setsockopt(socket->native_handle(), SOL_SOCKET, SO_REUSEPORT, &val, sizeof(val)) != 0) {
+          throw exception("Unable to set SO_REUSEPORT for UDP socket: errno %d", errno);
+      }
+#else  /* SO_REUSEPORT */
+      throw exception("SO_REUSEPORT is not supported on this platform, set server_udp.listeners to 0");
+#endif /* SO_REUSEPORT */
+  }
+  socket->bind(endpoint);
+  if(!socket->is_open()) {
+      throw exception("Unable to listen to UDP %s:%d", endpoint.address().to_string().c_str(), endpoint.port());
+  }
+  return socket;
+}
+
+void server_udp::listener_thread(
+    const boost::shared_ptr<boost::asio::io_service> & io_service,
+    const int & cpu
+) {
+  if(cpu >= 0) {
+#ifdef __linux__
+      cpu_set_t cpu_set;
+      CPU_ZERO(&cpu_set);
+      CPU_SET(cpu, &cpu_set);
+      int res = pthread_setaffinity_np(pthread_self(), sizeof(cpu_set), &cpu_set);
+      if(res != 0) {
+          LOG(log::LEVEL_WARNING, "Unable to pin UDP listener thread to CPU %d: error %d", cpu, res);
+      }
+#else  /* __linux__ */
+      LOG(log::LEVEL_WARNING, "Pinning UDP listener threads to CPUs is not supported on this platform");
+#endif /* __linux__ */
+  }
+
+  try {
+      io_service->run();
+  } catch(const std::exception & e) {
+      LOG(log::LEVEL_CRITICAL, "Exception in UDP listener thread: %s", e.what());
+  }
 }
 
 void server_udp::start()
 {
   // create threads
-  _thread_pool.reset(new thread_pool(_thread_pool_size));
+  _thread_pool.reset(new thread_pool(
+      _thread_pool_size,
+      _max_queue_size,
+      thread_pool::str2overflow_policy(_queue_overflow_policy),
+      thread_pool::str2scheduler(_thread_pool_scheduler)
+  ));
+
+  // start receiving
+  BOOST_FOREACH(const t_socket_ptr & socket, _sockets) {
+    this->receive(socket);
+  }
 
-  //
-  this->receive();
+  // start listener threads
+  my::size_t cpus = boost::thread::hardware_concurrency();
+  for(my::size_t ii = 0; ii < _listeners_io_services.size(); ++ii) {
+      int cpu = (_pin_listeners && cpus > 0) ? (int)(ii % cpus) : -1;
+      _listeners_threads.create_thread(boost::bind(&server_udp::listener_thread, _listeners_io_services[ii], cpu));
+  }
 }
 
 
@@ -179,35 +272,49 @@ void server_udp::stop()
 {
   LOG(log::LEVEL_DEBUG, "Stopping UDP server");
 
-  if(_socket) {
-      _socket->close();
-      _socket.reset();
+  // stop the listener threads first: the sockets are not thread safe
+  BOOST_FOREACH(const boost::shared_ptr<boost::asio::io_service> & io_service, _listeners_io_services) {
+    io_service->stop();
+  }
+  try {
+      _listeners_threads.join_all();
+  } catch (std::exception& e) {
+      LOG(log::LEVEL_ERROR, "%s", e.what());
+  }
+  BOOST_FOREACH(const t_socket_ptr & socket, _sockets) {
+    socket->close();
   }
+  _sockets.clear();
+  _listeners_io_services.clear();
   _thread_pool.reset();
 
   LOG(log::LEVEL_INFO, "Stopped UDP server");
 }
 
-void server_udp::update_status(const time_t & now)
+void server_udp::update_status(self_metrics & metrics)
 {
   // eat our own dog food
-  _rrdb->update_metric("self.udp.load_factor", now, _thread_pool->get_load_factor());
-  _rrdb->update_metric("self.udp.started_requests", now, _thread_pool->get_started_jobs());
-  _rrdb->update_metric("self.udp.finished_requests", now, _thread_pool->get_finished_jobs());
+  metrics.add("self.udp.load_factor",       _thread_pool->get_load_factor());
+  metrics.add("self.udp.started_requests",  _thread_pool->get_started_jobs());
+  metrics.add("self.udp.finished_requests", _thread_pool->get_finished_jobs());
+  metrics.add("self.udp.queue_size",        _thread_pool->get_queue_size());
+  metrics.add("self.udp.dropped_requests",  _thread_pool->get_dropped_jobs());
+  metrics.add("self.udp.wait_time",         _thread_pool->get_wait_time());
+  metrics.add("self.udp.run_time",          _thread_pool->get_run_time());
 }
 
-void server_udp::receive()
+void server_udp::receive(const t_socket_ptr & socket)
 {
   boost::intrusive_ptr<connection_udp> new_connection(
       new connection_udp(
-          _socket,
+          socket,
           _rrdb,
           _buffer_size,
           _send_success_response
       )
   );
 
-  _socket->async_receive_from(
+  socket->async_receive_from(
       boost::asio::buffer(
           &(new_connection->get_input_buffer())[0],
           new_connection->get_input_buffer().size()
@@ -216,6 +323,7 @@ void server_udp::receive()
       boost::bind(
           &server_udp::handle_receive,
           this,
+          socket,
           new_connection,
           boost::asio::placeholders::error,
           boost::asio::placeholders::bytes_transferred
@@ -224,6 +332,7 @@ void server_udp::receive()
 }
 
 void server_udp::handle_receive(
+    const t_socket_ptr & socket,
     const boost::intrusive_ptr<connection_udp> & new_connection,
     const boost::system::error_code& error,
     my::size_t bytes_transferred
@@ -246,5 +355,5 @@ void server_udp::handle_receive(
   }
 
   // next one, please
-  this->receive();
+  this->receive(socket);
 }
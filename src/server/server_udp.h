@@ -13,6 +13,7 @@
 #include <vector>
 
 #include <boost/asio.hpp>
+#include <boost/thread.hpp>
 #include <boost/shared_ptr.hpp>
 #include <boost/intrusive_ptr.hpp>
 
@@ -21,6 +22,7 @@
 class config;
 class thread_pool;
 class rrdb;
+class self_metrics;
 class connection_udp;
 
 class server_udp
@@ -36,12 +38,15 @@ public:
   void start();
   void stop();
 
-  void update_status(const time_t & now);
+  void update_status(self_metrics & metrics);
 
 protected:
-  void receive();
+  typedef boost::shared_ptr<boost::asio::ip::udp::socket> t_socket_ptr;
+
+  void receive(const t_socket_ptr & socket);
 
   void handle_receive(
+    const t_socket_ptr & socket,
     const boost::intrusive_ptr<connection_udp> & new_connection,
     const boost::system::error_code & error,
     my::size_t bytes_transferred
@@ -51,14 +56,33 @@ protected:
     return _rrdb;
   }
 
+  static t_socket_ptr open_socket(
+    boost::asio::io_service& io_service,
+    const boost::asio::ip::udp::endpoint & endpoint,
+    bool reuse_port
+  );
+  static void listener_thread(
+    const boost::shared_ptr<boost::asio::io_service> & io_service,
+    const int & cpu
+  );
+
 private:
   boost::shared_ptr<thread_pool>                  _thread_pool;
   boost::shared_ptr<rrdb>                         _rrdb;
-  boost::shared_ptr<boost::asio::ip::udp::socket> _socket;
+  std::vector<t_socket_ptr>                       _sockets;
+
+  // SO_REUSEPORT listeners with their own threads (empty if the socket is on the server's io_service)
+  std::vector< boost::shared_ptr<boost::asio::io_service> > _listeners_io_services;
+  boost::thread_group                                       _listeners_threads;
 
   std::string  _address;
   int          _port;
+  my::size_t  _listeners;
+  bool         _pin_listeners;
   my::size_t  _thread_pool_size;
+  std::string  _thread_pool_scheduler;
+  my::size_t  _max_queue_size;
+  std::string  _queue_overflow_policy;
   my::size_t  _buffer_size;
   bool         _send_success_response;
 }; // server_udp
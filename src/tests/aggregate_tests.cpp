@@ -0,0 +1,155 @@
+/*
+ * aggregate_tests.cpp
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: aleksey
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+#include "rrdb/rrdb_metric_tuples_aggregate.h"
+
+#include "tests/aggregate_tests.h"
+#include "tests/stats_rrdb_tests.h"
+
+aggregate_tests::aggregate_tests()
+{
+}
+
+aggregate_tests::~aggregate_tests()
+{
+}
+
+// integer values so the sums are exact regardless of the summation order,
+// with empty tuples (as in the blocks with gaps) sprinkled in
+void aggregate_tests::generate(t_rrdb_metric_tuples & tuples)
+{
+  t_rrdb_metric_tuple tuple;
+  for(my::size_t ii = 0; ii < tuples.get_size(); ++ii) {
+      memset(&tuple, 0, sizeof(tuple));
+      tuple._ts = ii * 60;
+      if(rand() % 4 != 0) {
+          for(int jj = rand() % 5; jj >= 0; --jj) {
+              rrdb_metric_tuple_update(tuple, (my::value_t)(rand() % 2000 - 1000));
+          }
+      }
+      tuples.set(ii, tuple);
+  }
+}
+
+void aggregate_tests::test_correctness(const int & n, const std::string & name, const my::size_t & size)
+{
+  char buf[1024];
+  snprintf(buf, sizeof(buf), "%s aggregation correctness for %lu tuples", name.c_str(), size);
+  TEST_SUBTEST_START(n, buf, false);
+
+  t_rrdb_metric_tuples_aggregate_func scalar(rrdb_metric_tuples_aggregate_get("scalar"));
+  t_rrdb_metric_tuples_aggregate_func func(rrdb_metric_tuples_aggregate_get(name));
+  TEST_CHECK(scalar);
+  if(!func) {
+      TEST_SUBTEST_END2("not supported on this CPU");
+      return;
+  }
+
+  t_rrdb_metric_tuples tuples(size);
+  for(int ii = 0; ii < 100; ++ii) {
+      aggregate_tests::generate(tuples);
+
+      // random range, empty or non-empty initial tuple
+      my::size_t first_pos = rand() % size;
+      my::size_t last_pos  = rand() % (first_pos + 1);
+      t_rrdb_metric_tuple expected, actual;
+      memset(&expected, 0, sizeof(expected));
+      if(ii % 2) {
+          rrdb_metric_tuple_update(expected, (my::value_t)(rand() % 2000 - 1000));
+      }
+      actual = expected;
+
+      scalar(expected, tuples, first_pos, last_pos);
+      func(actual, tuples, first_pos, last_pos);
+      TEST_CHECK_EQUAL(actual._count,   expected._count);
+      TEST_CHECK_EQUAL(actual._sum,     expected._sum);
+      TEST_CHECK_EQUAL(actual._sum_sqr, expected._sum_sqr);
+      TEST_CHECK_EQUAL(actual._min,     expected._min);
+      TEST_CHECK_EQUAL(actual._max,     expected._max);
+  }
+
+  TEST_SUBTEST_END();
+}
+
+void aggregate_tests::test_benchmark(const int & n, const std::string & name, const my::size_t & size, const my::size_t & group_by)
+{
+  char buf[1024];
+  snprintf(buf, sizeof(buf), "%s aggregation benchmark for %lu tuples grouped by %lu", name.c_str(), size, group_by);
+  TEST_SUBTEST_START(n, buf, false);
+
+  t_rrdb_metric_tuples_aggregate_func scalar(rrdb_metric_tuples_aggregate_get("scalar"));
+  t_rrdb_metric_tuples_aggregate_func func(rrdb_metric_tuples_aggregate_get(name));
+  TEST_CHECK(scalar);
+  if(!func) {
+      TEST_SUBTEST_END2("not supported on this CPU");
+      return;
+  }
+
+  t_rrdb_metric_tuples tuples(size);
+  aggregate_tests::generate(tuples);
+
+  // same "group by" walk with both implementations
+  t_rrdb_metric_tuple expected, actual;
+  boost::posix_time::time_duration delta[2];
+  t_rrdb_metric_tuples_aggregate_func funcs[2] = { scalar, func };
+  t_rrdb_metric_tuple * results[2] = { &expected, &actual };
+  for(int ii = 0; ii < 2; ++ii) {
+      t_rrdb_metric_tuple & total(*results[ii]);
+      memset(&total, 0, sizeof(total));
+
+      boost::posix_time::ptime ts1 = boost::posix_time::microsec_clock::local_time();
+      for(int jj = 0; jj < 10; ++jj) {
+          for(my::size_t pos = size; pos > 0; pos -= std::min(pos, group_by)) {
+              t_rrdb_metric_tuple group;
+              memset(&group, 0, sizeof(group));
+              funcs[ii](group, tuples, pos - 1, pos - std::min(pos, group_by));
+              rrdb_metric_tuple_update(total, group);
+          }
+      }
+      delta[ii] = boost::posix_time::microsec_clock::local_time() - ts1;
+  }
+  TEST_CHECK_EQUAL(actual._count,   expected._count);
+  TEST_CHECK_EQUAL(actual._sum,     expected._sum);
+  TEST_CHECK_EQUAL(actual._sum_sqr, expected._sum_sqr);
+  TEST_CHECK_EQUAL(actual._min,     expected._min);
+  TEST_CHECK_EQUAL(actual._max,     expected._max);
+
+  snprintf(buf, sizeof(buf),  "scalar %ld us, %s %ld us (%0.2fx)",
+      (long)delta[0].total_microseconds(),
+      name.c_str(),
+      (long)delta[1].total_microseconds(),
+      (double)delta[0].total_microseconds() / (double)std::max<long>(1, delta[1].total_microseconds())
+  );
+
+  // done
+  TEST_SUBTEST_END2(buf);
+}
+
+void aggregate_tests::run()
+{
+  aggregate_tests test;
+  const char * names[] = { "sse2", "avx2" };
+  const my::size_t sizes[] = { 1, 2, 3, 5, 17, 1000 };
+
+  int n = 0;
+  for(my::size_t ii = 0; ii < sizeof(names) / sizeof(names[0]); ++ii) {
+      for(my::size_t jj = 0; jj < sizeof(sizes) / sizeof(sizes[0]); ++jj) {
+          test.test_correctness(n++, names[ii], sizes[jj]);
+      }
+  }
+
+  // a year of 1 min data grouped by 1 hour
+  for(my::size_t ii = 0; ii < sizeof(names) / sizeof(names[0]); ++ii) {
+      test.test_benchmark(n++, names[ii], 525600, 60);
+  }
+}
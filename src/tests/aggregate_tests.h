@@ -0,0 +1,32 @@
+/*
+ * aggregate_tests.h
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: aleksey
+ */
+
+#ifndef TESTS_AGGREGATE_TESTS_H_
+#define TESTS_AGGREGATE_TESTS_H_
+
+#include <string>
+
+#include "common/types.h"
+
+#include "rrdb/rrdb_metric_tuple.h"
+
+class aggregate_tests
+{
+public:
+  aggregate_tests();
+  virtual ~aggregate_tests();
+
+  static void run();
+
+private:
+  void test_correctness(const int & n, const std::string & name, const my::size_t & size);
+  void test_benchmark(const int & n, const std::string & name, const my::size_t & size, const my::size_t & group_by);
+
+  static void generate(t_rrdb_metric_tuples & tuples);
+}; // aggregate_tests
+
+#endif /* TESTS_AGGREGATE_TESTS_H_ */
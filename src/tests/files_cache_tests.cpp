@@ -141,6 +141,48 @@ void files_cache_tests::test_delete_file(const int & n)
   TEST_SUBTEST_END();
 }
 
+void files_cache_tests::test_read_write(const int & n)
+{
+  TEST_SUBTEST_START(n, "read_write", false);
+
+  my::time_t ts = time(NULL);
+  my::filename_t filename = files_cache_tests::get_filename(5);
+  rrdb_file_ptr file = _files_cache->open_file(filename, ts);
+  TEST_CHECK(file);
+
+  // positional writes in any order
+  const char data1[] = "0123456789";
+  const char data2[] = "abcdef";
+  file->write(100, data2, sizeof(data2));
+  file->write(0, data1, sizeof(data1));
+
+  // read them back, the same handle should come from the cache
+  char buf[128];
+  rrdb_file_ptr file2 = _files_cache->open_file(filename, ts + 1);
+  TEST_CHECK_EQUAL(file.get(), file2.get());
+  file2->read(0, buf, sizeof(data1));
+  TEST_CHECK_EQUAL(std::string(buf), std::string(data1));
+  file2->read(100, buf, sizeof(data2));
+  TEST_CHECK_EQUAL(std::string(buf), std::string(data2));
+
+  // reading past the end should throw
+  bool thrown = false;
+  try {
+      file2->read(100, buf, sizeof(buf));
+  } catch(const std::exception & e) {
+      thrown = true;
+  }
+  TEST_CHECK(thrown);
+
+  // deleting the file doesn't break the handle we still hold
+  _files_cache->delete_file(filename);
+  file->read(2, buf, 3);
+  TEST_CHECK_EQUAL(std::string(buf, 3), std::string("234"));
+
+  // done
+  TEST_SUBTEST_END();
+}
+
 void files_cache_tests::run(const std::string & path)
 {
   // setup
@@ -151,6 +193,7 @@ void files_cache_tests::run(const std::string & path)
   // tests
   test.test_open_file(0);
   test.test_delete_file(0);
+  test.test_read_write(0);
 
   // cleanup
   test.cleanup();
@@ -30,6 +30,7 @@ private:
 
   void test_open_file(const int & n);
   void test_delete_file(const int & n);
+  void test_read_write(const int & n);
 
   static my::filename_t  get_filename(int n);
 
@@ -0,0 +1,192 @@
+/*
+ * format_tests.cpp
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: aleksey
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+#include "common/text_buffer.h"
+#include "common/memory_buffer.h"
+
+#include "rrdb/rrdb_metric_tuple.h"
+
+#include "tests/format_tests.h"
+#include "tests/stats_rrdb_tests.h"
+
+format_tests::format_tests()
+{
+}
+
+format_tests::~format_tests()
+{
+}
+
+static std::string format_tests_format(const double & value)
+{
+  text_buffer buf;
+  buf.append(value);
+  return std::string(buf.data(), buf.size());
+}
+
+void format_tests::test_format_double(const int & n)
+{
+  TEST_SUBTEST_START(n, "format doubles", false);
+
+  // integers
+  TEST_CHECK_EQUAL(format_tests_format(0), "0");
+  TEST_CHECK_EQUAL(format_tests_format(30), "30");
+  TEST_CHECK_EQUAL(format_tests_format(-5), "-5");
+  TEST_CHECK_EQUAL(format_tests_format(1000000), "1000000");
+  TEST_CHECK_EQUAL(format_tests_format(123456789012345.0), "123456789012345");
+
+  // shortest representation
+  TEST_CHECK_EQUAL(format_tests_format(0.1), "0.1");
+  TEST_CHECK_EQUAL(format_tests_format(-2.5), "-2.5");
+  TEST_CHECK_EQUAL(format_tests_format(1.0 / 3.0), "0.3333333333333333");
+  TEST_CHECK_EQUAL(format_tests_format(0.1 + 0.2), "0.30000000000000004");
+  TEST_CHECK_EQUAL(format_tests_format(1e20), "1e+20");
+  TEST_CHECK_EQUAL(format_tests_format(1e-7), "1e-07");
+
+  // special values
+  TEST_CHECK_EQUAL(format_tests_format(sqrt(-1.0)), "nan");
+  TEST_CHECK_EQUAL(format_tests_format(1.0 / 0.0), "inf");
+  TEST_CHECK_EQUAL(format_tests_format(-1.0 / 0.0), "-inf");
+
+  // unsigned
+  text_buffer buf(1);
+  buf.append((boost::uint64_t)0).append(',').append((boost::uint64_t)18446744073709551615ULL);
+  TEST_CHECK_EQUAL(std::string(buf.data(), buf.size()), "0,18446744073709551615");
+
+  // round trip
+  for(int ii = 0; ii < 100000; ++ii) {
+      double value = (rand() - RAND_MAX / 2) / (double)(rand() + 1) * pow(10.0, rand() % 40 - 20);
+      std::string str = format_tests_format(value);
+      if(strtod(str.c_str(), NULL) != value) {
+          TEST_CHECK_EQUAL(strtod(str.c_str(), NULL), value);
+          break;
+      }
+  }
+
+  TEST_SUBTEST_END();
+}
+
+void format_tests::test_format_csv(const int & n)
+{
+  TEST_SUBTEST_START(n, "format CSV", false);
+
+  t_rrdb_metric_tuple tuple;
+  memset(&tuple, 0, sizeof(tuple));
+  tuple._ts = 1371600000;
+  rrdb_metric_tuple_update(tuple, 2);
+  rrdb_metric_tuple_update(tuple, 4);
+
+  // all fields
+  t_tuple_expr_list expr_list;
+  expr_list.push_back(&rrdb_metric_tuple_write_all);
+  expr_list.push_back(&rrdb_metric_tuple_write_max);
+
+  t_tuple_column_list columns;
+  rrdb_metric_tuple_get_columns(expr_list, columns);
+  TEST_CHECK_EQUAL(columns.size(), 7);
+
+  text_buffer buf;
+  rrdb_metric_tuple_write_csv_header(columns, buf);
+  rrdb_metric_tuple_write_csv_tuple(columns, tuple, buf);
+  TEST_CHECK_EQUAL(std::string(buf.data(), buf.size()),
+      "ts,count,sum,avg,stddev,min,max,max\n"
+      "1371600000,2,6,3,1,2,4,4\n"
+  );
+
+  // the iostream path produces the same text for these values
+  t_memory_buffer_data res_data;
+  t_memory_buffer res(res_data);
+  rrdb_metric_tuple_write_header(expr_list, res);
+  rrdb_metric_tuple_write_tuple(expr_list, tuple, res);
+  res.flush();
+  TEST_CHECK_EQUAL(std::string(res_data.begin(), res_data.end()), std::string(buf.data(), buf.size()));
+
+  TEST_SUBTEST_END();
+}
+
+void format_tests::test_benchmark(const int & n, const my::size_t & size)
+{
+  char buf[1024];
+  snprintf(buf, sizeof(buf), "CSV formatting benchmark for %lu tuples", size);
+  TEST_SUBTEST_START(n, buf, false);
+
+  t_tuple_expr_list expr_list;
+  expr_list.push_back(&rrdb_metric_tuple_write_all);
+  t_tuple_column_list columns;
+  rrdb_metric_tuple_get_columns(expr_list, columns);
+
+  // non integer averages and stddevs to make it interesting
+  std::vector<t_rrdb_metric_tuple> tuples(size);
+  for(my::size_t ii = 0; ii < size; ++ii) {
+      memset(&tuples[ii], 0, sizeof(tuples[ii]));
+      tuples[ii]._ts = 1371600000 + ii * 60;
+      for(int jj = rand() % 5; jj >= 0; --jj) {
+          rrdb_metric_tuple_update(tuples[ii], (rand() % 100000) / 1000.0);
+      }
+  }
+
+  // iostream
+  boost::posix_time::ptime ts1 = boost::posix_time::microsec_clock::local_time();
+  t_memory_buffer_data res_data;
+  {
+    t_memory_buffer res(res_data);
+    for(my::size_t ii = 0; ii < size; ++ii) {
+        rrdb_metric_tuple_write_tuple(expr_list, tuples[ii], res);
+    }
+    res.flush();
+  }
+  boost::posix_time::time_duration delta1 = boost::posix_time::microsec_clock::local_time() - ts1;
+
+  // text buffer
+  boost::posix_time::ptime ts2 = boost::posix_time::microsec_clock::local_time();
+  t_memory_buffer_data text_data;
+  {
+    t_memory_buffer res(text_data);
+    text_buffer text(64 * 1024 + 1024);
+    for(my::size_t ii = 0; ii < size; ++ii) {
+        rrdb_metric_tuple_write_csv_tuple(columns, tuples[ii], text);
+        if(text.size() >= 64 * 1024) {
+            text.write_to(res);
+        }
+    }
+    text.write_to(res);
+    res.flush();
+  }
+  boost::posix_time::time_duration delta2 = boost::posix_time::microsec_clock::local_time() - ts2;
+
+  // both have one line per tuple
+  TEST_CHECK_EQUAL((my::size_t)std::count(res_data.begin(), res_data.end(), '\n'), size);
+  TEST_CHECK_EQUAL((my::size_t)std::count(text_data.begin(), text_data.end(), '\n'), size);
+
+  snprintf(buf, sizeof(buf),  "iostream %ld us (%lu bytes), text buffer %ld us (%lu bytes, %0.2fx)",
+      (long)delta1.total_microseconds(),
+      (unsigned long)res_data.size(),
+      (long)delta2.total_microseconds(),
+      (unsigned long)text_data.size(),
+      (double)delta1.total_microseconds() / (double)std::max<long>(1, delta2.total_microseconds())
+  );
+
+  // done
+  TEST_SUBTEST_END2(buf);
+}
+
+void format_tests::run()
+{
+  format_tests test;
+
+  int n = 0;
+  test.test_format_double(n++);
+  test.test_format_csv(n++);
+  test.test_benchmark(n++, 500000);
+}
@@ -0,0 +1,29 @@
+/*
+ * format_tests.h
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: aleksey
+ */
+
+#ifndef TESTS_FORMAT_TESTS_H_
+#define TESTS_FORMAT_TESTS_H_
+
+#include <string>
+
+#include "common/types.h"
+
+class format_tests
+{
+public:
+  format_tests();
+  virtual ~format_tests();
+
+  static void run();
+
+private:
+  void test_format_double(const int & n);
+  void test_format_csv(const int & n);
+  void test_benchmark(const int & n, const my::size_t & size);
+}; // format_tests
+
+#endif /* TESTS_FORMAT_TESTS_H_ */
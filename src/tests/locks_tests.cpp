@@ -0,0 +1,201 @@
+/*
+ * locks_tests.cpp
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: aleksey
+ */
+#include <stdio.h>
+#include <time.h>
+
+#include <boost/thread.hpp>
+#include <boost/thread/locks.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+#include "common/spinlock.h"
+#include "common/adaptive_lock.h"
+#include "common/named_lock.h"
+#include "common/log.h"
+
+#include "tests/locks_tests.h"
+#include "tests/stats_rrdb_tests.h"
+
+//
+// Increments the counter under the lock: the "work" is the number of
+// increments in the critical section
+//
+template<typename T>
+class locks_tests_worker
+{
+public:
+  locks_tests_worker(T & lock, volatile my::size_t & counter, const my::size_t & iterations, const my::size_t & work) :
+    _lock(lock),
+    _counter(counter),
+    _iterations(iterations),
+    _work(work)
+  {
+  }
+
+  void operator()()
+  {
+    for(my::size_t ii = 0; ii < _iterations; ++ii) {
+        boost::lock_guard<T> guard(_lock);
+        for(my::size_t jj = 0; jj < _work; ++jj) {
+            ++_counter;
+        }
+    }
+  }
+
+private:
+  T &                     _lock;
+  volatile my::size_t &   _counter;
+  my::size_t              _iterations;
+  my::size_t              _work;
+}; // class locks_tests_worker
+
+template<typename T>
+static my::size_t locks_tests_run(
+    T & lock,
+    const my::size_t & threads,
+    const my::size_t & iterations,
+    const my::size_t & work,
+    long & wall_us,
+    long & cpu_us
+) {
+  volatile my::size_t counter = 0;
+
+  clock_t cpu1 = clock();
+  boost::posix_time::ptime ts1 = boost::posix_time::microsec_clock::local_time();
+  boost::thread_group group;
+  for(my::size_t ii = 0; ii < threads; ++ii) {
+      group.create_thread(locks_tests_worker<T>(lock, counter, iterations, work));
+  }
+  group.join_all();
+  wall_us = (boost::posix_time::microsec_clock::local_time() - ts1).total_microseconds();
+  cpu_us  = (long)((clock() - cpu1) * 1000000.0 / CLOCKS_PER_SEC);
+
+  return counter;
+}
+
+locks_tests::locks_tests()
+{
+}
+
+locks_tests::~locks_tests()
+{
+}
+
+void locks_tests::test_correctness(const int & n, const my::size_t & threads)
+{
+  char buf[1024];
+  snprintf(buf, sizeof(buf), "adaptive lock correctness for %lu threads", SIZE_T_CAST threads);
+  TEST_SUBTEST_START(n, buf, false);
+
+  adaptive_lock lock;
+  long wall_us, cpu_us;
+  my::size_t iterations = 100000, work = 3;
+  my::size_t counter = locks_tests_run(lock, threads, iterations, work, wall_us, cpu_us);
+  TEST_CHECK_EQUAL(counter, threads * iterations * work);
+  TEST_CHECK_EQUAL(lock.is_locked(), false);
+
+  // the lock still works after parking
+  TEST_CHECK_EQUAL(lock.try_lock(), true);
+  TEST_CHECK_EQUAL(lock.is_locked(), true);
+  TEST_CHECK_EQUAL(lock.try_lock(), false);
+  lock.unlock();
+  TEST_CHECK_EQUAL(lock.is_locked(), false);
+
+  // done
+  TEST_SUBTEST_END();
+}
+
+void locks_tests::test_benchmark(const int & n, const my::size_t & threads, const my::size_t & work)
+{
+  char buf[1024];
+  snprintf(buf, sizeof(buf), "locks benchmark for %lu threads with %lu increments under lock", SIZE_T_CAST threads, SIZE_T_CAST work);
+  TEST_SUBTEST_START(n, buf, false);
+
+  // about the same total work for short and long critical sections
+  my::size_t iterations = 4000000 / (threads * work) + 1;
+  long wall_us[2], cpu_us[2];
+
+  spinlock lock1;
+  my::size_t counter1 = locks_tests_run(lock1, threads, iterations, work, wall_us[0], cpu_us[0]);
+  TEST_CHECK_EQUAL(counter1, threads * iterations * work);
+
+  adaptive_lock lock2;
+  my::size_t counter2 = locks_tests_run(lock2, threads, iterations, work, wall_us[1], cpu_us[1]);
+  TEST_CHECK_EQUAL(counter2, threads * iterations * work);
+
+  snprintf(buf, sizeof(buf),  "spinlock %ld us (cpu %ld us), adaptive %ld us (cpu %ld us, %lu contended, %lu parked)",
+      wall_us[0],
+      cpu_us[0],
+      wall_us[1],
+      cpu_us[1],
+      SIZE_T_CAST lock2.get_contended_count(),
+      SIZE_T_CAST lock2.get_parked_count()
+  );
+
+  // done
+  TEST_SUBTEST_END2(buf);
+}
+
+void locks_tests::test_named_lock(const int & n, const my::size_t & threads)
+{
+  char buf[1024];
+  snprintf(buf, sizeof(buf), "named lock stats for %lu threads", SIZE_T_CAST threads);
+  TEST_SUBTEST_START(n, buf, false);
+
+  std::vector<named_lock::t_stats> stats;
+  named_lock::get_stats(stats, true);
+
+  // two locks with the same name share the stats
+  named_lock lock1("test"), lock2("test");
+  long wall_us, cpu_us;
+  my::size_t iterations = 10000, work = 100;
+  my::size_t counter1 = locks_tests_run(lock1, threads, iterations, work, wall_us, cpu_us);
+  TEST_CHECK_EQUAL(counter1, threads * iterations * work);
+  my::size_t counter2 = locks_tests_run(lock2, threads, iterations, work, wall_us, cpu_us);
+  TEST_CHECK_EQUAL(counter2, threads * iterations * work);
+  TEST_CHECK_EQUAL(lock1.is_locked(), false);
+
+  named_lock::get_stats(stats, true);
+#ifdef ENABLE_LOCK_STATS
+  const named_lock::t_stats * test_stats = NULL;
+  for(my::size_t ii = 0; ii < stats.size(); ++ii) {
+      if(stats[ii]._name == "test") {
+          test_stats = &stats[ii];
+      }
+  }
+  TEST_CHECK(test_stats != NULL);
+  if(test_stats) {
+      TEST_CHECK_EQUAL(test_stats->_acquisitions, 2 * threads * iterations);
+      TEST_CHECK(test_stats->_contended <= test_stats->_acquisitions);
+  }
+#else  /* ENABLE_LOCK_STATS */
+  TEST_CHECK(stats.empty());
+#endif /* ENABLE_LOCK_STATS */
+
+  // done
+  TEST_SUBTEST_END();
+}
+
+void locks_tests::run()
+{
+  locks_tests test;
+  const my::size_t threads[] = { 1, 4, 16 };
+
+  int n = 0;
+  for(my::size_t ii = 0; ii < sizeof(threads) / sizeof(threads[0]); ++ii) {
+      test.test_correctness(n++, threads[ii]);
+  }
+
+  // tiny critical sections (metrics map lookups) and longer ones (block updates)
+  for(my::size_t ii = 0; ii < sizeof(threads) / sizeof(threads[0]); ++ii) {
+      test.test_benchmark(n++, threads[ii], 1);
+      test.test_benchmark(n++, threads[ii], 1000);
+  }
+
+  for(my::size_t ii = 0; ii < sizeof(threads) / sizeof(threads[0]); ++ii) {
+      test.test_named_lock(n++, threads[ii]);
+  }
+}
@@ -0,0 +1,29 @@
+/*
+ * locks_tests.h
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: aleksey
+ */
+
+#ifndef TESTS_LOCKS_TESTS_H_
+#define TESTS_LOCKS_TESTS_H_
+
+#include <string>
+
+#include "common/types.h"
+
+class locks_tests
+{
+public:
+  locks_tests();
+  virtual ~locks_tests();
+
+  static void run();
+
+private:
+  void test_correctness(const int & n, const my::size_t & threads);
+  void test_benchmark(const int & n, const my::size_t & threads, const my::size_t & work);
+  void test_named_lock(const int & n, const my::size_t & threads);
+}; // locks_tests
+
+#endif /* TESTS_LOCKS_TESTS_H_ */
@@ -43,6 +43,9 @@ void parsers_tests::run()
   test.test_statement_show_policy(7);
   test.test_statement_show_metrics(8);
   test.test_statement_show_status(9);
+  test.test_statement_select_metrics(10);
+  test.test_statement_select_aggregate(11);
+  test.test_statement_find_end(12);
 
 }
 
@@ -429,6 +432,18 @@ void parsers_tests::test_statement_select(const int & n)
   TEST_CHECK(st._group_by);
   TEST_CHECK_EQUAL(st._group_by.get(),  5 * INTERVAL_MIN);
 
+  // format
+  vst = statement_query_parse("SELECT * FROM 'test' BETWEEN 0 and 123456789 GROUP BY 5 mins FORMAT binary; ");
+  st = boost::get<statement_select>(vst);
+  TEST_CHECK(st._group_by);
+  TEST_CHECK(st._format);
+  TEST_CHECK_EQUAL(st._format.get(),   Format_Binary);
+  vst = statement_query_parse("SELECT * FROM 'test' BETWEEN 0 and 123456789 format CSV; ");
+  st = boost::get<statement_select>(vst);
+  TEST_CHECK(!st._group_by);
+  TEST_CHECK(st._format);
+  TEST_CHECK_EQUAL(st._format.get(),   Format_Csv);
+
   // errors
   TEST_CHECK_THROW(statement_query_parse("SELECT"), "Parser error: expecting <sequence><select field><expect>\",\"<select field> at the end");
   TEST_CHECK_THROW(statement_query_parse("SELECT FROM"), "Parser error: expecting <sequence><select field><expect>\",\"<select field> at \"  ^^^^^ FROM\"");
@@ -437,12 +452,92 @@ void parsers_tests::test_statement_select(const int & n)
   TEST_CHECK_THROW(statement_query_parse("SELECT * FROM 'test' BETWEEN 0"), "Parser error: expecting \"and\" at \" 0 ^^^^^ \"");
   TEST_CHECK_THROW(statement_query_parse("SELECT * FROM 'test' BETWEEN 0 and"), "Parser error: expecting <unsigned-integer> at \" and ^^^^^ \"");
   TEST_CHECK_THROW(statement_query_parse("SELECT * FROM 'test' BETWEEN 0 and 123456;xxx"), "Parser error: 'query statement' unexpected  'xxx'");
+  TEST_CHECK_THROW(statement_query_parse("SELECT * FROM 'test' BETWEEN 0 and 123456 FORMAT xml;"), "Parser error: expecting <result format> at \"  ^^^^^ xml;\"");
 
 
   // done
   TEST_SUBTEST_END();
 }
 
+void parsers_tests::test_statement_select_metrics(const int & n)
+{
+  TEST_SUBTEST_START(n, "statement SELECT FROM METRICS", false);
+  t_statement vst;
+  statement_select_metrics st;
+
+  // full
+  vst = statement_query_parse("SELECT * FROM METRICS LIKE 'web.*.latency' BETWEEN 0 and 123456789 GROUP BY 5 mins; ");
+  st = boost::get<statement_select_metrics>(vst);
+  TEST_CHECK_EQUAL(st._result.size(),  1);
+  TEST_CHECK(st._result[0] == &rrdb_metric_tuple_write_all);
+  TEST_CHECK_EQUAL(st._like,           "web.*.latency");
+  TEST_CHECK_EQUAL(st._ts_begin,        0);
+  TEST_CHECK_EQUAL(st._ts_end,          123456789);
+  TEST_CHECK(st._group_by);
+  TEST_CHECK_EQUAL(st._group_by.get(),  5 * INTERVAL_MIN);
+
+  // no GROUP BY
+  vst = statement_query_parse("select min, max from metrics like \"web\" between 0 and 123456789;");
+  st = boost::get<statement_select_metrics>(vst);
+  TEST_CHECK_EQUAL(st._result.size(),  2);
+  TEST_CHECK(st._result[0] == &rrdb_metric_tuple_write_min);
+  TEST_CHECK(st._result[1] == &rrdb_metric_tuple_write_max);
+  TEST_CHECK_EQUAL(st._like,           "web");
+  TEST_CHECK(!st._group_by);
+
+  // wildcards are not allowed in a single metric name
+  TEST_CHECK(boost::get<statement_select>(&(vst = statement_query_parse("SELECT * FROM METRIC 'metrics' BETWEEN 0 and 1;"))));
+  TEST_CHECK_THROW(statement_query_parse("SELECT * FROM METRIC 'web.*' BETWEEN 0 and 1;"), "Parser error: expecting \"'\" at \" 'web. ^^^^^ *' BETWEEN 0 and 1;\"");
+
+  // errors
+  TEST_CHECK_THROW(statement_query_parse("SELECT * FROM METRICS 'web.*'"), "Parser error: expecting \"like\" at \"  ^^^^^ 'web.*'\"");
+  TEST_CHECK_THROW(statement_query_parse("SELECT * FROM METRICS LIKE 'web.*'"), "Parser error: expecting \"between\" at \" 'web.*' ^^^^^ \"");
+
+  // done
+  TEST_SUBTEST_END();
+}
+
+void parsers_tests::test_statement_select_aggregate(const int & n)
+{
+  TEST_SUBTEST_START(n, "statement SELECT <aggregate> FROM METRICS", false);
+  t_statement vst;
+  statement_select_aggregate st;
+
+  // full
+  vst = statement_query_parse("SELECT SUM(avg), max( max ), Count(count) FROM METRICS LIKE 'host.*.cpu' BETWEEN 0 and 123456789 GROUP BY 1 min; ");
+  st = boost::get<statement_select_aggregate>(vst);
+  TEST_CHECK_EQUAL(st._result.size(),  3);
+  TEST_CHECK_EQUAL(st._result[0]._func, Aggregate_Sum);
+  TEST_CHECK(st._result[0]._field == &rrdb_metric_tuple_get_avg);
+  TEST_CHECK_EQUAL(st._result[1]._func, Aggregate_Max);
+  TEST_CHECK(st._result[1]._field == &rrdb_metric_tuple_get_max);
+  TEST_CHECK_EQUAL(st._result[2]._func, Aggregate_Count);
+  TEST_CHECK(st._result[2]._field == &rrdb_metric_tuple_get_count);
+  TEST_CHECK_EQUAL(st._like,           "host.*.cpu");
+  TEST_CHECK_EQUAL(st._ts_begin,        0);
+  TEST_CHECK_EQUAL(st._ts_end,          123456789);
+  TEST_CHECK(st._group_by);
+  TEST_CHECK_EQUAL(st._group_by.get(),  1 * INTERVAL_MIN);
+
+  // format
+  TEST_CHECK(!st._format);
+  vst = statement_query_parse("SELECT avg(sum) FROM METRICS LIKE 'host' BETWEEN 0 and 1 FORMAT Binary;");
+  st = boost::get<statement_select_aggregate>(vst);
+  TEST_CHECK(st._format);
+  TEST_CHECK_EQUAL(st._format.get(), Format_Binary);
+
+  // plain fields are still plain select
+  vst = statement_query_parse("SELECT sum, avg FROM METRICS LIKE 'host' BETWEEN 0 and 1;");
+  TEST_CHECK(boost::get<statement_select_metrics>(&vst));
+
+  // errors
+  TEST_CHECK_THROW(statement_query_parse("SELECT sum(xxx) FROM METRICS LIKE 'host' BETWEEN 0 and 1;"), "Parser error: expecting <aggregate field> at \" sum( ^^^^^ xxx) FROM METRICS LIKE 'host' BETWEEN 0 and 1;\"");
+  TEST_CHECK_THROW(statement_query_parse("SELECT sum(avg) FROM METRIC 'host' BETWEEN 0 and 1;"), "Parser error: expecting \"metrics\" at \"  ^^^^^ METRIC 'host' BETWEEN 0 and 1;\"");
+
+  // done
+  TEST_SUBTEST_END();
+}
+
 void parsers_tests::test_statement_show_policy(const int & n)
 {
   TEST_SUBTEST_START(n, "statement SHOW METRIC POLICY", false);
@@ -540,3 +635,21 @@ void parsers_tests::test_statement_show_status(const int & n)
   TEST_SUBTEST_END();
 }
 
+
+void parsers_tests::test_statement_find_end(const int & n)
+{
+  TEST_SUBTEST_START(n, "statements end in pipeline", false);
+
+  TEST_CHECK_EQUAL(statement_find_end(""), std::string::npos);
+  TEST_CHECK_EQUAL(statement_find_end("SHOW STATUS"), std::string::npos);
+  TEST_CHECK_EQUAL(statement_find_end("PIPELINE;"), 8);
+  TEST_CHECK_EQUAL(statement_find_end("SHOW STATUS; SHOW METRICS;"), 11);
+
+  // quoted names
+  TEST_CHECK_EQUAL(statement_find_end("SHOW METRICS LIKE 'a;b'; SHOW STATUS;"), 23);
+  TEST_CHECK_EQUAL(statement_find_end("SHOW METRICS LIKE \"a';b\"; SHOW STATUS;"), 24);
+  TEST_CHECK_EQUAL(statement_find_end("SHOW METRICS LIKE 'a;b"), std::string::npos);
+
+  // done
+  TEST_SUBTEST_END();
+}
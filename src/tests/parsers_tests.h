@@ -25,6 +25,9 @@ public:
   void test_statement_drop(const int & n);
   void test_statement_update(const int & n);
   void test_statement_select(const int & n);
+  void test_statement_select_metrics(const int & n);
+  void test_statement_select_aggregate(const int & n);
+  void test_statement_find_end(const int & n);
   void test_statement_show_policy(const int & n);
   void test_statement_show_metrics(const int & n);
   void test_statement_show_status(const int & n);
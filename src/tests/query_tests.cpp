@@ -9,6 +9,8 @@
 
 #include "rrdb/rrdb.h"
 #include "rrdb/rrdb_metric.h"
+#include "rrdb/rrdb_metric_tuples_cache.h"
+#include "rrdb/rrdb_results_cache.h"
 
 #include "common/log.h"
 #include "common/config.h"
@@ -36,6 +38,7 @@ void query_tests::initialize(const std::string & path)
   // create config
   t_test_config_data config_data;
   config_data["rrdb.path"] = path;
+  config_data["rrdb.rollups"] = "1 min";
   boost::shared_ptr<config> cfg = test_setup_config(path, config_data);
 
   // initiliaze
@@ -203,6 +206,368 @@ void query_tests::test_select_all_group_by(const int & n, const my::size_t & gro
   TEST_DATA(buf, std::string(res_data.begin(), res_data.end()));
 }
 
+static boost::uint64_t test_binary_get(const t_memory_buffer_data & data, my::size_t & pos, const my::size_t & size)
+{
+  if(pos + size > data.size()) {
+      throw exception("Unexpected end of binary data at %lu", pos);
+  }
+
+  boost::uint64_t ret = 0;
+  for(my::size_t ii = size; ii > 0; --ii) {
+      ret = (ret << 8) | (unsigned char)data[pos + ii - 1];
+  }
+  pos += size;
+  return ret;
+}
+
+static std::string test_binary_get_string(const t_memory_buffer_data & data, my::size_t & pos)
+{
+  my::size_t len = test_binary_get(data, pos, 4);
+  if(pos + len > data.size()) {
+      throw exception("Unexpected end of binary data at %lu", pos);
+  }
+
+  std::string ret(data.begin() + pos, data.begin() + pos + len);
+  pos += len;
+  return ret;
+}
+
+void query_tests::test_select_binary(const int & n)
+{
+  TEST_SUBTEST_START(n, "select in binary format", false);
+
+  char buf[1024];
+  snprintf(buf, sizeof(buf),  "select * from '%s' between %lu and %lu group by 13 secs",
+       _metric_name.c_str(),
+       _start_ts,
+       _end_ts
+   );
+
+  // query both formats
+  t_memory_buffer_data csv_data;
+  t_memory_buffer csv_res(csv_data);
+  _rrdb->execute_query_statement(std::string(buf) + ";", csv_res);
+
+  t_memory_buffer_data res_data;
+  t_memory_buffer res(res_data);
+  _rrdb->execute_query_statement(std::string(buf) + " format binary;", res);
+
+  t_test_csv_data parsed_data;
+  test_parse_csv_data(csv_data, parsed_data);
+  TEST_CHECK(parsed_data.size() > 1);
+
+  // header
+  my::size_t pos = 0;
+  TEST_CHECK(res_data.size() > 4);
+  TEST_CHECK_EQUAL(std::string(res_data.begin(), res_data.begin() + 4), RRDB_BINARY_FORMAT_MAGIC);
+  pos += 4;
+  TEST_CHECK_EQUAL(test_binary_get(res_data, pos, 4), RRDB_BINARY_FORMAT_VERSION);
+  TEST_CHECK_EQUAL(test_binary_get(res_data, pos, 4), 0); // no metric names
+  TEST_CHECK_EQUAL(test_binary_get(res_data, pos, 4), 6); // columns
+  TEST_CHECK_EQUAL(test_binary_get_string(res_data, pos), "count");
+  TEST_CHECK_EQUAL(test_binary_get_string(res_data, pos), "sum");
+  TEST_CHECK_EQUAL(test_binary_get_string(res_data, pos), "avg");
+  TEST_CHECK_EQUAL(test_binary_get_string(res_data, pos), "stddev");
+  TEST_CHECK_EQUAL(test_binary_get_string(res_data, pos), "min");
+  TEST_CHECK_EQUAL(test_binary_get_string(res_data, pos), "max");
+
+  // rows: ts + 6 doubles, must match CSV
+  TEST_CHECK_EQUAL(res_data.size() - pos, (parsed_data.size() - 1) * (8 + 6 * 8));
+  for(my::size_t ii = 1; ii < parsed_data.size() && pos < res_data.size(); ++ii) {
+      const std::vector<std::string> & row(parsed_data[ii]);
+      TEST_CHECK_EQUAL(test_binary_get(res_data, pos, 8), boost::lexical_cast<my::time_t>(row[0]));
+      for(my::size_t jj = 1; jj <= 6; ++jj) {
+          boost::uint64_t u = test_binary_get(res_data, pos, 8);
+          my::value_t v;
+          memcpy(&v, &u, sizeof(v));
+          TEST_CHECK_EQUAL(v, boost::lexical_cast<my::value_t>(row[jj]));
+      }
+  }
+
+  // done
+  TEST_SUBTEST_END();
+  TEST_DATA(buf, std::string(csv_data.begin(), csv_data.end()));
+}
+
+// collects the chunks
+class query_tests_drain :
+    public memory_buffer_drain
+{
+public:
+  void drain(const char * data, const my::size_t & size)
+  {
+    _chunks.push_back(std::string(data, size));
+  }
+
+public:
+  std::vector<std::string> _chunks;
+}; // query_tests_drain
+
+void query_tests::test_select_streaming(const int & n)
+{
+  TEST_SUBTEST_START(n, "select streaming in chunks", false);
+
+  char buf[1024];
+  snprintf(buf, sizeof(buf),  "select * from '%s' between %lu and %lu group by 1 sec; ",
+       _metric_name.c_str(),
+       _start_ts,
+       _end_ts
+   );
+
+  // all at once
+  t_memory_buffer_data res_data;
+  {
+    t_memory_buffer res(res_data);
+    _rrdb->execute_query_statement(buf, res);
+    res.flush();
+  }
+
+  // streaming: the header goes out before the data
+  query_tests_drain drain;
+  t_memory_buffer_data stream_data;
+  {
+    t_memory_buffer res(t_memory_buffer_device(stream_data, &drain, 16));
+    _rrdb->execute_query_statement(buf, res);
+    res.flush();
+  }
+  TEST_CHECK(stream_data.empty());
+  TEST_CHECK(drain._chunks.size() >= 2);
+  TEST_CHECK_EQUAL(drain._chunks.front(), "ts,count,sum,avg,stddev,min,max\n");
+
+  std::string all;
+  BOOST_FOREACH(const std::string & chunk, drain._chunks) {
+    all += chunk;
+  }
+  TEST_CHECK_EQUAL(all, std::string(res_data.begin(), res_data.end()));
+
+  // done
+  TEST_SUBTEST_END();
+  TEST_DATA(buf, all);
+}
+
+void query_tests::test_query_cost(const int & n)
+{
+  TEST_SUBTEST_START(n, "query cost", false);
+
+  char buf[1024];
+
+  // metadata: free
+  TEST_CHECK_EQUAL(_rrdb->get_query_cost(statement_query_parse("show status;")), 0);
+  TEST_CHECK_EQUAL(_rrdb->get_query_cost(statement_query_parse("show metrics;")), 0);
+
+  // all the data: all the tuples from the first two blocks and 5 mins from the last one
+  snprintf(buf, sizeof(buf),  "select * from '%s' between %lu and %lu ; ",
+      _metric_name.c_str(),
+      _start_ts,
+      _end_ts
+  );
+  my::size_t all_cost = _rrdb->get_query_cost(statement_query_parse(buf));
+  TEST_CHECK_EQUAL(all_cost, 10 + 3 + (_end_ts - _start_ts) / 30);
+
+  // last 5 secs: only a few tuples from each block
+  snprintf(buf, sizeof(buf),  "select * from '%s' between %lu and %lu ; ",
+      _metric_name.c_str(),
+      _end_ts - 5,
+      _end_ts
+  );
+  my::size_t cost = _rrdb->get_query_cost(statement_query_parse(buf));
+  TEST_CHECK(cost > 0);
+  TEST_CHECK(cost < 10);
+
+  // empty interval or unknown metric
+  snprintf(buf, sizeof(buf),  "select * from '%s' between %lu and %lu ; ",
+      _metric_name.c_str(),
+      _end_ts,
+      _start_ts
+  );
+  TEST_CHECK_EQUAL(_rrdb->get_query_cost(statement_query_parse(buf)), 0);
+  TEST_CHECK_EQUAL(_rrdb->get_query_cost(statement_query_parse("select * from 'test.unknown' between 1 and 2;")), 0);
+
+  // all the metrics
+  snprintf(buf, sizeof(buf),  "select * from metrics like '%s' between %lu and %lu ; ",
+      _metric_name.c_str(),
+      _start_ts,
+      _end_ts
+  );
+  TEST_CHECK_EQUAL(_rrdb->get_query_cost(statement_query_parse(buf)), all_cost);
+
+  // done
+  TEST_SUBTEST_END();
+}
+
+static std::string query_tests_execute(const boost::shared_ptr<rrdb> & db, const std::string & query)
+{
+  t_memory_buffer_data res_data;
+  {
+    t_memory_buffer res(res_data);
+    db->execute_query_statement(query, res);
+    res.flush();
+  }
+  return std::string(res_data.begin(), res_data.end());
+}
+
+void query_tests::test_select_results_cache(const int & n)
+{
+  TEST_SUBTEST_START(n, "select with results cache", false);
+
+  const boost::shared_ptr<rrdb_results_cache> & results_cache(_rrdb->get_results_cache());
+  results_cache->clear();
+  results_cache->get_cache_hits(true);
+
+  // the last buckets are still open
+  char buf[1024];
+  snprintf(buf, sizeof(buf),  "select * from '%s' between %lu and %lu group by 7 secs; ",
+      _metric_name.c_str(),
+      _start_ts,
+      _end_ts + 60
+  );
+
+  // the second time the sealed buckets come from the cache
+  std::string res1 = query_tests_execute(_rrdb, buf);
+  TEST_CHECK(results_cache->get_cache_size() > 0);
+  std::string res2 = query_tests_execute(_rrdb, buf);
+  TEST_CHECK_EQUAL(results_cache->get_cache_hits(true), 1);
+  TEST_CHECK_EQUAL(res1, res2);
+
+  // new data: the open bucket is computed again
+  _rrdb->update_metric(_metric_name, _end_ts, 1.0);
+  std::string res3 = query_tests_execute(_rrdb, buf);
+  TEST_CHECK_EQUAL(results_cache->get_cache_hits(true), 1);
+  TEST_CHECK(res1 != res3);
+  results_cache->clear();
+  TEST_CHECK_EQUAL(query_tests_execute(_rrdb, buf), res3);
+
+  // late data: the cached buckets are not valid anymore
+  _rrdb->update_metric(_metric_name, _end_ts - 5, 1.0);
+  std::string res4 = query_tests_execute(_rrdb, buf);
+  TEST_CHECK_EQUAL(results_cache->get_cache_hits(true), 0);
+  TEST_CHECK(res3 != res4);
+  results_cache->clear();
+  TEST_CHECK_EQUAL(query_tests_execute(_rrdb, buf), res4);
+
+  // done
+  TEST_SUBTEST_END();
+  TEST_DATA(buf, res4);
+}
+
+// returns the first row that doesn't match the expected "group by" buckets
+// for the values (ts - start_ts) with one late value in the first bucket
+// if it's not 0
+static std::string query_tests_check_buckets(
+    const std::string & res,
+    const my::time_t & start_ts,
+    const my::interval_t & group_by,
+    const my::size_t & rows,
+    const my::value_t & late_value
+) {
+  t_test_csv_data parsed_data;
+  test_parse_csv_data(t_memory_buffer_data(res.begin(), res.end()), parsed_data);
+  if(parsed_data.size() != 1 + rows) { // 1 header row
+      return "unexpected rows number";
+  }
+
+  // ts,count,sum,avg,stddev,min,max
+  for(my::size_t ii = 1; ii < parsed_data.size(); ++ii) {
+      const std::vector<std::string> & row(parsed_data[ii]);
+      my::time_t ts = boost::lexical_cast<my::time_t>(row[0]);
+      my::value_t kk = (ts - start_ts) / group_by;
+      my::value_t count = group_by;
+      my::value_t sum   = group_by * group_by * kk + group_by * (group_by - 1) / 2;
+      my::value_t max   = group_by * kk + group_by - 1;
+      if(ts == start_ts && late_value > 0) {
+          count += 1;
+          sum   += late_value;
+          max    = late_value;
+      }
+      if(boost::lexical_cast<my::value_t>(row[1]) != count ||
+         boost::lexical_cast<my::value_t>(row[2]) != sum   ||
+         boost::lexical_cast<my::value_t>(row[5]) != group_by * kk ||
+         boost::lexical_cast<my::value_t>(row[6]) != max
+      ) {
+          return "unexpected row for ts " + row[0];
+      }
+  }
+  return std::string();
+}
+
+void query_tests::test_select_rollup(const int & n)
+{
+  TEST_SUBTEST_START(n, "select group by rollup", false);
+
+  // the second block freq doesn't align with "group by 1 min" so w/o
+  // the rollup we would get the proportional approximations
+  std::string metric_name("test.rollup");
+  boost::intrusive_ptr<rrdb_metric> metric(
+      _rrdb->create_metric(metric_name, retention_policy_parse("1 sec for 1 min, 45 secs for 1 hour"))
+  );
+  TEST_CHECK_EQUAL(metric->get_rollups().size(), 1);
+  TEST_CHECK_EQUAL(metric->get_rollups().front(), 60);
+  for(my::time_t ts = _start_ts; ts < _start_ts + 600; ++ts) {
+      _rrdb->update_metric(metric_name, ts, ts - _start_ts);
+  }
+
+  char buf[1024];
+  snprintf(buf, sizeof(buf),  "select * from '%s' between %lu and %lu group by 1 min; ",
+      metric_name.c_str(),
+      _start_ts,
+      _start_ts + 600
+  );
+  std::string res1 = query_tests_execute(_rrdb, buf);
+  TEST_CHECK_EQUAL(query_tests_check_buckets(res1, _start_ts, 60, 10, 0), std::string());
+
+  // late data goes directly to the rollup
+  _rrdb->update_metric(metric_name, _start_ts + 30, 1000);
+  std::string res2 = query_tests_execute(_rrdb, buf);
+  TEST_CHECK_EQUAL(query_tests_check_buckets(res2, _start_ts, 60, 10, 1000), std::string());
+
+  // the rollup is loaded back from the file
+  metric->save_file(_rrdb->get_files_cache());
+  _rrdb->get_tuples_cache()->clear();
+  TEST_CHECK_EQUAL(query_tests_execute(_rrdb, buf), res2);
+
+  boost::intrusive_ptr<rrdb_metric> loaded(new rrdb_metric(metric->get_filename()));
+  loaded->load_file(_rrdb->get_files_cache());
+  TEST_CHECK_EQUAL(retention_policy_write(loaded->get_policy()), retention_policy_write(metric->get_policy()));
+  TEST_CHECK_EQUAL(loaded->get_rollups().size(), 1);
+  TEST_CHECK_EQUAL(loaded->get_rollups().front(), 60);
+
+  _rrdb->drop_metric(metric_name);
+
+  // done
+  TEST_SUBTEST_END();
+  TEST_DATA(buf, res2);
+}
+
+void query_tests::test_select_planner(const int & n)
+{
+  TEST_SUBTEST_START(n, "select group by planner", false);
+
+  // the second block is used for "group by" multiples of 10 secs
+  std::string metric_name("test.planner");
+  _rrdb->create_metric(metric_name, retention_policy_parse("1 sec for 1 min, 10 secs for 1 hour"));
+  for(my::time_t ts = _start_ts; ts < _start_ts + 600; ++ts) {
+      _rrdb->update_metric(metric_name, ts, ts - _start_ts);
+  }
+
+  char buf[1024];
+  my::interval_t group_bys[] = { 20, 30, 120 };
+  for(my::size_t ii = 0; ii < sizeof(group_bys) / sizeof(group_bys[0]); ++ii) {
+      snprintf(buf, sizeof(buf),  "select * from '%s' between %lu and %lu group by %lu secs; ",
+          metric_name.c_str(),
+          _start_ts,
+          _start_ts + 600,
+          SIZE_T_CAST group_bys[ii]
+      );
+      std::string res = query_tests_execute(_rrdb, buf);
+      TEST_CHECK_EQUAL(query_tests_check_buckets(res, _start_ts, group_bys[ii], 600 / group_bys[ii], 0), std::string());
+  }
+
+  _rrdb->drop_metric(metric_name);
+
+  // done
+  TEST_SUBTEST_END();
+}
+
 void query_tests::partial_interval_test(const int & n)
 {
   TEST_SUBTEST_START(n, "partial_interval_test", false);
@@ -263,6 +628,123 @@ void query_tests::partial_interval_test(const int & n)
   TEST_SUBTEST_END();
 }
 
+void query_tests::test_select_metrics(const int & n, const my::size_t & num_metrics)
+{
+  TEST_SUBTEST_START(n, "select from metrics like", false);
+
+  // N matching metrics with value = index and one that doesn't match
+  char buf[1024];
+  for(my::size_t ii = 0; ii < num_metrics; ++ii) {
+      snprintf(buf, sizeof(buf), "test.metrics.%02lu.latency", ii);
+      for(my::time_t ts = _start_ts; ts < _start_ts + 60; ts += _freq) {
+          _rrdb->update_metric(buf, ts, ii);
+      }
+  }
+  _rrdb->update_metric("test.metrics.00.other", _start_ts, 1);
+
+  snprintf(buf, sizeof(buf),  "select * from metrics like 'test.metrics.*.latency' between %lu and %lu group by 1 min; ",
+       _start_ts,
+       _start_ts + 60
+   );
+
+  // query
+  t_memory_buffer_data res_data;
+  t_memory_buffer res(res_data);
+  _rrdb->execute_query_statement(buf, res);
+
+  t_test_csv_data parsed_data;
+  test_parse_csv_data(res_data, parsed_data);
+
+  // count: 1 header row + 1 row per metric sorted by name
+  TEST_CHECK_EQUAL(parsed_data.size(), 1 + num_metrics);
+  TEST_CHECK_EQUAL(parsed_data[0][0], "metric");
+  TEST_CHECK_EQUAL(parsed_data[0][1], "ts");
+  for(my::size_t ii = 1; ii < parsed_data.size(); ++ii) {
+      const std::vector<std::string> & row(parsed_data[ii]);
+      snprintf(buf, sizeof(buf), "test.metrics.%02lu.latency", ii - 1);
+
+      TEST_CHECK_EQUAL(row[0], buf); // metric
+      TEST_CHECK_EQUAL(boost::lexical_cast<my::time_t>(row[1]),  _start_ts); // ts
+      TEST_CHECK_EQUAL(boost::lexical_cast<my::value_t>(row[2]), 60 / _freq);  // count
+      TEST_CHECK_EQUAL(boost::lexical_cast<my::value_t>(row[3]), (ii - 1) * 60 / _freq);  // sum
+  }
+
+  // cleanup
+  for(my::size_t ii = 0; ii < num_metrics; ++ii) {
+      snprintf(buf, sizeof(buf), "test.metrics.%02lu.latency", ii);
+      _rrdb->drop_metric(buf);
+  }
+  _rrdb->drop_metric("test.metrics.00.other");
+
+  // done
+  TEST_SUBTEST_END();
+  TEST_DATA(buf, std::string(res_data.begin(), res_data.end()));
+}
+
+void query_tests::test_select_aggregate(const int & n, const my::size_t & num_metrics)
+{
+  TEST_SUBTEST_START(n, "select aggregate from metrics like", false);
+
+  // N metrics with value = index for the 1st minute and only even ones
+  // for the 2nd minute
+  char buf[1024];
+  for(my::size_t ii = 0; ii < num_metrics; ++ii) {
+      snprintf(buf, sizeof(buf), "test.aggregate.%02lu.cpu", ii);
+      for(my::time_t ts = _start_ts; ts < _start_ts + ((ii % 2) ? 60 : 120); ts += _freq) {
+          _rrdb->update_metric(buf, ts, ii);
+      }
+  }
+
+  snprintf(buf, sizeof(buf),  "select sum(avg), max(max), count(count), avg(sum) from metrics like 'test.aggregate.*.cpu' between %lu and %lu group by 1 min; ",
+       _start_ts,
+       _start_ts + 120
+   );
+
+  // query
+  t_memory_buffer_data res_data;
+  t_memory_buffer res(res_data);
+  _rrdb->execute_query_statement(buf, res);
+
+  t_test_csv_data parsed_data;
+  test_parse_csv_data(res_data, parsed_data);
+
+  // count: 1 header row + 2 rows, newest first
+  TEST_CHECK_EQUAL(parsed_data.size(), 3);
+  TEST_CHECK_EQUAL(parsed_data[0].size(), 5);
+  TEST_CHECK_EQUAL(parsed_data[0][0], "ts");
+  TEST_CHECK_EQUAL(parsed_data[0][1], "sum(avg)");
+  TEST_CHECK_EQUAL(parsed_data[0][4], "avg(sum)");
+
+  // 2nd minute: even metrics only
+  my::value_t even_sum = 0, even_num = 0;
+  for(my::size_t ii = 0; ii < num_metrics; ii += 2) {
+      even_sum += ii;
+      ++even_num;
+  }
+  TEST_CHECK_EQUAL(boost::lexical_cast<my::time_t>(parsed_data[1][0]),  _start_ts + 60);
+  TEST_CHECK_EQUAL(boost::lexical_cast<my::value_t>(parsed_data[1][1]), even_sum);
+  TEST_CHECK_EQUAL(boost::lexical_cast<my::value_t>(parsed_data[1][2]), (num_metrics - 1) / 2 * 2);
+  TEST_CHECK_EQUAL(boost::lexical_cast<my::value_t>(parsed_data[1][3]), even_num);
+  TEST_CHECK_EQUAL(boost::lexical_cast<my::value_t>(parsed_data[1][4]), even_sum * 60 / _freq / even_num);
+
+  // 1st minute: all metrics
+  TEST_CHECK_EQUAL(boost::lexical_cast<my::time_t>(parsed_data[2][0]),  _start_ts);
+  TEST_CHECK_EQUAL(boost::lexical_cast<my::value_t>(parsed_data[2][1]), num_metrics * (num_metrics - 1) / 2);
+  TEST_CHECK_EQUAL(boost::lexical_cast<my::value_t>(parsed_data[2][2]), num_metrics - 1);
+  TEST_CHECK_EQUAL(boost::lexical_cast<my::value_t>(parsed_data[2][3]), num_metrics);
+  TEST_CHECK_EQUAL(boost::lexical_cast<my::value_t>(parsed_data[2][4]), (num_metrics - 1) / 2.0 * 60 / _freq);
+
+  // cleanup
+  for(my::size_t ii = 0; ii < num_metrics; ++ii) {
+      snprintf(buf, sizeof(buf), "test.aggregate.%02lu.cpu", ii);
+      _rrdb->drop_metric(buf);
+  }
+
+  // done
+  TEST_SUBTEST_END();
+  TEST_DATA(buf, std::string(res_data.begin(), res_data.end()));
+}
+
 /*
 void query_tests::test_template(const int & n)
 {
@@ -300,6 +782,15 @@ void query_tests::run(const std::string & path)
   test.test_select_all_group_by(ii++, 365*24*60*60, "select all group by 1 year");
 
   // TODO: tests for "SELECT min,max" (i.e. not "select *")
+  test.test_select_binary(ii++);
+  test.test_select_streaming(ii++);
+  test.test_query_cost(ii++);
+  test.test_select_results_cache(ii++);
+  test.test_select_rollup(ii++);
+  test.test_select_planner(ii++);
+
+  test.test_select_metrics(ii++, 20);
+  test.test_select_aggregate(ii++, 11);
 
 
   // need new metric
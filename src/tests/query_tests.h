@@ -32,6 +32,14 @@ private:
   void test_select_all(const int & n);
   void test_select_5_sec(const int & n);
   void test_select_all_group_by(const int & n, const my::size_t & group_by, const std::string & msg);
+  void test_select_binary(const int & n);
+  void test_select_streaming(const int & n);
+  void test_query_cost(const int & n);
+  void test_select_results_cache(const int & n);
+  void test_select_rollup(const int & n);
+  void test_select_planner(const int & n);
+  void test_select_metrics(const int & n, const my::size_t & num_metrics);
+  void test_select_aggregate(const int & n, const my::size_t & num_metrics);
 
   void partial_interval_test(const int & n);
 
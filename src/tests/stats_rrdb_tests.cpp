@@ -32,6 +32,11 @@
 #include "tests/lru_tests.h"
 #include "tests/files_cache_tests.h"
 #include "tests/journal_file_tests.h"
+#include "tests/tuples_cache_tests.h"
+#include "tests/aggregate_tests.h"
+#include "tests/locks_tests.h"
+#include "tests/thread_pool_tests.h"
+#include "tests/format_tests.h"
 #include "tests/query_tests.h"
 #include "tests/update_tests.h"
 #include "tests/parsers_tests.h"
@@ -131,6 +136,41 @@ int main(int argc, char ** argv)
     journal_file_tests::run(path);
     TEST_END("journal_file_tests");
 
+    //
+    // tuples_cache_tests
+    //
+    TEST_START("tuples_cache_tests");
+    tuples_cache_tests::run(path);
+    TEST_END("tuples_cache_tests");
+
+    //
+    // aggregate_tests
+    //
+    TEST_START("aggregate_tests");
+    aggregate_tests::run();
+    TEST_END("aggregate_tests");
+
+    //
+    // locks_tests
+    //
+    TEST_START("locks_tests");
+    locks_tests::run();
+    TEST_END("locks_tests");
+
+    //
+    // thread_pool_tests
+    //
+    TEST_START("thread_pool_tests");
+    thread_pool_tests::run();
+    TEST_END("thread_pool_tests");
+
+    //
+    // format_tests
+    //
+    TEST_START("format_tests");
+    format_tests::run();
+    TEST_END("format_tests");
+
     //
     // parsers_tests
     //
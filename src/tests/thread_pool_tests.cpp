@@ -0,0 +1,418 @@
+/*
+ * thread_pool_tests.cpp
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: aleksey
+ */
+#include <stdio.h>
+#include <vector>
+
+#include <boost/thread.hpp>
+#include <boost/atomic.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+#include "common/thread_pool.h"
+#include "common/latency_histogram.h"
+#include "common/log.h"
+
+#include "tests/thread_pool_tests.h"
+#include "tests/stats_rrdb_tests.h"
+
+//
+// The tasks wait for the gate to open and record the order they were
+// executed in: this lets us fill up the pool threads and the queue
+//
+class thread_pool_tests_gate
+{
+public:
+  thread_pool_tests_gate() :
+    _open(false),
+    _waiting(0)
+  {
+  }
+
+  void wait(const int & id)
+  {
+    boost::unique_lock<boost::mutex> guard(_lock);
+    ++_waiting;
+    _cond.notify_all();
+    while(!_open) {
+        _cond.wait(guard);
+    }
+    _executed.push_back(id);
+  }
+
+  void open()
+  {
+    boost::lock_guard<boost::mutex> guard(_lock);
+    _open = true;
+    _cond.notify_all();
+  }
+
+  // waits until the given number of tasks are running
+  void wait_for_running(const my::size_t & count)
+  {
+    boost::unique_lock<boost::mutex> guard(_lock);
+    while(_waiting < count) {
+        _cond.wait(guard);
+    }
+  }
+
+  std::vector<int> get_executed()
+  {
+    boost::lock_guard<boost::mutex> guard(_lock);
+    return _executed;
+  }
+
+private:
+  boost::mutex              _lock;
+  boost::condition_variable _cond;
+  bool                      _open;
+  my::size_t                _waiting;
+  std::vector<int>          _executed;
+}; // class thread_pool_tests_gate
+
+class thread_pool_tests_task:
+    public thread_pool_task
+{
+public:
+  thread_pool_tests_task(thread_pool_tests_gate & gate, const int & id) :
+    _gate(gate),
+    _id(id)
+  {
+  }
+
+  // thread_pool_task
+  void run()
+  {
+    _gate.wait(_id);
+  }
+
+private:
+  thread_pool_tests_gate &  _gate;
+  int                       _id;
+}; // class thread_pool_tests_task
+
+//
+// Adds to the shared counter: the task is as short as the scheduling
+// overhead we want to measure
+//
+class thread_pool_tests_counter_task:
+    public thread_pool_task
+{
+public:
+  thread_pool_tests_counter_task(boost::atomic<my::size_t> & counter) :
+    _counter(counter)
+  {
+  }
+
+  // thread_pool_task
+  void run()
+  {
+    _counter.fetch_add(1, boost::memory_order_relaxed);
+  }
+
+private:
+  boost::atomic<my::size_t> & _counter;
+}; // class thread_pool_tests_counter_task
+
+static void thread_pool_tests_produce(const boost::shared_ptr<thread_pool> & pool, boost::atomic<my::size_t> & counter, const my::size_t & tasks)
+{
+  for(my::size_t ii = 0; ii < tasks; ++ii) {
+      pool->run(boost::intrusive_ptr<thread_pool_task>(new thread_pool_tests_counter_task(counter)));
+  }
+}
+
+static void thread_pool_tests_wait(const boost::shared_ptr<thread_pool> & pool)
+{
+  while(pool->get_load_factor() > 0) {
+      boost::this_thread::sleep(boost::posix_time::milliseconds(10));
+  }
+}
+
+static void thread_pool_tests_submit(const boost::shared_ptr<thread_pool> & pool, thread_pool_tests_gate & gate, const int & id)
+{
+  pool->run(boost::intrusive_ptr<thread_pool_task>(new thread_pool_tests_task(gate, id)));
+}
+
+thread_pool_tests::thread_pool_tests()
+{
+}
+
+thread_pool_tests::~thread_pool_tests()
+{
+}
+
+void thread_pool_tests::test_unbounded(const int & n)
+{
+  TEST_SUBTEST_START(n, "unbounded queue", false);
+
+  thread_pool_tests_gate gate;
+  boost::shared_ptr<thread_pool> pool(new thread_pool(1));
+  thread_pool_tests_submit(pool, gate, 0);
+  gate.wait_for_running(1);
+  for(int ii = 1; ii <= 10; ++ii) {
+      thread_pool_tests_submit(pool, gate, ii);
+  }
+  TEST_CHECK_EQUAL(pool->get_queue_size(), 10);
+
+  gate.open();
+  thread_pool_tests_wait(pool);
+
+  TEST_CHECK_EQUAL(gate.get_executed().size(), 11);
+  TEST_CHECK_EQUAL(pool->get_started_jobs(), 11);
+  TEST_CHECK_EQUAL(pool->get_finished_jobs(), 11);
+  TEST_CHECK_EQUAL(pool->get_dropped_jobs(), 0);
+
+  // done
+  TEST_SUBTEST_END();
+}
+
+void thread_pool_tests::test_overflow(const int & n, const enum thread_pool::overflow_policy & policy)
+{
+  char buf[1024];
+  snprintf(buf, sizeof(buf), "bounded queue with the %s policy", policy == thread_pool::Overflow_DropNewest ? "drop newest" : "drop oldest");
+  TEST_SUBTEST_START(n, buf, false);
+
+  // one running task and two in the queue
+  thread_pool_tests_gate gate;
+  boost::shared_ptr<thread_pool> pool(new thread_pool(1, 2, policy));
+  thread_pool_tests_submit(pool, gate, 0);
+  gate.wait_for_running(1);
+  thread_pool_tests_submit(pool, gate, 1);
+  thread_pool_tests_submit(pool, gate, 2);
+  TEST_CHECK_EQUAL(pool->get_queue_size(), 2);
+
+  // overflow
+  thread_pool_tests_submit(pool, gate, 3);
+  thread_pool_tests_submit(pool, gate, 4);
+  TEST_CHECK_EQUAL(pool->get_queue_size(), 2);
+  TEST_CHECK_EQUAL(pool->get_dropped_jobs(), 2);
+
+  gate.open();
+  thread_pool_tests_wait(pool);
+
+  std::vector<int> executed(gate.get_executed());
+  TEST_CHECK_EQUAL(executed.size(), 3);
+  if(executed.size() == 3) {
+      TEST_CHECK_EQUAL(executed[0], 0);
+      if(policy == thread_pool::Overflow_DropNewest) {
+          TEST_CHECK_EQUAL(executed[1], 1);
+          TEST_CHECK_EQUAL(executed[2], 2);
+      } else {
+          TEST_CHECK_EQUAL(executed[1], 3);
+          TEST_CHECK_EQUAL(executed[2], 4);
+      }
+  }
+  TEST_CHECK_EQUAL(pool->get_started_jobs(), 5);
+  TEST_CHECK_EQUAL(pool->get_finished_jobs(), 3);
+  TEST_CHECK_EQUAL(pool->get_dropped_jobs(), 2);
+
+  // done
+  TEST_SUBTEST_END();
+}
+
+void thread_pool_tests::test_block(const int & n)
+{
+  TEST_SUBTEST_START(n, "bounded queue with the block policy", false);
+
+  // one running task and two in the queue
+  thread_pool_tests_gate gate;
+  boost::shared_ptr<thread_pool> pool(new thread_pool(1, 2, thread_pool::Overflow_Block));
+  thread_pool_tests_submit(pool, gate, 0);
+  gate.wait_for_running(1);
+  thread_pool_tests_submit(pool, gate, 1);
+  thread_pool_tests_submit(pool, gate, 2);
+
+  // overflow: the submitter waits until the gate opens
+  boost::thread submitter(boost::bind(&thread_pool_tests_submit, pool, boost::ref(gate), 3));
+  TEST_CHECK_EQUAL(submitter.timed_join(boost::posix_time::milliseconds(100)), false);
+  TEST_CHECK_EQUAL(pool->get_queue_size(), 2);
+
+  gate.open();
+  submitter.join();
+  thread_pool_tests_wait(pool);
+
+  std::vector<int> executed(gate.get_executed());
+  TEST_CHECK_EQUAL(executed.size(), 4);
+  if(executed.size() == 4) {
+      for(int ii = 0; ii < 4; ++ii) {
+          TEST_CHECK_EQUAL(executed[ii], ii);
+      }
+  }
+  TEST_CHECK_EQUAL(pool->get_finished_jobs(), 4);
+  TEST_CHECK_EQUAL(pool->get_dropped_jobs(), 0);
+
+  // done
+  TEST_SUBTEST_END();
+}
+
+void thread_pool_tests::test_work_stealing(const int & n, const my::size_t & threads, const my::size_t & producers)
+{
+  char buf[1024];
+  snprintf(buf, sizeof(buf), "work stealing with %lu threads and %lu producers", SIZE_T_CAST threads, SIZE_T_CAST producers);
+  TEST_SUBTEST_START(n, buf, false);
+
+  boost::atomic<my::size_t> counter(0);
+  my::size_t tasks = 100000;
+  boost::shared_ptr<thread_pool> pool(new thread_pool(threads, 0, thread_pool::Overflow_DropNewest, thread_pool::Scheduler_WorkStealing));
+  boost::thread_group group;
+  for(my::size_t ii = 0; ii < producers; ++ii) {
+      group.create_thread(boost::bind(&thread_pool_tests_produce, pool, boost::ref(counter), tasks));
+  }
+  group.join_all();
+  thread_pool_tests_wait(pool);
+
+  TEST_CHECK_EQUAL(counter.load(), producers * tasks);
+  TEST_CHECK_EQUAL(pool->get_started_jobs(), producers * tasks);
+  TEST_CHECK_EQUAL(pool->get_finished_jobs(), producers * tasks);
+  TEST_CHECK_EQUAL(pool->get_queue_size(), 0);
+
+  // the blocked tasks are picked up by the other threads
+  if(threads > 1) {
+      thread_pool_tests_gate gate;
+      for(my::size_t ii = 0; ii < threads; ++ii) {
+          thread_pool_tests_submit(pool, gate, ii);
+      }
+      gate.wait_for_running(threads);
+      gate.open();
+      thread_pool_tests_wait(pool);
+      TEST_CHECK_EQUAL(gate.get_executed().size(), threads);
+  }
+
+  // the bounded queue is not supported
+  TEST_CHECK_THROW(
+      thread_pool(threads, 10, thread_pool::Overflow_DropNewest, thread_pool::Scheduler_WorkStealing),
+      "The work stealing thread pool does not support the bounded queue"
+  );
+
+  // done
+  TEST_SUBTEST_END();
+}
+
+void thread_pool_tests::test_benchmark(const int & n, const my::size_t & threads)
+{
+  char buf[1024];
+  snprintf(buf, sizeof(buf), "thread pools benchmark for %lu threads", SIZE_T_CAST threads);
+  TEST_SUBTEST_START(n, buf, false);
+
+  // one producer like the udp receive loop
+  const enum thread_pool::scheduler schedulers[] = { thread_pool::Scheduler_Shared, thread_pool::Scheduler_WorkStealing };
+  my::size_t tasks = 500000;
+  long wall_us[2];
+  for(my::size_t ii = 0; ii < sizeof(schedulers) / sizeof(schedulers[0]); ++ii) {
+      boost::atomic<my::size_t> counter(0);
+      boost::shared_ptr<thread_pool> pool(new thread_pool(threads, 0, thread_pool::Overflow_DropNewest, schedulers[ii]));
+
+      boost::posix_time::ptime ts1 = boost::posix_time::microsec_clock::local_time();
+      thread_pool_tests_produce(pool, counter, tasks);
+      thread_pool_tests_wait(pool);
+      wall_us[ii] = (boost::posix_time::microsec_clock::local_time() - ts1).total_microseconds();
+
+      TEST_CHECK_EQUAL(counter.load(), tasks);
+  }
+
+  snprintf(buf, sizeof(buf),  "shared %ld us, work stealing %ld us for %lu tasks",
+      wall_us[0],
+      wall_us[1],
+      SIZE_T_CAST tasks
+  );
+
+  // done
+  TEST_SUBTEST_END2(buf);
+}
+
+void thread_pool_tests::test_latency_histogram(const int & n)
+{
+  TEST_SUBTEST_START(n, "latency histogram", false);
+
+  latency_histogram histogram;
+  latency_histogram::t_percentiles percentiles;
+  histogram.get_percentiles(percentiles);
+  TEST_CHECK_EQUAL(percentiles._count, 0);
+  TEST_CHECK_EQUAL(percentiles._max, 0);
+
+  // small values are exact
+  for(my::size_t ii = 0; ii < 100; ++ii) {
+      histogram.record(ii < 99 ? 5 : 7);
+  }
+  histogram.get_percentiles(percentiles, true);
+  TEST_CHECK_EQUAL(percentiles._count, 100);
+  TEST_CHECK_EQUAL(percentiles._p50, 5);
+  TEST_CHECK_EQUAL(percentiles._p99, 5);
+  TEST_CHECK_EQUAL(percentiles._p999, 7);
+  TEST_CHECK_EQUAL(percentiles._max, 7);
+
+  // reset
+  histogram.get_percentiles(percentiles);
+  TEST_CHECK_EQUAL(percentiles._count, 0);
+
+  // large values are within the bucket precision
+  for(boost::uint64_t ii = 1; ii <= 100000; ++ii) {
+      histogram.record(ii);
+  }
+  histogram.get_percentiles(percentiles);
+  TEST_CHECK_EQUAL(percentiles._count, 100000);
+  TEST_CHECK(percentiles._p50  >= 50000 && percentiles._p50  <= 50000 * 17 / 16);
+  TEST_CHECK(percentiles._p99  >= 99000 && percentiles._p99  <= 100000);
+  TEST_CHECK(percentiles._p999 >= 99900 && percentiles._p999 <= 100000);
+  TEST_CHECK_EQUAL(percentiles._max, 100000);
+
+  // very large values go to the last bucket
+  histogram.record((boost::uint64_t)1 << 40);
+  histogram.get_percentiles(percentiles);
+  TEST_CHECK_EQUAL(percentiles._count, 100001);
+  TEST_CHECK_EQUAL(percentiles._max, (boost::uint64_t)1 << 40);
+
+  // done
+  TEST_SUBTEST_END();
+}
+
+void thread_pool_tests::test_latency(const int & n)
+{
+  TEST_SUBTEST_START(n, "thread pool wait and run time", false);
+
+  // the second task waits while the first runs
+  thread_pool_tests_gate gate;
+  boost::shared_ptr<thread_pool> pool(new thread_pool(1));
+  thread_pool_tests_submit(pool, gate, 0);
+  gate.wait_for_running(1);
+  thread_pool_tests_submit(pool, gate, 1);
+  boost::this_thread::sleep(boost::posix_time::milliseconds(20));
+  gate.open();
+  thread_pool_tests_wait(pool);
+
+  latency_histogram::t_percentiles wait_time, run_time;
+  pool->get_wait_time().get_percentiles(wait_time, true);
+  pool->get_run_time().get_percentiles(run_time, true);
+  TEST_CHECK_EQUAL(wait_time._count, 2);
+  TEST_CHECK(wait_time._max >= 20000);
+  TEST_CHECK_EQUAL(run_time._count, 2);
+  TEST_CHECK(run_time._max >= 20000);
+
+  // done
+  TEST_SUBTEST_END();
+}
+
+void thread_pool_tests::run()
+{
+  thread_pool_tests test;
+
+  int n = 0;
+  test.test_unbounded(n++);
+  test.test_overflow(n++, thread_pool::Overflow_DropNewest);
+  test.test_overflow(n++, thread_pool::Overflow_DropOldest);
+  test.test_block(n++);
+
+  const my::size_t threads[] = { 1, 4, 16 };
+  for(my::size_t ii = 0; ii < sizeof(threads) / sizeof(threads[0]); ++ii) {
+      test.test_work_stealing(n++, threads[ii], 1);
+      test.test_work_stealing(n++, threads[ii], 4);
+  }
+  for(my::size_t ii = 0; ii < sizeof(threads) / sizeof(threads[0]); ++ii) {
+      test.test_benchmark(n++, threads[ii]);
+  }
+
+  test.test_latency_histogram(n++);
+  test.test_latency(n++);
+}
@@ -0,0 +1,34 @@
+/*
+ * thread_pool_tests.h
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: aleksey
+ */
+
+#ifndef TESTS_THREAD_POOL_TESTS_H_
+#define TESTS_THREAD_POOL_TESTS_H_
+
+#include <string>
+
+#include "common/types.h"
+#include "common/thread_pool.h"
+
+class thread_pool_tests
+{
+public:
+  thread_pool_tests();
+  virtual ~thread_pool_tests();
+
+  static void run();
+
+private:
+  void test_unbounded(const int & n);
+  void test_overflow(const int & n, const enum thread_pool::overflow_policy & policy);
+  void test_block(const int & n);
+  void test_work_stealing(const int & n, const my::size_t & threads, const my::size_t & producers);
+  void test_benchmark(const int & n, const my::size_t & threads);
+  void test_latency_histogram(const int & n);
+  void test_latency(const int & n);
+}; // thread_pool_tests
+
+#endif /* TESTS_THREAD_POOL_TESTS_H_ */
@@ -0,0 +1,264 @@
+/*
+ * tuples_cache_tests.cpp
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: aleksey
+ */
+
+#include <vector>
+#include <string.h>
+
+#include <boost/thread.hpp>
+#include <boost/bind.hpp>
+#include <boost/atomic.hpp>
+
+#include "parser/retention_policy.h"
+
+#include "rrdb/rrdb_metric.h"
+#include "rrdb/rrdb_metric_block.h"
+#include "rrdb/rrdb_files_cache.h"
+#include "rrdb/rrdb_journal_file.h"
+#include "rrdb/rrdb_metric_tuples_cache.h"
+
+#include "tests/stats_rrdb_tests.h"
+#include "tests/tuples_cache_tests.h"
+
+#define TEST_METRIC_NAME  "test.tuples_cache"
+
+// counts the selected tuples
+class tuples_cache_tests_walker :
+    public rrdb::data_walker
+{
+public:
+  tuples_cache_tests_walker() : _count(0) { }
+
+  void append(const t_rrdb_metric_tuple & tuple, const my::interval_t & interval)
+  {
+    ++_count;
+  }
+  void flush()
+  {
+  }
+
+public:
+  my::size_t _count;
+}; // tuples_cache_tests_walker
+
+// slow loader that counts how many times it was called
+class tuples_cache_tests_loader :
+    public rrdb_metric_tuples_cache::loader
+{
+public:
+  tuples_cache_tests_loader() : _count(0) { }
+
+  t_rrdb_metric_tuples_ptr load()
+  {
+    ++_count;
+    boost::this_thread::sleep(boost::posix_time::milliseconds(200));
+    return t_rrdb_metric_tuples_ptr(new t_rrdb_metric_tuples(10));
+  }
+
+public:
+  boost::atomic<my::size_t> _count;
+}; // tuples_cache_tests_loader
+
+static void tuples_cache_tests_find_or_load(
+    boost::shared_ptr<rrdb_metric_tuples_cache> tuples_cache,
+    const rrdb_metric_block * block,
+    my::filename_t filename,
+    tuples_cache_tests_loader * loader,
+    boost::atomic<my::size_t> * loaded
+) {
+  t_rrdb_metric_tuples_ptr the_tuples = tuples_cache->find_or_load(block, filename, time(NULL), *loader);
+  if(the_tuples && the_tuples->get_size() == 10) {
+      ++(*loaded);
+  }
+}
+
+tuples_cache_tests::tuples_cache_tests()
+{
+}
+
+tuples_cache_tests::~tuples_cache_tests()
+{
+}
+
+void tuples_cache_tests::initialize(const std::string & path)
+{
+  _files_cache.reset(new rrdb_files_cache());
+  _tuples_cache.reset(new rrdb_metric_tuples_cache(_files_cache));
+  _journal_file.reset(new rrdb_journal_file(_files_cache));
+
+  // create config
+  t_test_config_data config_data;
+  config_data["rrdb.path"] = path;
+
+  //
+  boost::shared_ptr<config> cfg = test_setup_config(path, config_data);
+
+  // initiliaze
+  _files_cache->initialize(cfg);
+  _tuples_cache->initialize(cfg);
+  _journal_file->initialize();
+}
+
+void tuples_cache_tests::cleanup()
+{
+  _files_cache->delete_file(rrdb_metric::construct_filename(TEST_METRIC_NAME));
+  _journal_file->delete_journal_file();
+}
+
+void tuples_cache_tests::test_hot_set(const int & n)
+{
+  my::time_t ts = time(NULL);
+  rrdb_metric_tuples_cache::t_hot_blocks hot_blocks;
+
+  TEST_SUBTEST_START(n, "hot_set", false);
+
+  // create metric and write some data to the disk
+  t_retention_policy policy = retention_policy_parse("1 sec for 1 hour, 30 sec for 1 day");
+  boost::intrusive_ptr<rrdb_metric> metric(new rrdb_metric());
+  metric->create(TEST_METRIC_NAME, policy);
+  metric->save_file(_files_cache);
+  for(my::time_t ii = 0; ii < 100; ++ii) {
+      metric->update(_tuples_cache, ts - 100 + ii, 1.0);
+  }
+  metric->save_dirty_blocks(_files_cache, _journal_file);
+  _journal_file->apply_journal(metric->get_filename());
+  _journal_file->clear();
+
+  // nothing is in the cache yet: blocks were in memory
+  _tuples_cache->clear();
+  TEST_CHECK_EQUAL(_tuples_cache->get_cache_size(), 0);
+
+  // select reads both blocks from disk
+  tuples_cache_tests_walker walker;
+  metric->select(_tuples_cache, 0, ts + 1, walker);
+  TEST_CHECK(walker._count > 0);
+  TEST_CHECK_EQUAL(_tuples_cache->get_cache_size(), 2);
+
+  // save and load the hot set: the blocks should come back in the file order
+  _tuples_cache->save_hot_set(10);
+  _tuples_cache->load_hot_set(hot_blocks);
+  TEST_CHECK_EQUAL(hot_blocks.size(), 2);
+  TEST_CHECK_EQUAL(*(hot_blocks[0]._filename), *(metric->get_filename()));
+  TEST_CHECK_EQUAL(*(hot_blocks[1]._filename), *(metric->get_filename()));
+  TEST_CHECK(hot_blocks[0]._offset < hot_blocks[1]._offset);
+
+  // the hot set is limited
+  rrdb_metric_tuples_cache::t_hot_blocks hot_blocks2;
+  _tuples_cache->save_hot_set(1);
+  _tuples_cache->load_hot_set(hot_blocks2);
+  TEST_CHECK_EQUAL(hot_blocks2.size(), 1);
+
+  // warm up: reload metric and load the blocks back into the empty cache
+  my::filename_t filename = metric->get_filename();
+  metric.reset(new rrdb_metric(filename));
+  metric->load_file(_files_cache);
+  _tuples_cache->clear();
+  for(my::size_t ii = 0; ii < hot_blocks.size(); ++ii) {
+      metric->warm_up_block(_tuples_cache, hot_blocks[ii]._offset);
+  }
+  TEST_CHECK_EQUAL(_tuples_cache->get_cache_size(), 2);
+
+  // and now select should not miss
+  my::size_t misses = _tuples_cache->get_cache_misses(true);
+  TEST_CHECK_EQUAL(misses, 2);
+  tuples_cache_tests_walker walker2;
+  metric->select(_tuples_cache, 0, ts + 1, walker2);
+  TEST_CHECK_EQUAL(walker2._count, walker._count);
+  TEST_CHECK_EQUAL(_tuples_cache->get_cache_misses(), 0);
+
+  // done
+  TEST_SUBTEST_END();
+}
+
+void tuples_cache_tests::test_single_flight(const int & n, const my::size_t & num_threads)
+{
+  TEST_SUBTEST_START(n, "single_flight", false);
+
+  boost::intrusive_ptr<rrdb_metric_block> block(new rrdb_metric_block(1, 10, 0));
+  my::filename_t filename(new std::string("test.single_flight"));
+  tuples_cache_tests_loader loader;
+  boost::atomic<my::size_t> loaded(0);
+
+  _tuples_cache->clear();
+  _tuples_cache->get_coalesced_loads(true);
+
+  // all threads miss at the same time
+  boost::thread_group threads;
+  for(my::size_t ii = 0; ii < num_threads; ++ii) {
+      threads.create_thread(boost::bind(tuples_cache_tests_find_or_load,
+          _tuples_cache, block.get(), filename, &loader, &loaded
+      ));
+  }
+  threads.join_all();
+
+  // only one read, everybody got the data
+  TEST_CHECK_EQUAL(loader._count, 1);
+  TEST_CHECK_EQUAL(loaded, num_threads);
+  TEST_CHECK_EQUAL(_tuples_cache->get_cache_size(), 1);
+  TEST_CHECK_EQUAL(_tuples_cache->get_coalesced_loads() + _tuples_cache->get_cache_hits(), num_threads - 1);
+
+  // cleanup
+  _tuples_cache->erase(block.get());
+
+  // done
+  TEST_SUBTEST_END();
+}
+
+void tuples_cache_tests::test_columns(const int & n, const my::size_t & size)
+{
+  TEST_SUBTEST_START(n, "tuples columns", false);
+
+  t_rrdb_metric_tuples tuples(size);
+  TEST_CHECK_EQUAL(tuples.get_size(), size);
+  TEST_CHECK_EQUAL(((my::size_t)tuples.get_ts_column())  % t_rrdb_metric_tuples::Column_Alignment, 0);
+  TEST_CHECK_EQUAL(((my::size_t)tuples.get_sum_column()) % t_rrdb_metric_tuples::Column_Alignment, 0);
+  TEST_CHECK_EQUAL(((my::size_t)tuples.get_max_column()) % t_rrdb_metric_tuples::Column_Alignment, 0);
+
+  // array of tuples -> columns -> array of tuples
+  std::vector<t_rrdb_metric_tuple> in(size), out(size);
+  for(my::size_t ii = 0; ii < size; ++ii) {
+      in[ii]._ts      = 1000 + ii;
+      in[ii]._count   = ii + 1;
+      in[ii]._sum     = ii * 2;
+      in[ii]._sum_sqr = ii * 4;
+      in[ii]._min     = ii;
+      in[ii]._max     = ii * 3;
+  }
+  tuples.load(0, &(in[0]), size);
+  tuples.store(0, &(out[0]), size);
+  TEST_CHECK_EQUAL(memcmp(&(in[0]), &(out[0]), size * sizeof(t_rrdb_metric_tuple)), 0);
+  TEST_CHECK_EQUAL(tuples.get_ts_column()[size - 1], (my::time_t)(1000 + size - 1));
+  TEST_CHECK_EQUAL(tuples.get_count_column()[size - 1], size);
+
+  // single tuple access
+  t_rrdb_metric_tuple tuple;
+  tuples.zero(size / 2);
+  tuples.get(size / 2, tuple);
+  TEST_CHECK_EQUAL(tuple._ts, 0);
+  TEST_CHECK_EQUAL(tuple._count, 0);
+  tuples.set(size / 2, in[size / 2]);
+  tuples.get(size / 2, tuple);
+  TEST_CHECK_EQUAL(memcmp(&tuple, &(in[size / 2]), sizeof(tuple)), 0);
+
+  TEST_SUBTEST_END();
+}
+
+void tuples_cache_tests::run(const std::string & path)
+{
+  // setup
+  tuples_cache_tests test;
+  test.initialize(path);
+  test.cleanup();
+
+  // tests
+  test.test_hot_set(0);
+  test.test_single_flight(1, 10);
+  test.test_columns(2, 1);
+  test.test_columns(3, 1001);
+
+  // cleanup
+  test.cleanup();
+}
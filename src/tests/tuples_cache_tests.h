@@ -0,0 +1,42 @@
+/*
+ * tuples_cache_tests.h
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: aleksey
+ */
+
+#ifndef TUPLES_CACHE_TESTS_H_
+#define TUPLES_CACHE_TESTS_H_
+
+#include <string>
+#include <boost/shared_ptr.hpp>
+
+#include "common/types.h"
+
+class rrdb_files_cache;
+class rrdb_journal_file;
+class rrdb_metric_tuples_cache;
+
+class tuples_cache_tests
+{
+public:
+  tuples_cache_tests();
+  virtual ~tuples_cache_tests();
+
+  static void run(const std::string & path);
+
+private:
+  void initialize(const std::string & path);
+  void cleanup();
+
+  void test_hot_set(const int & n);
+  void test_single_flight(const int & n, const my::size_t & num_threads);
+  void test_columns(const int & n, const my::size_t & size);
+
+private:
+  boost::shared_ptr<rrdb_files_cache>  _files_cache;
+  boost::shared_ptr<rrdb_journal_file> _journal_file;
+  boost::shared_ptr<rrdb_metric_tuples_cache> _tuples_cache;
+};
+
+#endif /* TUPLES_CACHE_TESTS_H_ */
@@ -16,6 +16,8 @@
 #include "rrdb/rrdb_metric.h"
 
 #include "common/thread_pool.h"
+#include "common/self_metrics.h"
+#include "common/latency_histogram.h"
 
 #include "common/log.h"
 #include "common/config.h"
@@ -24,6 +26,7 @@
 #include "tests/stats_rrdb_tests.h"
 
 #define METRIC_NAME_TEMPLATE "test.metric.%lu"
+#define SELF_METRIC_NAME_TEMPLATE "test.self.%lu"
 
 
 class load_test_task :
@@ -55,8 +58,61 @@ private:
   std::string             _cmd;
 }; // load_test_task
 
+//
+// Counts the data points in the selected tuples
+//
+class load_test_count_walker :
+    public rrdb::data_walker
+{
+public:
+  load_test_count_walker() :
+    _count(0),
+    _sum(0)
+  {
+  }
+
+  void append(const t_rrdb_metric_tuple & tuple, const my::interval_t & /* interval */)
+  {
+    _count += tuple._count;
+    _sum   += tuple._sum;
+  }
+
+  void flush()
+  {
+  }
+
+public:
+  my::value_t _count;
+  my::value_t _sum;
+}; // load_test_count_walker
+
+//
+// Bumps the self_counter from its own thread
+//
+class self_counter_test_worker
+{
+public:
+  self_counter_test_worker(self_counter & counter, const my::size_t & iterations) :
+    _counter(counter),
+    _iterations(iterations)
+  {
+  }
+
+  void operator()()
+  {
+    for(my::size_t ii = 0; ii < _iterations; ++ii) {
+        _counter.add();
+    }
+  }
+
+private:
+  self_counter & _counter;
+  my::size_t     _iterations;
+}; // self_counter_test_worker
+
 update_tests::update_tests() :
-  _rrdb(new rrdb())
+  _rrdb(new rrdb()),
+  _sharded_rrdb(new rrdb())
 {
 }
 
@@ -74,6 +130,11 @@ void update_tests::initialize(const std::string & path)
 
   // initiliaze
   _rrdb->initialize(cfg);
+
+  // the same with the update shards
+  config_data["rrdb.update_shards"] = "4";
+  config_data["rrdb.update_shard_queue_size"] = "1000";
+  _sharded_rrdb->initialize(test_setup_config(path, config_data));
 }
 
 void update_tests::cleanup(const my::size_t & num_metrics)
@@ -86,25 +147,36 @@ void update_tests::cleanup(const my::size_t & num_metrics)
     if(_rrdb->find_metric(buf)) {
         _rrdb->drop_metric(buf);
     }
+    if(_sharded_rrdb->find_metric(buf)) {
+        _sharded_rrdb->drop_metric(buf);
+    }
   }
 }
 
 void update_tests::load_test(const int & n,
     const my::size_t & num_metrics,
     const my::size_t & num_threads,
-    const my::size_t & num_tasks
+    const my::size_t & num_tasks,
+    bool sharded,
+    bool work_stealing
 ) {
   char buf[1024];
+  boost::shared_ptr<rrdb> db(sharded ? _sharded_rrdb : _rrdb);
 
   //
-  snprintf(buf, sizeof(buf), "load test - %lu metrics, %lu threads, %lu tasks", num_metrics, num_threads, num_tasks);
+  snprintf(buf, sizeof(buf), "load test - %lu metrics, %lu threads, %lu tasks%s%s", num_metrics, num_threads, num_tasks,
+      sharded ? ", sharded" : "",
+      work_stealing ? ", work stealing" : ""
+  );
   TEST_SUBTEST_START(n, buf, false);
 
   // cleanup locally
   this->cleanup(num_metrics);
 
   my::time_t ts(time(NULL));
-  boost::shared_ptr<thread_pool> threads(new thread_pool(num_threads));
+  boost::shared_ptr<thread_pool> threads(new thread_pool(num_threads, 0, thread_pool::Overflow_DropNewest,
+      work_stealing ? thread_pool::Scheduler_WorkStealing : thread_pool::Scheduler_Shared
+  ));
   boost::posix_time::ptime ts1 = boost::posix_time::microsec_clock::local_time();
   for(my::size_t ii = 0; ii < num_tasks; ii++) {
       snprintf(buf, sizeof(buf),
@@ -113,7 +185,7 @@ void update_tests::load_test(const int & n,
           ts + ii
       );
 
-      boost::intrusive_ptr<load_test_task> task(new load_test_task(_rrdb, buf));
+      boost::intrusive_ptr<load_test_task> task(new load_test_task(db, buf));
       threads->run(task);
 
       if(ii % 10000 == 0) {
@@ -128,11 +200,20 @@ void update_tests::load_test(const int & n,
   }
 
   TEST_CHECK_EQUAL(threads->get_load_factor(), 0);
+  db->wait_for_updates();
 
   // done - print results
   boost::posix_time::ptime ts2 = boost::posix_time::microsec_clock::local_time();
   boost::posix_time::time_duration delta = ts2 - ts1;
 
+  // every update is there
+  load_test_count_walker walker;
+  for(my::size_t ii = 0; ii < num_metrics; ++ii) {
+      snprintf(buf, sizeof(buf), METRIC_NAME_TEMPLATE, ii);
+      db->select_from_metric(buf, ts - INTERVAL_DAY, ts + 2 * INTERVAL_DAY, walker);
+  }
+  TEST_CHECK_EQUAL(walker._count, num_tasks);
+
   snprintf(buf, sizeof(buf),  "%0.2f tasks per second",
       (double)num_tasks * boost::posix_time::seconds(1).total_microseconds() / (double)delta.total_microseconds()
   );
@@ -198,6 +279,83 @@ void update_tests::last_block_test(const int & n)
   TEST_SUBTEST_END2("Done");
 }
 
+void update_tests::self_metrics_test(const int & n, const my::size_t & num_threads)
+{
+  char buf[1024];
+  snprintf(buf, sizeof(buf), "self metrics with %lu threads", SIZE_T_CAST num_threads);
+  TEST_SUBTEST_START(n, buf, false);
+  my::time_t ts = time(NULL);
+
+  // the stripes add up
+  self_counter counter;
+  my::size_t iterations = 100000;
+  boost::thread_group group;
+  for(my::size_t ii = 0; ii < num_threads; ++ii) {
+      group.create_thread(self_counter_test_worker(counter, iterations));
+  }
+  group.join_all();
+  TEST_CHECK_EQUAL(counter.get(), num_threads * iterations);
+  TEST_CHECK_EQUAL(counter.get(true), num_threads * iterations);
+  TEST_CHECK_EQUAL(counter.get(), 0);
+
+  // the batch: two values and the histogram percentiles, the empty histogram is skipped
+  latency_histogram histogram, empty_histogram;
+  histogram.record(100);
+
+  self_metrics metrics;
+  snprintf(buf, sizeof(buf), SELF_METRIC_NAME_TEMPLATE, (my::size_t)0);
+  metrics.add(buf, 1);
+  snprintf(buf, sizeof(buf), SELF_METRIC_NAME_TEMPLATE, (my::size_t)1);
+  metrics.add(buf, 2);
+  snprintf(buf, sizeof(buf), SELF_METRIC_NAME_TEMPLATE, (my::size_t)2);
+  metrics.add(buf, histogram);
+  metrics.add("test.self.empty", empty_histogram);
+  TEST_CHECK_EQUAL(metrics.get_values().size(), 2 + 4);
+  TEST_CHECK_EQUAL(metrics.get_values()[2].first, "test.self.2.p50");
+
+  // ensure the metrics don't exist from previous run
+  for(my::size_t ii = 0; ii < metrics.get_values().size(); ++ii) {
+      if(_rrdb->find_metric(metrics.get_values()[ii].first)) {
+          _rrdb->drop_metric(metrics.get_values()[ii].first);
+      }
+  }
+
+  // the metrics are created on the first write
+  _rrdb->update_self_metrics(metrics, ts);
+  for(my::size_t ii = 0; ii < metrics.get_values().size(); ++ii) {
+      load_test_count_walker walker;
+      _rrdb->select_from_metric(metrics.get_values()[ii].first, ts - INTERVAL_DAY, ts + INTERVAL_DAY, walker);
+      TEST_CHECK_EQUAL(walker._count, 1);
+      TEST_CHECK_EQUAL(walker._sum, metrics.get_values()[ii].second);
+  }
+
+  // the dropped metric is created again on the next write
+  snprintf(buf, sizeof(buf), SELF_METRIC_NAME_TEMPLATE, (my::size_t)0);
+  _rrdb->drop_metric(buf);
+  TEST_CHECK(!_rrdb->find_metric(buf));
+  _rrdb->update_self_metrics(metrics, ts + 1);
+  TEST_CHECK(_rrdb->find_metric(buf));
+  {
+    load_test_count_walker walker;
+    _rrdb->select_from_metric(buf, ts - INTERVAL_DAY, ts + INTERVAL_DAY, walker);
+    TEST_CHECK_EQUAL(walker._count, 1);
+  }
+  snprintf(buf, sizeof(buf), SELF_METRIC_NAME_TEMPLATE, (my::size_t)1);
+  {
+    load_test_count_walker walker;
+    _rrdb->select_from_metric(buf, ts - INTERVAL_DAY, ts + INTERVAL_DAY, walker);
+    TEST_CHECK_EQUAL(walker._count, 2);
+  }
+
+  // done
+  TEST_SUBTEST_END();
+
+  // cleanup locally
+  for(my::size_t ii = 0; ii < metrics.get_values().size(); ++ii) {
+      _rrdb->drop_metric(metrics.get_values()[ii].first);
+  }
+}
+
 void update_tests::run(const std::string & path)
 {
   // setup
@@ -213,6 +371,12 @@ void update_tests::run(const std::string & path)
   test.load_test(n++,   5, 5, 50000);
   test.load_test(n++, 10,  5, 50000);
   test.load_test(n++, 10, 50, 50000);
+  test.load_test(n++, 10, 50, 50000, true);
+  test.load_test(n++, 10,  5, 50000, false, true);
+  test.load_test(n++, 10, 50, 50000, false, true);
+
+  test.self_metrics_test(n++, 1);
+  test.self_metrics_test(n++, 16);
 
   // cleanup
   test.cleanup();
@@ -28,15 +28,20 @@ private:
   void load_test(const int & n,
       const my::size_t & num_metrics,
       const my::size_t & num_threads,
-      const my::size_t & num_tasks
+      const my::size_t & num_tasks,
+      bool sharded = false,
+      bool work_stealing = false
   );
 
+  void self_metrics_test(const int & n, const my::size_t & num_threads);
+
 private:
   void initialize(const std::string & path);
   void cleanup(const my::size_t & num_metrics = 1);
 
 private:
   boost::shared_ptr<rrdb> _rrdb;
+  boost::shared_ptr<rrdb> _sharded_rrdb;
 };
 
 #endif /* UPDATE_TESTS_H_ */